@@ -0,0 +1,110 @@
+/**
+ * @file bench.h
+ * @brief Shared helpers for the transcode benchmarks
+ *
+ * Header-only so each bench_*.c builds from a single source file.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "transcode.h"
+#include "log.h"
+
+#define BENCH_MAX_SESSIONS 64
+
+/** Frame rate of the synthetic fixture (30000/1001) */
+#define BENCH_FIXTURE_FPS 29.97
+
+/**
+ * Outcome of running N identical sessions to completion
+ */
+typedef struct {
+    double wall_s;        /**< Slowest session's wall time */
+    double cpu_s;         /**< Total user+sys CPU across sessions */
+    long max_rss_kb;      /**< Largest single-session peak RSS */
+    long long bytes;      /**< Total output bytes */
+    int failed;           /**< Sessions that exited non-zero or produced nothing */
+} BenchRun;
+
+static inline double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline double bench_tv(struct timeval tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/**
+ * Transcode the fixture in n concurrent sessions, draining all output
+ */
+static inline void bench_run_sessions(const char *fixture, TranscodeConfig tc, int n, BenchRun *res) {
+    TranscodeProcess procs[BENCH_MAX_SESSIONS];
+    long long bytes[BENCH_MAX_SESSIONS] = {0};
+    int done[BENCH_MAX_SESSIONS] = {0};
+    static char sink[65536];
+
+    memset(res, 0, sizeof(*res));
+    if (n > BENCH_MAX_SESSIONS) n = BENCH_MAX_SESSIONS;
+
+    double t0 = bench_now();
+    for (int i = 0; i < n; i++) {
+        if (transcode_spawn(fixture, tc, &procs[i]) < 0) {
+            LOG_ERROR("BENCH", "spawn failed for session %d", i);
+            exit(1);
+        }
+    }
+
+    /* One poll per session keeps stderr drained alongside stdout */
+    int running = n;
+    while (running > 0) {
+        struct pollfd pfds[BENCH_MAX_SESSIONS];
+        for (int i = 0; i < n; i++) {
+            pfds[i].fd = done[i] ? -1 : procs[i].out_fd;
+            pfds[i].events = POLLIN;
+        }
+        if (poll(pfds, n, -1) < 0) continue;
+        for (int i = 0; i < n; i++) {
+            if (done[i] || !(pfds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            ssize_t r = transcode_read(&procs[i], sink, sizeof(sink));
+            if (r > 0) {
+                bytes[i] += r;
+                continue;
+            }
+            /* EOF: FFmpeg finished the fixture */
+            done[i] = 1;
+            running--;
+        }
+    }
+    res->wall_s = bench_now() - t0;
+
+    for (int i = 0; i < n; i++) {
+        /* Let FFmpeg exit on its own so transcode_finish() doesn't signal it */
+        siginfo_t info;
+        waitid(P_PID, procs[i].pid, &info, WEXITED | WNOWAIT);
+
+        struct rusage ru;
+        int status = transcode_finish(&procs[i], &ru);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || bytes[i] == 0) {
+            res->failed++;
+            LOG_WARN("BENCH", "session %d failed: %s", i,
+                     procs[i].last_error[0] ? procs[i].last_error : "no output");
+        }
+        res->cpu_s += bench_tv(ru.ru_utime) + bench_tv(ru.ru_stime);
+        res->bytes += bytes[i];
+        if (ru.ru_maxrss > res->max_rss_kb) res->max_rss_kb = ru.ru_maxrss;
+    }
+}
+
+#endif
@@ -0,0 +1,343 @@
+/**
+ * @file bench_dvr.c
+ * @brief DVR scheduler scale and accuracy benchmark
+ *
+ * Hosts the real scheduler thread against a scratch database:
+ * 1. Seeds thousands of future background timers through db_add_timer()
+ * 2. Adds bursts of timers that all start at the same instant (prime time)
+ * 3. Starts the scheduler with a fake recorder first in PATH and waits for
+ *    every burst to start and stop
+ *
+ * The fake recorder is this binary invoked through an `ffmpeg` symlink. It
+ * logs the wall-clock time it was exec'd and the time SIGTERM arrived, and
+ * drains the scheduler's /stream/ URL if a server is listening (run through
+ * with_server.sh to exercise the stand-in core as well).
+ *
+ * Reported:
+ *   start skew  Recorder exec time minus timer start (p50/p90/max); later
+ *               execs for an already-started timer count as re-forks
+ *   stop skew   SIGTERM receipt minus timer end (p50/p90/max)
+ *   scheduler   SchedulerStats: DB time, lock wait/hold and busy time per
+ *               tick, slot overflows
+ *
+ * Usage:
+ *   bench_dvr [-t timers] [-b bursts] [-k burst_size] [-g gap_s] [-d duration_s]
+ *             [-i poll_ms] [-o out.json]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <errno.h>
+#include <limits.h>
+#include <libgen.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "db.h"
+#include "scheduler.h"
+#include "log.h"
+
+int g_verbose = 0;
+
+#define MAX_SAMPLES 4096
+
+static long long wall_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static double mono_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* ==========================================================================
+ * Fake recorder (argv[0] == "ffmpeg")
+ * ========================================================================== */
+
+static volatile sig_atomic_t recorder_stop = 0;
+
+static void on_term(int sig) {
+    (void)sig;
+    recorder_stop = 1;
+}
+
+static void recorder_log(const char *event, const char *out) {
+    const char *path = getenv("BENCH_DVR_LOG");
+    if (!path) return;
+    char line[512];
+    int n = snprintf(line, sizeof(line), "%s %d %lld %s\n", event, getpid(), wall_ms(), out ? out : "-");
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0) return;
+    write(fd, line, n);   /* single O_APPEND write: lines never interleave */
+    close(fd);
+}
+
+/**
+ * Stand-in for `ffmpeg -i URL ... OUTPUT`: log, drain the URL, log SIGTERM
+ */
+static int recorder_main(int argc, char *argv[]) {
+    const char *url = NULL;
+    const char *out = argc > 1 ? argv[argc - 1] : NULL;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "-i") == 0) url = argv[i + 1];
+    }
+    struct sigaction sa = { .sa_handler = on_term };
+    sigaction(SIGTERM, &sa, NULL);
+    recorder_log("start", out);
+
+    int fd = -1;
+    int port;
+    char path[256];
+    if (url && sscanf(url, "http://127.0.0.1:%d%255s", &port, path) == 2) {
+        struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+        inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            char req[512];
+            int n = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n", path);
+            write(fd, req, n);
+        } else {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    static char sink[65536];
+    while (!recorder_stop) {
+        if (fd >= 0) {
+            ssize_t n = read(fd, sink, sizeof(sink));
+            if (n > 0) continue;
+            if (n < 0 && errno == EINTR) continue;
+            close(fd);
+            fd = -1;
+        }
+        pause();
+    }
+    recorder_log("stop", out);
+    return 0;
+}
+
+/* ==========================================================================
+ * Benchmark
+ * ========================================================================== */
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double pct(double *v, int n, double p) {
+    if (n == 0) return 0;
+    return v[(int)(p / 100.0 * (n - 1) + 0.5)];
+}
+
+typedef struct {
+    double v[MAX_SAMPLES];
+    int n;
+} Samples;
+
+static void print_dist(FILE *out, const char *name, Samples *s) {
+    qsort(s->v, s->n, sizeof(double), cmp_double);
+    printf("%-12s n=%-5d p50=%8.1fms  p90=%8.1fms  max=%8.1fms\n",
+           name, s->n, pct(s->v, s->n, 50), pct(s->v, s->n, 90), pct(s->v, s->n, 100));
+    if (out) {
+        fprintf(out, "\"%s\":{\"n\":%d,\"p50\":%.1f,\"p90\":%.1f,\"max\":%.1f},",
+                name, s->n, pct(s->v, s->n, 50), pct(s->v, s->n, 90), pct(s->v, s->n, 100));
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (strcmp(basename(argv[0]), "ffmpeg") == 0) return recorder_main(argc, argv);
+
+    int timers = 5000, bursts = 3, burst_size = 12, gap_s = 5, duration_s = 3, poll_ms = 10000;
+    const char *out_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:b:k:g:d:i:o:v")) != -1) {
+        switch (opt) {
+            case 't': timers = atoi(optarg); break;
+            case 'b': bursts = atoi(optarg); break;
+            case 'k': burst_size = atoi(optarg); break;
+            case 'g': gap_s = atoi(optarg); break;
+            case 'd': duration_s = atoi(optarg); break;
+            case 'i': poll_ms = atoi(optarg); break;
+            case 'o': out_path = optarg; break;
+            case 'v': g_verbose = 1; break;
+            default:
+                fprintf(stderr, "Usage: %s [-t timers] [-b bursts] [-k burst_size] [-g gap_s] "
+                        "[-d duration_s] [-i poll_ms] [-o out.json]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (bursts * burst_size > MAX_SAMPLES) {
+        fprintf(stderr, "bursts x burst_size must be <= %d\n", MAX_SAMPLES);
+        return 1;
+    }
+
+    /* Scratch dir holding the database, recordings/ and the fake recorder */
+    char exe[PATH_MAX], out_abs[PATH_MAX] = "";
+    ssize_t el = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (el <= 0) return 1;
+    exe[el] = 0;
+    if (out_path && !realpath(dirname(strdupa(out_path)), out_abs)) out_abs[0] = 0;
+    if (out_path && out_abs[0]) {
+        strncat(out_abs, "/", sizeof(out_abs) - strlen(out_abs) - 1);
+        strncat(out_abs, basename(strdupa(out_path)), sizeof(out_abs) - strlen(out_abs) - 1);
+    }
+
+    char work[] = "/tmp/bench_dvr.XXXXXX";
+    if (!mkdtemp(work) || chdir(work) != 0) {
+        perror("scratch dir");
+        return 1;
+    }
+    mkdir("bin", 0755);
+    if (symlink(exe, "bin/ffmpeg") != 0) {
+        perror("symlink");
+        return 1;
+    }
+    char env[PATH_MAX * 2];
+    snprintf(env, sizeof(env), "%s/bin:%s", work, getenv("PATH") ? getenv("PATH") : "/usr/bin:/bin");
+    setenv("PATH", env, 1);
+    char log_path[PATH_MAX];
+    snprintf(log_path, sizeof(log_path), "%s/recorder.log", work);
+    setenv("BENCH_DVR_LOG", log_path, 1);
+
+    if (!db_init()) return 1;
+
+    /* Background timers spread over the next week; none fire during the run */
+    long long now = wall_ms();
+    long long horizon = now + (long long)(bursts + 2) * gap_s * 1000 + 3600 * 1000LL;
+    double t0 = mono_ms();
+    for (int i = 0; i < timers; i++) {
+        char title[64], chan[16];
+        snprintf(title, sizeof(title), "seed-%d", i);
+        snprintf(chan, sizeof(chan), "%d.%d", 2 + (i % 100) / 4, 1 + i % 4);
+        long long start = horizon + (long long)(i % 2016) * 300 * 1000;
+        db_add_timer(i % 7 ? "once" : "weekly", title, chan, start, start + 1800 * 1000LL);
+    }
+    double seed_ms = mono_ms() - t0;
+
+    /* Bursts: burst_size timers sharing one start instant, 1s after a poll boundary */
+    long long first = now + 2000;
+    for (int b = 0; b < bursts; b++) {
+        long long start = first + (long long)b * gap_s * 1000;
+        for (int k = 0; k < burst_size; k++) {
+            char title[64], chan[16];
+            snprintf(title, sizeof(title), "burst%d-%d", b, k);
+            snprintf(chan, sizeof(chan), "%d.%d", 2 + k / 4, 1 + k % 4);
+            db_add_timer("once", title, chan, start, start + duration_s * 1000LL);
+        }
+    }
+
+    /* Direct cost of the scheduler's pending-timer query at this table size */
+    double q0 = mono_ms();
+    int q_iter = 50;
+    for (int i = 0; i < q_iter; i++) {
+        Timer *pending = NULL;
+        int count = 0;
+        if (db_get_pending_timers(now, &pending, &count)) free(pending);
+    }
+    double query_ms = (mono_ms() - q0) / q_iter;
+
+    printf("seeded %d timers in %.0fms (%.1fus/insert), pending query %.2fms\n",
+           timers + bursts * burst_size, seed_ms, seed_ms * 1000 / (timers ? timers : 1), query_ms);
+    printf("%d burst(s) of %d, %ds apart, %ds long, poll %dms\n", bursts, burst_size, gap_s, duration_s, poll_ms);
+
+    scheduler_set_poll_interval(poll_ms);
+    scheduler_reset_stats();
+    start_scheduler();
+
+    /* Last burst ends, plus one poll to notice it and slack for the reaping */
+    long long done_at = first + (long long)(bursts - 1) * gap_s * 1000 + duration_s * 1000LL + poll_ms + 2000;
+    while (wall_ms() < done_at) usleep(100000);
+
+    SchedulerStats st;
+    scheduler_get_stats(&st);
+
+    /* Match recorder log lines back to their burst via the output filename */
+    static Samples start_skew, stop_skew;
+    static unsigned char seen[MAX_SAMPLES];
+    int reforks = 0;
+    FILE *lf = fopen(log_path, "r");
+    char line[512];
+    while (lf && fgets(line, sizeof(line), lf)) {
+        char event[16], out[256];
+        int pid, b, k;
+        long long ts;
+        if (sscanf(line, "%15s %d %lld %255s", event, &pid, &ts, out) != 4) continue;
+        const char *name = strrchr(out, '/');
+        if (!name || sscanf(name + 1, "burst%d-%d-", &b, &k) != 2) continue;
+        if (b < 0 || b >= bursts || k < 0 || k >= burst_size) continue;
+        long long start = first + (long long)b * gap_s * 1000;
+        if (strcmp(event, "start") == 0) {
+            /* Only the first start of a timer is skew; repeats are re-forks */
+            if (!seen[b * burst_size + k]) {
+                seen[b * burst_size + k] = 1;
+                start_skew.v[start_skew.n++] = ts - start;
+            } else {
+                reforks++;
+            }
+            kill(pid, SIGTERM);  /* stragglers the scheduler had no slot for */
+        } else if (strcmp(event, "stop") == 0 && stop_skew.n < MAX_SAMPLES) {
+            stop_skew.v[stop_skew.n++] = ts - (start + duration_s * 1000LL);
+        }
+    }
+    if (lf) fclose(lf);
+    usleep(200000);
+    while (waitpid(-1, NULL, WNOHANG) > 0) {}
+
+    FILE *out = out_abs[0] ? fopen(out_abs, "w") : NULL;
+    if (out) {
+        fprintf(out, "{\"timers\":%d,\"bursts\":%d,\"burst_size\":%d,\"poll_ms\":%d,"
+                "\"seed_us_per_insert\":%.2f,\"pending_query_ms\":%.3f,\"reforks\":%d,",
+                timers, bursts, burst_size, poll_ms, seed_ms * 1000 / (timers ? timers : 1), query_ms, reforks);
+    }
+    print_dist(out, "start_skew", &start_skew);
+    print_dist(out, "stop_skew", &stop_skew);
+
+    double ticks = st.ticks ? st.ticks : 1;
+    printf("recorders    %d of %d timers started, %d re-fork(s) of already-started timers\n",
+           start_skew.n, bursts * burst_size, reforks);
+    printf("scheduler    ticks=%lu started=%lu stopped=%lu died=%lu failures=%lu slot_overflows=%lu\n",
+           st.ticks, st.started, st.stopped, st.died, st.start_failures, st.slot_overflows);
+    printf("             start skew avg=%.1fms max=%.1fms, stop skew avg=%.1fms max=%.1fms\n",
+           st.started ? st.start_skew_sum_ms / st.started : 0, st.start_skew_max_ms,
+           st.stopped ? st.stop_skew_sum_ms / st.stopped : 0, st.stop_skew_max_ms);
+    printf("             db/tick avg=%.2fms max=%.2fms, busy/tick avg=%.2fms max=%.2fms\n",
+           st.db_sum_ms / ticks, st.db_tick_max_ms, st.tick_sum_ms / ticks, st.tick_max_ms);
+    printf("             lock wait total=%.2fms max=%.3fms, hold total=%.2fms max=%.2fms\n",
+           st.lock_wait_sum_ms, st.lock_wait_max_ms, st.lock_hold_sum_ms, st.lock_hold_max_ms);
+
+    if (out) {
+        fprintf(out, "\"scheduler\":{\"ticks\":%lu,\"started\":%lu,\"stopped\":%lu,\"died\":%lu,"
+                "\"start_failures\":%lu,\"slot_overflows\":%lu,"
+                "\"db_tick_avg_ms\":%.3f,\"db_tick_max_ms\":%.3f,\"busy_tick_avg_ms\":%.3f,\"busy_tick_max_ms\":%.3f,"
+                "\"lock_wait_sum_ms\":%.3f,\"lock_wait_max_ms\":%.3f,\"lock_hold_sum_ms\":%.3f,\"lock_hold_max_ms\":%.3f}}\n",
+                st.ticks, st.started, st.stopped, st.died, st.start_failures, st.slot_overflows,
+                st.db_sum_ms / ticks, st.db_tick_max_ms, st.tick_sum_ms / ticks, st.tick_max_ms,
+                st.lock_wait_sum_ms, st.lock_wait_max_ms, st.lock_hold_sum_ms, st.lock_hold_max_ms);
+        fclose(out);
+    }
+
+    db_close();
+    if (!getenv("KEEP_WORK")) {
+        char cmd[PATH_MAX + 16];
+        snprintf(cmd, sizeof(cmd), "rm -rf '%s'", work);
+        if (system(cmd) != 0) fprintf(stderr, "could not remove %s\n", work);
+    } else {
+        printf("scratch dir kept: %s\n", work);
+    }
+    return 0;
+}
@@ -0,0 +1,377 @@
+/**
+ * @file bench_guide.c
+ * @brief Guide payload size and parse time, JSON against CBOR
+ *
+ * Builds a synthetic xmltv.json (100 channels by default, a mix of 30 and
+ * 60 minute programs, titles drawn from a few hundred shows as real guides
+ * repeat them, half the descriptions per episode), loads it with
+ * guide_parse() and then, for a 12-hour dashboard window and for the
+ * whole guide, reports for each representation /api/guide can send:
+ *
+ *   bytes         Body as sent, and gzip/brotli at the cached-body levels
+ *   encode_ms     guide_write_json() / guide_write_cbor()
+ *   decode_ms     Back into channels, programs and strings: guide_parse()
+ *                 for the JSON, a decoder for the CBOR layout for the CBOR
+ *
+ * Times are the median of -r runs. The dashboard's own decoders
+ * (JSON.parse, decodeCbor) are not measured here.
+ *
+ * Usage:
+ *   bench_guide [-c channels] [-d days] [-r runs] [-o out.json]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "guide.h"
+#include "compress.h"
+#include "arena.h"
+#include "log.h"
+
+int g_verbose = 0;
+
+#define MAX_RUNS 64
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} Buffer;
+
+static void buffer_write(void *ctx, const char *data, size_t len) {
+    Buffer *b = ctx;
+    if (b->len + len > b->cap) {
+        b->cap = (b->len + len) * 2;
+        b->data = realloc(b->data, b->cap);
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+static void buffer_printf(Buffer *b, const char *fmt, ...) {
+    char line[512];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    buffer_write(b, line, n < (int)sizeof(line) ? (size_t)n : sizeof(line) - 1);
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static Buffer build_xmltv(int channels, int days, long long start) {
+    static const char *words[] = { "Harbor", "Night", "Kitchen", "Detective", "Garden", "Market", "Frontier",
+                                   "Morning", "Science", "Family", "Island", "Court", "Weather", "Motor",
+                                   "Comedy", "Journey" };
+    Buffer b = { NULL, 0, 0 };
+    buffer_printf(&b, "{\"channels\":[");
+    for (int c = 0; c < channels; c++) {
+        buffer_printf(&b, "%s{\"id\":\"%d.%d\",\"name\":\"Station %d\",\"icon\":\"http://core.lan/logos/%d.png\"}",
+                      c ? "," : "", 2 + c / 4, 1 + c % 4, c, c);
+    }
+    buffer_printf(&b, "],\"programs\":[");
+    int first = 1;
+    for (int c = 0; c < channels; c++) {
+        long long t = start, end = start + days * 86400000LL;
+        for (int n = 0; t < end; n++) {
+            int show = (c * 37 + n * 11) % 300;
+            long long len = (show % 3 == 0 ? 60 : 30) * 60000LL;
+            char desc[256];
+            if (n % 2) {
+                snprintf(desc, sizeof(desc), "Episode %d. The %s crew are back with a story set in %s, "
+                         "where nothing goes to plan.", n, words[show % 16], words[(show + n) % 16]);
+            } else {
+                snprintf(desc, sizeof(desc), "The %s %s show: weekly highlights, guests and news. (CC)",
+                         words[show % 16], words[show / 16 % 16]);
+            }
+            buffer_printf(&b, "%s{\"channel\":\"%d.%d\",\"start\":%lld,\"end\":%lld,\"title\":\"%s %s %d\","
+                          "\"desc\":\"%s\"}", first ? "" : ",", 2 + c / 4, 1 + c % 4, t, t + len,
+                          words[show % 16], words[show / 16 % 16], show, desc);
+            first = 0;
+            t += len;
+        }
+    }
+    buffer_printf(&b, "]}");
+    return b;
+}
+
+/* ==========================================================================
+ * CBOR decoding (the layout in guide.h)
+ * ========================================================================== */
+
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+} Cursor;
+
+/** Read an item's head; -1 on malformed input */
+static int cbor_head(Cursor *c, int *major, uint64_t *value) {
+    if (c->p >= c->end) return -1;
+    int initial = *c->p++;
+    int info = initial & 31, n;
+    *major = initial >> 5;
+    if (info < 24) {
+        *value = info;
+        return 0;
+    }
+    if (info == 24) n = 1;
+    else if (info == 25) n = 2;
+    else if (info == 26) n = 4;
+    else if (info == 27) n = 8;
+    else return -1;
+    if (c->end - c->p < n) return -1;
+    *value = 0;
+    for (int i = 0; i < n; i++) *value = *value << 8 | *c->p++;
+    return 0;
+}
+
+static int cbor_expect(Cursor *c, int major, uint64_t *value) {
+    int m;
+    return cbor_head(c, &m, value) == 0 && m == major ? 0 : -1;
+}
+
+static int cbor_int(Cursor *c, long long *out) {
+    int major;
+    uint64_t v;
+    if (cbor_head(c, &major, &v) < 0 || major > 1) return -1;
+    *out = major ? -1 - (long long)v : (long long)v;
+    return 0;
+}
+
+/** Copy a text string into the pool */
+static int cbor_text(Cursor *c, char **pool, const char **out) {
+    uint64_t len;
+    if (cbor_expect(c, 3, &len) < 0 || (uint64_t)(c->end - c->p) < len) return -1;
+    memcpy(*pool, c->p, len);
+    (*pool)[len] = '\0';
+    *out = *pool;
+    *pool += len + 1;
+    c->p += len;
+    return 0;
+}
+
+static int key_is(Cursor *c, const char *key) {
+    uint64_t len;
+    if (cbor_expect(c, 3, &len) < 0 || len != strlen(key) || memcmp(c->p, key, len) != 0) return 0;
+    c->p += len;
+    return 1;
+}
+
+/**
+ * Decode into a snapshot shaped like guide_parse()'s
+ */
+static GuideSnapshot *decode_cbor(const char *data, size_t len) {
+    Cursor c = { (const unsigned char *)data, (const unsigned char *)data + len };
+    GuideSnapshot *g = calloc(1, sizeof(*g));
+    char *pool = g->strings = malloc(len);
+    uint64_t n, count;
+    long long generation, start, end, unit;
+    if (cbor_expect(&c, 5, &n) < 0 || n != 7) goto fail;
+    if (!key_is(&c, "generation") || cbor_int(&c, &generation) < 0) goto fail;
+    if (!key_is(&c, "start") || cbor_int(&c, &start) < 0) goto fail;
+    if (!key_is(&c, "end") || cbor_int(&c, &end) < 0) goto fail;
+    if (!key_is(&c, "unit") || cbor_int(&c, &unit) < 0) goto fail;
+    g->generation = generation;
+
+    if (!key_is(&c, "channels") || cbor_expect(&c, 4, &count) < 0) goto fail;
+    g->num_channels = count;
+    g->channels = calloc(count ? count : 1, sizeof(GuideChannel));
+    for (uint64_t i = 0; i < count; i++) {
+        GuideChannel *ch = &g->channels[i];
+        if (cbor_expect(&c, 4, &n) < 0 || n != 3 || cbor_text(&c, &pool, &ch->id) < 0 ||
+            cbor_text(&c, &pool, &ch->name) < 0 || cbor_text(&c, &pool, &ch->icon) < 0) goto fail;
+    }
+
+    if (!key_is(&c, "strings") || cbor_expect(&c, 4, &count) < 0) goto fail;
+    g->num_texts = count;
+    g->texts = calloc(count ? count : 1, sizeof(char *));
+    for (uint64_t i = 0; i < count; i++) {
+        if (cbor_text(&c, &pool, &g->texts[i]) < 0) goto fail;
+    }
+
+    if (!key_is(&c, "programs") || cbor_expect(&c, 4, &count) < 0 || count != (uint64_t)g->num_channels) {
+        goto fail;
+    }
+    int cap = 1024;
+    g->programs = malloc(cap * sizeof(GuideProgram));
+    for (int ch = 0; ch < g->num_channels; ch++) {
+        if (cbor_expect(&c, 4, &n) < 0 || n % 4) goto fail;
+        g->channels[ch].first = g->num_programs;
+        g->channels[ch].count = n / 4;
+        long long prev_end = start;
+        for (uint64_t i = 0; i < n; i += 4) {
+            long long gap, duration, title, description;
+            if (cbor_int(&c, &gap) < 0 || cbor_int(&c, &duration) < 0 || cbor_int(&c, &title) < 0 ||
+                cbor_int(&c, &description) < 0 || title < 0 || title >= g->num_texts ||
+                description < 0 || description >= g->num_texts) goto fail;
+            if (g->num_programs == cap) {
+                cap *= 2;
+                g->programs = realloc(g->programs, cap * sizeof(GuideProgram));
+            }
+            GuideProgram *p = &g->programs[g->num_programs++];
+            p->start = prev_end + gap * unit;
+            p->end = prev_end = p->start + duration * unit;
+            p->title_id = title;
+            p->description_id = description;
+            p->title = g->texts[title];
+            p->description = g->texts[description];
+            p->channel = ch;
+        }
+    }
+    atomic_init(&g->refs, 1);
+    return g;
+
+fail:
+    atomic_init(&g->refs, 1);
+    guide_release(g);
+    return NULL;
+}
+
+/* ==========================================================================
+ * Measurement
+ * ========================================================================== */
+
+typedef struct {
+    const char *window;
+    const char *format;
+    size_t bytes;
+    long long gzip_bytes;
+    long long br_bytes;        /**< -1 without brotli */
+    double encode_ms;
+    double decode_ms;
+    int programs;              /**< Decoded back, as a check */
+} Result;
+
+static void count_write(void *ctx, const char *data, size_t len) {
+    (void)data;
+    *(long long *)ctx += len;
+}
+
+static long long compressed_size(const Buffer *body, ContentEncoding encoding) {
+    Arena arena = ARENA_INIT;
+    long long size = 0;
+    Compressor *c = compressor_new(&arena, encoding, 1, count_write, &size);
+    compressor_write(c, body->data, body->len);
+    compressor_finish(c);
+    arena_reset(&arena);
+    return size;
+}
+
+static void measure(Result *r, const GuideSnapshot *guide, long long start, long long end, int cbor, int runs) {
+    double encode[MAX_RUNS], decode[MAX_RUNS];
+    Buffer body = { NULL, 0, 0 };
+    for (int i = 0; i < runs; i++) {
+        body.len = 0;
+        JsonWriter writer = { buffer_write, &body };
+        double t0 = now_ms();
+        if (cbor) guide_write_cbor(&writer, guide, start, end);
+        else guide_write_json(&writer, guide, start, end);
+        encode[i] = now_ms() - t0;
+
+        t0 = now_ms();
+        GuideSnapshot *back = cbor ? decode_cbor(body.data, body.len) : guide_parse(body.data, body.len);
+        decode[i] = now_ms() - t0;
+        r->programs = back ? back->num_programs : -1;
+        guide_release(back);
+    }
+    qsort(encode, runs, sizeof(double), cmp_double);
+    qsort(decode, runs, sizeof(double), cmp_double);
+    r->format = cbor ? "cbor" : "json";
+    r->bytes = body.len;
+    r->gzip_bytes = compressed_size(&body, ENCODING_GZIP);
+    r->br_bytes = compress_negotiate("\r\nAccept-Encoding: br", 1) == ENCODING_BR
+                  ? compressed_size(&body, ENCODING_BR) : -1;
+    r->encode_ms = encode[runs / 2];
+    r->decode_ms = decode[runs / 2];
+    free(body.data);
+}
+
+int main(int argc, char *argv[]) {
+    int channels = 100, days = 14, runs = 5;
+    const char *out_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:r:o:v")) != -1) {
+        switch (opt) {
+            case 'c': channels = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+            case 'd': days = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+            case 'r': runs = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+            case 'o': out_path = optarg; break;
+            case 'v': g_verbose = 1; break;
+            default:
+                fprintf(stderr, "Usage: %s [-c channels] [-d days] [-r runs] [-o out.json]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (runs > MAX_RUNS) runs = MAX_RUNS;
+
+    long long slot_ms = 30 * 60 * 1000LL;
+    long long start = (long long)time(NULL) * 1000 / slot_ms * slot_ms;
+    Buffer xmltv = build_xmltv(channels, days, start);
+    double t0 = now_ms();
+    GuideSnapshot *guide = guide_parse(xmltv.data, xmltv.len);
+    double load_ms = now_ms() - t0;
+    if (!guide) {
+        fprintf(stderr, "guide_parse failed on the synthetic guide\n");
+        return 1;
+    }
+    printf("xmltv.json: %zu KB, %d channels, %d programs, %d distinct texts, loaded in %.1f ms\n\n",
+           xmltv.len / 1024, guide->num_channels, guide->num_programs, guide->num_texts, load_ms);
+
+    struct { const char *name; long long start, end; } windows[] = {
+        { "12h", start - slot_ms, start + 24 * slot_ms },
+        { "all", start, start + days * 86400000LL },
+    };
+    Result results[4];
+    int n = 0;
+    printf("%-6s %-5s %12s %12s %12s %10s %10s %9s\n", "window", "fmt", "bytes", "gzip", "br",
+           "encode_ms", "decode_ms", "programs");
+    for (size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); w++) {
+        for (int cbor = 0; cbor < 2; cbor++) {
+            Result *r = &results[n++];
+            r->window = windows[w].name;
+            measure(r, guide, windows[w].start, windows[w].end, cbor, runs);
+            printf("%-6s %-5s %12zu %12lld %12lld %10.2f %10.2f %9d\n", r->window, r->format, r->bytes,
+                   r->gzip_bytes, r->br_bytes, r->encode_ms, r->decode_ms, r->programs);
+        }
+        const Result *json = &results[n - 2], *cbor = &results[n - 1];
+        printf("%-6s cbor/json: bytes %.2f  gzip %.2f  decode %.2f\n\n", windows[w].name,
+               (double)cbor->bytes / json->bytes, (double)cbor->gzip_bytes / json->gzip_bytes,
+               cbor->decode_ms / json->decode_ms);
+    }
+
+    if (out_path) {
+        FILE *f = fopen(out_path, "w");
+        if (f) {
+            fprintf(f, "{\"channels\":%d,\"days\":%d,\"programs\":%d,\"results\":[", channels, days,
+                    guide->num_programs);
+            for (int i = 0; i < n; i++) {
+                fprintf(f, "%s{\"window\":\"%s\",\"format\":\"%s\",\"bytes\":%zu,\"gzip_bytes\":%lld,"
+                        "\"br_bytes\":%lld,\"encode_ms\":%.3f,\"decode_ms\":%.3f}",
+                        i ? "," : "", results[i].window, results[i].format, results[i].bytes,
+                        results[i].gzip_bytes, results[i].br_bytes, results[i].encode_ms, results[i].decode_ms);
+            }
+            fprintf(f, "]}\n");
+            fclose(f);
+        }
+    }
+
+    guide_release(guide);
+    free(xmltv.data);
+    return 0;
+}
@@ -0,0 +1,288 @@
+/**
+ * @file bench_io.c
+ * @brief Request rate, throughput and server CPU cost of the I/O engine
+ *
+ * Runs three phases against a running server, each for a fixed time with
+ * N client threads:
+ * - close:     GET /api/version on a new connection per request (accept
+ *              and connection setup dominate)
+ * - keepalive: GET /api/version back to back on persistent connections
+ *              (request parsing and the keep-alive wait)
+ * - bulk:      GET of a large static file on persistent connections (the
+ *              file path, spliced with io_uring)
+ *
+ * The server's user+system CPU is read from /proc/<pid>/stat around each
+ * phase, so the results are CPU per 1000 requests and CPU per Gbps (cores
+ * kept busy per Gbit/s sent), which is what differs between engines once
+ * both saturate the client. Run once per engine (make bench-io does) and
+ * compare; -l labels the run in the JSON.
+ *
+ * The server pid defaults to $ZAPLINK_PID (set by with_server.sh).
+ *
+ * Usage:
+ *   bench_io [-P server_pid] [-H host] [-p port] [-c clients] [-t seconds]
+ *            [-f /bulk/path] [-l label] [-o out.json]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/**
+ * What one phase asks for
+ */
+typedef struct {
+    const char *name;
+    const char *path;
+    int keep_alive;
+} Phase;
+
+/**
+ * Outcome of one phase
+ */
+typedef struct {
+    double elapsed_s;
+    long requests;
+    long errors;
+    long long bytes;
+    double cpu_s;              /**< Server user+system CPU during the phase */
+} PhaseResult;
+
+static const char *host = "127.0.0.1";
+static int port = 3000;
+static int clients = 8;
+static int duration_s = 10;
+static pid_t server_pid = 0;
+
+static struct sockaddr_in server_addr;
+static const Phase *current;
+static atomic_int stop_flag;
+static atomic_long total_requests;
+static atomic_long total_errors;
+static atomic_llong total_bytes;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Server user+system CPU seconds so far, -1 if unknown
+ */
+static double server_cpu_s(void) {
+    if (server_pid <= 0) return -1;
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)server_pid);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+
+    /* Fields 14 and 15 (utime, stime), counted after comm's closing ')' */
+    char *rp = strrchr(buf, ')');
+    unsigned long utime, stime;
+    if (!rp || sscanf(rp + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+        return -1;
+    }
+    return (utime + stime) / (double)sysconf(_SC_CLK_TCK);
+}
+
+static int connect_server(void) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Send one GET on fd and read its response (Content-Length framed)
+ *
+ * @param reusable Set if the server keeps the connection open
+ * @return Body bytes, or -1 if the request failed
+ */
+static long long get(int fd, const char *path, int keep_alive, int *reusable) {
+    char buf[65536];
+    int len = snprintf(buf, sizeof(buf), "GET %s HTTP/1.1\r\nHost: %s:%d\r\n%s\r\n", path, host, port,
+                       keep_alive ? "" : "Connection: close\r\n");
+    if (write(fd, buf, len) != len) return -1;
+
+    size_t have = 0;
+    char *end = NULL;
+    while (!end) {
+        ssize_t n = read(fd, buf + have, sizeof(buf) - 1 - have);
+        if (n <= 0) return -1;
+        have += n;
+        buf[have] = '\0';
+        end = strstr(buf, "\r\n\r\n");
+        if (!end && have == sizeof(buf) - 1) return -1;
+    }
+    *end = '\0';
+    if (strncmp(buf, "HTTP/1.1 200", 12) != 0) return -1;
+    char *cl = strcasestr(buf, "\r\nContent-Length:");
+    if (!cl) return -1;
+    long long body = atoll(cl + 17);
+    *reusable = keep_alive && strcasestr(buf, "\r\nConnection: close") == NULL;
+
+    long long left = body - (long long)(have - (end + 4 - buf));
+    while (left > 0) {
+        ssize_t n = read(fd, buf, left < (long long)sizeof(buf) ? (size_t)left : sizeof(buf));
+        if (n <= 0) return -1;
+        left -= n;
+    }
+    return body;
+}
+
+static void *client(void *arg) {
+    (void)arg;
+    int fd = -1;
+    while (!atomic_load(&stop_flag)) {
+        if (fd < 0 && (fd = connect_server()) < 0) {
+            atomic_fetch_add(&total_errors, 1);
+            usleep(1000);
+            continue;
+        }
+        int reusable = 0;
+        long long body = get(fd, current->path, current->keep_alive, &reusable);
+        if (body < 0) atomic_fetch_add(&total_errors, 1);
+        else {
+            atomic_fetch_add(&total_requests, 1);
+            atomic_fetch_add(&total_bytes, body);
+        }
+        if (body < 0 || !reusable) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd >= 0) close(fd);
+    return NULL;
+}
+
+static void run_phase(const Phase *phase, PhaseResult *res) {
+    current = phase;
+    atomic_store(&stop_flag, 0);
+    atomic_store(&total_requests, 0);
+    atomic_store(&total_errors, 0);
+    atomic_store(&total_bytes, 0);
+
+    pthread_t *threads = calloc(clients, sizeof(pthread_t));
+    double cpu0 = server_cpu_s();
+    double t0 = now_s();
+    for (int i = 0; i < clients; i++) pthread_create(&threads[i], NULL, client, NULL);
+    sleep(duration_s);
+    atomic_store(&stop_flag, 1);
+    for (int i = 0; i < clients; i++) pthread_join(threads[i], NULL);
+    free(threads);
+
+    res->elapsed_s = now_s() - t0;
+    double cpu1 = server_cpu_s();
+    res->cpu_s = cpu0 >= 0 && cpu1 >= 0 ? cpu1 - cpu0 : -1;
+    res->requests = atomic_load(&total_requests);
+    res->errors = atomic_load(&total_errors);
+    res->bytes = atomic_load(&total_bytes);
+}
+
+static double gbps(const PhaseResult *r) {
+    return r->bytes * 8 / 1e9 / r->elapsed_s;
+}
+
+/** Server cores busy per Gbit/s delivered */
+static double cpu_per_gbps(const PhaseResult *r) {
+    double g = gbps(r);
+    return r->cpu_s >= 0 && g > 0 ? r->cpu_s / r->elapsed_s / g : 0;
+}
+
+/** Server CPU milliseconds per 1000 requests */
+static double cpu_ms_per_kreq(const PhaseResult *r) {
+    return r->cpu_s >= 0 && r->requests > 0 ? r->cpu_s * 1e3 / (r->requests / 1e3) : 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *out_path = NULL;
+    const char *label = "";
+    const char *bulk_path = "/images/zaplink.png";
+    int opt;
+    while ((opt = getopt(argc, argv, "H:p:c:t:f:l:P:o:")) != -1) {
+        switch (opt) {
+            case 'H': host = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'c': clients = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+            case 't': duration_s = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+            case 'f': bulk_path = optarg; break;
+            case 'l': label = optarg; break;
+            case 'P': server_pid = atoi(optarg); break;
+            case 'o': out_path = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-P pid] [-H host] [-p port] [-c clients] [-t secs] "
+                        "[-f bulk_path] [-l label] [-o out.json]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (server_pid == 0 && getenv("ZAPLINK_PID")) server_pid = atoi(getenv("ZAPLINK_PID"));
+
+    signal(SIGPIPE, SIG_IGN);
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    struct hostent *he = gethostbyname(host);
+    if (!he) {
+        fprintf(stderr, "Unknown host %s\n", host);
+        return 1;
+    }
+    memcpy(&server_addr.sin_addr, he->h_addr_list[0], sizeof(server_addr.sin_addr));
+
+    const Phase phases[] = {
+        { "close", "/api/version", 0 },
+        { "keepalive", "/api/version", 1 },
+        { "bulk", bulk_path, 1 },
+    };
+    enum { NUM_PHASES = sizeof(phases) / sizeof(phases[0]) };
+    PhaseResult results[NUM_PHASES];
+
+    printf("%-10s %9s %6s %10s %8s %8s %13s %12s\n",
+           "phase", "requests", "errors", "req/s", "Gbps", "cpu_s", "cpu_ms/kreq", "cores/Gbps");
+    for (int i = 0; i < NUM_PHASES; i++) {
+        PhaseResult *r = &results[i];
+        run_phase(&phases[i], r);
+        printf("%-10s %9ld %6ld %10.0f %8.3f %8.2f %13.1f %12.3f\n", phases[i].name, r->requests, r->errors,
+               r->requests / r->elapsed_s, gbps(r), r->cpu_s, cpu_ms_per_kreq(r), cpu_per_gbps(r));
+        fflush(stdout);
+    }
+
+    if (out_path) {
+        FILE *f = fopen(out_path, "w");
+        if (!f) {
+            perror(out_path);
+            return 1;
+        }
+        fprintf(f, "{\"label\":\"%s\",\"clients\":%d,\"phases\":[", label, clients);
+        for (int i = 0; i < NUM_PHASES; i++) {
+            PhaseResult *r = &results[i];
+            fprintf(f, "%s{\"phase\":\"%s\",\"path\":\"%s\",\"duration_s\":%.2f,\"requests\":%ld,"
+                    "\"errors\":%ld,\"rps\":%.1f,\"gbps\":%.4f,\"cpu_s\":%.3f,"
+                    "\"cpu_ms_per_kreq\":%.2f,\"cpu_per_gbps\":%.4f}",
+                    i ? "," : "", phases[i].name, phases[i].path, r->elapsed_s, r->requests, r->errors,
+                    r->requests / r->elapsed_s, gbps(r), r->cpu_s, cpu_ms_per_kreq(r), cpu_per_gbps(r));
+        }
+        fprintf(f, "]}\n");
+        fclose(f);
+    }
+    return 0;
+}
@@ -0,0 +1,426 @@
+/**
+ * @file bench_micro.c
+ * @brief Microbenchmarks for the per-request CPU-bound helpers
+ *
+ * Measures ns/op and heap allocations/op for:
+ *   json_escape        A realistic program description
+ *   query_write_json   A 3-hour guide window of program rows, plain and
+ *                      through the streaming gzip compressor
+ *   channels_load      A 300-channel channels.conf
+ *   build_ffmpeg_args  Budgeted software and VA-API sessions
+ *   client_handler     Request routing for API, playlist and static paths,
+ *                      served over a socketpair (includes the syscalls);
+ *                      the _gzip cases are compressed-cache hits, the
+ *                      _keepalive case pipelines three requests on one
+ *                      connection
+ *   hpack              Decoding a browser's request header block on a new
+ *                      connection, and encoding a JSON response's headers
+ *                      once they are in the dynamic table
+ *
+ * The static helpers are reached by compiling db.c, transcode.c and web.c
+ * into this translation unit; the Makefile links the remaining server
+ * objects. malloc/calloc/realloc/free are interposed to count allocations
+ * (including SQLite's and libc's internal ones).
+ *
+ * Each case is calibrated to run for about -m milliseconds and repeated -r
+ * times; the median repetition is reported.
+ *
+ * Usage:
+ *   bench_micro [-m ms_per_rep] [-r reps] [-f filter] [-o out.json]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+
+/* Static helpers under test */
+#include "../src/db.c"
+#include "../src/transcode.c"
+#include "../src/web.c"
+
+#include "channels.h"
+#include "hpack.h"
+#include "log.h"
+
+int g_verbose = 0;
+
+/* ==========================================================================
+ * Allocation counting
+ * ========================================================================== */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static unsigned long alloc_calls = 0;
+static unsigned long long alloc_bytes = 0;
+
+void *malloc(size_t size) {
+    __atomic_fetch_add(&alloc_calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&alloc_bytes, size, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    __atomic_fetch_add(&alloc_calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&alloc_bytes, n * size, __ATOMIC_RELAXED);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    __atomic_fetch_add(&alloc_calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&alloc_bytes, size, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+/* ==========================================================================
+ * Harness
+ * ========================================================================== */
+
+typedef void (*BenchFn)(void *ctx);
+
+typedef struct {
+    const char *name;
+    BenchFn fn;
+    void *ctx;
+    double ns_per_op;
+    double allocs_per_op;
+    double bytes_per_op;
+    long iters;
+} MicroCase;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Calibrate an iteration count, then time `reps` repetitions
+ */
+static void run_case(MicroCase *mc, int ms_per_rep, int reps) {
+    long iters = 1;
+    for (;;) {
+        double t0 = now_ns();
+        for (long i = 0; i < iters; i++) mc->fn(mc->ctx);
+        double dt = now_ns() - t0;
+        if (dt >= ms_per_rep * 1e6 / 4 || iters >= (1L << 30)) {
+            iters = (long)(iters * (ms_per_rep * 1e6 / (dt > 0 ? dt : 1)));
+            if (iters < 1) iters = 1;
+            break;
+        }
+        iters *= 4;
+    }
+
+    double samples[64];
+    if (reps > 64) reps = 64;
+    unsigned long calls0 = alloc_calls;
+    unsigned long long bytes0 = alloc_bytes;
+    for (int r = 0; r < reps; r++) {
+        double t0 = now_ns();
+        for (long i = 0; i < iters; i++) mc->fn(mc->ctx);
+        samples[r] = (now_ns() - t0) / iters;
+    }
+    qsort(samples, reps, sizeof(double), cmp_double);
+    mc->ns_per_op = samples[reps / 2];
+    mc->allocs_per_op = (double)(alloc_calls - calls0) / ((double)iters * reps);
+    mc->bytes_per_op = (double)(alloc_bytes - bytes0) / ((double)iters * reps);
+    mc->iters = iters;
+}
+
+/* ==========================================================================
+ * Fixtures
+ * ========================================================================== */
+
+static const char *sample_description =
+    "Detectives \"Riley\" and Chen follow a lead from the 1990s cold case\n"
+    "into a harbor town where nobody wants to talk, and a storm cuts the\n"
+    "power just as the suspect's alibi comes apart. Stereo\\CC. (2024)";
+
+static void seed_programs(int channels, int hours) {
+    long long base = 1700000000000LL;
+    sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(db, "INSERT INTO programs (frequency, channel_service_id, start_time, end_time, "
+                       "title, description, event_id, source_id) VALUES (?, ?, ?, ?, ?, ?, ?, ?)", -1, &stmt, 0);
+    for (int c = 0; c < channels; c++) {
+        for (int slot = 0; slot < hours * 2; slot++) {
+            char title[64];
+            snprintf(title, sizeof(title), "Program %d on %d", slot, c);
+            sqlite3_bind_int(stmt, 1, 57000000 + (c / 4) * 6000000);
+            sqlite3_bind_int(stmt, 2, c + 1);
+            sqlite3_bind_int64(stmt, 3, base + slot * 1800000LL);
+            sqlite3_bind_int64(stmt, 4, base + (slot + 1) * 1800000LL);
+            sqlite3_bind_text(stmt, 5, title, -1, SQLITE_TRANSIENT);
+            sqlite3_bind_text(stmt, 6, sample_description, -1, SQLITE_STATIC);
+            sqlite3_bind_int(stmt, 7, slot);
+            sqlite3_bind_int(stmt, 8, c + 1);
+            sqlite3_step(stmt);
+            sqlite3_reset(stmt);
+        }
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+}
+
+static void write_channels_conf(int n) {
+    FILE *f = fopen("channels.conf", "w");
+    for (int i = 0; i < n; i++) {
+        fprintf(f, "[Channel %d]\n\tVCHANNEL = %d.%d\n\tSERVICE_ID = %d\n\tFREQUENCY = %d\n"
+                "\tMODULATION = VSB/8\n\tDELIVERY_SYSTEM = ATSC\n\tVIDEO_PID = %d\n\tAUDIO_PID = %d\n\n",
+                i, 2 + i / 4, 1 + i % 4, i + 1, 57000000 + (i / 4) * 6000000, 49 + i, 52 + i);
+    }
+    fclose(f);
+}
+
+/* ==========================================================================
+ * Cases
+ * ========================================================================== */
+
+static volatile size_t sink;
+
+static void bm_json_escape(void *ctx) {
+    (void)ctx;
+    char out[2048];
+    json_escape(out, sample_description, sizeof(out));
+    sink += out[0];
+}
+
+static void count_write(void *ctx, const char *data, size_t len) {
+    (void)ctx;
+    sink += len + (unsigned char)data[0];
+}
+
+static void bm_query_write_json(void *ctx) {
+    JsonWriter writer = { count_write, NULL };
+    query_write_json(&writer, (const char *)ctx);
+}
+
+static void gzip_write(void *ctx, const char *data, size_t len) {
+    compressor_write(ctx, data, len);
+}
+
+static void bm_query_write_json_gzip(void *ctx) {
+    Arena arena = ARENA_INIT;
+    Compressor *c = compressor_new(&arena, ENCODING_GZIP, 0, count_write, NULL);
+    JsonWriter writer = { gzip_write, c };
+    query_write_json(&writer, (const char *)ctx);
+    compressor_finish(c);
+    arena_reset(&arena);
+}
+
+static void bm_channels_load(void *ctx) {
+    (void)ctx;
+    int count = 0;
+    Channel *ch = channels_load(&count);
+    sink += count;
+    channels_free(ch, count);
+}
+
+static void bm_build_args(void *ctx) {
+    TranscodeConfig *tc = ctx;
+    EncodeBudget budget = { .active = 1, .threads = 4, .node = 0 };
+    int argc;
+    char **argv = build_ffmpeg_args("http://127.0.0.1:18392/stream/15.1", *tc, &budget, &argc);
+    sink += argc;
+    free(argv);
+}
+
+static void bm_client_handler(void *ctx) {
+    const char *request = ctx;
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) return;
+    write(sv[0], request, strlen(request));
+    /* EOF after the last request, so the keep-alive loop doesn't wait */
+    shutdown(sv[0], SHUT_WR);
+
+    client_handler((void *)(intptr_t)sv[1]);   /* closes sv[1] */
+
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(sv[0], buf, sizeof(buf))) > 0) sink += n;
+    close(sv[0]);
+}
+
+typedef struct {
+    uint8_t block[1024];
+    size_t len;
+} HpackBlock;
+
+static void count_header(void *ctx, const char *name, size_t name_len, const char *value, size_t value_len) {
+    (void)ctx;
+    sink += name_len + value_len + (unsigned char)name[0] + (value_len ? (unsigned char)value[0] : 0);
+}
+
+static void bm_hpack_decode(void *ctx) {
+    HpackBlock *b = ctx;
+    HpackTable t;
+    hpack_table_init(&t, HPACK_TABLE_SIZE);
+    hpack_decode(&t, b->block, b->len, count_header, NULL);
+    hpack_table_free(&t);
+}
+
+static void bm_hpack_encode(void *ctx) {
+    HpackTable *t = ctx;
+    uint8_t out[256];
+    int len = hpack_encode_begin(t, out, sizeof(out));
+    len += hpack_encode(t, out + len, sizeof(out) - len, ":status", "200");
+    len += hpack_encode(t, out + len, sizeof(out) - len, "content-type", "application/json");
+    len += hpack_encode(t, out + len, sizeof(out) - len, "vary", "Accept-Encoding");
+    len += hpack_encode(t, out + len, sizeof(out) - len, "content-encoding", "gzip");
+    len += hpack_encode(t, out + len, sizeof(out) - len, "content-length", "1234");
+    sink += len;
+}
+
+int main(int argc, char *argv[]) {
+    int ms_per_rep = 200, reps = 5;
+    const char *filter = NULL, *out_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:r:f:o:")) != -1) {
+        switch (opt) {
+            case 'm': ms_per_rep = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+            case 'r': reps = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+            case 'f': filter = optarg; break;
+            case 'o': out_path = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-m ms_per_rep] [-r reps] [-f filter] [-o out.json]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    /* Scratch dir: the DB and channels.conf are opened relative to cwd */
+    char out_abs[4096] = "";
+    if (out_path) {
+        if (out_path[0] == '/') snprintf(out_abs, sizeof(out_abs), "%s", out_path);
+        else if (getcwd(out_abs, sizeof(out_abs) - 256)) {
+            strncat(out_abs, "/", sizeof(out_abs) - strlen(out_abs) - 1);
+            strncat(out_abs, out_path, sizeof(out_abs) - strlen(out_abs) - 1);
+        }
+    }
+    char work[] = "/tmp/bench_micro.XXXXXX";
+    if (!mkdtemp(work) || chdir(work) != 0) {
+        perror("scratch dir");
+        return 1;
+    }
+    if (!db_init()) return 1;
+    seed_programs(100, 24);
+    write_channels_conf(300);
+    config_load();
+    caps_probe(work);   /* no ffmpeg probe needed; empty device dir */
+
+    /* 3-hour window across 100 channels: 600 rows */
+    static char guide_sql[256];
+    snprintf(guide_sql, sizeof(guide_sql),
+             "SELECT * FROM programs WHERE end_time > %lld AND start_time < %lld ORDER BY start_time",
+             1700000000000LL + 4 * 3600000LL, 1700000000000LL + 7 * 3600000LL);
+
+    static TranscodeConfig tc_sw, tc_vaapi;
+    memset(&tc_sw, 0, sizeof(tc_sw));
+    tc_sw.backend = TRANSCODE_BACKEND_SOFTWARE;
+    tc_sw.codec = TRANSCODE_CODEC_HEVC;
+    tc_sw.height = 720;
+    tc_vaapi = tc_sw;
+    tc_vaapi.backend = TRANSCODE_BACKEND_VAAPI;
+    tc_vaapi.codec = TRANSCODE_CODEC_H264;
+
+    /* What a browser sends for a dashboard API call */
+    static const char *browser_request[][2] = {
+        { ":method", "GET" }, { ":authority", "zaplink.lan:3000" }, { ":scheme", "https" },
+        { ":path", "/api/timers" },
+        { "user-agent", "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+                        "Chrome/120.0.0.0 Safari/537.36" },
+        { "accept", "application/json, text/plain, */*" }, { "accept-encoding", "gzip, deflate, br" },
+        { "accept-language", "en-US,en;q=0.9" }, { "referer", "https://zaplink.lan:3000/" },
+        { "sec-fetch-mode", "cors" }, { "sec-fetch-site", "same-origin" },
+    };
+    static HpackBlock request_block;
+    HpackTable request_encoder;
+    hpack_table_init(&request_encoder, HPACK_TABLE_SIZE);
+    for (size_t i = 0; i < sizeof(browser_request) / sizeof(browser_request[0]); i++) {
+        request_block.len += hpack_encode(&request_encoder, request_block.block + request_block.len,
+                                          sizeof(request_block.block) - request_block.len,
+                                          browser_request[i][0], browser_request[i][1]);
+    }
+    hpack_table_free(&request_encoder);
+    static HpackTable response_encoder;
+    hpack_table_init(&response_encoder, HPACK_TABLE_SIZE);
+
+    MicroCase cases[] = {
+        { "json_escape/description", bm_json_escape, NULL, 0, 0, 0, 0 },
+        { "query_write_json/guide_600_rows", bm_query_write_json, guide_sql, 0, 0, 0, 0 },
+        { "query_write_json/guide_600_rows_gzip", bm_query_write_json_gzip, guide_sql, 0, 0, 0, 0 },
+        { "query_write_json/timers_empty", bm_query_write_json, "SELECT * FROM timers", 0, 0, 0, 0 },
+        { "channels_load/300", bm_channels_load, NULL, 0, 0, 0, 0 },
+        { "build_ffmpeg_args/software_hevc_720p", bm_build_args, &tc_sw, 0, 0, 0, 0 },
+        { "build_ffmpeg_args/vaapi_h264_720p", bm_build_args, &tc_vaapi, 0, 0, 0, 0 },
+        { "client_handler/api_version", bm_client_handler,
+          "GET /api/version HTTP/1.1\r\nHost: localhost:3000\r\n\r\n", 0, 0, 0, 0 },
+        { "client_handler/api_status", bm_client_handler,
+          "GET /api/status HTTP/1.1\r\nHost: localhost:3000\r\n\r\n", 0, 0, 0, 0 },
+        { "client_handler/api_timers", bm_client_handler,
+          "GET /api/timers HTTP/1.1\r\nHost: localhost:3000\r\n\r\n", 0, 0, 0, 0 },
+        { "client_handler/api_timers_gzip", bm_client_handler,
+          "GET /api/timers HTTP/1.1\r\nHost: localhost:3000\r\nAccept-Encoding: gzip\r\n\r\n", 0, 0, 0, 0 },
+        { "client_handler/playlist_300", bm_client_handler,
+          "GET /playlist.m3u HTTP/1.1\r\nHost: localhost:3000\r\n\r\n", 0, 0, 0, 0 },
+        { "client_handler/playlist_300_gzip", bm_client_handler,
+          "GET /playlist.m3u HTTP/1.1\r\nHost: localhost:3000\r\nAccept-Encoding: gzip, br\r\n\r\n", 0, 0, 0, 0 },
+        { "client_handler/api_timers_x3_keepalive", bm_client_handler,
+          "GET /api/timers HTTP/1.1\r\nHost: localhost:3000\r\n\r\n"
+          "GET /api/timers HTTP/1.1\r\nHost: localhost:3000\r\n\r\n"
+          "GET /api/timers HTTP/1.1\r\nHost: localhost:3000\r\n\r\n", 0, 0, 0, 0 },
+        { "client_handler/static_404", bm_client_handler,
+          "GET /missing.css HTTP/1.1\r\nHost: localhost:3000\r\n\r\n", 0, 0, 0, 0 },
+        { "hpack/decode_browser_request", bm_hpack_decode, &request_block, 0, 0, 0, 0 },
+        { "hpack/encode_json_response", bm_hpack_encode, &response_encoder, 0, 0, 0, 0 },
+    };
+    int ncases = sizeof(cases) / sizeof(cases[0]);
+
+    printf("%-40s %12s %12s %12s %10s\n", "case", "ns/op", "allocs/op", "bytes/op", "iters");
+    for (int i = 0; i < ncases; i++) {
+        MicroCase *mc = &cases[i];
+        if (filter && !strstr(mc->name, filter)) continue;
+        run_case(mc, ms_per_rep, reps);
+        printf("%-40s %12.0f %12.2f %12.0f %10ld\n", mc->name, mc->ns_per_op,
+               mc->allocs_per_op, mc->bytes_per_op, mc->iters);
+        fflush(stdout);
+    }
+
+    if (out_abs[0]) {
+        FILE *f = fopen(out_abs, "w");
+        if (f) {
+            fprintf(f, "{\"ms_per_rep\":%d,\"reps\":%d,\"cases\":[", ms_per_rep, reps);
+            int first = 1;
+            for (int i = 0; i < ncases; i++) {
+                if (cases[i].iters == 0) continue;
+                fprintf(f, "%s{\"name\":\"%s\",\"ns_per_op\":%.1f,\"allocs_per_op\":%.2f,\"bytes_per_op\":%.0f}",
+                        first ? "" : ",", cases[i].name, cases[i].ns_per_op, cases[i].allocs_per_op,
+                        cases[i].bytes_per_op);
+                first = 0;
+            }
+            fprintf(f, "]}\n");
+            fclose(f);
+        }
+    }
+
+    db_close();
+    char cmd[128];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", work);
+    if (system(cmd) != 0) fprintf(stderr, "could not remove %s\n", work);
+    return 0;
+}
@@ -0,0 +1,162 @@
+/**
+ * @file bench_transcode.c
+ * @brief Transcode throughput matrix across backends, codecs, presets and sizes
+ *
+ * For every backend/codec the capability probe reports as viable, each
+ * preset and output height is run once, unpaced, over the synthetic
+ * fixture through the server's own transcode_spawn()/build_ffmpeg_args()
+ * path. Per run it records:
+ * - fps and speed factor (media seconds per wall second)
+ * - CPU seconds per output minute (user+sys of the FFmpeg child)
+ * - Peak RSS of the FFmpeg child
+ *
+ * Results are written as JSON, followed by a suggested concurrent session
+ * capacity per backend using the server's default preset at source size.
+ *
+ * Usage:
+ *   bench_transcode [-b backend] [-c codec] [-d fixture_seconds] [-o out.json] fixture.ts
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "transcode.h"
+#include "capabilities.h"
+#include "encode_sched.h"
+#include "log.h"
+
+int g_verbose = 0;
+
+/** Keep 20% headroom when turning measurements into a session count */
+#define CAPACITY_HEADROOM 0.8
+
+/** Presets per backend/codec; NULL entry = the server's default */
+static const char *presets_x26x[] = { NULL, "ultrafast", "veryfast", "medium" };
+static const char *presets_svtav1[] = { NULL, "8", "12" };
+static const char *presets_nvenc[] = { NULL, "p1", "p7" };
+static const char *presets_qsv[] = { NULL, "veryfast", "veryslow" };
+static const char *presets_vaapi[] = { NULL };
+
+static const int heights[] = { 0, 720, 480 };
+
+static int preset_list(TranscodeBackend b, TranscodeCodec c, const char ***out) {
+    switch (b) {
+        case TRANSCODE_BACKEND_SOFTWARE:
+            if (c == TRANSCODE_CODEC_AV1) { *out = presets_svtav1; return 3; }
+            *out = presets_x26x; return 4;
+        case TRANSCODE_BACKEND_NVENC: *out = presets_nvenc; return 3;
+        case TRANSCODE_BACKEND_QSV: *out = presets_qsv; return 3;
+        default: *out = presets_vaapi; return 1;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *only_backend = NULL, *only_codec = NULL;
+    const char *out_path = "transcode.json";
+    double media_s = 30;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:c:d:o:v")) != -1) {
+        switch (opt) {
+            case 'b': only_backend = optarg; break;
+            case 'c': only_codec = optarg; break;
+            case 'd': media_s = atof(optarg); break;
+            case 'o': out_path = optarg; break;
+            case 'v': g_verbose = 1; break;
+            default:
+                fprintf(stderr, "Usage: %s [-b backend] [-c codec] [-d seconds] [-o out.json] fixture.ts\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Missing fixture path\n");
+        return 1;
+    }
+    const char *fixture = argv[optind];
+
+    encode_sched_init(0);  /* One session at a time: let FFmpeg use the whole box */
+    caps_probe("/dev");
+    int cores, cpus, nodes;
+    encode_sched_topology(&cores, &cpus, &nodes);
+
+    FILE *out = fopen(out_path, "w");
+    if (!out) {
+        perror(out_path);
+        return 1;
+    }
+    fprintf(out, "{\"host\":{\"cpus\":%d,\"cores\":%d,\"numa_nodes\":%d},\"fixture_seconds\":%.1f,\"runs\":[",
+            cpus, cores, nodes, media_s);
+
+    printf("%-8s %-5s %-10s %-6s %8s %7s %12s %8s\n",
+           "backend", "codec", "preset", "height", "fps", "speed", "cpu_s/min", "rss_MB");
+
+    int first_run = 1;
+    int capacity[CAPS_NUM_BACKENDS];
+    for (int b = 0; b < CAPS_NUM_BACKENDS; b++) {
+        capacity[b] = -1;
+        if (only_backend && strcmp(only_backend, transcode_backend_name(b)) != 0) continue;
+
+        for (int c = 0; c < CAPS_NUM_CODECS; c++) {
+            if (only_codec && strcmp(only_codec, transcode_codec_name(c)) != 0) continue;
+            if (!caps_viable(b, c)) continue;
+
+            const char **presets;
+            int npresets = preset_list(b, c, &presets);
+            for (int p = 0; p < npresets; p++) {
+                for (size_t h = 0; h < sizeof(heights) / sizeof(heights[0]); h++) {
+                    TranscodeConfig tc = {
+                        .backend = b, .codec = c, .unpaced = 1,
+                        .preset = presets[p], .height = heights[h],
+                    };
+                    BenchRun r;
+                    bench_run_sessions(fixture, tc, 1, &r);
+
+                    double speed = media_s / r.wall_s;
+                    double fps = media_s * BENCH_FIXTURE_FPS / r.wall_s;
+                    double cpu_per_min = r.cpu_s / (media_s / 60.0);
+                    const char *pname = presets[p] ? presets[p] : "default";
+
+                    printf("%-8s %-5s %-10s %-6d %8.1f %6.2fx %12.1f %8ld%s\n",
+                           transcode_backend_name(b), transcode_codec_name(c), pname,
+                           heights[h], fps, speed, cpu_per_min, r.max_rss_kb / 1024,
+                           r.failed ? "  FAILED" : "");
+                    fflush(stdout);
+
+                    fprintf(out, "%s{\"backend\":\"%s\",\"codec\":\"%s\",\"preset\":\"%s\",\"height\":%d,"
+                            "\"ok\":%s,\"fps\":%.2f,\"speed\":%.3f,\"cpu_s_per_min\":%.2f,"
+                            "\"peak_rss_kb\":%ld,\"output_bytes\":%lld}",
+                            first_run ? "" : ",", transcode_backend_name(b), transcode_codec_name(c),
+                            pname, heights[h], r.failed ? "false" : "true", fps, speed,
+                            cpu_per_min, r.max_rss_kb, r.bytes);
+                    first_run = 0;
+
+                    /* Capacity from what the server actually runs: default preset, source size, h264 */
+                    if (r.failed || presets[p] || heights[h] != 0 || c != TRANSCODE_CODEC_H264) continue;
+                    int by_cpu = cpu_per_min > 0 ? (int)(cpus * 60.0 * CAPACITY_HEADROOM / cpu_per_min) : 0;
+                    int by_engine = (int)(speed * CAPACITY_HEADROOM);
+                    capacity[b] = (b == TRANSCODE_BACKEND_SOFTWARE || by_engine > by_cpu) ? by_cpu : by_engine;
+                }
+            }
+        }
+    }
+
+    fprintf(out, "],\"capacity\":{");
+    printf("\nSuggested concurrent live sessions (h264, default preset, source size, %d%% headroom):\n",
+           (int)(CAPACITY_HEADROOM * 100));
+    int first_cap = 1;
+    for (int b = 0; b < CAPS_NUM_BACKENDS; b++) {
+        if (capacity[b] < 0) continue;
+        printf("  %-8s %d\n", transcode_backend_name(b), capacity[b]);
+        fprintf(out, "%s\"%s\":%d", first_cap ? "" : ",", transcode_backend_name(b), capacity[b]);
+        first_cap = 0;
+    }
+    fprintf(out, "}}\n");
+    fclose(out);
+
+    printf("\nResults written to %s\n", out_path);
+    return 0;
+}
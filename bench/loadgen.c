@@ -0,0 +1,398 @@
+/**
+ * @file loadgen.c
+ * @brief HTTP load generator for ZapLinkWeb
+ *
+ * Drives a running server with:
+ * - N request workers issuing a weighted mix of API endpoints, static assets and
+ *   /playlist.m3u requests back to back (one connection per request)
+ * - M long-lived /stream/ sessions rotating through channels
+ *
+ * The server pid defaults to $ZAPLINK_PID (set by with_server.sh).
+ * While running, the server process (and its FFmpeg children) is sampled
+ * from /proc every interval. At the end, per-endpoint throughput and
+ * latency percentiles are printed and optionally written as JSON along
+ * with the resource time series.
+ *
+ * Usage:
+ *   loadgen [-P server_pid] [-H host] [-p port] [-c workers] [-s streams]
+ *           [-t seconds] [-i interval] [-m api:60,static:30,playlist:10]
+ *           [-S /stream/] [-n channels] [-o out.json]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "procstat.h"
+
+/** Endpoints per traffic class */
+static const char *api_paths[] = {
+    "/api/status", "/api/recordings", "/api/timers", "/api/config", "/api/version"
+};
+static const char *static_paths[] = {
+    "/", "/favicon.ico", "/images/zaplink.png", "/initializing.html"
+};
+static const char *playlist_paths[] = {
+    "/playlist.m3u", "/playlist.m3u?backend=vaapi&codec=hevc&bitrate=8000"
+};
+
+#define NUM_API (sizeof(api_paths) / sizeof(api_paths[0]))
+#define NUM_STATIC (sizeof(static_paths) / sizeof(static_paths[0]))
+#define NUM_PLAYLIST (sizeof(playlist_paths) / sizeof(playlist_paths[0]))
+#define NUM_ENDPOINTS (NUM_API + NUM_STATIC + NUM_PLAYLIST)
+
+#define MAX_SAMPLES 100000
+
+/**
+ * Latencies for one endpoint, merged from all workers at the end
+ */
+typedef struct {
+    const char *path;
+    double *lat_ms;
+    size_t count, cap;
+    long errors;
+    long long bytes;
+} EndpointStats;
+
+/**
+ * One /proc sample plus traffic over the preceding interval
+ */
+typedef struct {
+    double t;
+    double req_per_s;
+    double stream_mbps;
+    ProcSample proc;
+} SeriesPoint;
+
+static const char *host = "127.0.0.1";
+static int port = 3000;
+static int workers = 8;
+static int streams = 0;
+static int duration_s = 30;
+static int interval_s = 1;
+static int num_channels = 100;
+static const char *stream_prefix = "/stream/";
+static pid_t server_pid = 0;
+static int weight_api = 60, weight_static = 30, weight_playlist = 10;
+
+static struct sockaddr_in server_addr;
+static atomic_int stop_flag;
+static atomic_long total_requests;
+static atomic_llong stream_bytes;
+static atomic_long stream_errors;
+
+static EndpointStats endpoints[NUM_ENDPOINTS];
+static pthread_mutex_t merge_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static SeriesPoint *series;
+static int series_len = 0;
+
+/** Time-to-first-byte of stream sessions */
+static double *ttfb_ms;
+static size_t ttfb_count = 0, ttfb_cap = 0;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void push(double **arr, size_t *count, size_t *cap, double v) {
+    if (*count == *cap) {
+        *cap = *cap ? *cap * 2 : 1024;
+        *arr = realloc(*arr, sizeof(double) * *cap);
+    }
+    (*arr)[(*count)++] = v;
+}
+
+static int connect_server(void) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Issue one GET and read the response to EOF
+ *
+ * @return HTTP status, or -1 on connection failure
+ */
+static int http_get(const char *path, long long *bytes) {
+    int fd = connect_server();
+    if (fd < 0) return -1;
+
+    char req[1200];
+    int len = snprintf(req, sizeof(req),
+        "GET %s HTTP/1.1\r\nHost: %s:%d\r\nConnection: close\r\n\r\n", path, host, port);
+    if (write(fd, req, len) != len) {
+        close(fd);
+        return -1;
+    }
+
+    char buf[16384];
+    int status = -1;
+    ssize_t n;
+    *bytes = 0;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        if (*bytes == 0 && n > 12) status = atoi(buf + 9);
+        *bytes += n;
+    }
+    close(fd);
+    return status;
+}
+
+static int pick_endpoint(unsigned int *seed) {
+    int total = weight_api + weight_static + weight_playlist;
+    int r = rand_r(seed) % (total > 0 ? total : 1);
+    if (r < weight_api) return rand_r(seed) % NUM_API;
+    if (r < weight_api + weight_static) return NUM_API + rand_r(seed) % NUM_STATIC;
+    return NUM_API + NUM_STATIC + rand_r(seed) % NUM_PLAYLIST;
+}
+
+static void *request_worker(void *arg) {
+    unsigned int seed = (unsigned int)(long)arg * 7919 + (unsigned int)time(NULL);
+    EndpointStats local[NUM_ENDPOINTS];
+    memset(local, 0, sizeof(local));
+
+    while (!atomic_load(&stop_flag)) {
+        int e = pick_endpoint(&seed);
+        long long bytes;
+        double t0 = now_ms();
+        int status = http_get(endpoints[e].path, &bytes);
+        double dt = now_ms() - t0;
+
+        if (status < 200 || status >= 400) local[e].errors++;
+        else push(&local[e].lat_ms, &local[e].count, &local[e].cap, dt);
+        local[e].bytes += bytes;
+        atomic_fetch_add(&total_requests, 1);
+    }
+
+    pthread_mutex_lock(&merge_mutex);
+    for (size_t e = 0; e < NUM_ENDPOINTS; e++) {
+        for (size_t i = 0; i < local[e].count; i++) {
+            push(&endpoints[e].lat_ms, &endpoints[e].count, &endpoints[e].cap, local[e].lat_ms[i]);
+        }
+        endpoints[e].errors += local[e].errors;
+        endpoints[e].bytes += local[e].bytes;
+        free(local[e].lat_ms);
+    }
+    pthread_mutex_unlock(&merge_mutex);
+    return NULL;
+}
+
+/**
+ * Hold a stream session open, reconnecting on the next channel if it drops
+ */
+static void *stream_worker(void *arg) {
+    int idx = (int)(long)arg;
+    int chan = idx;
+
+    while (!atomic_load(&stop_flag)) {
+        int fd = connect_server();
+        if (fd < 0) {
+            atomic_fetch_add(&stream_errors, 1);
+            sleep(1);
+            continue;
+        }
+
+        char req[256];
+        int len = snprintf(req, sizeof(req),
+            "GET %s%d.%d HTTP/1.1\r\nHost: %s:%d\r\nConnection: close\r\n\r\n",
+            stream_prefix, 2 + (chan % num_channels) / 4, 1 + (chan % num_channels) % 4, host, port);
+        write(fd, req, len);
+
+        /* Wake up periodically to notice stop_flag */
+        struct timeval tv = { .tv_sec = 1, .tv_usec = 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        char buf[65536];
+        double t0 = now_ms();
+        int first = 1;
+        while (!atomic_load(&stop_flag)) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+            if (n <= 0) {
+                atomic_fetch_add(&stream_errors, 1);
+                break;
+            }
+            if (first) {
+                pthread_mutex_lock(&merge_mutex);
+                push(&ttfb_ms, &ttfb_count, &ttfb_cap, now_ms() - t0);
+                pthread_mutex_unlock(&merge_mutex);
+                first = 0;
+            }
+            atomic_fetch_add(&stream_bytes, n);
+        }
+        close(fd);
+        chan += streams > 0 ? streams : 1;
+    }
+    return NULL;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, size_t n, double p) {
+    if (n == 0) return 0;
+    size_t i = (size_t)(p / 100.0 * (n - 1) + 0.5);
+    return sorted[i < n ? i : n - 1];
+}
+
+static void parse_mix(const char *spec) {
+    weight_api = weight_static = weight_playlist = 0;
+    char *copy = strdup(spec);
+    for (char *tok = strtok(copy, ","); tok; tok = strtok(NULL, ",")) {
+        char *colon = strchr(tok, ':');
+        int w = colon ? atoi(colon + 1) : 1;
+        if (colon) *colon = '\0';
+        if (strcmp(tok, "api") == 0) weight_api = w;
+        else if (strcmp(tok, "static") == 0) weight_static = w;
+        else if (strcmp(tok, "playlist") == 0) weight_playlist = w;
+    }
+    free(copy);
+}
+
+static void write_json(const char *path, double elapsed_s) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return;
+    }
+    fprintf(f, "{\"workers\":%d,\"streams\":%d,\"duration_s\":%.1f,\"endpoints\":[", workers, streams, elapsed_s);
+    for (size_t e = 0; e < NUM_ENDPOINTS; e++) {
+        EndpointStats *s = &endpoints[e];
+        fprintf(f, "%s{\"path\":\"%s\",\"requests\":%zu,\"errors\":%ld,\"rps\":%.1f,"
+                "\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f,\"bytes\":%lld}",
+                e ? "," : "", s->path, s->count, s->errors, s->count / elapsed_s,
+                percentile(s->lat_ms, s->count, 50), percentile(s->lat_ms, s->count, 90),
+                percentile(s->lat_ms, s->count, 99), percentile(s->lat_ms, s->count, 100), s->bytes);
+    }
+    fprintf(f, "],\"stream\":{\"errors\":%ld,\"ttfb_p50_ms\":%.1f,\"ttfb_p99_ms\":%.1f},\"series\":[",
+            atomic_load(&stream_errors), percentile(ttfb_ms, ttfb_count, 50), percentile(ttfb_ms, ttfb_count, 99));
+    for (int i = 0; i < series_len; i++) {
+        SeriesPoint *p = &series[i];
+        fprintf(f, "%s{\"t\":%.1f,\"rps\":%.1f,\"stream_mbps\":%.2f,\"threads\":%d,\"fds\":%d,"
+                "\"rss_kb\":%ld,\"children\":%d,\"zombies\":%d,\"children_rss_kb\":%ld}",
+                i ? "," : "", p->t, p->req_per_s, p->stream_mbps, p->proc.threads, p->proc.fds,
+                p->proc.rss_kb, p->proc.children, p->proc.zombies, p->proc.children_rss_kb);
+    }
+    fprintf(f, "]}\n");
+    fclose(f);
+}
+
+int main(int argc, char *argv[]) {
+    const char *out_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "H:p:c:s:t:i:m:S:n:P:o:")) != -1) {
+        switch (opt) {
+            case 'H': host = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'c': workers = atoi(optarg); break;
+            case 's': streams = atoi(optarg); break;
+            case 't': duration_s = atoi(optarg); break;
+            case 'i': interval_s = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+            case 'm': parse_mix(optarg); break;
+            case 'S': stream_prefix = optarg; break;
+            case 'n': num_channels = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+            case 'P': server_pid = atoi(optarg); break;
+            case 'o': out_path = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s -P pid [-H host] [-p port] [-c workers] [-s streams] "
+                        "[-t secs] [-i secs] [-m mix] [-S prefix] [-n channels] [-o out.json]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (server_pid == 0 && getenv("ZAPLINK_PID")) server_pid = atoi(getenv("ZAPLINK_PID"));
+
+    signal(SIGPIPE, SIG_IGN);
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    struct hostent *he = gethostbyname(host);
+    if (!he) {
+        fprintf(stderr, "Unknown host %s\n", host);
+        return 1;
+    }
+    memcpy(&server_addr.sin_addr, he->h_addr_list[0], sizeof(server_addr.sin_addr));
+
+    size_t e = 0;
+    for (size_t i = 0; i < NUM_API; i++) endpoints[e++].path = api_paths[i];
+    for (size_t i = 0; i < NUM_STATIC; i++) endpoints[e++].path = static_paths[i];
+    for (size_t i = 0; i < NUM_PLAYLIST; i++) endpoints[e++].path = playlist_paths[i];
+    series = calloc(MAX_SAMPLES, sizeof(SeriesPoint));
+
+    pthread_t *threads = calloc(workers + streams, sizeof(pthread_t));
+    for (int i = 0; i < streams; i++) pthread_create(&threads[i], NULL, stream_worker, (void *)(long)i);
+    for (int i = 0; i < workers; i++) pthread_create(&threads[streams + i], NULL, request_worker, (void *)(long)i);
+
+    printf("%6s %8s %10s %8s %6s %10s %8s %7s %12s\n",
+           "t", "req/s", "stream_Mb", "threads", "fds", "rss_KB", "children", "zombie", "child_rssKB");
+
+    double start = now_ms();
+    long last_req = 0;
+    long long last_bytes = 0;
+    while (now_ms() - start < duration_s * 1000.0) {
+        sleep(interval_s);
+        double t = (now_ms() - start) / 1000.0;
+        long req = atomic_load(&total_requests);
+        long long sb = atomic_load(&stream_bytes);
+
+        SeriesPoint p = { .t = t };
+        p.req_per_s = (req - last_req) / (double)interval_s;
+        p.stream_mbps = (sb - last_bytes) * 8 / 1e6 / interval_s;
+        last_req = req;
+        last_bytes = sb;
+        if (server_pid > 0 && !procstat_sample(server_pid, &p.proc)) {
+            fprintf(stderr, "Server pid %d is gone\n", (int)server_pid);
+            break;
+        }
+        if (series_len < MAX_SAMPLES) series[series_len++] = p;
+
+        printf("%6.0f %8.0f %10.2f %8d %6d %10ld %8d %7d %12ld\n", t, p.req_per_s, p.stream_mbps,
+               p.proc.threads, p.proc.fds, p.proc.rss_kb, p.proc.children, p.proc.zombies,
+               p.proc.children_rss_kb);
+        fflush(stdout);
+    }
+    atomic_store(&stop_flag, 1);
+    for (int i = 0; i < workers + streams; i++) pthread_join(threads[i], NULL);
+    double elapsed = (now_ms() - start) / 1000.0;
+
+    printf("\n%-55s %8s %6s %8s %9s %9s %9s %9s\n",
+           "endpoint", "requests", "errors", "req/s", "p50_ms", "p90_ms", "p99_ms", "max_ms");
+    for (size_t i = 0; i < NUM_ENDPOINTS; i++) {
+        EndpointStats *s = &endpoints[i];
+        qsort(s->lat_ms, s->count, sizeof(double), cmp_double);
+        printf("%-55s %8zu %6ld %8.1f %9.2f %9.2f %9.2f %9.2f\n", s->path, s->count, s->errors,
+               s->count / elapsed, percentile(s->lat_ms, s->count, 50),
+               percentile(s->lat_ms, s->count, 90), percentile(s->lat_ms, s->count, 99),
+               percentile(s->lat_ms, s->count, 100));
+    }
+    if (streams > 0) {
+        qsort(ttfb_ms, ttfb_count, sizeof(double), cmp_double);
+        printf("\nstreams: %d sessions, %zu starts, %ld drops, ttfb p50=%.0fms p99=%.0fms, %.1f MB relayed\n",
+               streams, ttfb_count, atomic_load(&stream_errors), percentile(ttfb_ms, ttfb_count, 50),
+               percentile(ttfb_ms, ttfb_count, 99), atomic_load(&stream_bytes) / 1e6);
+    }
+
+    if (out_path) write_json(out_path, elapsed);
+    return 0;
+}
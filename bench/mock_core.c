@@ -0,0 +1,239 @@
+/**
+ * @file mock_core.c
+ * @brief Stand-in ZapLinkCore for benchmarks
+ *
+ * Serves the two ZapLinkCore endpoints ZapLinkWeb depends on:
+ *   GET /stream/<channel>   The fixture TS, looped and paced at its own bitrate
+ *   GET /xmltv.json         A synthetic guide (channels x days of 30-minute slots)
+ *
+ * It can also write a matching channels.conf so /playlist.m3u has a lineup.
+ *
+ * Usage:
+ *   mock_core -f fixture.ts [-d fixture_seconds] [-p port] [-n channels]
+ *             [-D guide_days] [-L tune_ms] [-C channels.conf]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+
+#include "strbuf.h"
+#include "log.h"
+
+int g_verbose = 0;
+
+/** Bytes written per paced send: 56 TS packets */
+#define CHUNK_BYTES (188 * 56)
+
+static const char *fixture_path = NULL;
+static off_t fixture_size = 0;
+static double fixture_seconds = 30;
+static int num_channels = 100;
+static int guide_days = 2;
+static int tune_ms = 0;
+
+/** Pre-rendered guide body */
+static char *guide_json = NULL;
+static size_t guide_len = 0;
+
+static void channel_number(int i, char *out, size_t len) {
+    snprintf(out, len, "%d.%d", 2 + i / 4, 1 + i % 4);
+}
+
+/**
+ * Build xmltv.json in ZapLinkCore's shape: {"channels":[...],"programs":[...]}
+ */
+static void build_guide(void) {
+    size_t cap = 1 << 20;
+    guide_json = malloc(cap);
+    guide_len = 0;
+
+    long long slot_ms = 30 * 60 * 1000LL;
+    long long start = ((long long)time(NULL) * 1000 / slot_ms) * slot_ms - 2 * slot_ms;
+    int slots = guide_days * 48;
+
+    strbuf_append(&guide_json, &guide_len, &cap, "{\"channels\":[");
+    for (int i = 0; i < num_channels; i++) {
+        char num[16];
+        channel_number(i, num, sizeof(num));
+        strbuf_append(&guide_json, &guide_len, &cap, "%s{\"id\":\"%s\",\"name\":\"Mock %s\",\"icon\":\"\"}",
+               i ? "," : "", num, num);
+    }
+    strbuf_append(&guide_json, &guide_len, &cap, "],\"programs\":[");
+    for (int i = 0; i < num_channels; i++) {
+        char num[16];
+        channel_number(i, num, sizeof(num));
+        for (int s = 0; s < slots; s++) {
+            long long ps = start + s * slot_ms;
+            strbuf_append(&guide_json, &guide_len, &cap,
+                   "%s{\"channel\":\"%s\",\"start\":%lld,\"end\":%lld,\"title\":\"Program %d-%d\","
+                   "\"desc\":\"Synthetic listing for benchmark traffic on channel %s.\"}",
+                   (i || s) ? "," : "", num, ps, ps + slot_ms, i, s, num);
+        }
+    }
+    strbuf_append(&guide_json, &guide_len, &cap, "]}");
+}
+
+static void write_channels_conf(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    for (int i = 0; i < num_channels; i++) {
+        char num[16];
+        channel_number(i, num, sizeof(num));
+        fprintf(f, "[Mock %s]\n\tVCHANNEL = %s\n\tSERVICE_ID = %d\n\tFREQUENCY = %d\n\n",
+                num, num, i + 1, 177000000 + (i / 4) * 6000000);
+    }
+    fclose(f);
+}
+
+static void send_simple(int fd, int status, const char *ctype, const char *body, size_t len) {
+    char hdr[256];
+    int n = snprintf(hdr, sizeof(hdr),
+        "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+        status, status == 200 ? "OK" : "Not Found", ctype, len);
+    write(fd, hdr, n);
+    size_t off = 0;
+    while (off < len) {
+        ssize_t w = write(fd, body + off, len - off);
+        if (w <= 0) return;
+        off += w;
+    }
+}
+
+/**
+ * Loop the fixture to the client at its natural bitrate until it hangs up
+ */
+static void serve_stream(int fd) {
+    int in = open(fixture_path, O_RDONLY);
+    if (in < 0) {
+        send_simple(fd, 404, "text/plain", "no fixture", 10);
+        return;
+    }
+
+    if (tune_ms > 0) usleep(tune_ms * 1000);
+
+    const char *hdr = "HTTP/1.1 200 OK\r\nContent-Type: video/mp2t\r\nConnection: close\r\n\r\n";
+    write(fd, hdr, strlen(hdr));
+
+    double bytes_per_sec = fixture_size / fixture_seconds;
+    long long chunk_ns = (long long)(CHUNK_BYTES / bytes_per_sec * 1e9);
+    off_t loop_size = fixture_size - fixture_size % 188;
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    char buf[CHUNK_BYTES];
+    off_t pos = 0;
+    while (1) {
+        size_t want = sizeof(buf);
+        if ((off_t)want > loop_size - pos) want = loop_size - pos;
+        ssize_t n = pread(in, buf, want, pos);
+        if (n <= 0) {
+            pos = 0;
+            continue;
+        }
+        pos += n;
+        if (pos >= loop_size) pos = 0;
+        if (write(fd, buf, n) < 0) break;
+
+        next.tv_nsec += chunk_ns;
+        while (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    close(in);
+}
+
+static void *conn_thread(void *arg) {
+    int fd = (int)(long)arg;
+    char req[2048];
+    ssize_t n = read(fd, req, sizeof(req) - 1);
+    if (n > 0) {
+        req[n] = '\0';
+        char method[16], path[1024];
+        if (sscanf(req, "%15s %1023s", method, path) == 2) {
+            LOG_DEBUG("MOCK", "%s %s", method, path);
+            if (strncmp(path, "/stream/", 8) == 0) {
+                serve_stream(fd);
+            } else if (strcmp(path, "/xmltv.json") == 0) {
+                send_simple(fd, 200, "application/json", guide_json, guide_len);
+            } else {
+                send_simple(fd, 404, "text/plain", "Not Found", 9);
+            }
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    int port = 18392;
+    const char *channels_conf = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:d:p:n:D:L:C:v")) != -1) {
+        switch (opt) {
+            case 'f': fixture_path = optarg; break;
+            case 'd': fixture_seconds = atof(optarg); break;
+            case 'p': port = atoi(optarg); break;
+            case 'n': num_channels = atoi(optarg); break;
+            case 'D': guide_days = atoi(optarg); break;
+            case 'L': tune_ms = atoi(optarg); break;
+            case 'C': channels_conf = optarg; break;
+            case 'v': g_verbose = 1; break;
+            default:
+                fprintf(stderr, "Usage: %s -f fixture.ts [-d secs] [-p port] [-n channels] "
+                        "[-D days] [-L tune_ms] [-C channels.conf]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    struct stat st;
+    if (!fixture_path || stat(fixture_path, &st) != 0 || st.st_size < 188) {
+        fprintf(stderr, "A TS fixture is required (-f)\n");
+        return 1;
+    }
+    fixture_size = st.st_size;
+
+    signal(SIGPIPE, SIG_IGN);
+    build_guide();
+    if (channels_conf) write_channels_conf(channels_conf);
+
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port),
+                                .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(s, 128) < 0) {
+        perror("mock_core bind");
+        return 1;
+    }
+    LOG_INFO("MOCK", "Stand-in core on 127.0.0.1:%d (%d channels, guide %zu KB)",
+             port, num_channels, guide_len / 1024);
+
+    while (1) {
+        int c = accept(s, NULL, NULL);
+        if (c < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        pthread_t th;
+        pthread_create(&th, NULL, conn_thread, (void *)(long)c);
+        pthread_detach(th);
+    }
+    return 0;
+}
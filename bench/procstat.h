@@ -0,0 +1,108 @@
+/**
+ * @file procstat.h
+ * @brief /proc sampling of the server process and its children
+ *
+ * Header-only helper shared by the load and soak harnesses. A sample holds
+ * the server's thread count, open fds and RSS plus totals for its direct
+ * children (FFmpeg sessions and recorders), including zombies that have
+ * not been reaped.
+ */
+
+#ifndef PROCSTAT_H
+#define PROCSTAT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/types.h>
+
+/**
+ * One point-in-time view of the server
+ */
+typedef struct {
+    int alive;              /**< Server process still exists */
+    int threads;            /**< Threads: from /proc/<pid>/status */
+    long rss_kb;            /**< VmRSS of the server */
+    int fds;                /**< Entries in /proc/<pid>/fd */
+    int children;           /**< Live direct children */
+    int zombies;            /**< Direct children in state Z */
+    long children_rss_kb;   /**< Sum of VmRSS of live children */
+} ProcSample;
+
+/**
+ * Read "Key:  value" fields from /proc/<pid>/status
+ */
+static inline void procstat_status(pid_t pid, int *threads, long *rss_kb) {
+    char path[64], line[256];
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (!f) return;
+    while (fgets(line, sizeof(line), f)) {
+        if (threads && strncmp(line, "Threads:", 8) == 0) *threads = atoi(line + 8);
+        else if (rss_kb && strncmp(line, "VmRSS:", 6) == 0) *rss_kb = atol(line + 6);
+    }
+    fclose(f);
+}
+
+static inline int procstat_count_fds(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/fd", (int)pid);
+    DIR *d = opendir(path);
+    if (!d) return -1;
+    int n = 0;
+    struct dirent *ent;
+    while ((ent = readdir(d))) {
+        if (ent->d_name[0] != '.') n++;
+    }
+    closedir(d);
+    return n;
+}
+
+/**
+ * Sample the server and scan /proc for its direct children
+ *
+ * @return 1 if the server is alive, 0 otherwise
+ */
+static inline int procstat_sample(pid_t pid, ProcSample *out) {
+    memset(out, 0, sizeof(*out));
+    out->fds = procstat_count_fds(pid);
+    if (out->fds < 0) return 0;
+    out->alive = 1;
+    procstat_status(pid, &out->threads, &out->rss_kb);
+
+    DIR *d = opendir("/proc");
+    if (!d) return 1;
+    struct dirent *ent;
+    while ((ent = readdir(d))) {
+        int child = atoi(ent->d_name);
+        if (child <= 0) continue;
+
+        char path[64], buf[512];
+        snprintf(path, sizeof(path), "/proc/%d/stat", child);
+        FILE *f = fopen(path, "r");
+        if (!f) continue;
+        size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+        fclose(f);
+        buf[n] = '\0';
+
+        /* comm may contain spaces: fields resume after the last ')' */
+        char *rp = strrchr(buf, ')');
+        char state;
+        int ppid;
+        if (!rp || sscanf(rp + 2, "%c %d", &state, &ppid) != 2 || ppid != pid) continue;
+
+        if (state == 'Z') {
+            out->zombies++;
+        } else {
+            long rss = 0;
+            procstat_status(child, NULL, &rss);
+            out->children++;
+            out->children_rss_kb += rss;
+        }
+    }
+    closedir(d);
+    return 1;
+}
+
+#endif
@@ -0,0 +1,449 @@
+/**
+ * @file soak.c
+ * @brief Long-running leak soak for ZapLinkWeb
+ *
+ * Runs hours of mixed traffic against a running server (normally through
+ * with_server.sh and the stand-in core):
+ *   zap       Open /stream/ or /transcode/ on a random channel, read for
+ *             0.5-3s, hang up
+ *   playback  Hold a /stream/ session for 30-120s
+ *   timers    Create short timers through /api/timers so the scheduler
+ *             starts and stops recorders, then delete the finished
+ *             recordings and timers
+ *   api       API, static asset and playlist requests back to back
+ *
+ * The server and its children are sampled from /proc (procstat.h). After a
+ * warm-up period a least-squares trend is fitted to each series, and the
+ * run fails when the growth it predicts over the measured window exceeds
+ * the threshold for fds, threads, zombies or RSS. Exit status: 0 pass,
+ * 1 leak detected, 2 server died.
+ *
+ * Usage:
+ *   soak [-P pid] [-p port] [-t 4h] [-i 10s] [-w 10m] [-z zappers] [-l players]
+ *        [-a api_workers] [-r timer_period_s] [-n channels]
+ *        [-F fds] [-T threads] [-Z zombies] [-R rss_pct] [-o out.json]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "procstat.h"
+
+static const char *api_paths[] = {
+    "/api/status", "/api/recordings", "/api/timers", "/api/config", "/api/version",
+    "/", "/favicon.ico", "/playlist.m3u", "/playlist.m3u?backend=vaapi&codec=hevc"
+};
+#define NUM_API_PATHS (sizeof(api_paths) / sizeof(api_paths[0]))
+
+/**
+ * One /proc sample
+ */
+typedef struct {
+    double t;
+    ProcSample proc;
+} SoakPoint;
+
+/**
+ * Leak criterion for one series
+ */
+typedef struct {
+    const char *name;
+    double threshold;       /**< Allowed growth over the window */
+    int percent;            /**< threshold is a percentage of the starting value */
+    double start;           /**< Fitted value at the start of the window */
+    double growth;          /**< Fitted growth over the window */
+    int failed;
+} Verdict;
+
+static int port = 3000;
+static int num_channels = 100;
+static pid_t server_pid = 0;
+
+static struct sockaddr_in server_addr;
+static atomic_int stop_flag;
+static atomic_long zaps, plays, timers_created, api_requests, errors;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Parse "90", "90s", "30m" or "4h" into seconds
+ */
+static int parse_duration(const char *s) {
+    char *end;
+    double v = strtod(s, &end);
+    if (*end == 'm') v *= 60;
+    else if (*end == 'h') v *= 3600;
+    return (int)v;
+}
+
+/** Sleep in short steps so workers notice stop_flag */
+static void nap(double seconds) {
+    double until = now_s() + seconds;
+    while (!atomic_load(&stop_flag) && now_s() < until) usleep(100000);
+}
+
+static int connect_server(void) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct timeval tv = { .tv_sec = 1, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Issue one request and read the response to EOF
+ *
+ * @param body Output: heap copy of the response body (may be NULL)
+ * @return HTTP status, or -1 on connection failure
+ */
+static int http_request(const char *method, const char *path, const char *payload, char **body) {
+    int fd = connect_server();
+    if (fd < 0) return -1;
+
+    char req[1024];
+    int len = snprintf(req, sizeof(req),
+        "%s %s HTTP/1.1\r\nHost: 127.0.0.1:%d\r\nConnection: close\r\n"
+        "Content-Type: application/json\r\nContent-Length: %zu\r\n\r\n%s",
+        method, path, port, payload ? strlen(payload) : 0, payload ? payload : "");
+    if (write(fd, req, len) != len) {
+        close(fd);
+        return -1;
+    }
+
+    size_t cap = 16384, total = 0;
+    char *buf = malloc(cap + 1);
+    ssize_t n;
+    while ((n = read(fd, buf + total, cap - total)) > 0 ||
+           (n < 0 && errno == EINTR)) {
+        if (n < 0) continue;
+        total += n;
+        if (total == cap) {
+            cap *= 2;
+            buf = realloc(buf, cap + 1);
+        }
+    }
+    close(fd);
+    buf[total] = '\0';
+
+    int status = total > 12 ? atoi(buf + 9) : -1;
+    if (body) {
+        char *b = strstr(buf, "\r\n\r\n");
+        *body = strdup(b ? b + 4 : "");
+    }
+    free(buf);
+    return status;
+}
+
+/**
+ * Read a stream for `seconds`, then hang up
+ */
+static void hold_stream(const char *prefix, int chan, double seconds) {
+    int fd = connect_server();
+    if (fd < 0) {
+        atomic_fetch_add(&errors, 1);
+        return;
+    }
+    char req[256];
+    int len = snprintf(req, sizeof(req), "GET %s%d.%d HTTP/1.1\r\nHost: 127.0.0.1:%d\r\nConnection: close\r\n\r\n",
+                       prefix, 2 + chan / 4, 1 + chan % 4, port);
+    write(fd, req, len);
+
+    char buf[65536];
+    double until = now_s() + seconds;
+    while (!atomic_load(&stop_flag) && now_s() < until) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+        if (n <= 0) {
+            atomic_fetch_add(&errors, 1);
+            break;
+        }
+    }
+    close(fd);
+}
+
+static void *zap_worker(void *arg) {
+    unsigned int seed = (unsigned int)(long)arg * 7919 + (unsigned int)time(NULL);
+    while (!atomic_load(&stop_flag)) {
+        const char *prefix = rand_r(&seed) % 2 ? "/stream/" : "/transcode/software/h264/";
+        hold_stream(prefix, rand_r(&seed) % num_channels, 0.5 + (rand_r(&seed) % 2500) / 1000.0);
+        atomic_fetch_add(&zaps, 1);
+    }
+    return NULL;
+}
+
+static void *play_worker(void *arg) {
+    unsigned int seed = (unsigned int)(long)arg * 104729 + (unsigned int)time(NULL);
+    while (!atomic_load(&stop_flag)) {
+        hold_stream("/stream/", rand_r(&seed) % num_channels, 30 + rand_r(&seed) % 90);
+        atomic_fetch_add(&plays, 1);
+    }
+    return NULL;
+}
+
+static void *api_worker(void *arg) {
+    unsigned int seed = (unsigned int)(long)arg * 31337 + (unsigned int)time(NULL);
+    while (!atomic_load(&stop_flag)) {
+        int status = http_request("GET", api_paths[rand_r(&seed) % NUM_API_PATHS], NULL, NULL);
+        if (status < 200 || status >= 400) atomic_fetch_add(&errors, 1);
+        atomic_fetch_add(&api_requests, 1);
+    }
+    return NULL;
+}
+
+/** Numeric field value; the DB JSON builders emit every value as a string */
+static long long json_num(const char *p) {
+    if (*p == '"') p++;
+    return atoll(p);
+}
+
+/**
+ * Delete every "soak-" entry whose time field plus min_age is in the past
+ *
+ * Works on the flat arrays returned by /api/timers and /api/recordings.
+ * Recordings are written with end_time 0, so they are aged by start_time.
+ */
+static void delete_finished(const char *list_path, const char *item_prefix,
+                            const char *time_field, long long min_age_ms) {
+    char *body = NULL;
+    if (http_request("GET", list_path, NULL, &body) != 200 || !body) {
+        free(body);
+        return;
+    }
+    long long now_ms = (long long)time(NULL) * 1000;
+    for (char *obj = strchr(body, '{'); obj; obj = strchr(obj + 1, '{')) {
+        char *close_brace = strchr(obj, '}');
+        if (!close_brace) break;
+        *close_brace = '\0';
+        char *id = strstr(obj, "\"id\":");
+        char *when = strstr(obj, time_field);
+        if (id && when && strstr(obj, "\"soak-")) {
+            if (json_num(when + strlen(time_field)) + min_age_ms < now_ms) {
+                char path[128];
+                snprintf(path, sizeof(path), "%s%lld", item_prefix, json_num(id + 5));
+                http_request("DELETE", path, NULL, NULL);
+            }
+        }
+        *close_brace = '}';
+        obj = close_brace;
+    }
+    free(body);
+}
+
+typedef struct {
+    int period_s;
+} TimerArgs;
+
+static void *timer_worker(void *arg) {
+    TimerArgs *ta = arg;
+    int n = 0;
+    while (!atomic_load(&stop_flag)) {
+        long long start = (long long)time(NULL) * 1000;
+        char payload[256];
+        snprintf(payload, sizeof(payload),
+                 "{\"type\":\"once\",\"title\":\"soak-%d\",\"channel_num\":\"%d.%d\","
+                 "\"start_time\":%lld,\"end_time\":%lld}",
+                 n, 2 + (n % num_channels) / 4, 1 + n % 4, start, start + ta->period_s * 1000LL / 2);
+        if (http_request("POST", "/api/timers", payload, NULL) == 200) atomic_fetch_add(&timers_created, 1);
+        else atomic_fetch_add(&errors, 1);
+        n++;
+
+        nap(ta->period_s);
+        delete_finished("/api/recordings", "/api/recordings/", "\"start_time\":", ta->period_s * 1000LL);
+        delete_finished("/api/timers", "/api/timers/", "\"end_time\":", 0);
+    }
+    return NULL;
+}
+
+/**
+ * Least-squares fit y = a + b*t over points[from..n)
+ */
+static void fit(const SoakPoint *pts, int from, int n, double (*get)(const ProcSample *),
+                double *a, double *b) {
+    double st = 0, sy = 0, stt = 0, sty = 0;
+    int m = n - from;
+    for (int i = from; i < n; i++) {
+        double t = pts[i].t, y = get(&pts[i].proc);
+        st += t;
+        sy += y;
+        stt += t * t;
+        sty += t * y;
+    }
+    double den = m * stt - st * st;
+    *b = (m > 1 && den != 0) ? (m * sty - st * sy) / den : 0;
+    *a = m > 0 ? (sy - *b * st) / m : 0;
+}
+
+static double get_fds(const ProcSample *p) { return p->fds; }
+static double get_threads(const ProcSample *p) { return p->threads; }
+static double get_zombies(const ProcSample *p) { return p->zombies; }
+static double get_rss(const ProcSample *p) { return p->rss_kb; }
+
+int main(int argc, char *argv[]) {
+    int duration_s = 4 * 3600, interval_s = 10, warmup_s = -1;
+    int zappers = 2, players = 2, api_workers = 4, timer_period_s = 60;
+    double max_fds = 16, max_threads = 8, max_zombies = 2, max_rss_pct = 10;
+    const char *out_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "P:p:t:i:w:z:l:a:r:n:F:T:Z:R:o:")) != -1) {
+        switch (opt) {
+            case 'P': server_pid = atoi(optarg); break;
+            case 'p': port = atoi(optarg); break;
+            case 't': duration_s = parse_duration(optarg); break;
+            case 'i': interval_s = parse_duration(optarg) > 0 ? parse_duration(optarg) : 1; break;
+            case 'w': warmup_s = parse_duration(optarg); break;
+            case 'z': zappers = atoi(optarg); break;
+            case 'l': players = atoi(optarg); break;
+            case 'a': api_workers = atoi(optarg); break;
+            case 'r': timer_period_s = atoi(optarg) > 0 ? atoi(optarg) : 0; break;
+            case 'n': num_channels = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+            case 'F': max_fds = atof(optarg); break;
+            case 'T': max_threads = atof(optarg); break;
+            case 'Z': max_zombies = atof(optarg); break;
+            case 'R': max_rss_pct = atof(optarg); break;
+            case 'o': out_path = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-P pid] [-p port] [-t 4h] [-i 10s] [-w 10m] [-z zappers] "
+                        "[-l players] [-a api_workers] [-r timer_period_s] [-n channels] "
+                        "[-F fds] [-T threads] [-Z zombies] [-R rss_pct] [-o out.json]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (server_pid == 0 && getenv("ZAPLINK_PID")) server_pid = atoi(getenv("ZAPLINK_PID"));
+    if (server_pid <= 0) {
+        fprintf(stderr, "Server pid required (-P or $ZAPLINK_PID)\n");
+        return 1;
+    }
+    if (warmup_s < 0) warmup_s = duration_s / 10;
+
+    signal(SIGPIPE, SIG_IGN);
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &server_addr.sin_addr);
+
+    int max_points = duration_s / interval_s + 2;
+    SoakPoint *pts = calloc(max_points, sizeof(SoakPoint));
+    int npts = 0;
+
+    int nthreads = zappers + players + api_workers + (timer_period_s > 0);
+    pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+    TimerArgs ta = { timer_period_s };
+    int t = 0;
+    for (int i = 0; i < zappers; i++) pthread_create(&threads[t++], NULL, zap_worker, (void *)(long)i);
+    for (int i = 0; i < players; i++) pthread_create(&threads[t++], NULL, play_worker, (void *)(long)i);
+    for (int i = 0; i < api_workers; i++) pthread_create(&threads[t++], NULL, api_worker, (void *)(long)i);
+    if (timer_period_s > 0) pthread_create(&threads[t++], NULL, timer_worker, &ta);
+
+    printf("soak: %ds (warm-up %ds), %d zappers, %d players, %d api workers, timer every %ds\n",
+           duration_s, warmup_s, zappers, players, api_workers, timer_period_s);
+    printf("%8s %8s %6s %10s %8s %7s %8s %8s %8s\n",
+           "t", "threads", "fds", "rss_KB", "children", "zombie", "zaps", "api", "errors");
+
+    int died = 0;
+    double start = now_s(), last_print = -1e9;
+    while (now_s() - start < duration_s) {
+        sleep(interval_s);
+        SoakPoint p = { .t = now_s() - start };
+        if (!procstat_sample(server_pid, &p.proc)) {
+            fprintf(stderr, "Server pid %d is gone after %.0fs\n", (int)server_pid, p.t);
+            died = 1;
+            break;
+        }
+        if (npts < max_points) pts[npts++] = p;
+
+        /* Print about once a minute so hour-long runs stay readable */
+        if (p.t - last_print >= 60 || interval_s >= 60) {
+            printf("%8.0f %8d %6d %10ld %8d %7d %8ld %8ld %8ld\n", p.t, p.proc.threads, p.proc.fds,
+                   p.proc.rss_kb, p.proc.children, p.proc.zombies, atomic_load(&zaps),
+                   atomic_load(&api_requests), atomic_load(&errors));
+            fflush(stdout);
+            last_print = p.t;
+        }
+    }
+    atomic_store(&stop_flag, 1);
+    for (int i = 0; i < nthreads; i++) pthread_join(threads[i], NULL);
+
+    /* Trend over the post-warm-up window */
+    int from = 0;
+    while (from < npts && pts[from].t < warmup_s) from++;
+    double window = npts > from ? pts[npts - 1].t - pts[from].t : 0;
+
+    Verdict v[] = {
+        { "fds", max_fds, 0, 0, 0, 0 },
+        { "threads", max_threads, 0, 0, 0, 0 },
+        { "zombies", max_zombies, 0, 0, 0, 0 },
+        { "rss_kb", max_rss_pct, 1, 0, 0, 0 },
+    };
+    double (*getters[])(const ProcSample *) = { get_fds, get_threads, get_zombies, get_rss };
+    int leaks = 0;
+
+    printf("\ntrend over %.0fs after warm-up (%d samples)\n", window, npts - from);
+    for (int i = 0; i < 4; i++) {
+        double a, b;
+        fit(pts, from, npts, getters[i], &a, &b);
+        v[i].start = a + b * (npts > from ? pts[from].t : 0);
+        v[i].growth = b * window;
+        double allowed = v[i].percent ? v[i].start * v[i].threshold / 100.0 : v[i].threshold;
+        v[i].failed = npts - from >= 3 && v[i].growth > allowed;
+        leaks += v[i].failed;
+        printf("  %-8s start=%10.1f growth=%+10.1f allowed=%8.1f%s  %s\n", v[i].name, v[i].start,
+               v[i].growth, allowed, v[i].percent ? " (pct)" : "", v[i].failed ? "LEAK" : "ok");
+    }
+    printf("traffic: %ld zaps, %ld playbacks, %ld timers, %ld api requests, %ld errors\n",
+           atomic_load(&zaps), atomic_load(&plays), atomic_load(&timers_created),
+           atomic_load(&api_requests), atomic_load(&errors));
+
+    if (out_path) {
+        FILE *f = fopen(out_path, "w");
+        if (f) {
+            fprintf(f, "{\"duration_s\":%d,\"warmup_s\":%d,\"server_died\":%s,\"verdicts\":[",
+                    duration_s, warmup_s, died ? "true" : "false");
+            for (int i = 0; i < 4; i++) {
+                fprintf(f, "%s{\"metric\":\"%s\",\"start\":%.1f,\"growth\":%.1f,\"threshold\":%.1f,"
+                        "\"percent\":%s,\"leak\":%s}", i ? "," : "", v[i].name, v[i].start, v[i].growth,
+                        v[i].threshold, v[i].percent ? "true" : "false", v[i].failed ? "true" : "false");
+            }
+            fprintf(f, "],\"traffic\":{\"zaps\":%ld,\"playbacks\":%ld,\"timers\":%ld,\"api\":%ld,\"errors\":%ld},"
+                    "\"series\":[", atomic_load(&zaps), atomic_load(&plays), atomic_load(&timers_created),
+                    atomic_load(&api_requests), atomic_load(&errors));
+            for (int i = 0; i < npts; i++) {
+                ProcSample *p = &pts[i].proc;
+                fprintf(f, "%s{\"t\":%.0f,\"threads\":%d,\"fds\":%d,\"rss_kb\":%ld,\"children\":%d,"
+                        "\"zombies\":%d,\"children_rss_kb\":%ld}", i ? "," : "", pts[i].t, p->threads,
+                        p->fds, p->rss_kb, p->children, p->zombies, p->children_rss_kb);
+            }
+            fprintf(f, "]}\n");
+            fclose(f);
+        }
+    }
+
+    if (died) return 2;
+    if (leaks) {
+        printf("FAIL: %d metric(s) trending upward beyond threshold\n", leaks);
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
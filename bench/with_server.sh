@@ -0,0 +1,56 @@
+#!/bin/bash
+#
+# Run a benchmark command against a throwaway ZapLinkWeb + stand-in core.
+#
+# Creates a scratch working directory (fresh database, generated
+# channels.conf, symlinked public/), starts mock_core on 18392 and the
+# server pinned to it with -c, waits for port 3000, then runs the command
+# with ZAPLINK_PID set to the server's pid. Everything is torn down on exit.
+#
+# Usage: bench/with_server.sh <build_dir> <command> [args...]
+#   MOCK_ARGS   extra mock_core options (e.g. "-L 500 -D 14")
+#   SERVER_ARGS extra zaplinkweb options (e.g. "-v")
+#   KEEP_WORK=1 keep the scratch directory (server.log, database)
+
+set -euo pipefail
+
+BUILD=$(cd "${1:?build dir}" && pwd)
+shift
+REPO=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d /tmp/zaplink-bench.XXXXXX)
+MOCK_PID=""
+SERVER_PID=""
+
+cleanup() {
+    [ -n "$SERVER_PID" ] && kill "$SERVER_PID" 2>/dev/null && wait "$SERVER_PID" 2>/dev/null
+    [ -n "$MOCK_PID" ] && kill "$MOCK_PID" 2>/dev/null && wait "$MOCK_PID" 2>/dev/null
+    if [ "${KEEP_WORK:-0}" = 1 ]; then
+        echo "Scratch directory kept: $WORK"
+    else
+        rm -rf "$WORK"
+    fi
+}
+trap cleanup EXIT
+
+ln -s "$REPO/public" "$WORK/public"
+
+# shellcheck disable=SC2086
+"$BUILD/bench/mock_core" -f "$BUILD/bench/synthetic.ts" -C "$WORK/channels.conf" ${MOCK_ARGS:-} \
+    >"$WORK/mock.log" 2>&1 &
+MOCK_PID=$!
+
+# shellcheck disable=SC2086
+(cd "$WORK" && exec "$BUILD/zaplinkweb" -c http://127.0.0.1:18392 ${SERVER_ARGS:-}) \
+    >"$WORK/server.log" 2>&1 &
+SERVER_PID=$!
+
+for _ in $(seq 50); do
+    if (exec 3<>/dev/tcp/127.0.0.1/3000) 2>/dev/null; then
+        break
+    fi
+    sleep 0.1
+done
+
+export ZAPLINK_PID=$SERVER_PID
+export ZAPLINK_WORK=$WORK
+"$@"
@@ -0,0 +1,532 @@
+/**
+ * @file zap_latency.c
+ * @brief Channel-change (zap) latency against a running ZapLinkWeb
+ *
+ * Repeatedly opens a stream for the next channel in a sequence, exactly as
+ * a viewer zapping would, and timestamps from connect():
+ *   headers     End of the HTTP response headers
+ *   first_byte  First body byte
+ *   keyframe    First decodable keyframe fully described:
+ *                 fMP4  first moof whose first video sample is a sync sample
+ *                 WebM  first video SimpleBlock with the keyframe flag
+ *                 TS    video PES start with random_access_indicator set
+ *   frame       All bytes of that first keyframe received (first presentable
+ *               frame for a decoder)
+ *
+ * Each profile is a URL pattern; the default set is /stream/ (dashboard
+ * config) plus /transcode/<backend>/<codec>/ for every backend/codec given.
+ * Per-profile distributions (p50/p90/max) are printed and written to JSON.
+ *
+ * Usage:
+ *   zap_latency [-p port] [-b software,vaapi] [-c h264,hevc] [-z zaps]
+ *               [-n channels] [-T timeout_s] [-D dwell_ms] [-R core_port]
+ *               [-o out.json]
+ *
+ *   -R port  Also zap the stand-in core's raw TS directly as a baseline
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define MAX_PROFILES 32
+#define MAX_CAPTURE (16 * 1024 * 1024)
+
+enum { M_HEADERS, M_FIRST_BYTE, M_KEYFRAME, M_FRAME, NUM_METRICS };
+static const char *metric_names[NUM_METRICS] = { "headers", "first_byte", "keyframe", "frame" };
+
+/**
+ * A URL pattern being measured and its collected samples
+ */
+typedef struct {
+    char label[64];
+    char prefix[128];      /**< Path prefix; the channel number is appended */
+    int port;
+    double *samples[NUM_METRICS];
+    int counts[NUM_METRICS];
+    int failures;
+} Profile;
+
+static Profile profiles[MAX_PROFILES];
+static int num_profiles = 0;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static uint32_t rd32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint64_t rd64(const uint8_t *p) {
+    return (uint64_t)rd32(p) << 32 | rd32(p + 4);
+}
+
+/* ==========================================================================
+ * Fragmented MP4
+ * ========================================================================== */
+
+/**
+ * Find a child box of the given type inside [p, end)
+ */
+static const uint8_t *find_box(const uint8_t *p, const uint8_t *end, const char *type, uint64_t *size_out) {
+    while (p + 8 <= end) {
+        uint64_t size = rd32(p);
+        size_t hdr = 8;
+        if (size == 1) {
+            if (p + 16 > end) return NULL;
+            size = rd64(p + 8);
+            hdr = 16;
+        } else if (size == 0) {
+            size = end - p;
+        }
+        if (size < hdr || p + size > end) return NULL;
+        if (memcmp(p + 4, type, 4) == 0) {
+            *size_out = size;
+            return p;
+        }
+        p += size;
+    }
+    return NULL;
+}
+
+/**
+ * Track ID of the first 'vide' track in a complete moov, 0 if none
+ */
+static uint32_t mp4_video_track(const uint8_t *moov, uint64_t moov_size) {
+    const uint8_t *p = moov + 8, *end = moov + moov_size;
+    uint64_t sz;
+    const uint8_t *trak;
+    while ((trak = find_box(p, end, "trak", &sz))) {
+        const uint8_t *tend = trak + sz;
+        uint64_t s2, s3, s4;
+        const uint8_t *tkhd = find_box(trak + 8, tend, "tkhd", &s2);
+        const uint8_t *mdia = find_box(trak + 8, tend, "mdia", &s3);
+        const uint8_t *hdlr = mdia ? find_box(mdia + 8, mdia + s3, "hdlr", &s4) : NULL;
+        if (tkhd && hdlr && s4 >= 20 && memcmp(hdlr + 16, "vide", 4) == 0) {
+            /* tkhd: version(1) flags(3) then times; track_ID follows */
+            int v1 = tkhd[8] == 1;
+            return rd32(tkhd + 8 + 4 + (v1 ? 16 : 8));
+        }
+        p = tend;
+    }
+    return 0;
+}
+
+typedef struct {
+    uint32_t video_track;
+    int have_moov;
+    size_t scan;            /**< Offset of the next top-level box to inspect */
+    size_t frame_end;       /**< Absolute end of first keyframe's data (0 = unknown) */
+} Mp4State;
+
+/**
+ * Advance the fMP4 parser over the captured bytes
+ *
+ * @return Bitmask of newly reached milestones (1 << M_KEYFRAME, 1 << M_FRAME)
+ */
+static int mp4_progress(Mp4State *st, const uint8_t *buf, size_t len, int reached) {
+    int hit = 0;
+    if (!(reached & (1 << M_KEYFRAME))) {
+        while (st->scan + 8 <= len) {
+            const uint8_t *box = buf + st->scan;
+            uint64_t size = rd32(box);
+            if (size == 1) {
+                if (st->scan + 16 > len) break;
+                size = rd64(box + 8);
+            }
+            if (size < 8) return hit;
+
+            int is_moov = memcmp(box + 4, "moov", 4) == 0;
+            int is_moof = memcmp(box + 4, "moof", 4) == 0;
+            if ((is_moov || is_moof) && st->scan + size > len) break;  /* wait for whole box */
+
+            if (is_moov) {
+                st->video_track = mp4_video_track(box, size);
+                st->have_moov = 1;
+            } else if (is_moof && st->have_moov) {
+                const uint8_t *end = box + size;
+                uint64_t s;
+                const uint8_t *traf = box + 8;
+                while ((traf = find_box(traf, end, "traf", &s))) {
+                    const uint8_t *tend = traf + s;
+                    uint64_t s2, s3;
+                    const uint8_t *tfhd = find_box(traf + 8, tend, "tfhd", &s2);
+                    const uint8_t *trun = find_box(traf + 8, tend, "trun", &s3);
+                    traf = tend;
+                    if (!tfhd || !trun || rd32(tfhd + 12) != st->video_track) continue;
+
+                    /* tfhd optional fields */
+                    uint32_t tf = rd32(tfhd + 8) & 0xFFFFFF;
+                    const uint8_t *q = tfhd + 16;
+                    if (tf & 0x01) q += 8;                 /* base_data_offset */
+                    if (tf & 0x02) q += 4;                 /* sample_description_index */
+                    if (tf & 0x08) q += 4;                 /* default_sample_duration */
+                    uint32_t def_size = 0, def_flags = 0;
+                    if (tf & 0x10) { def_size = rd32(q); q += 4; }
+                    if (tf & 0x20) { def_flags = rd32(q); }
+
+                    /* trun: data_offset, first_sample_flags, then per-sample fields */
+                    uint32_t rf = rd32(trun + 8) & 0xFFFFFF;
+                    const uint8_t *r = trun + 16;
+                    int32_t data_offset = 0;
+                    uint32_t first_flags = def_flags, first_size = def_size;
+                    if (rf & 0x001) { data_offset = (int32_t)rd32(r); r += 4; }
+                    if (rf & 0x004) { first_flags = rd32(r); r += 4; }
+                    if (rf & 0x100) r += 4;
+                    if (rf & 0x200) { first_size = rd32(r); r += 4; }
+                    if ((rf & 0x400) && !(rf & 0x004)) first_flags = rd32(r);
+
+                    /* sample_is_non_sync_sample is bit 16 */
+                    if (!(first_flags & 0x10000)) {
+                        hit |= 1 << M_KEYFRAME;
+                        st->frame_end = st->scan + data_offset + first_size;
+                    }
+                    break;
+                }
+            }
+            st->scan += size;
+            if (hit) break;
+        }
+    }
+    if (st->frame_end && len >= st->frame_end && !(reached & (1 << M_FRAME))) hit |= 1 << M_FRAME;
+    return hit;
+}
+
+/* ==========================================================================
+ * WebM (Matroska)
+ * ========================================================================== */
+
+/** Read an EBML variable-length integer; returns its length or 0 */
+static int ebml_vint(const uint8_t *p, const uint8_t *end, uint64_t *val, int keep_marker) {
+    if (p >= end || *p == 0) return 0;
+    int n = __builtin_clz(*p) - 23;   /* leading zeros within the byte + 1 */
+    if (p + n > end) return 0;
+    uint64_t v = keep_marker ? *p : (*p & (0xFF >> n));
+    for (int i = 1; i < n; i++) v = v << 8 | p[i];
+    *val = v;
+    return n;
+}
+
+typedef struct {
+    size_t scan;
+    size_t frame_end;
+    uint64_t video_track;
+} WebmState;
+
+static int webm_progress(WebmState *st, const uint8_t *buf, size_t len, int reached) {
+    int hit = 0;
+    const uint8_t *end = buf + len;
+    while (!(reached & (1 << M_KEYFRAME)) && !hit) {
+        const uint8_t *p = buf + st->scan;
+        uint64_t id, size;
+        int a = ebml_vint(p, end, &id, 1);
+        int b = a ? ebml_vint(p + a, end, &size, 0) : 0;
+        if (!a || !b) break;
+        const uint8_t *data = p + a + b;
+        int unknown = (size == (1ULL << (7 * b)) - 1);
+
+        /* Descend into Segment (0x18538067), Cluster (0x1F43B675), Tracks, TrackEntry */
+        if (id == 0x18538067 || id == 0x1F43B675 || id == 0x1654AE6B || id == 0xAE) {
+            if (id == 0xAE && !unknown && data + size <= end) {
+                /* TrackEntry: TrackNumber (0xD7) + TrackType (0x83, 1 = video) */
+                uint64_t num = 0, type = 0;
+                const uint8_t *q = data;
+                while (q < data + size) {
+                    uint64_t cid, csz, cval = 0;
+                    int ca = ebml_vint(q, end, &cid, 1);
+                    int cb = ca ? ebml_vint(q + ca, end, &csz, 0) : 0;
+                    if (!ca || !cb) break;
+                    for (uint64_t i = 0; i < csz && i < 8; i++) cval = cval << 8 | q[ca + cb + i];
+                    if (cid == 0xD7) num = cval;
+                    else if (cid == 0x83) type = cval;
+                    q += ca + cb + csz;
+                }
+                if (type == 1 && !st->video_track) st->video_track = num;
+                st->scan = (data + size) - buf;
+                continue;
+            }
+            st->scan = data - buf;
+            continue;
+        }
+        if (id == 0xA3) {  /* SimpleBlock: track vint, timecode(2), flags(1) */
+            if (data + 4 > end) break;
+            uint64_t track;
+            int t = ebml_vint(data, end, &track, 0);
+            if (!t || data + t + 3 > end) break;
+            uint8_t flags = data[t + 2];
+            if ((!st->video_track || track == st->video_track) && (flags & 0x80)) {
+                hit |= 1 << M_KEYFRAME;
+                st->frame_end = (data + size) - buf;
+            }
+        }
+        if (unknown || data + size > end) break;
+        st->scan = (data + size) - buf;
+    }
+    if (st->frame_end && len >= st->frame_end && !(reached & (1 << M_FRAME))) hit |= 1 << M_FRAME;
+    return hit;
+}
+
+/* ==========================================================================
+ * MPEG-TS
+ * ========================================================================== */
+
+typedef struct {
+    size_t scan;
+    int pmt_pid;
+    int video_pid;
+    int in_keyframe;        /**< Collecting the keyframe PES */
+} TsState;
+
+static int ts_progress(TsState *st, const uint8_t *buf, size_t len, int reached) {
+    int hit = 0;
+    while (st->scan + 188 <= len && !(reached & (1 << M_FRAME)) && !(hit & (1 << M_FRAME))) {
+        const uint8_t *pkt = buf + st->scan;
+        st->scan += 188;
+        if (pkt[0] != 0x47) continue;
+
+        int pusi = pkt[1] & 0x40;
+        int pid = (pkt[1] & 0x1F) << 8 | pkt[2];
+        int afc = (pkt[3] >> 4) & 3;
+        const uint8_t *payload = pkt + 4;
+        int rai = 0;
+        if (afc & 2) {
+            if (payload[0] > 0) rai = payload[1] & 0x40;
+            payload += 1 + payload[0];
+        }
+        if (!(afc & 1) || payload >= pkt + 188) continue;
+
+        if (pid == 0 && pusi && !st->pmt_pid) {
+            /* PAT: first program's PMT PID */
+            const uint8_t *sec = payload + 1 + payload[0];
+            if (sec + 12 <= pkt + 188) st->pmt_pid = (sec[10] & 0x1F) << 8 | sec[11];
+        } else if (pid == st->pmt_pid && pusi && !st->video_pid) {
+            const uint8_t *sec = payload + 1 + payload[0];
+            int sec_len = (sec[1] & 0x0F) << 8 | sec[2];
+            int info_len = (sec[10] & 0x0F) << 8 | sec[11];
+            const uint8_t *es = sec + 12 + info_len, *es_end = sec + 3 + sec_len - 4;
+            while (es + 5 <= es_end && es + 5 <= pkt + 188) {
+                int type = es[0];
+                if (type == 0x02 || type == 0x1B || type == 0x24) {
+                    st->video_pid = (es[1] & 0x1F) << 8 | es[2];
+                    break;
+                }
+                es += 5 + ((es[3] & 0x0F) << 8 | es[4]);
+            }
+        } else if (pid == st->video_pid && st->video_pid) {
+            if (pusi && st->in_keyframe) {
+                hit |= 1 << M_FRAME;   /* next PES started: keyframe PES complete */
+            } else if (pusi && rai && !(reached & (1 << M_KEYFRAME))) {
+                hit |= 1 << M_KEYFRAME;
+                st->in_keyframe = 1;
+            }
+        }
+    }
+    return hit;
+}
+
+/* ==========================================================================
+ * Zap loop
+ * ========================================================================== */
+
+static void record(Profile *p, int metric, double v) {
+    p->samples[metric] = realloc(p->samples[metric], sizeof(double) * (p->counts[metric] + 1));
+    p->samples[metric][p->counts[metric]++] = v;
+}
+
+/**
+ * Open one stream and measure milestones, closing as soon as a frame is in
+ *
+ * @return 1 if every milestone was reached
+ */
+static int zap_once(Profile *prof, const char *channel, double timeout_ms, double results[NUM_METRICS]) {
+    for (int m = 0; m < NUM_METRICS; m++) results[m] = -1;
+
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(prof->port) };
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    double t0 = now_ms();
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return 0;
+    }
+    char req[512];
+    int rl = snprintf(req, sizeof(req), "GET %s%s HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n\r\n",
+                      prof->prefix, channel);
+    write(fd, req, rl);
+
+    static uint8_t buf[MAX_CAPTURE];
+    size_t len = 0, body = 0;
+    int reached = 0;
+    enum { FMT_UNKNOWN, FMT_MP4, FMT_WEBM, FMT_TS } fmt = FMT_UNKNOWN;
+    Mp4State mp4 = {0};
+    WebmState webm = {0};
+    TsState ts = {0};
+
+    while (!(reached & (1 << M_FRAME)) && len < sizeof(buf)) {
+        double left = timeout_ms - (now_ms() - t0);
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (left <= 0 || poll(&pfd, 1, (int)left) <= 0) break;
+        ssize_t n = read(fd, buf + len, sizeof(buf) - len);
+        if (n <= 0) break;
+        len += n;
+        double t = now_ms() - t0;
+
+        if (!(reached & (1 << M_HEADERS))) {
+            uint8_t *hdr_end = memmem(buf, len, "\r\n\r\n", 4);
+            if (!hdr_end) continue;
+            if (len < 12 || buf[9] != '2') break;   /* non-2xx: failed zap */
+            results[M_HEADERS] = t;
+            reached |= 1 << M_HEADERS;
+            body = (hdr_end + 4) - buf;
+            memmove(buf, buf + body, len - body);
+            len -= body;
+        }
+        if (len == 0) continue;
+        if (!(reached & (1 << M_FIRST_BYTE))) {
+            results[M_FIRST_BYTE] = t;
+            reached |= 1 << M_FIRST_BYTE;
+        }
+
+        if (fmt == FMT_UNKNOWN && len >= 8) {
+            if (buf[0] == 0x47) fmt = FMT_TS;
+            else if (rd32(buf) == 0x1A45DFA3) fmt = FMT_WEBM;
+            else fmt = FMT_MP4;
+        }
+
+        int hit = 0;
+        if (fmt == FMT_MP4) hit = mp4_progress(&mp4, buf, len, reached);
+        else if (fmt == FMT_WEBM) hit = webm_progress(&webm, buf, len, reached);
+        else if (fmt == FMT_TS) hit = ts_progress(&ts, buf, len, reached);
+
+        for (int m = M_KEYFRAME; m <= M_FRAME; m++) {
+            if ((hit & (1 << m)) && !(reached & (1 << m))) {
+                results[m] = t;
+                reached |= 1 << m;
+            }
+        }
+    }
+    close(fd);
+    return reached == (1 << NUM_METRICS) - 1;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double pct(double *v, int n, double p) {
+    if (n == 0) return 0;
+    int i = (int)(p / 100.0 * (n - 1) + 0.5);
+    return v[i];
+}
+
+static void add_profile(const char *label, const char *prefix, int port) {
+    if (num_profiles >= MAX_PROFILES) return;
+    Profile *p = &profiles[num_profiles++];
+    memset(p, 0, sizeof(*p));
+    snprintf(p->label, sizeof(p->label), "%s", label);
+    snprintf(p->prefix, sizeof(p->prefix), "%s", prefix);
+    p->port = port;
+}
+
+int main(int argc, char *argv[]) {
+    int port = 3000, core_port = 0, zaps = 20, channels = 100, dwell_ms = 0;
+    double timeout_s = 20;
+    char backends[256] = "software", codecs[256] = "h264";
+    const char *out_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:b:c:z:n:T:D:R:o:")) != -1) {
+        switch (opt) {
+            case 'p': port = atoi(optarg); break;
+            case 'b': snprintf(backends, sizeof(backends), "%s", optarg); break;
+            case 'c': snprintf(codecs, sizeof(codecs), "%s", optarg); break;
+            case 'z': zaps = atoi(optarg); break;
+            case 'n': channels = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+            case 'T': timeout_s = atof(optarg); break;
+            case 'D': dwell_ms = atoi(optarg); break;
+            case 'R': core_port = atoi(optarg); break;
+            case 'o': out_path = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-p port] [-b backends] [-c codecs] [-z zaps] [-n channels] "
+                        "[-T timeout_s] [-D dwell_ms] [-R core_port] [-o out.json]\n", argv[0]);
+                return 1;
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    if (core_port) add_profile("core/raw-ts", "/stream/", core_port);
+    add_profile("stream/dashboard-config", "/stream/", port);
+    char bcopy[256];
+    snprintf(bcopy, sizeof(bcopy), "%s", backends);
+    for (char *b = strtok(bcopy, ","); b; b = strtok(NULL, ",")) {
+        char ccopy[256], *save;
+        snprintf(ccopy, sizeof(ccopy), "%s", codecs);
+        for (char *c = strtok_r(ccopy, ",", &save); c; c = strtok_r(NULL, ",", &save)) {
+            char label[64], prefix[128];
+            snprintf(label, sizeof(label), "transcode/%s/%s", b, c);
+            snprintf(prefix, sizeof(prefix), "/transcode/%s/%s/", b, c);
+            add_profile(label, prefix, port);
+        }
+    }
+
+    for (int p = 0; p < num_profiles; p++) {
+        Profile *prof = &profiles[p];
+        fprintf(stderr, "%s: %d zaps\n", prof->label, zaps);
+        for (int z = 0; z < zaps; z++) {
+            char chan[16];
+            snprintf(chan, sizeof(chan), "%d.%d", 2 + (z % channels) / 4, 1 + (z % channels) % 4);
+            double r[NUM_METRICS];
+            if (!zap_once(prof, chan, timeout_s * 1000, r)) prof->failures++;
+            for (int m = 0; m < NUM_METRICS; m++) {
+                if (r[m] >= 0) record(prof, m, r[m]);
+            }
+            if (dwell_ms > 0) usleep(dwell_ms * 1000);
+        }
+    }
+
+    printf("%-28s %-11s %6s %9s %9s %9s\n", "profile", "milestone", "n", "p50_ms", "p90_ms", "max_ms");
+    FILE *out = out_path ? fopen(out_path, "w") : NULL;
+    if (out) fprintf(out, "{\"zaps\":%d,\"profiles\":[", zaps);
+    for (int p = 0; p < num_profiles; p++) {
+        Profile *prof = &profiles[p];
+        if (out) fprintf(out, "%s{\"profile\":\"%s\",\"failures\":%d", p ? "," : "", prof->label, prof->failures);
+        for (int m = 0; m < NUM_METRICS; m++) {
+            int n = prof->counts[m];
+            qsort(prof->samples[m], n, sizeof(double), cmp_double);
+            printf("%-28s %-11s %6d %9.1f %9.1f %9.1f\n", m == 0 ? prof->label : "", metric_names[m], n,
+                   pct(prof->samples[m], n, 50), pct(prof->samples[m], n, 90), pct(prof->samples[m], n, 100));
+            if (out) {
+                fprintf(out, ",\"%s\":{\"n\":%d,\"p50\":%.2f,\"p90\":%.2f,\"max\":%.2f,\"samples\":[",
+                        metric_names[m], n, pct(prof->samples[m], n, 50), pct(prof->samples[m], n, 90),
+                        pct(prof->samples[m], n, 100));
+                for (int i = 0; i < n; i++) fprintf(out, "%s%.2f", i ? "," : "", prof->samples[m][i]);
+                fprintf(out, "]}");
+            }
+        }
+        if (prof->failures) printf("%-28s %d failed zap(s)\n", "", prof->failures);
+        if (out) fprintf(out, "}");
+    }
+    if (out) {
+        fprintf(out, "]}\n");
+        fclose(out);
+    }
+    return 0;
+}
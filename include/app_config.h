@@ -16,6 +16,7 @@
 typedef struct {
     char backend[32];  /**< Transcoding backend: "software", "qsv", "nvenc", "vaapi" */
     char codec[32];    /**< Video codec: "h264", "hevc", "av1" */
+    int encode_budget; /**< Budget threads and pin cores for software encodes (0 or 1) */
 } AppConfig;
 
 /** Global configuration instance */
@@ -23,7 +24,7 @@ extern AppConfig app_config;
 
 /**
  * Load configuration from CONFIG_FILE
- * Falls back to defaults ("software", "h264") if file doesn't exist
+ * Falls back to defaults ("software", "h264", budgeting on) if file doesn't exist
  */
 void config_load(void);
 
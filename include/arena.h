@@ -0,0 +1,93 @@
+/**
+ * @file arena.h
+ * @brief Request-scoped bump allocator
+ *
+ * Everything a request builds (path copies, JSON bodies, id arrays, the
+ * M3U playlist) is carved out of one Arena and released together by
+ * arena_reset() when the connection is done, instead of being freed one
+ * block at a time on whichever thread finished with it.
+ *
+ * Chunks go back to a process-wide pool bounded by ARENA_POOL_BYTES, so a
+ * steady stream of requests reuses the same few chunks rather than
+ * fragmenting the heap. Chunks are taken best-fit, which lets a large
+ * response (the guide) keep landing in the chunk it grew last time.
+ *
+ * Blocks that other modules allocate with malloc can be handed to the
+ * arena with arena_adopt() and are freed on reset.
+ *
+ * Usage:
+ *   Arena arena = ARENA_INIT;
+ *   char *json = query_to_json(&arena, sql);
+ *   ...
+ *   arena_reset(&arena);
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/** Default chunk size; larger requests get a chunk of their own size */
+#define ARENA_CHUNK_SIZE (16 * 1024)
+
+/** Bytes of free chunks kept for reuse; chunks beyond this are freed */
+#define ARENA_POOL_BYTES (4 * 1024 * 1024)
+
+typedef struct ArenaChunk ArenaChunk;
+typedef struct ArenaCleanup ArenaCleanup;
+
+typedef struct {
+    ArenaChunk *chunk;         /**< Current chunk, older chunks linked behind it */
+    ArenaCleanup *cleanups;    /**< Adopted heap blocks */
+} Arena;
+
+#define ARENA_INIT { NULL, NULL }
+
+/**
+ * Pool counters (for benchmarks)
+ */
+typedef struct {
+    unsigned long chunks_malloced;  /**< Chunks that had to come from malloc */
+    unsigned long chunks_reused;    /**< Chunks taken from the pool */
+    size_t pooled_bytes;            /**< Bytes currently in the pool */
+} ArenaStats;
+
+/**
+ * Allocate from the arena (16-byte aligned, uninitialized)
+ *
+ * @return NULL when out of memory; this and every function below fail
+ *         that way, and the request should fail with a 500
+ */
+void *arena_alloc(Arena *arena, size_t size);
+
+/**
+ * Grow an arena block, in place when it is the most recent allocation
+ *
+ * @param ptr Block from this arena, or NULL
+ * @param old_size Size ptr was allocated with
+ * @param new_size New size
+ */
+void *arena_realloc(Arena *arena, void *ptr, size_t old_size, size_t new_size);
+
+char *arena_strdup(Arena *arena, const char *str);
+
+/**
+ * printf into a new arena block
+ */
+char *arena_sprintf(Arena *arena, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * Free a malloc'd block when the arena is reset
+ *
+ * @return ptr, or NULL (with ptr already freed) when out of memory
+ */
+void *arena_adopt(Arena *arena, void *ptr);
+
+/**
+ * Release every block and return the chunks to the pool
+ */
+void arena_reset(Arena *arena);
+
+void arena_get_stats(ArenaStats *stats);
+
+#endif
@@ -0,0 +1,81 @@
+/**
+ * @file capabilities.h
+ * @brief Startup probe of FFmpeg encoders, filters and GPU render nodes
+ *
+ * The probe runs `ffmpeg -encoders` and `ffmpeg -filters` (resolved through
+ * PATH, so a fake binary can stand in) and scans a device directory for
+ * render nodes and NVIDIA device files. The result is cached as a
+ * backend x codec capability matrix that:
+ * - Is reported by /api/status
+ * - Supplies the render node used for VA-API/QSV device init
+ * - Orders the fallback chain tried when a session starts
+ */
+
+#ifndef CAPABILITIES_H
+#define CAPABILITIES_H
+
+#include "transcode.h"
+
+/** Number of TranscodeBackend / encodable TranscodeCodec values */
+#define CAPS_NUM_BACKENDS 4
+#define CAPS_NUM_CODECS 3
+
+/**
+ * Cached capability matrix
+ */
+typedef struct {
+    int probed;                                       /**< 1 once caps_probe() has run */
+    int ffmpeg_found;                                 /**< FFmpeg could be executed */
+    int encoders[CAPS_NUM_BACKENDS][CAPS_NUM_CODECS]; /**< Encoder compiled in (1/0) */
+    int device[CAPS_NUM_BACKENDS];                    /**< Backend hardware present (1/0) */
+    int filter_yadif;                                 /**< yadif deinterlacer */
+    int filter_hwupload;                              /**< hwupload (VA-API/QSV upload) */
+    int filter_scale_vaapi;                           /**< scale_vaapi */
+    int filter_vpp_qsv;                               /**< vpp_qsv */
+    char render_node[64];                             /**< First usable render node, "" if none */
+    char intel_render_node[64];                       /**< First Intel render node (QSV), "" if none */
+} Capabilities;
+
+/**
+ * Probe FFmpeg and render nodes, replacing any cached result
+ *
+ * @param dev_dir Device root holding dri/renderD* and nvidia0 (normally "/dev")
+ */
+void caps_probe(const char *dev_dir);
+
+/**
+ * Copy the cached capability matrix, consistent even while a probe runs
+ */
+void caps_get(Capabilities *out);
+
+/**
+ * Check whether a backend can encode a codec on this host
+ *
+ * Stream copy is always viable. Before the probe has run every
+ * combination is assumed viable.
+ */
+int caps_viable(TranscodeBackend backend, TranscodeCodec codec);
+
+/**
+ * Build the ordered list of backends to try for a session
+ *
+ * The preferred backend comes first if viable, then the remaining viable
+ * hardware backends, then software.
+ *
+ * @param preferred Backend requested by the user
+ * @param codec Output codec
+ * @param chain Output: backends to try in order
+ * @param max Capacity of chain
+ * @return Number of entries written (at least 1)
+ */
+int caps_fallback_chain(TranscodeBackend preferred, TranscodeCodec codec,
+                        TranscodeBackend *chain, int max);
+
+/**
+ * Serialize the capability matrix as a JSON object
+ *
+ * @return Heap-allocated JSON string (caller must free)
+ */
+char *caps_to_json(void);
+
+#endif
@@ -10,6 +10,9 @@
 #ifndef CHANNELS_H
 #define CHANNELS_H
 
+/** Path to channels configuration file */
+#define CHANNELS_CONF "channels.conf"
+
 /**
  * Channel information structure
  */
@@ -0,0 +1,18 @@
+/**
+ * @file clock.h
+ * @brief Monotonic millisecond clock shared by the I/O paths
+ *
+ * Deadlines and stall watchdogs (HTTP write timeouts, FFmpeg output
+ * waits, the handoff drain) compare against this clock, so they are not
+ * affected by wall-clock steps.
+ */
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+/**
+ * Milliseconds on CLOCK_MONOTONIC (arbitrary origin)
+ */
+long long mono_ms(void);
+
+#endif
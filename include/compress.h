@@ -0,0 +1,121 @@
+/**
+ * @file compress.h
+ * @brief Content-Encoding negotiation, streaming compression and a
+ *        compressed response cache
+ *
+ * Compressor turns a stream of body writes into gzip, deflate or brotli
+ * output delivered to a sink as it is produced, so a large JSON body is
+ * compressed row by row instead of being built in full first. zlib and
+ * brotli state is allocated from the request arena.
+ *
+ * Brotli is only offered for cacheable bodies: it is compressed once at
+ * high quality and then served from the cache, which keeps every repeat
+ * hit free of compression work. Uncacheable bodies use gzip/deflate at a
+ * cheaper level.
+ *
+ * Brotli support is compiled in when the Makefile finds libbrotlienc
+ * (ZAPLINK_BROTLI).
+ */
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+#include "arena.h"
+
+/** Bodies smaller than this are not worth compressing */
+#define COMPRESS_MIN_BYTES 1024
+
+/** zlib level for streamed (uncacheable) and cached bodies */
+#define COMPRESS_GZIP_LEVEL_STREAM 5
+#define COMPRESS_GZIP_LEVEL_CACHED 9
+
+/** Brotli quality and window for cached bodies */
+#define COMPRESS_BROTLI_QUALITY 9
+#define COMPRESS_BROTLI_LGWIN 20
+
+/** Total compressed bytes kept by the response cache */
+#define COMPRESS_CACHE_BYTES (16 * 1024 * 1024)
+
+/** Entries kept by the response cache */
+#define COMPRESS_CACHE_ENTRIES 128
+
+typedef enum {
+    ENCODING_IDENTITY = 0,
+    ENCODING_GZIP,
+    ENCODING_DEFLATE,
+    ENCODING_BR,
+    ENCODING_COUNT
+} ContentEncoding;
+
+/**
+ * Pick a Content-Encoding from the request's Accept-Encoding header
+ *
+ * Honours q-values (q=0 refuses an encoding); ties prefer br, then gzip,
+ * then deflate.
+ *
+ * @param request Raw request head
+ * @param allow_br Whether brotli may be chosen (cacheable bodies only)
+ */
+ContentEncoding compress_negotiate(const char *request, int allow_br);
+
+/**
+ * Content-Encoding token ("gzip", "deflate", "br"), NULL for identity
+ */
+const char *compress_encoding_name(ContentEncoding encoding);
+
+/**
+ * Receives compressed output
+ */
+typedef void (*CompressSink)(void *ctx, const char *data, size_t len);
+
+typedef struct Compressor Compressor;
+
+/**
+ * Start a compressed stream
+ *
+ * @param arena Request arena (compressor state is allocated here)
+ * @param encoding Output encoding; identity passes writes through
+ * @param cacheable Use the cached-body (slower, smaller) settings
+ * @param sink Output callback
+ * @param ctx Passed to sink
+ * @return The compressor, or NULL when the arena is out of memory (if only
+ *         the encoder state cannot be allocated, it passes writes through
+ *         as identity instead)
+ */
+Compressor *compressor_new(Arena *arena, ContentEncoding encoding, int cacheable,
+                           CompressSink sink, void *ctx);
+
+void compressor_write(Compressor *c, const char *data, size_t len);
+
+/**
+ * Flush the remaining output and end the stream
+ *
+ * @return 0, or -1 if the encoder failed (out of memory) and the output
+ *         is incomplete
+ */
+int compressor_finish(Compressor *c);
+
+/**
+ * Look up a cached body
+ *
+ * @param key Caller-built key (must change whenever the body would)
+ * @param accepted Encoding negotiated for this request
+ * @param arena Receives a copy of the body
+ * @param data Output: body in arena
+ * @param len Output: body length
+ * @param encoding Output: encoding of the body (identity if it was too
+ *                 small to compress)
+ * @return 1 on hit, 0 on miss
+ */
+int compress_cache_get(const char *key, ContentEncoding accepted, Arena *arena,
+                       char **data, size_t *len, ContentEncoding *encoding);
+
+/**
+ * Store a body for requests that negotiated `accepted`, evicting least
+ * recently used entries as needed
+ */
+void compress_cache_put(const char *key, ContentEncoding accepted, ContentEncoding encoding,
+                        const char *data, size_t len);
+
+#endif
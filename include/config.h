@@ -22,4 +22,7 @@
 /** Runtime configuration file for transcoding settings */
 #define CONFIG_FILE "zaplink.conf"
 
+/** Flight recorder dump written on SIGUSR1 or a crash */
+#define FLIGHT_DUMP_FILE "zaplinkweb.flight"
+
 #endif
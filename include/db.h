@@ -16,6 +16,7 @@
 
 #include <sqlite3.h>
 #include <time.h>
+#include "arena.h"
 
 /**
  * Timer structure representing a scheduled recording
@@ -29,6 +30,23 @@ typedef struct {
     long long end_time;        /**< End time in milliseconds since epoch */
 } Timer;
 
+/**
+ * A completed live, playback or recording session (one session_telemetry row)
+ */
+typedef struct {
+    long long started_at;      /**< Start time in milliseconds since epoch */
+    int kind;                  /**< SessionKind (telemetry.h) */
+    int backend;               /**< TranscodeBackend */
+    int codec;                 /**< TranscodeCodec */
+    char channel[32];          /**< Channel number, or "recording" for playback */
+    long long duration_ms;     /**< Spawn to exit */
+    double speed;              /**< Media seconds per wall second (0 = unknown) */
+    double cpu_s;              /**< FFmpeg user + system CPU seconds */
+    long peak_rss_kb;          /**< FFmpeg peak resident set size */
+    long long bytes;           /**< Bytes sent to the client or written to disk */
+    char failure[128];         /**< Failure reason, empty on success */
+} SessionRecord;
+
 /* ============================================================================
  * Database Lifecycle
  * ============================================================================ */
@@ -46,33 +64,58 @@ void db_close(void);
 
 /* ============================================================================
  * JSON API Helpers
+ *
+ * JSON is emitted through a JsonWriter, so the caller can compress and send
+ * it on the fly. Rows are staged in memory under the DB lock and handed to
+ * the writer once the statement is finished: the writer may block on a
+ * socket, and a listing must neither see nor stall concurrent writes.
  * ============================================================================ */
 
+/**
+ * Receives JSON output in pieces
+ */
+typedef struct {
+    void (*write)(void *ctx, const char *data, size_t len);
+    void *ctx;
+} JsonWriter;
+
 /**
  * Get all channels as JSON array
- * @return Heap-allocated JSON string (caller must free)
+ * @param arena Request arena
+ * @return JSON string in arena
  */
-char *db_get_channels_json(void);
+char *db_get_channels_json(Arena *arena);
 
 /**
- * Get EPG guide data as JSON for a time range
+ * Write EPG guide data as JSON for a time range
+ * @param writer Output
  * @param start_time Start of range (ms since epoch)
  * @param end_time End of range (ms since epoch)
- * @return Heap-allocated JSON string (caller must free)
+ * @return 0, or -1 when out of memory (nothing was written)
  */
-char *db_get_guide_json(long long start_time, long long end_time);
+int db_write_guide_json(JsonWriter *writer, long long start_time, long long end_time);
 
 /**
- * Get all recordings as JSON array
- * @return Heap-allocated JSON string (caller must free)
+ * Write all recordings as JSON array
+ * @param writer Output
+ * @return 0, or -1 when out of memory (nothing was written)
  */
-char *db_get_recordings_json(void);
+int db_write_recordings_json(JsonWriter *writer);
 
 /**
- * Get all timers as JSON array
- * @return Heap-allocated JSON string (caller must free)
+ * Write all timers as JSON array
+ * @param writer Output
+ * @return 0, or -1 when out of memory (nothing was written)
  */
-char *db_get_timers_json(void);
+int db_write_timers_json(JsonWriter *writer);
+
+/**
+ * Get the write generation of the timers and recordings tables
+ *
+ * Changes after every committed insert or delete, so it can key caches of
+ * /api/timers and /api/recordings bodies.
+ */
+unsigned long db_generation(void);
 
 /* ============================================================================
  * Timer Management
@@ -110,10 +153,11 @@ int db_delete_recording(int id);
 
 /**
  * Get the file path for a recording
+ * @param arena Request arena
  * @param id Recording ID
- * @return Heap-allocated path string (caller must free), NULL if not found
+ * @return Path string in arena, NULL if not found
  */
-char *db_get_recording_path(int id);
+char *db_get_recording_path(Arena *arena, int id);
 
 /* ============================================================================
  * Scheduler Support
@@ -148,4 +192,33 @@ int db_add_recording_entry(const char *title, const char *channel_name,
  */
 int db_update_recording_end_time(int id, long long end);
 
+/* ============================================================================
+ * Session Telemetry (append-only)
+ * ============================================================================ */
+
+/**
+ * Append completed sessions in one transaction
+ * @param records Sessions to append
+ * @param count Number of sessions
+ * @return 1 on success, 0 on failure
+ */
+int db_add_session_records(const SessionRecord *records, int count);
+
+/**
+ * Get sessions that started at or after a time
+ * @param since Earliest start time (ms since epoch)
+ * @param records Output: array of SessionRecord structs (caller must free)
+ * @param count Output: number of records returned
+ * @return 1 on success, 0 on failure
+ */
+int db_get_session_records(long long since, SessionRecord **records, int *count);
+
+/**
+ * Write the most recent sessions as JSON array
+ * @param writer Output
+ * @param limit Maximum rows
+ * @return 0, or -1 when out of memory (nothing was written)
+ */
+int db_write_sessions_json(JsonWriter *writer, int limit);
+
 #endif
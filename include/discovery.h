@@ -43,4 +43,14 @@ void start_mdns_service(int port);
  */
 const char* get_core_base_url(void);
 
+/**
+ * Pin the ZapLinkCore base URL, ignoring mDNS results from then on
+ *
+ * Used with the -c command line option (e.g. to point at a local
+ * stand-in core for benchmarks).
+ *
+ * @param url Base URL such as "http://127.0.0.1:18392"
+ */
+void set_core_base_url(const char *url);
+
 #endif
@@ -0,0 +1,78 @@
+/**
+ * @file encode_sched.h
+ * @brief CPU-aware thread budgeting for concurrent software encodes
+ *
+ * Without a budget every software FFmpeg lets libx264/libx265 spawn one
+ * thread per core, so N concurrent sessions oversubscribe the box N times.
+ * The encode scheduler hands each session:
+ * - An explicit encoder thread count
+ * - A CPU affinity set of whole physical cores (SMT siblings kept together)
+ *   packed into a single NUMA node where possible
+ *
+ * Core topology is read once from sysfs at startup. Budgets shrink as more
+ * sessions are active and when the 1-minute load average shows the box is
+ * already busy with other work.
+ */
+
+#ifndef ENCODE_SCHED_H
+#define ENCODE_SCHED_H
+
+#include <sys/types.h>
+
+/** Upper bound on physical cores handed to a single session */
+#define ENCODE_MAX_CORES_PER_SESSION 4
+
+/** Highest logical CPU number (exclusive) an affinity set can hold */
+#define ENCODE_MAX_CPUS 1024
+
+/**
+ * Resources granted to one encode session
+ */
+typedef struct {
+    int active;        /**< 1 if this budget holds cores, 0 = unbudgeted */
+    int threads;       /**< Encoder thread count (0 = let FFmpeg decide) */
+    int node;          /**< NUMA node the cores belong to (-1 = unknown) */
+    /** Affinity set for the FFmpeg child: bit n of the array is CPU n */
+    unsigned long cpus[ENCODE_MAX_CPUS / (8 * sizeof(unsigned long))];
+} EncodeBudget;
+
+/**
+ * Read CPU topology from sysfs and reset core accounting
+ *
+ * @param enabled 0 disables budgeting (FFmpeg defaults, no pinning)
+ */
+void encode_sched_init(int enabled);
+
+/**
+ * Reserve cores for a new software encode session
+ *
+ * @param budget Output: granted threads and affinity set
+ * @return 1 if a budget was granted, 0 if budgeting is disabled
+ */
+int encode_sched_acquire(EncodeBudget *budget);
+
+/**
+ * Return the cores held by a budget (no-op for inactive budgets)
+ */
+void encode_sched_release(EncodeBudget *budget);
+
+/**
+ * Pin a process to its budget's CPU set
+ *
+ * Safe to call in a forked child before exec.
+ *
+ * @param pid Process to pin (0 = calling process)
+ * @param budget Budget returned by encode_sched_acquire()
+ */
+void encode_sched_apply(pid_t pid, const EncodeBudget *budget);
+
+/**
+ * Get topology summary
+ *
+ * @param cores Output: physical core count (may be NULL)
+ * @param cpus Output: online logical CPU count (may be NULL)
+ * @param nodes Output: NUMA node count (may be NULL)
+ */
+void encode_sched_topology(int *cores, int *cpus, int *nodes);
+
+#endif
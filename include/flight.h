@@ -0,0 +1,158 @@
+/**
+ * @file flight.h
+ * @brief Always-on in-memory flight recorder
+ *
+ * Hot paths append fixed-size binary events to a lock-free ring that
+ * always holds the most recent FLIGHT_RING_SIZE events. Recording costs
+ * one atomic increment and a clock read, so it stays enabled in
+ * production regardless of -v.
+ *
+ * The ring is dumped:
+ * - To FLIGHT_DUMP_FILE on SIGUSR1
+ * - To FLIGHT_DUMP_FILE on SIGSEGV/SIGBUS/SIGFPE/SIGILL/SIGABRT, before
+ *   the default action runs
+ * - Over HTTP from /debug/flight
+ *
+ * Dumps are decoded offline with tools/flight_decode.
+ *
+ * Dump format (host byte order):
+ *   FlightHeader, then `capacity` FlightEvent slots in ring order.
+ *   A slot is valid when seq != 0; events sort by seq.
+ */
+
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#include <stdint.h>
+
+/** Events kept in the ring (power of two) */
+#define FLIGHT_RING_SIZE 16384
+
+/** Relay writes blocking longer than this are recorded as stalls */
+#define FLIGHT_STALL_MS 50
+
+#define FLIGHT_MAGIC "ZLFR"
+#define FLIGHT_VERSION 1
+
+/**
+ * Event types; the meaning of a and b is listed per type
+ */
+typedef enum {
+    FLIGHT_NONE = 0,
+    FLIGHT_ACCEPT,        /**< a = client fd */
+    FLIGHT_ROUTE,         /**< a = FlightRoute, b = client fd */
+    FLIGHT_SPAWN,         /**< a = FFmpeg pid, b = backend << 8 | codec */
+    FLIGHT_SPAWN_FAIL,    /**< a = errno, b = backend << 8 | codec */
+    FLIGHT_FIRST_BYTE,    /**< a = FFmpeg pid, b = us since spawn */
+    FLIGHT_WRITE_STALL,   /**< a = client fd, b = us blocked in write() */
+    FLIGHT_RELAY_END,     /**< a = FFmpeg pid, b = bytes relayed (client or FFmpeg gone) */
+    FLIGHT_CHILD_EXIT,    /**< a = pid, b = wait status (-1 = not reaped) */
+    FLIGHT_SCHED_TICK,    /**< a = pending timers, b = busy us */
+    FLIGHT_REC_START,     /**< a = recorder pid, b = timer id */
+    FLIGHT_REC_STOP,      /**< a = recorder pid, b = recording id */
+    FLIGHT_REC_DIED,      /**< a = recorder pid, b = recording id */
+    FLIGHT_DUMP,          /**< a = FlightReason */
+    FLIGHT_TIMEOUT,       /**< a = client fd or FFmpeg pid, b = FlightTimeout */
+    FLIGHT_NUM_EVENTS
+} FlightEventType;
+
+/**
+ * Route chosen by client_handler (FLIGHT_ROUTE)
+ */
+typedef enum {
+    FLIGHT_ROUTE_STATIC = 0,
+    FLIGHT_ROUTE_API,
+    FLIGHT_ROUTE_PLAY,
+    FLIGHT_ROUTE_STREAM,
+    FLIGHT_ROUTE_TRANSCODE,
+    FLIGHT_ROUTE_PLAYLIST,
+    FLIGHT_ROUTE_DEBUG,
+    FLIGHT_NUM_ROUTES
+} FlightRoute;
+
+/**
+ * Why a dump was written
+ */
+typedef enum {
+    FLIGHT_REASON_SIGNAL = 1,   /**< SIGUSR1 */
+    FLIGHT_REASON_CRASH,        /**< Fatal signal */
+    FLIGHT_REASON_HTTP,         /**< /debug/flight */
+} FlightReason;
+
+/**
+ * Deadline the timer wheel enforced (FLIGHT_TIMEOUT)
+ */
+typedef enum {
+    FLIGHT_TIMEOUT_REQUEST = 1, /**< Request not read in time */
+    FLIGHT_TIMEOUT_IDLE,        /**< Keep-alive connection idle */
+    FLIGHT_TIMEOUT_SEND,        /**< Write made no progress */
+    FLIGHT_TIMEOUT_SESSION,     /**< FFmpeg produced no output */
+} FlightTimeout;
+
+/**
+ * One recorded event (40 bytes)
+ */
+typedef struct {
+    uint64_t ts_ns;     /**< CLOCK_MONOTONIC */
+    uint64_t seq;       /**< 1-based sequence number, 0 = slot being written */
+    uint32_t tid;       /**< Kernel thread ID */
+    uint16_t type;      /**< FlightEventType */
+    uint16_t reserved;
+    int64_t a;
+    int64_t b;
+} FlightEvent;
+
+/**
+ * Dump file header (48 bytes)
+ */
+typedef struct {
+    char magic[4];      /**< FLIGHT_MAGIC */
+    uint32_t version;   /**< FLIGHT_VERSION */
+    uint32_t event_size;
+    uint32_t capacity;
+    uint64_t head;      /**< Events recorded since start */
+    uint64_t mono_ns;   /**< CLOCK_MONOTONIC at dump time */
+    uint64_t real_ns;   /**< CLOCK_REALTIME at dump time, to place events */
+    uint32_t reason;    /**< FlightReason */
+    uint32_t pid;
+} FlightHeader;
+
+/**
+ * Install the SIGUSR1 and fatal-signal dump handlers
+ */
+void flight_init(void);
+
+/**
+ * Append an event to the ring (lock-free, async-signal-safe)
+ */
+void flight_record(FlightEventType type, int64_t a, int64_t b);
+
+/**
+ * Size in bytes of a full dump (header + ring)
+ */
+unsigned long flight_dump_size(void);
+
+/**
+ * Write a full dump to a file descriptor (async-signal-safe)
+ *
+ * @return 0 on success, -1 if a write failed
+ */
+int flight_write(int fd, FlightReason reason);
+
+/**
+ * Write a dump to FLIGHT_DUMP_FILE via a temporary file and rename
+ * (async-signal-safe)
+ *
+ * @return 0 on success, -1 on failure
+ */
+int flight_dump_file(FlightReason reason);
+
+/**
+ * Printable names for decoders and logs
+ */
+const char *flight_event_name(int type);
+const char *flight_route_name(int route);
+const char *flight_reason_name(int reason);
+const char *flight_timeout_name(int timeout);
+
+#endif
@@ -0,0 +1,214 @@
+/**
+ * @file guide.h
+ * @brief In-memory EPG store fed from ZapLinkCore
+ *
+ * A background thread fetches the core's /xmltv.json every
+ * GUIDE_REFRESH_MS (GUIDE_RETRY_MS while the core is unknown or a fetch
+ * fails), parses it into an immutable GuideSnapshot and swaps it in.
+ * Readers hold a reference from guide_acquire() for as long as they
+ * write from it, so a refresh never blocks them or frees data under
+ * them.
+ *
+ * The generation changes only when a fetch brings a different guide, so
+ * it can key caches of guide-derived responses. Programs are grouped by
+ * channel, each channel's in start order, so a time window is one short
+ * scan per channel. Titles and descriptions are interned: a repeat shares
+ * the first copy and its id.
+ *
+ * Each refresh is also diffed against the previous snapshot, programs
+ * being matched by channel id and start time. Every program inserted or
+ * updated (new end, title or description) and every one deleted takes the
+ * next number of a change sequence that only grows within a process (the
+ * epoch). A program remembers the change that last touched it, deletions
+ * leave a tombstone, so a client that has seen changes up to seq can be
+ * sent only what changed since. Only the newest GUIDE_MAX_TOMBSTONES
+ * tombstones are kept; the horizon records how far back the history is
+ * complete.
+ *
+ * A window can also be written as CBOR (RFC 8949), for clients that send
+ * Accept: application/cbor:
+ *
+ *   {"generation": uint, "start": ms, "end": ms, "unit": 1 or 1000,
+ *    "channels": [[id, name, icon], ...],
+ *    "strings": [text, ...],
+ *    "programs": [[gap, duration, title, description, ...], ...]}
+ *
+ * "programs" holds one flat array per channel, in the order of
+ * "channels", with four integers per program. gap is the program's start
+ * minus the previous program's end on that channel (the window start for
+ * the first; negative if it began before the window or before the
+ * previous program ended, as overlapping listings do), duration is end
+ * minus start, both in units of "unit" ms (1000 when every time in the
+ * window is a whole second). title and description index "strings",
+ * which holds each distinct text in the window once.
+ *
+ * For clients that only draw what is on screen, the guide is also cut
+ * into tiles: row r holds channels [r * GUIDE_TILE_CHANNELS, (r + 1) *
+ * GUIDE_TILE_CHANNELS) in the core's order, column c the programs
+ * overlapping [c * GUIDE_TILE_MS, (c + 1) * GUIDE_TILE_MS) since the Unix
+ * epoch. A tile is written like a window restricted to its channels, so
+ * it is fixed for a generation and can be cached indefinitely under that
+ * generation and the change sequence's epoch (generations, too, restart
+ * with the process).
+ */
+
+#ifndef GUIDE_H
+#define GUIDE_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include "db.h"
+
+/** Interval between guide refreshes */
+#define GUIDE_REFRESH_MS (10 * 60 * 1000)
+
+/** Interval between attempts while no guide could be fetched */
+#define GUIDE_RETRY_MS (30 * 1000)
+
+/** Connect, send and receive timeout for the core request */
+#define GUIDE_FETCH_TIMEOUT_MS 15000
+
+/** Largest xmltv.json accepted */
+#define GUIDE_MAX_BYTES (64 * 1024 * 1024)
+
+/** Channels per guide tile */
+#define GUIDE_TILE_CHANNELS 16
+
+/** Time per guide tile */
+#define GUIDE_TILE_MS (6 * 60 * 60 * 1000LL)
+
+/** Deleted programs remembered for change feeds */
+#define GUIDE_MAX_TOMBSTONES 65536
+
+typedef struct {
+    const char *id;            /**< Channel number as the core names it ("15.1") */
+    const char *name;
+    const char *icon;          /**< Logo URL, "" if none */
+    int first;                 /**< Index of its first program */
+    int count;                 /**< Programs on this channel */
+} GuideChannel;
+
+typedef struct {
+    long long start;           /**< ms since epoch */
+    long long end;
+    const char *title;
+    const char *description;   /**< "" if none */
+    int channel;               /**< Index into channels */
+    int title_id;              /**< Index into texts */
+    int description_id;
+    unsigned long seq;         /**< Change that last inserted or updated it */
+    unsigned long created;     /**< Change that inserted it */
+} GuideProgram;
+
+/** A program deleted by a refresh */
+typedef struct {
+    char channel[32];
+    long long start;
+    unsigned long seq;
+} GuideTombstone;
+
+/**
+ * One parsed guide; never modified once published
+ */
+typedef struct {
+    unsigned long generation;
+    long long fetched_at;      /**< ms since epoch */
+    int num_channels;
+    int num_programs;
+    GuideChannel *channels;    /**< In the core's order */
+    GuideProgram *programs;    /**< Grouped by channel, each in start order */
+    char *strings;             /**< Decoded strings the entries point into */
+    const char **texts;        /**< Distinct titles and descriptions */
+    int num_texts;
+    long long epoch;           /**< Identifies this process's change sequence */
+    unsigned long seq;         /**< Last change */
+    unsigned long channels_seq; /**< Last change to the lineup */
+    unsigned long horizon;     /**< Changes after this one are all known */
+    GuideTombstone *tombstones; /**< In seq order */
+    int num_tombstones;
+    atomic_int refs;
+} GuideSnapshot;
+
+/**
+ * Start the refresh thread
+ */
+void guide_start(void);
+
+/**
+ * Take a reference to the current guide
+ *
+ * @return Snapshot to pass to guide_release(), NULL until the first
+ *         successful fetch
+ */
+GuideSnapshot *guide_acquire(void);
+
+void guide_release(GuideSnapshot *guide);
+
+/**
+ * Generation of the current guide (0 until the first fetch)
+ */
+unsigned long guide_generation(void);
+
+/**
+ * Parse a document in the shape of ZapLinkCore's /xmltv.json:
+ * {"channels":[{"id","name","icon"}],"programs":[{"channel","start",
+ * "end","title","desc" or "description"}]}
+ *
+ * Numbers may also be sent as strings. Programs of unknown channels are
+ * dropped.
+ *
+ * @return Snapshot with one reference and generation 0, or NULL if the
+ *         document is malformed
+ */
+GuideSnapshot *guide_parse(const char *json, size_t len);
+
+/**
+ * Write the channel list as a JSON array of {"id","name","icon"}
+ */
+void guide_write_channels_json(JsonWriter *writer, const GuideSnapshot *guide);
+
+/**
+ * Write the programs overlapping [start, end) as a JSON array of
+ * {"channel","start","end","title","description"}
+ */
+void guide_write_programs_json(JsonWriter *writer, const GuideSnapshot *guide,
+                               long long start, long long end);
+
+/**
+ * Write {"generation","channels":[...],"programs":[...]} for a window
+ */
+void guide_write_json(JsonWriter *writer, const GuideSnapshot *guide, long long start, long long end);
+
+/**
+ * Write the changes after `since` as
+ * {"epoch","seq","reset","channels","inserted","updated","deleted"}
+ *
+ * inserted and updated list programs as guide_write_programs_json() does,
+ * deleted lists {"channel","start"}; channels is present only if the
+ * lineup changed. When the history does not reach back to since (or since
+ * is 0, or from another epoch, which the caller maps to 0), reset is true
+ * and inserted holds the whole guide: the client must start over from it.
+ */
+void guide_write_changes_json(JsonWriter *writer, const GuideSnapshot *guide, unsigned long since);
+
+/**
+ * Write a window as CBOR, in the layout described above
+ *
+ * @return 0, or -1 if out of memory (nothing was written)
+ */
+int guide_write_cbor(JsonWriter *writer, const GuideSnapshot *guide, long long start, long long end);
+
+/**
+ * Write tile (row, col) as guide_write_json() writes a window; empty past
+ * the last channel
+ */
+void guide_write_tile_json(JsonWriter *writer, const GuideSnapshot *guide, int row, long long col);
+
+/**
+ * Write tile (row, col) as guide_write_cbor() writes a window
+ *
+ * @return 0, or -1 if out of memory (nothing was written)
+ */
+int guide_write_tile_cbor(JsonWriter *writer, const GuideSnapshot *guide, int row, long long col);
+
+#endif
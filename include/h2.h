@@ -0,0 +1,90 @@
+/**
+ * @file h2.h
+ * @brief HTTP/2 over cleartext TCP (h2c, RFC 7540)
+ *
+ * A connection becomes HTTP/2 either by prior knowledge (it opens with
+ * the client preface) or by an HTTP/1.1 request carrying "Upgrade: h2c",
+ * which is answered as stream 1 after a 101. The connection thread then
+ * reads frames and each request stream runs on a thread of its own,
+ * through the same handler and HttpResponse calls as an HTTP/1.1
+ * request, so one connection carries the dashboard's status, timers,
+ * recordings and asset requests side by side.
+ *
+ * The request is handed to the handler as HTTP/1.1-style text rebuilt
+ * from the decoded header block ("GET /path HTTP/2.0", Host from
+ * :authority, Title-Cased field names), so request parsing is shared.
+ *
+ * Flow control: DATA a stream sends waits for both the stream and the
+ * connection send window; request bodies are credited back as soon as
+ * they are read. Frame writes from all streams are serialized on one
+ * mutex, which also guards the HPACK encoder so header blocks reach the
+ * client in the order their table updates were made.
+ *
+ * Browsers only use HTTP/2 over TLS; they reach h2c through a reverse
+ * proxy that terminates TLS and speaks h2c to this server.
+ */
+
+#ifndef H2_H
+#define H2_H
+
+#include "http.h"
+
+/** Concurrent request streams per connection (SETTINGS_MAX_CONCURRENT_STREAMS) */
+#define H2_MAX_STREAMS 100
+
+/** Largest frame payload accepted (the SETTINGS_MAX_FRAME_SIZE default) */
+#define H2_MAX_FRAME 16384
+
+/** Initial flow-control window for both directions */
+#define H2_INITIAL_WINDOW 65535
+
+/** A connection with no open streams is closed after this long */
+#define H2_IDLE_TIMEOUT_MS 30000
+
+/**
+ * Serves one request on an HTTP/2 stream (called on the stream's thread)
+ *
+ * Must finish the response with http_end().
+ */
+typedef void (*H2Handler)(HttpConn *request, HttpResponse *res);
+
+/**
+ * Whether the request just read is the HTTP/2 connection preface
+ */
+int h2_is_preface(HttpConn *conn);
+
+/**
+ * Whether the request just read asks to upgrade to h2c (and can: it has
+ * no body and carries HTTP2-Settings)
+ */
+int h2_wants_upgrade(HttpConn *conn);
+
+/**
+ * Serve the connection as HTTP/2 until it closes
+ *
+ * Called after h2_is_preface() or h2_wants_upgrade(); the upgrade request
+ * itself is answered as stream 1. Returns once every stream has finished;
+ * the caller closes the socket.
+ */
+void h2_serve(HttpConn *conn, H2Handler handler);
+
+/*
+ * Response side of a stream, used by http.c for an HttpResponse whose
+ * h2 member is set. Return -1 once the stream or connection is gone.
+ */
+
+struct H2Stream;
+
+int h2_begin(struct H2Stream *s, int status, const char *content_type, const char *headers,
+             long long content_length);
+
+int h2_write(struct H2Stream *s, const void *data, size_t len);
+
+/**
+ * End the stream: cleanly (empty DATA with END_STREAM) if complete,
+ * otherwise with RST_STREAM so the client does not take a cut-off body
+ * for a whole one
+ */
+void h2_end(struct H2Stream *s, int complete);
+
+#endif
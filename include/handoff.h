@@ -0,0 +1,183 @@
+/**
+ * @file handoff.h
+ * @brief Zero-downtime restart: listening socket and live session handoff
+ *
+ * SIGUSR2 starts the binary on disk again (same arguments, same working
+ * directory) and hands it everything that must survive the restart over
+ * a Unix socket, with the file descriptors passed as SCM_RIGHTS:
+ *
+ *   old                                   new
+ *   HELLO, LISTEN (listening socket)  ->
+ *                                     <-  READY (initialized, accepting)
+ *   stops accepting; each relay, at its next chunk boundary:
+ *   RELAY (client socket, FFmpeg stdout/stderr, pidfd)  ->  resumes relay
+ *   RECORDER (pidfd) per DVR recording  ->  adopted by its scheduler
+ *   SCHEDULER                         ->  starts its scheduler
+ *   waits for ordinary requests to finish (Connection: close)
+ *   DONE, exits
+ *
+ * FFmpeg processes keep running throughout, so viewers and recordings
+ * see at most a pipe's worth of delay. Adopted FFmpegs are not children
+ * of the new process: they are signalled and waited for through their
+ * pidfds, and their exit status is not available.
+ *
+ * If the new binary fails to start or does not report READY within
+ * HANDOFF_READY_TIMEOUT_MS, the old process keeps serving.
+ *
+ * Under systemd the service is Type=notify: READY=1 is sent once
+ * listening, and the new process reports itself with MAINPID= so
+ * systemd follows it (NotifyAccess=all). The listening socket may also
+ * come from socket activation (LISTEN_FDS), in which case
+ * `systemctl restart` queues connections instead of refusing them.
+ */
+
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+/** Bumped whenever a message layout changes; mismatches refuse the handoff */
+#define HANDOFF_VERSION 1
+
+/** How long the new process has to initialize and report READY */
+#define HANDOFF_READY_TIMEOUT_MS 30000
+
+/** How long the old process waits for requests and relays to move over */
+#define HANDOFF_DRAIN_MS 15000
+
+/** Environment variable carrying the handoff socket to the new process */
+#define HANDOFF_ENV "ZAPLINK_HANDOFF_FD"
+
+typedef enum {
+    HANDOFF_MSG_HELLO = 1,
+    HANDOFF_MSG_LISTEN,
+    HANDOFF_MSG_READY,
+    HANDOFF_MSG_RELAY,
+    HANDOFF_MSG_RECORDER,
+    HANDOFF_MSG_SCHEDULER,
+    HANDOFF_MSG_DONE
+} HandoffMsgType;
+
+/**
+ * A relay paused at a chunk boundary
+ *
+ * Travels with the client socket, FFmpeg's stdout and stderr pipes and a
+ * pidfd for FFmpeg.
+ */
+typedef struct {
+    pid_t pid;                 /**< FFmpeg */
+    int budgeted;              /**< FFmpeg holds a software encode budget */
+    int chunked;               /**< Response framing, see HttpResponse */
+    int chunk_ok;
+    int keep_alive;
+    long long sent;            /**< Body bytes already sent */
+    long long started_at;      /**< Session start, ms since epoch */
+    int kind;                  /**< SessionKind */
+    int backend;
+    int codec;
+    char channel[32];
+    double cpu_s;              /**< CPU of FFmpegs that failed before this one */
+    long peak_rss_kb;
+    double media_s;
+    double speed;
+} HandoffRelay;
+
+/**
+ * A running DVR recorder (travels with its pidfd)
+ */
+typedef struct {
+    pid_t pid;
+    int timer_id;
+    int recording_id;
+    long long end_time;        /**< ms since epoch */
+    long long started_at;
+    char path[256];
+    char channel[32];
+} HandoffRecorder;
+
+/**
+ * Remember how to start this binary again and install the SIGUSR2
+ * handler; in a process started by a handoff, pick up the handoff socket
+ *
+ * Call first thing in main().
+ */
+void handoff_init(int argc, char *argv[]);
+
+/**
+ * Whether this process was started by a handoff (its scheduler is
+ * started once the old process has passed its recorders)
+ */
+int handoff_inherited(void);
+
+/**
+ * Listening socket inherited from the old process or from systemd
+ * socket activation
+ *
+ * @return Socket, or -1 if the caller should create one
+ */
+int handoff_listen_fd(void);
+
+/**
+ * Report the server as accepting on listen_fd: READY to the old process
+ * (then receive its sessions in the background) and to systemd
+ */
+void handoff_ready(int listen_fd);
+
+/**
+ * Whether sessions should move to a new process now
+ *
+ * Checked by relays between chunks and by connection threads, which stop
+ * keeping connections alive.
+ */
+int handoff_pending(void);
+
+/**
+ * Send a paused relay to the new process
+ *
+ * On success the caller closes its copies of the descriptors without
+ * touching the socket or signalling FFmpeg.
+ *
+ * @return 0, or -1 if the relay must carry on here
+ */
+int handoff_send_relay(const HandoffRelay *relay, int sock, int out_fd, int err_fd);
+
+/**
+ * Send a running recorder to the new process
+ *
+ * @return 0, or -1 if it could not be sent
+ */
+int handoff_send_recorder(const HandoffRecorder *recorder);
+
+/**
+ * Once the acceptor has stopped: wait for the remaining connections
+ * (bounded by HANDOFF_DRAIN_MS), then tell the new process it is done
+ */
+void handoff_drain(void);
+
+/**
+ * pidfd of a process, or -1 (kernel without pidfd_open)
+ */
+int handoff_pidfd(pid_t pid);
+
+/**
+ * Signal an adopted process, through its pidfd if it has one
+ */
+int handoff_kill(pid_t pid, int pidfd, int sig);
+
+/**
+ * Wait for an adopted process to exit
+ *
+ * @param timeout_ms 0 to poll, -1 to wait
+ * @return 1 if it has exited, 0 if still running
+ */
+int handoff_exited(pid_t pid, int pidfd, int timeout_ms);
+
+/**
+ * CPU time and peak RSS of an adopted process so far, from /proc (zeros
+ * once it is gone)
+ */
+void handoff_usage(pid_t pid, struct rusage *ru);
+
+#endif
@@ -0,0 +1,91 @@
+/**
+ * @file hpack.h
+ * @brief HPACK header compression for HTTP/2 (RFC 7541)
+ *
+ * One HpackTable is the dynamic table of one direction of one connection:
+ * the decoder's mirrors what the client's encoder has indexed, the
+ * encoder's what we have told the client to index. Both start empty and
+ * are bounded by SETTINGS_HEADER_TABLE_SIZE.
+ *
+ * The encoder indexes response headers that repeat across responses
+ * (content-type, vary, content-encoding), so after the first response on
+ * a connection they cost one byte each; values that change every time
+ * (content-length, x-*) are sent as literals without indexing. String
+ * literals are Huffman-coded when that is shorter.
+ */
+
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Default (and our advertised) dynamic table size in bytes */
+#define HPACK_TABLE_SIZE 4096
+
+/** Entries that fit in a table of HPACK_TABLE_SIZE (each costs 32 + lengths) */
+#define HPACK_MAX_ENTRIES (HPACK_TABLE_SIZE / 32)
+
+/** Longest decoded name or value accepted */
+#define HPACK_MAX_STRING 8192
+
+typedef struct {
+    char *name;                /**< name\0value\0 in one block */
+    char *value;
+    size_t name_len;
+    size_t value_len;
+} HpackEntry;
+
+/**
+ * Dynamic table (a ring, newest entry first)
+ */
+typedef struct {
+    HpackEntry entries[HPACK_MAX_ENTRIES];
+    int first;                 /**< Slot of the newest entry */
+    int count;
+    size_t size;               /**< Sum of entry sizes (RFC 7541 4.1) */
+    size_t max_size;           /**< Current maximum size */
+    size_t limit;              /**< Ceiling for max_size from SETTINGS */
+    int size_update;           /**< Encoder: a size update must open the next block */
+} HpackTable;
+
+void hpack_table_init(HpackTable *t, size_t limit);
+
+void hpack_table_free(HpackTable *t);
+
+/**
+ * Receives each decoded header field (strings are not NUL-terminated)
+ */
+typedef void (*HpackHeaderFn)(void *ctx, const char *name, size_t name_len,
+                              const char *value, size_t value_len);
+
+/**
+ * Decode a complete header block
+ *
+ * @return 0 on success, -1 on a compression error (the connection must
+ *         then be closed: the tables are out of sync)
+ */
+int hpack_decode(HpackTable *t, const uint8_t *block, size_t len, HpackHeaderFn fn, void *ctx);
+
+/**
+ * Apply the peer's SETTINGS_HEADER_TABLE_SIZE to the encoder table
+ */
+void hpack_encoder_set_limit(HpackTable *t, size_t limit);
+
+/**
+ * Start a header block (emits a pending table size update)
+ *
+ * @return Bytes written to out, or -1 if cap is too small
+ */
+int hpack_encode_begin(HpackTable *t, uint8_t *out, size_t cap);
+
+/**
+ * Encode one header field
+ *
+ * @param name Lowercase field name
+ * @return Bytes written to out, or -1 if cap is too small (the table is
+ *         left unchanged)
+ */
+int hpack_encode(HpackTable *t, uint8_t *out, size_t cap, const char *name, const char *value);
+
+#endif
@@ -0,0 +1,255 @@
+/**
+ * @file http.h
+ * @brief HTTP/1.1 connection reading and response framing
+ *
+ * A connection thread reads requests with http_read_request() and answers
+ * each through an HttpResponse, which decides how the body is delimited:
+ *
+ * - Known length: Content-Length
+ * - Unknown length (live and recording streams, JSON generated row by
+ *   row): chunked transfer-encoding when the client speaks HTTP/1.1 and
+ *   the connection is being kept alive, otherwise the body runs until the
+ *   connection closes, as before
+ *
+ * Either way the connection can carry the next request once the response
+ * is complete, so a player or the dashboard does not pay a new TCP
+ * handshake (and a new thread) per request. A connection is closed
+ * instead when the client asks for it, a write fails, a response ends
+ * early, the request did not fit in the buffer, after HTTP_KEEPALIVE_MAX
+ * requests, or when it sits idle for HTTP_KEEPALIVE_TIMEOUT_MS.
+ *
+ * A watched connection (http_conn_watch()) keeps its deadlines on the
+ * shared timer wheel (timer_wheel.h) instead of in its reads: a request
+ * must arrive in full within HTTP_REQUEST_TIMEOUT_MS of its first byte
+ * (of the accept, for the first one), and no single write may go
+ * HTTP_SEND_TIMEOUT_MS without progress. When one is missed the watchdog
+ * shuts the socket down, which fails the blocked call on the connection's
+ * own thread; that thread then unwinds as it does for a client that hung
+ * up. Slow or stalled clients thus cost no thread of their own beyond the
+ * connection's and no poll per read.
+ *
+ * On an HTTP/2 connection (h2.h) each stream gets an HttpResponse whose
+ * h2 member is set; the same calls then send HEADERS and DATA frames.
+ *
+ * Usage:
+ *   HttpConn conn;
+ *   http_conn_init(&conn, sock);
+ *   while (http_read_request(&conn) > 0) {
+ *       HttpResponse res;
+ *       http_response_init(&res, &conn);
+ *       http_begin(&res, 200, "OK", "video/mp4", NULL, -1);
+ *       while (...) http_write(&res, buf, n);
+ *       if (!http_end(&res)) break;   // also sends the last chunk
+ *   }
+ *   close(sock);
+ */
+
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+#include "timer_wheel.h"
+
+/** Largest request (head and body) that is read; longer ones are truncated */
+#define HTTP_REQUEST_MAX 8192
+
+/** How long an idle keep-alive connection waits for its next request */
+#define HTTP_KEEPALIVE_TIMEOUT_MS 5000
+
+/** Requests served on one connection before it is closed */
+#define HTTP_KEEPALIVE_MAX 100
+
+/** Time allowed for a whole request head and body (watched connections) */
+#define HTTP_REQUEST_TIMEOUT_MS 10000
+
+/** Time a write may block without sending anything (watched connections) */
+#define HTTP_SEND_TIMEOUT_MS 30000
+
+/** Largest write issued at once, so a big body shows progress per slice */
+#define HTTP_SEND_SLICE (256 * 1024)
+
+/**
+ * Deadline a watched connection is waiting on
+ */
+typedef enum {
+    HTTP_DEADLINE_NONE = 0,
+    HTTP_DEADLINE_REQUEST,     /**< Rest of a request that has started */
+    HTTP_DEADLINE_IDLE,        /**< Next request on a kept-alive connection */
+} HttpDeadline;
+
+/**
+ * A client connection and its request buffer
+ */
+typedef struct HttpConn {
+    int sock;
+    int served;                /**< Requests read so far */
+    int truncated;             /**< Current request did not fit in buf */
+    size_t len;                /**< Bytes in buf */
+    size_t request_len;        /**< Bytes of buf that belong to the current request */
+    char saved;                /**< Byte replaced by the request's terminating NUL */
+    WheelTimer watchdog;       /**< Deadline check while watched */
+    int watched;
+    _Atomic int deadline;      /**< HttpDeadline being waited on */
+    _Atomic long long deadline_at;   /**< Monotonic ms it expires at */
+    _Atomic long long writing_since; /**< Monotonic ms the current write began (0 = none) */
+    _Atomic int timed_out;     /**< The watchdog shut the socket down */
+    char buf[HTTP_REQUEST_MAX + 1];
+} HttpConn;
+
+struct H2Stream;
+
+/**
+ * A response being written to a connection
+ */
+typedef struct {
+    int sock;
+    int keep_alive;            /**< Connection can carry another request afterwards */
+    int chunk_ok;              /**< Client speaks HTTP/1.1 */
+    int chunked;               /**< Body is framed with chunked transfer-encoding */
+    int head_sent;
+    int failed;                /**< A write failed; the client is gone */
+    int detached;              /**< Connection handed to another process: leave it alone */
+    long long length;          /**< Announced Content-Length (-1 = none) */
+    long long sent;            /**< Body bytes written */
+    struct H2Stream *h2;       /**< HTTP/2 stream carrying the response, or NULL */
+    struct HttpConn *conn;     /**< Watched connection whose writes are timed, or NULL */
+} HttpResponse;
+
+void http_conn_init(HttpConn *conn, int sock);
+
+/**
+ * Put the connection's deadlines on the timer wheel
+ */
+void http_conn_watch(HttpConn *conn);
+
+/**
+ * Take the connection off the timer wheel, before it is closed or handed
+ * to code that does its own timing; returns once the watchdog cannot act
+ * on it any more
+ */
+void http_conn_unwatch(HttpConn *conn);
+
+/**
+ * Start waiting on a read deadline ms from now, for a protocol reading a
+ * watched connection itself (h2.c); no-op if the connection is not watched
+ */
+void http_conn_set_deadline(HttpConn *conn, HttpDeadline kind, int ms);
+
+/** The read being timed has completed */
+void http_conn_clear_deadline(HttpConn *conn);
+
+/**
+ * Stamp the start of a write, or progress on it (active = 1), or its end
+ * (active = 0), for the send deadline; one writer at a time
+ */
+void http_conn_sending(HttpConn *conn, int active);
+
+/**
+ * Read the next request into conn->buf
+ *
+ * Reads the head and as much of a Content-Length body as fits. The request
+ * is NUL-terminated in place; bytes of a pipelined request that follows
+ * are kept for the next call. After the first request, waits at most
+ * HTTP_KEEPALIVE_TIMEOUT_MS for the next one to start.
+ *
+ * @return Request length, 0 if the client closed, went idle or missed its
+ *         deadline, -1 on error
+ */
+ssize_t http_read_request(HttpConn *conn);
+
+/**
+ * Body of the current request (after the blank line), or NULL
+ */
+char *http_request_body(HttpConn *conn);
+
+/**
+ * Copy a header of the current request into out ("" if absent)
+ *
+ * @return 1 if the header is present
+ */
+int http_request_header(HttpConn *conn, const char *name, char *out, size_t size);
+
+/**
+ * Move the bytes read beyond the current request into out, for a protocol
+ * that takes over the connection
+ *
+ * @return Bytes copied
+ */
+size_t http_conn_take_pending(HttpConn *conn, char *out, size_t size);
+
+/**
+ * Prepare the response to the request just read
+ *
+ * Keep-alive follows the request's version and Connection header.
+ */
+void http_response_init(HttpResponse *res, HttpConn *conn);
+
+/**
+ * Send the status line and headers
+ *
+ * @param headers Extra header lines, each ending in "\r\n" (may be NULL)
+ * @param content_length Body length, or -1 if unknown (chunked, or
+ *                       delimited by closing the connection)
+ * @return 0 on success, -1 if the write failed
+ */
+int http_begin(HttpResponse *res, int status, const char *status_text,
+               const char *content_type, const char *headers, long long content_length);
+
+/**
+ * Write body bytes, as one chunk if the body is chunked
+ *
+ * @return 0 on success, -1 if the write failed (the client is gone)
+ */
+int http_write(HttpResponse *res, const void *data, size_t len);
+
+/**
+ * Finish the response (terminating chunk if chunked)
+ *
+ * @return 1 if the connection can serve another request, 0 if it must be
+ *         closed
+ */
+int http_end(HttpResponse *res);
+
+/**
+ * Write len body bytes read from fd at its current offset
+ *
+ * With the io_uring engine an unchunked HTTP/1.1 body is spliced from the
+ * file to the socket (io_send_file()); otherwise the bytes are copied
+ * through http_write().
+ *
+ * @return 0 on success, -1 if the write or a read failed
+ */
+int http_send_file(HttpResponse *res, int fd, size_t len);
+
+/**
+ * Whether http_splice() can be used for this response
+ */
+int http_can_splice(HttpResponse *res);
+
+/**
+ * Write len body bytes that are waiting in pipe_fd, moving them to the
+ * socket without a copy through user space (as one chunk if chunked)
+ *
+ * Only when http_can_splice(); len must not exceed what the pipe holds.
+ *
+ * @return 0 on success, -1 if the write failed
+ */
+int http_splice(HttpResponse *res, int pipe_fd, size_t len);
+
+/**
+ * Mark the body as cut short: http_end() will close the connection
+ * without the terminating chunk, so the client sees a truncated response
+ * rather than a complete one
+ */
+void http_abort(HttpResponse *res);
+
+/**
+ * Send a complete response with a Content-Length body
+ */
+void http_send(HttpResponse *res, int status, const char *status_text,
+               const char *content_type, const void *body, size_t len);
+
+#endif
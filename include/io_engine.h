@@ -0,0 +1,102 @@
+/**
+ * @file io_engine.h
+ * @brief Socket and file I/O engine: blocking syscalls or io_uring
+ *
+ * The server keeps one thread per connection either way; the engine only
+ * decides how that thread's I/O reaches the kernel. With io_uring:
+ *
+ * - The acceptor arms one multishot accept and reaps a completion per
+ *   connection instead of calling accept4() for each
+ * - A keep-alive connection waits for its next request with a recv linked
+ *   to a timeout, one io_uring_enter() where poll() then read() took two
+ * - Static files go file -> pipe -> socket with two linked splices per
+ *   pipeful, never passing through user space
+ * - Stream relays splice FFmpeg's stdout pipe straight into the socket,
+ *   with the chunk-size line and trailing CRLF linked around it, so the
+ *   relayed media is not copied through a user buffer either
+ *
+ * Rings are per thread but pooled: a connection thread takes one on first
+ * use and gives it back when it exits, so short connections do not pay
+ * for io_uring_setup() and the mappings. A pooled ring also carries the
+ * thread's splice pipe.
+ *
+ * The blocking engine is the plain syscall path used before, and is what
+ * runs when the kernel lacks io_uring or it is disabled (containers often
+ * filter it).
+ */
+
+#ifndef IO_ENGINE_H
+#define IO_ENGINE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef enum {
+    IO_ENGINE_BLOCKING = 0,
+    IO_ENGINE_URING
+} IoEngine;
+
+/** Entries per connection thread ring (a splice chain needs three) */
+#define IO_RING_ENTRIES 8
+
+/** Idle rings kept for reuse by later connection threads */
+#define IO_RING_POOL 64
+
+/** Splice pipe capacity requested per ring (the default is 64 KB) */
+#define IO_PIPE_SIZE (256 * 1024)
+
+/**
+ * Select the engine: "auto" (io_uring when the kernel offers every
+ * operation used, else blocking), "uring" (same, but warns when it has to
+ * fall back) or "blocking"
+ *
+ * @return 0, or -1 for an unknown name
+ */
+int io_engine_init(const char *name);
+
+IoEngine io_engine(void);
+
+const char *io_engine_name(IoEngine engine);
+
+/**
+ * Accept the next connection (SOCK_CLOEXEC); acceptor thread only
+ *
+ * @return Client socket, or -1 with errno set (ECANCELED once
+ *         io_accept_stop() has been called)
+ */
+int io_accept(int listen_fd);
+
+/**
+ * Make the acceptor stop: io_accept() returns the connections the kernel
+ * has already handed over, then fails with ECANCELED. Any thread.
+ */
+void io_accept_stop(void);
+
+/**
+ * Receive from a socket, giving up after timeout_ms (no limit if < 0)
+ *
+ * @return Bytes read, 0 at EOF, -1 with errno ETIMEDOUT on timeout or
+ *         another errno on error
+ */
+ssize_t io_recv(int sock, void *buf, size_t len, int timeout_ms);
+
+/**
+ * Send len bytes of a file from offset without copying them to user space
+ *
+ * @return 0 once all of it is sent, -1 if the socket failed, -2 if the
+ *         engine cannot splice (blocking engine, no ring) and the caller
+ *         should copy instead
+ */
+int io_send_file(int sock, int fd, off_t offset, size_t len);
+
+/**
+ * Send head, then len bytes moved out of pipe_fd, then tail, as one
+ * linked submission (head and tail may be empty)
+ *
+ * @return 0, -1 if the socket or pipe failed, -2 if the engine cannot
+ *         splice
+ */
+int io_send_pipe(int sock, int pipe_fd, size_t len, const char *head, size_t head_len,
+                 const char *tail, size_t tail_len);
+
+#endif
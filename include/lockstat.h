@@ -0,0 +1,132 @@
+/**
+ * @file lockstat.h
+ * @brief Instrumented mutex with wait/hold times and contended sites
+ *
+ * TrackedMutex wraps a pthread mutex. Every acquisition records hold time;
+ * an acquisition that finds the mutex taken also records how long it
+ * waited and from which call site. All counters are updated while the
+ * mutex itself is held, so instrumentation adds no locking of its own.
+ *
+ * Mutexes register themselves on first use and are listed, with their
+ * most contended sites, in /debug/threads. One that lives in dynamic
+ * memory (a connection's, say) is set up with tracked_mutex_init() and
+ * leaves the list through tracked_mutex_destroy().
+ *
+ * Usage:
+ *   static TrackedMutex foo_mutex = TRACKED_MUTEX_INITIALIZER("foo");
+ *   tracked_lock(&foo_mutex);
+ *   ...
+ *   tracked_unlock(&foo_mutex);
+ *
+ * A condition variable is waited on through tracked_cond_wait() /
+ * tracked_cond_timedwait(), which end the hold before sleeping and count
+ * the wakeup as a new uncontended acquisition.
+ */
+
+#ifndef LOCKSTAT_H
+#define LOCKSTAT_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+/** Call sites tracked per mutex; later sites share the last slot */
+#define LOCKSTAT_MAX_SITES 16
+
+#define LOCKSTAT_STR_(x) #x
+#define LOCKSTAT_STR(x) LOCKSTAT_STR_(x)
+
+/**
+ * Counters for one call site ("file.c:123" or a function name)
+ */
+typedef struct {
+    const char *site;
+    unsigned long acquisitions;
+    unsigned long contended;
+    uint64_t wait_ns;           /**< Total time spent waiting */
+    uint64_t wait_max_ns;
+    uint64_t hold_max_ns;
+} LockSite;
+
+/**
+ * Instrumented mutex (statically initialize with TRACKED_MUTEX_INITIALIZER)
+ */
+typedef struct TrackedMutex {
+    pthread_mutex_t mutex;
+    const char *name;
+    int registered;
+    struct TrackedMutex *next;  /**< Registry list */
+
+    unsigned long acquisitions;
+    unsigned long contended;
+    uint64_t wait_ns;
+    uint64_t wait_max_ns;
+    uint64_t hold_ns;
+    uint64_t hold_max_ns;
+
+    /* Current holder, valid while locked */
+    uint64_t locked_at_ns;
+    int owner_tid;
+    LockSite *owner_site;
+
+    int num_sites;
+    LockSite sites[LOCKSTAT_MAX_SITES];
+} TrackedMutex;
+
+#define TRACKED_MUTEX_INITIALIZER(lock_name) { .mutex = PTHREAD_MUTEX_INITIALIZER, .name = (lock_name) }
+
+/**
+ * Initialize a mutex that is not statically allocated
+ *
+ * @param name String with static lifetime, shared by every instance
+ */
+void tracked_mutex_init(TrackedMutex *m, const char *name);
+
+/**
+ * Unregister and destroy a tracked_mutex_init() mutex; it must be unlocked
+ */
+void tracked_mutex_destroy(TrackedMutex *m);
+
+/** Lock, attributing the acquisition to the calling line */
+#define tracked_lock(m) tracked_lock_at((m), __FILE__ ":" LOCKSTAT_STR(__LINE__))
+
+/** Try to lock without waiting; 0 on success like pthread_mutex_trylock */
+#define tracked_trylock(m) tracked_trylock_at((m), __FILE__ ":" LOCKSTAT_STR(__LINE__))
+
+/**
+ * Lock, attributing the acquisition to `site`
+ *
+ * @param site String with static lifetime; sites are compared by pointer
+ */
+void tracked_lock_at(TrackedMutex *m, const char *site);
+
+int tracked_trylock_at(TrackedMutex *m, const char *site);
+
+void tracked_unlock(TrackedMutex *m);
+
+/** Wait on a condition variable with m held, like pthread_cond_wait */
+#define tracked_cond_wait(c, m) tracked_cond_timedwait_at((c), (m), NULL, __FILE__ ":" LOCKSTAT_STR(__LINE__))
+
+/** Wait until abstime (on the condition variable's clock); ETIMEDOUT like pthread_cond_timedwait */
+#define tracked_cond_timedwait(c, m, abstime) \
+    tracked_cond_timedwait_at((c), (m), (abstime), __FILE__ ":" LOCKSTAT_STR(__LINE__))
+
+/**
+ * Wait on a condition variable, attributing the reacquisition to `site`
+ *
+ * @param abstime Deadline, or NULL to wait without one
+ * @return 0, or the pthread_cond_timedwait() error
+ */
+int tracked_cond_timedwait_at(pthread_cond_t *cond, TrackedMutex *m,
+                              const struct timespec *abstime, const char *site);
+
+/**
+ * Serialize every registered mutex with its sites, most contended first
+ *
+ * Counters are read without locking, so a snapshot may be slightly torn.
+ *
+ * @return JSON array (caller frees)
+ */
+char *lockstat_json(void);
+
+#endif
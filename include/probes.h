@@ -0,0 +1,47 @@
+/**
+ * @file probes.h
+ * @brief USDT (SystemTap SDT) probe points for bpftrace/perf
+ *
+ * When <sys/sdt.h> is available (systemtap-sdt-dev / systemtap-sdt-devel)
+ * each PROBEn() expands to a single NOP plus an ELF note under provider
+ * "zaplinkweb"; otherwise it compiles to nothing. Build with
+ * -DZAPLINK_NO_PROBES to drop them even when the header exists.
+ *
+ * Probes (arguments in order):
+ *   request__start     fd, route (FlightRoute), method, path
+ *   request__end       fd, route
+ *   session__spawn     pid, backend, codec
+ *   session__first_byte pid, us since spawn
+ *   session__exit      pid, bytes relayed, wait status
+ *   relay__write       fd, bytes, us blocked
+ *   relay__stall       fd, us blocked (>= FLIGHT_STALL_MS)
+ *   db__statement      sql, ns
+ *   sched__tick        pending timers, busy us
+ *   sched__start       timer id, recorder pid, ms late
+ *   sched__stop        recording id, recorder pid, ms late
+ *
+ * List them with: bpftrace -l 'usdt:build/zaplinkweb:*'
+ * Sample scripts live in tools/bpftrace/.
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+#if !defined(ZAPLINK_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define ZAPLINK_PROBES 1
+#endif
+#endif
+
+#ifdef ZAPLINK_PROBES
+#define PROBE2(name, a, b)          DTRACE_PROBE2(zaplinkweb, name, a, b)
+#define PROBE3(name, a, b, c)       DTRACE_PROBE3(zaplinkweb, name, a, b, c)
+#define PROBE4(name, a, b, c, d)    DTRACE_PROBE4(zaplinkweb, name, a, b, c, d)
+#else
+#define PROBE2(name, a, b)          do { (void)(a); (void)(b); } while (0)
+#define PROBE3(name, a, b, c)       do { (void)(a); (void)(b); (void)(c); } while (0)
+#define PROBE4(name, a, b, c, d)    do { (void)(a); (void)(b); (void)(c); (void)(d); } while (0)
+#endif
+
+#endif
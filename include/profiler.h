@@ -0,0 +1,55 @@
+/**
+ * @file profiler.h
+ * @brief In-process sampling CPU profiler (/debug/profile)
+ *
+ * While a profile runs, an ITIMER_PROF timer raises SIGPROF for every
+ * 1/hz seconds of CPU the process consumes. The kernel delivers it to
+ * the thread that was running, whose stack is captured with backtrace()
+ * into a preallocated buffer. Afterwards the stacks are symbolized with
+ * dladdr (the server links with -rdynamic) and returned as folded stacks
+ * ("root;caller;callee count" lines) for flamegraph.pl or speedscope.
+ *
+ * Nothing is installed between profiles, so the idle cost is zero.
+ * Only one profile runs at a time.
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#define PROFILE_DEFAULT_SECONDS 10
+#define PROFILE_MAX_SECONDS 60
+#define PROFILE_DEFAULT_HZ 99
+#define PROFILE_MAX_HZ 1000
+
+/** Frames kept per sample (innermost first) */
+#define PROFILE_MAX_DEPTH 32
+
+/** Samples kept per profile; later samples are counted as dropped */
+#define PROFILE_MAX_SAMPLES 32768
+
+/**
+ * Outcome of a profile run
+ */
+typedef struct {
+    unsigned long samples;      /**< Stacks captured */
+    unsigned long dropped;      /**< Samples lost to a full buffer */
+    unsigned long stacks;       /**< Distinct folded stacks */
+    int seconds;
+    int hz;
+} ProfileStats;
+
+/**
+ * Sample all threads for `seconds` at `hz` and fold the stacks
+ *
+ * Blocks the calling thread for the duration. Out-of-range arguments are
+ * clamped to the limits above.
+ *
+ * @param seconds Wall-clock duration
+ * @param hz Samples per CPU-second
+ * @param stats Filled with sample counts (may be NULL)
+ * @return Folded stacks (caller frees), or NULL with errno EBUSY if a
+ *         profile is already running or ENOMEM if memory ran out
+ */
+char *profiler_run(int seconds, int hz, ProfileStats *stats);
+
+#endif
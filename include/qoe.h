@@ -0,0 +1,114 @@
+/**
+ * @file qoe.h
+ * @brief Viewer quality-of-experience telemetry (/api/qoe)
+ *
+ * The player tags every stream URL with a random session id (?sid=) and
+ * batches what the viewer saw - startup time, stalls, watch time, hls.js
+ * level switches and decode errors - to POST /api/qoe.
+ *
+ * On the server the same sid keys a session record that the streaming
+ * routes fill in: channel, the backend/codec profile actually spawned
+ * (after capability fallback), FFmpeg pid, time to first byte and bytes
+ * relayed. Client and server halves are joined by sid and aggregated per
+ * channel and profile into startup, server first-byte and rebuffer-ratio
+ * histograms, served by GET /api/qoe.
+ *
+ * A session contributes its rebuffer ratio once the player reports "end"
+ * or it has been idle for QOE_IDLE_MS.
+ *
+ * Beacons are unauthenticated, so they never name a group: a sid the
+ * server did not stream is aggregated under channel and profile "unknown",
+ * and a beacon never takes the slot of a session being streamed.
+ */
+
+#ifndef QOE_H
+#define QOE_H
+
+#include <stddef.h>
+#include "transcode.h"
+
+/** Session ids are at most this long (including NUL) */
+#define QOE_SID_LEN 33
+
+/** Sessions tracked at once; the least recently updated client-only one is finalized first */
+#define QOE_MAX_SESSIONS 512
+
+/** Channel/profile groups aggregated */
+#define QOE_MAX_GROUPS 128
+
+/** Sessions without updates for this long are finalized */
+#define QOE_IDLE_MS (5 * 60 * 1000)
+
+/** Histogram buckets (upper bounds; the last bucket is open-ended) */
+#define QOE_STARTUP_BUCKETS 8
+#define QOE_REBUFFER_BUCKETS 8
+
+/**
+ * Take the sid= parameter off a streaming URL
+ *
+ * Truncates `path` at '?' and copies a sanitized sid (alphanumerics, '-'
+ * and '_') to `sid`, or leaves it empty.
+ */
+void qoe_take_sid(char *path, char *sid, size_t sid_len);
+
+/**
+ * Open (or resume) the server half of a session for the calling thread
+ *
+ * @param sid Player session id; empty to have one generated
+ * @param channel Channel number, or "recording" for DVR playback
+ */
+void qoe_session_begin(const char *sid, const char *channel);
+
+/**
+ * Record the FFmpeg process serving the calling thread's session
+ * (no-op when no session is open)
+ */
+void qoe_session_started(int pid, TranscodeBackend backend, TranscodeCodec codec, long long first_byte_us);
+
+/**
+ * Record bytes relayed to the client when the relay ends
+ */
+void qoe_session_relayed(long long bytes);
+
+/**
+ * Close the calling thread's server session
+ */
+void qoe_session_finish(void);
+
+/**
+ * Ingest a beacon batch
+ *
+ * {"sid":"..","channel":"..","profile":"..","events":[
+ *   {"type":"startup","ms":812}, {"type":"stall","ms":430},
+ *   {"type":"play","ms":10000}, {"type":"level","bitrate":4500000},
+ *   {"type":"error","code":"mediaError"}, {"type":"end"}]}
+ *
+ * channel and profile are ignored (the server half supplies them), as are
+ * events with a negative ms or bitrate.
+ *
+ * @return 0 on success, -1 if the body is malformed
+ */
+int qoe_ingest(const char *body);
+
+/**
+ * Serialize per-group histograms and recent sessions
+ *
+ * @return JSON object (caller frees)
+ */
+char *qoe_json(void);
+
+/**
+ * Sessions the server is currently streaming: sid, channel, profile, pid
+ * and opened_ms (ms since epoch)
+ *
+ * @return JSON array (caller frees)
+ */
+char *qoe_active_json(void);
+
+/**
+ * Changes whenever a server session opens, starts its process or closes,
+ * so it can key caches of qoe_active_json()
+ */
+unsigned long qoe_generation(void);
+
+#endif
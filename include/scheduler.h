@@ -14,14 +14,91 @@
 #ifndef SCHEDULER_H
 #define SCHEDULER_H
 
+#include "arena.h"
+#include "handoff.h"
+
 /**
  * Start the DVR scheduler background thread
  *
- * This function spawns a thread that polls the database every 10 seconds
- * for pending timers and manages active recordings.
+ * This function spawns a thread that polls the database every poll interval
+ * (10 seconds unless changed with scheduler_set_poll_interval()) for
+ * pending timers and manages active recordings.
  */
 void start_scheduler(void);
 
+/**
+ * Hand every running recorder to the new process and stop the scheduler
+ * thread, so recordings carry on there and none is started twice
+ *
+ * Returns once the recorders have been sent.
+ */
+void scheduler_handoff(void);
+
+/**
+ * Track a recorder handed over by the previous process
+ *
+ * @param pidfd pidfd of the recorder (ownership passes), or -1
+ */
+void scheduler_adopt(const HandoffRecorder *recorder, int pidfd);
+
+/**
+ * Stop every recorder and give each a few seconds to finalize its file
+ *
+ * For shutdown, where recorders would otherwise outlive the server with
+ * nobody to stop them. Takes locks and sleeps, so it must not be called
+ * from a signal handler (main.c runs it on its shutdown thread).
+ */
+void scheduler_terminate_recorders(void);
+
+/**
+ * Change the database poll interval
+ *
+ * Takes effect after the current sleep. Intended for benchmarks; the
+ * default matches the server's normal behavior.
+ *
+ * @param ms Interval in milliseconds (values below 10 are clamped)
+ */
+void scheduler_set_poll_interval(int ms);
+
+/**
+ * Scheduler timing counters accumulated since start or the last reset
+ *
+ * Skews compare the wall clock at the moment the scheduler forked or
+ * reaped a recorder with the timer's start or end time. DB time covers
+ * every database call made by the scheduler thread; lock wait and hold
+ * cover the scheduler thread's own use of the active-recording mutex.
+ */
+typedef struct {
+    unsigned long ticks;            /**< Poll iterations completed */
+    unsigned long started;          /**< Recorders forked */
+    unsigned long stopped;          /**< Recorders stopped at end time */
+    unsigned long died;             /**< Recorders that exited on their own */
+    unsigned long start_failures;   /**< DB entry or fork failures */
+    unsigned long slot_overflows;   /**< Recorders forked with no free slot */
+    double start_skew_sum_ms;
+    double start_skew_max_ms;
+    double stop_skew_sum_ms;
+    double stop_skew_max_ms;
+    double db_sum_ms;               /**< Total time in db_* calls */
+    double db_tick_max_ms;          /**< Worst single tick's DB time */
+    double lock_wait_sum_ms;
+    double lock_wait_max_ms;
+    double lock_hold_sum_ms;
+    double lock_hold_max_ms;
+    double tick_sum_ms;             /**< Busy time per tick, excluding sleep */
+    double tick_max_ms;
+} SchedulerStats;
+
+/**
+ * Copy the current scheduler counters
+ */
+void scheduler_get_stats(SchedulerStats *out);
+
+/**
+ * Zero the scheduler counters
+ */
+void scheduler_reset_stats(void);
+
 /**
  * Manually stop an active recording
  *
@@ -42,10 +119,11 @@ int get_active_recording_count(void);
 /**
  * Get array of active recording IDs
  *
+ * @param arena Request arena
  * @param count Output: number of IDs in returned array
- * @return Heap-allocated array of recording IDs (caller must free),
- *         NULL if no active recordings
+ * @return Array of recording IDs in arena, NULL if no active recordings
+ *         (or, with *count nonzero, if the arena is out of memory)
  */
-int *get_active_recording_ids(int *count);
+int *get_active_recording_ids(Arena *arena, int *count);
 
 #endif
@@ -0,0 +1,34 @@
+/**
+ * @file strbuf.h
+ * @brief printf-append into a growing heap buffer
+ *
+ * The JSON and text builders that do not run inside a request (lock and
+ * thread dumps, QoE and cost reports, folded profiles) grow one malloc'd
+ * buffer and hand it to the caller.
+ *
+ * Usage:
+ *   size_t len = 0, cap = 4096;
+ *   char *json = malloc(cap);
+ *   json[0] = '\0';
+ *   strbuf_append(&json, &len, &cap, "{\"count\":%d}", count);
+ */
+
+#ifndef STRBUF_H
+#define STRBUF_H
+
+#include <stddef.h>
+
+/**
+ * Append printf output, growing the buffer as needed
+ *
+ * @param buf Heap buffer, reallocated when full
+ * @param len Bytes used, excluding the terminating NUL
+ * @param cap Bytes allocated
+ * @param fmt printf format
+ * @return 0 on success, -1 if formatting failed or memory ran out (the
+ *         buffer is left as it was)
+ */
+int strbuf_append(char **buf, size_t *len, size_t *cap, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+#endif
@@ -0,0 +1,97 @@
+/**
+ * @file telemetry.h
+ * @brief Historical session telemetry for capacity planning
+ *
+ * Every completed live stream, DVR playback and recording is summarized
+ * in a SessionRecord (duration, profile, FFmpeg speed, CPU seconds, peak
+ * RSS, bytes sent, failure reason) and appended to the session_telemetry
+ * table.
+ *
+ * Streaming threads only copy the record into an in-memory queue; a
+ * writer thread appends the queue to the database in one transaction
+ * every TELEMETRY_FLUSH_MS. If the queue is full the record is dropped
+ * and counted rather than blocking the relay.
+ *
+ * p50/p95 cost per (kind, backend, codec) profile is computed from the
+ * table on request (/api/telemetry/costs).
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "db.h"
+
+/** Records buffered between flushes */
+#define TELEMETRY_QUEUE 1024
+
+/** Interval between database flushes */
+#define TELEMETRY_FLUSH_MS 2000
+
+/** Default history covered by /api/telemetry/costs */
+#define TELEMETRY_COST_DAYS 7
+
+/** Codecs tracked per backend (including copy) */
+#define TELEMETRY_NUM_CODECS 4
+
+typedef enum {
+    SESSION_LIVE = 0,      /**< /stream, /transcode */
+    SESSION_PLAYBACK,      /**< /play (DVR file) */
+    SESSION_RECORDING,     /**< DVR recorder */
+    SESSION_NUM_KINDS
+} SessionKind;
+
+/**
+ * Cost of a profile over its completed sessions
+ */
+typedef struct {
+    int sessions;
+    int failures;
+    double cpu_per_min_p50;    /**< FFmpeg CPU seconds per wall minute */
+    double cpu_per_min_p95;
+    double rss_kb_p50;         /**< FFmpeg peak RSS */
+    double rss_kb_p95;
+    double speed_p50;          /**< Media seconds per wall second */
+    double speed_p95;
+    double duration_s_p50;
+    double duration_s_p95;
+} ProfileCost;
+
+/**
+ * Start the writer thread (after db_init())
+ */
+void telemetry_start(void);
+
+/**
+ * Queue a completed session without blocking on the database
+ *
+ * @return 0 if queued, -1 if the queue was full and the record dropped
+ */
+int telemetry_record(const SessionRecord *record);
+
+/**
+ * Write out everything queued (shutdown path)
+ */
+void telemetry_flush(void);
+
+/**
+ * Compute per-profile costs from the database
+ *
+ * @param days History to include
+ * @param kind SessionKind to include, or -1 for all
+ * @return JSON object (caller frees)
+ */
+char *telemetry_costs_json(int days, int kind);
+
+/**
+ * "live", "playback", "recording"
+ */
+const char *session_kind_name(int kind);
+
+/**
+ * Parse a session kind name
+ *
+ * @return SessionKind, or -1 if unknown
+ */
+int session_kind_parse(const char *name);
+
+#endif
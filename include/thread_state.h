@@ -0,0 +1,75 @@
+/**
+ * @file thread_state.h
+ * @brief Per-thread state registry for /debug/threads
+ *
+ * Long-lived and per-connection threads register a role and mark what
+ * they are blocked on around blocking calls (socket, FFmpeg pipe, DB,
+ * a lock, a child process). Marking is two stores and a clock read into
+ * the thread's own slot; unregistered threads skip it entirely.
+ */
+
+#ifndef THREAD_STATE_H
+#define THREAD_STATE_H
+
+/** Registry slots; threads beyond this run unregistered */
+#define THREAD_STATE_MAX 512
+
+typedef enum {
+    THREAD_RUNNING = 0,
+    THREAD_ACCEPT,          /**< Waiting for connections */
+    THREAD_SOCKET_READ,     /**< Reading from a client or upstream socket */
+    THREAD_SOCKET_WRITE,    /**< Writing to a client socket */
+    THREAD_PIPE_READ,       /**< Waiting for FFmpeg output */
+    THREAD_DB,              /**< Holding the DB lock / running SQL */
+    THREAD_LOCK,            /**< Waiting for a contended mutex */
+    THREAD_CHILD_WAIT,      /**< waitpid() on a child process */
+    THREAD_SLEEP,           /**< Timed sleep */
+    THREAD_NUM_STATES
+} ThreadState;
+
+/**
+ * Previous state returned by thread_state_enter()
+ */
+typedef struct {
+    ThreadState state;
+    const char *detail;
+} ThreadStateMark;
+
+/**
+ * Claim a slot for the calling thread
+ *
+ * @param role Static string shown in /debug/threads ("http", "scheduler")
+ */
+void thread_state_register(const char *role);
+
+/**
+ * Release the calling thread's slot
+ */
+void thread_state_unregister(void);
+
+/**
+ * Set a free-form label for the thread's current work (copied, e.g. the
+ * request path)
+ */
+void thread_state_label(const char *label);
+
+/**
+ * Enter a state until the matching thread_state_leave()
+ *
+ * @param detail Static string (lock name, "ffmpeg", ...) or NULL
+ * @return Previous state, to pass to thread_state_leave()
+ */
+ThreadStateMark thread_state_enter(ThreadState state, const char *detail);
+
+void thread_state_leave(ThreadStateMark prev);
+
+const char *thread_state_name(ThreadState state);
+
+/**
+ * Serialize the registered threads
+ *
+ * @return JSON array (caller frees)
+ */
+char *thread_state_json(void);
+
+#endif
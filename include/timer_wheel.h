@@ -0,0 +1,83 @@
+/**
+ * @file timer_wheel.h
+ * @brief Shared hierarchical timer wheel for deadlines and watchdogs
+ *
+ * One thread serves every deadline in the server, so a connection or
+ * session pays for a WheelTimer embedded in its own struct rather than a
+ * thread or a timerfd. Arming and cancelling are O(1) list operations
+ * under one mutex; expiry costs O(1) per timer plus at most one cascade
+ * per wheel level.
+ *
+ * The wheel has TIMER_LEVELS levels of TIMER_SLOTS slots. Level 0 slots
+ * are one TIMER_TICK_MS tick wide, each higher level's slots cover a
+ * whole rotation of the level below; timers move down a level when their
+ * slot comes round, and fire from level 0. With 10 ms ticks the levels
+ * reach 640 ms, 41 s, 44 min and 46 h; timers are limited to
+ * TIMER_MAX_MS. The thread sleeps until the next occupied level 0 slot
+ * or cascade, and indefinitely while nothing is armed.
+ *
+ * Callbacks run on the timer thread with the wheel locked: once
+ * timer_cancel() returns, the callback is neither running nor going to
+ * run, so its owner can free the WheelTimer or close the descriptor the
+ * callback acts on. Callbacks must therefore be short (a shutdown(), a
+ * kill()) and must not call back into the wheel; to fire again they
+ * return the delay instead.
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+
+/** Wheel resolution: deadlines fire up to one tick late */
+#define TIMER_TICK_MS 10
+
+#define TIMER_LEVELS 4
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+
+/** Longest delay a timer can be armed for */
+#define TIMER_MAX_MS (60 * 60 * 1000)
+
+typedef struct WheelTimer WheelTimer;
+
+/**
+ * Expiry callback
+ *
+ * @return Milliseconds until it should fire again, or 0 to stay disarmed
+ */
+typedef int (*WheelTimerFn)(WheelTimer *timer);
+
+/**
+ * A deadline, embedded in whatever it guards
+ *
+ * A zeroed WheelTimer is valid and disarmed.
+ */
+struct WheelTimer {
+    WheelTimer *next;
+    WheelTimer **pprev;        /**< NULL while disarmed */
+    uint64_t expires;          /**< Tick it fires at */
+    WheelTimerFn fn;
+};
+
+/**
+ * Arm (or re-arm) a timer to call fn after ms milliseconds
+ *
+ * Starts the timer thread on first use.
+ */
+void timer_arm(WheelTimer *timer, WheelTimerFn fn, int ms);
+
+/**
+ * Disarm a timer, waiting out its callback if it is running
+ *
+ * @return 1 if it was armed, 0 if it had already fired (or never armed)
+ */
+int timer_cancel(WheelTimer *timer);
+
+/**
+ * Wheel counters as JSON: pending, peak pending, armed, fired, ticks and
+ * cascaded timers (caller frees)
+ */
+char *timer_wheel_json(void);
+
+#endif
@@ -8,13 +8,28 @@
  * The transcoding pipeline:
  * 1. Fetch source stream from ZapLinkCore (or file for playback)
  * 2. Transcode using configured backend/codec
- * 3. Output fragmented MP4 (or WebM for AV1) to client socket
+ * 3. Output fragmented MP4 (or WebM for AV1) to the client, chunked on
+ *    keep-alive connections
  */
 
 #ifndef TRANSCODE_H
 #define TRANSCODE_H
 
 #include <stdio.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include "encode_sched.h"
+#include "handoff.h"
+#include "http.h"
+#include "timer_wheel.h"
+
+/**
+ * A relayed FFmpeg that keeps the relay waiting this long for output is
+ * killed, and the session ends as "stalled" (or, before its first byte,
+ * the next backend is tried)
+ */
+#define TRANSCODE_STALL_MS 20000
 
 /**
  * Hardware acceleration backend for transcoding
@@ -44,34 +59,128 @@ typedef struct {
     TranscodeCodec codec;      /**< Output video codec */
     int bitrate_kbps;          /**< Video bitrate in kbps (0 = default 10000) */
     int surround51;            /**< Enable 5.1 surround audio (0 or 1) */
+    int unpaced;               /**< Read input as fast as possible (no -re), for benchmarks */
+    const char *preset;        /**< Encoder preset override (NULL = backend default) */
+    int height;                /**< Output height in lines (0 = keep source size) */
 } TranscodeConfig;
 
 /**
- * Transcode a live stream and write to client socket
+ * A running FFmpeg child
+ */
+typedef struct {
+    pid_t pid;                 /**< FFmpeg process ID */
+    int out_fd;                /**< Read end of FFmpeg's stdout pipe */
+    int err_fd;                /**< Read end of FFmpeg's stderr pipe (-1 once closed) */
+    int adopted;               /**< Taken over from the previous process: not our child */
+    int pidfd;                 /**< pidfd of an adopted FFmpeg (-1 = none) */
+    TranscodeBackend backend;  /**< Backend this process was started with */
+    EncodeBudget budget;       /**< CPU budget held by this process */
+    char last_error[256];      /**< Last line FFmpeg logged to stderr */
+    double media_s;            /**< Output timestamp from the last -stats line */
+    double speed;              /**< Encode speed from the last -stats line (0 = unknown) */
+    char err_line[256];        /**< Partial stderr line being assembled */
+    size_t err_len;            /**< Bytes in err_line */
+    WheelTimer watchdog;       /**< Output stall check while relayed */
+    _Atomic long long waiting_since; /**< Monotonic ms a wait for output began (0 = none) */
+    _Atomic int stalled;       /**< Killed by the watchdog */
+} TranscodeProcess;
+
+/**
+ * Get the URL/config name of a backend ("software", "qsv", ...)
+ */
+const char *transcode_backend_name(TranscodeBackend backend);
+
+/**
+ * Get the URL/config name of a codec ("h264", "hevc", "av1", "copy")
+ */
+const char *transcode_codec_name(TranscodeCodec codec);
+
+/**
+ * Transcode a live stream and write it to the client
  *
- * Fetches from ZapLinkCore and transcodes in real-time.
+ * Fetches from ZapLinkCore and transcodes in real-time. The completed
+ * session is recorded as SESSION_LIVE telemetry.
  *
- * @param client_socket Socket to write HTTP response to
+ * @param res Response to write (headers are sent here)
  * @param core_url Base URL of ZapLinkCore (e.g., "http://127.0.0.1:18392")
  * @param channel_id Channel number (e.g., "15.1")
  * @param config Transcoding configuration
  * @return 0 on success, -1 on error
  */
-int transcode_stream(int client_socket, const char *core_url,
+int transcode_stream(HttpResponse *res, const char *core_url,
                      const char *channel_id, TranscodeConfig config);
 
 /**
- * Transcode any input source and write to client socket
+ * Transcode any input source and write it to the client
  *
  * Lower-level function that accepts any FFmpeg-compatible input
- * (URL or file path).
+ * (URL or file path). Backends are tried in capability fallback order
+ * (see caps_fallback_chain()): if FFmpeg exits before producing output,
+ * e.g. because hardware init failed, the next viable backend is started.
+ * HTTP headers are only sent once the first media bytes arrive.
+ * The completed session is recorded as SESSION_PLAYBACK telemetry. If
+ * FFmpeg fails mid-stream the response is aborted (http_abort()) rather
+ * than ended cleanly.
  *
- * @param client_socket Socket to write HTTP response to
+ * @param res Response to write (headers are sent here)
  * @param input_source URL or file path to transcode
  * @param config Transcoding configuration
  * @return 0 on success, -1 on error
  */
-int transcode_source(int client_socket, const char *input_source,
+int transcode_source(HttpResponse *res, const char *input_source,
                      TranscodeConfig config);
 
+/**
+ * Spawn FFmpeg for an input source without touching any socket
+ *
+ * Software encodes are given a thread budget and CPU affinity from the
+ * encode scheduler (see encode_sched.h).
+ *
+ * @param input_source URL or file path to transcode
+ * @param config Transcoding configuration
+ * @param proc Output: child process handle
+ * @return 0 on success, -1 on error
+ */
+int transcode_spawn(const char *input_source, TranscodeConfig config,
+                    TranscodeProcess *proc);
+
+/**
+ * Read FFmpeg output, collecting stderr lines into last_error meanwhile
+ *
+ * Progress lines ("frame=... time=... speed=...") update media_s and
+ * speed instead.
+ *
+ * @param proc Process handle from transcode_spawn()
+ * @param buf Destination buffer
+ * @param len Size of buf
+ * @return Bytes read, 0 at end of stream, -1 on error
+ */
+ssize_t transcode_read(TranscodeProcess *proc, char *buf, size_t len);
+
+/**
+ * Wait for FFmpeg output like transcode_read(), but leave it in the pipe
+ * (proc->out_fd) for the caller to splice
+ *
+ * @return Bytes waiting in the pipe, 0 at end of stream, -1 on error
+ */
+ssize_t transcode_ready(TranscodeProcess *proc);
+
+/**
+ * Carry on a relay handed over by the previous process (see handoff.h)
+ *
+ * Picks up at the chunk boundary where it was paused, on a response
+ * whose head has already been sent; FFmpeg is signalled through pidfd.
+ * The session's telemetry record covers both processes.
+ */
+void transcode_resume(HttpResponse *res, const HandoffRelay *paused, int out_fd, int err_fd, int pidfd);
+
+/**
+ * Stop FFmpeg, reap it and release its CPU budget
+ *
+ * @param proc Process handle from transcode_spawn()
+ * @param usage Output: child resource usage (may be NULL)
+ * @return Wait status of the child
+ */
+int transcode_finish(TranscodeProcess *proc, struct rusage *usage);
+
 #endif
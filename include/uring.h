@@ -0,0 +1,74 @@
+/**
+ * @file uring.h
+ * @brief Minimal io_uring ring over the raw syscalls
+ *
+ * Just enough of the kernel interface for io_engine.c: set up and map a
+ * ring, queue SQEs, submit and wait, and reap CQEs. No liburing, so the
+ * build gains no dependency; <linux/io_uring.h> comes with the kernel
+ * headers.
+ *
+ * A Ring is used by one thread at a time.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+typedef struct {
+    int fd;
+    unsigned sq_entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sqe_tail;         /**< SQEs handed out, published on submit */
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_map;
+    void *cq_map;
+    size_t sq_map_size;
+    size_t cq_map_size;
+    size_t sqes_size;
+} Ring;
+
+/**
+ * @return 0, or -1 with errno set (ENOSYS, EPERM when io_uring is
+ *         disabled or filtered, ENOMEM)
+ */
+int ring_init(Ring *r, unsigned entries);
+
+void ring_free(Ring *r);
+
+/**
+ * Next free SQE, zeroed, or NULL if the submission queue is full
+ */
+struct io_uring_sqe *ring_sqe(Ring *r);
+
+/**
+ * Submit queued SQEs and, if wait is set, block until a completion is
+ * ready to reap
+ *
+ * Restarts after signals (the profiler's SIGPROF).
+ *
+ * @return 0, or -1 with errno set
+ */
+int ring_submit(Ring *r, int wait);
+
+/**
+ * Oldest unreaped completion, or NULL; release it with ring_cqe_seen()
+ */
+struct io_uring_cqe *ring_cqe(Ring *r);
+
+void ring_cqe_seen(Ring *r);
+
+/**
+ * Whether the kernel supports an opcode (IORING_REGISTER_PROBE)
+ */
+int ring_supports(Ring *r, int opcode);
+
+#endif
@@ -9,20 +9,38 @@
  * - Recording playback via /api/play/
  *
  * The server is single-threaded per connection, spawning a pthread
- * for each incoming request.
+ * for each incoming connection; the thread serves keep-alive requests
+ * until the connection closes.
  */
 
 #ifndef WEB_SERVER_H
 #define WEB_SERVER_H
 
+#include "handoff.h"
+
 /**
  * Start the HTTP server
  *
  * This function blocks and runs the main accept() loop.
  * Each client connection is handled in a new thread.
+ * The listening socket is the one inherited through a handoff or from
+ * systemd, if any. Returns once a handoff has stopped the acceptor.
  *
  * @param port TCP port to listen on
  */
 void start_web_server(int port);
 
+/**
+ * Connections currently being served (including adopted relays)
+ */
+int web_active_connections(void);
+
+/**
+ * Resume a relay handed over by the previous process on a thread of its
+ * own; the connection is served normally once the relay ends
+ *
+ * Takes ownership of the descriptors.
+ */
+void web_adopt_relay(const HandoffRelay *relay, int sock, int out_fd, int err_fd, int pidfd);
+
 #endif
@@ -0,0 +1,167 @@
+/**
+ * @file arena.c
+ * @brief Request-scoped bump allocator with a shared chunk pool
+ *
+ * The pool is a list of free chunks under one mutex, touched once per
+ * chunk per request; the allocation fast path is a bounds check and an
+ * add on the caller's own arena.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "arena.h"
+#include "lockstat.h"
+
+#define ARENA_ALIGN 16
+#define ALIGN_UP(n) (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+struct ArenaChunk {
+    ArenaChunk *next;
+    size_t size;               /**< Usable bytes in data */
+    size_t used;
+    _Alignas(ARENA_ALIGN) char data[];
+};
+
+struct ArenaCleanup {
+    ArenaCleanup *next;
+    void *ptr;
+};
+
+static ArenaChunk *pool = NULL;
+static ArenaStats pool_stats;
+static TrackedMutex pool_mutex = TRACKED_MUTEX_INITIALIZER("arena_pool");
+
+/** Smallest pooled chunk that fits, else a fresh one */
+static ArenaChunk *chunk_take(size_t min) {
+    tracked_lock(&pool_mutex);
+    ArenaChunk **best = NULL;
+    for (ArenaChunk **c = &pool; *c; c = &(*c)->next) {
+        if ((*c)->size >= min && (!best || (*c)->size < (*best)->size)) {
+            best = c;
+            if ((*c)->size == min) break;
+        }
+    }
+    ArenaChunk *chunk = NULL;
+    if (best) {
+        chunk = *best;
+        *best = chunk->next;
+        pool_stats.pooled_bytes -= chunk->size;
+        pool_stats.chunks_reused++;
+    } else {
+        pool_stats.chunks_malloced++;
+    }
+    tracked_unlock(&pool_mutex);
+
+    if (!chunk) {
+        size_t size = min > ARENA_CHUNK_SIZE ? min : ARENA_CHUNK_SIZE;
+        chunk = malloc(sizeof(ArenaChunk) + size);
+        if (!chunk) return NULL;
+        chunk->size = size;
+    }
+    chunk->used = 0;
+    chunk->next = NULL;
+    return chunk;
+}
+
+static void chunk_give(ArenaChunk *chunk) {
+    tracked_lock(&pool_mutex);
+    if (pool_stats.pooled_bytes + chunk->size <= ARENA_POOL_BYTES) {
+        chunk->next = pool;
+        pool = chunk;
+        pool_stats.pooled_bytes += chunk->size;
+        chunk = NULL;
+    }
+    tracked_unlock(&pool_mutex);
+    free(chunk);
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size = ALIGN_UP(size ? size : 1);
+    ArenaChunk *c = arena->chunk;
+    if (!c || c->size - c->used < size) {
+        c = chunk_take(size);
+        if (!c) return NULL;
+        c->next = arena->chunk;
+        arena->chunk = c;
+    }
+    void *p = c->data + c->used;
+    c->used += size;
+    return p;
+}
+
+void *arena_realloc(Arena *arena, void *ptr, size_t old_size, size_t new_size) {
+    if (!ptr) return arena_alloc(arena, new_size);
+    if (new_size <= old_size) return ptr;
+
+    ArenaChunk *c = arena->chunk;
+    size_t old_aligned = ALIGN_UP(old_size ? old_size : 1);
+    size_t new_aligned = ALIGN_UP(new_size);
+    if (c && (char *)ptr + old_aligned == c->data + c->used &&
+        c->size - (c->used - old_aligned) >= new_aligned) {
+        c->used += new_aligned - old_aligned;
+        return ptr;
+    }
+
+    void *p = arena_alloc(arena, new_size);
+    if (p) memcpy(p, ptr, old_size);
+    return p;
+}
+
+char *arena_strdup(Arena *arena, const char *str) {
+    size_t len = strlen(str) + 1;
+    char *p = arena_alloc(arena, len);
+    if (p) memcpy(p, str, len);
+    return p;
+}
+
+char *arena_sprintf(Arena *arena, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (n < 0) return arena_strdup(arena, "");
+
+    char *p = arena_alloc(arena, (size_t)n + 1);
+    if (!p) return NULL;
+    va_start(ap, fmt);
+    vsnprintf(p, (size_t)n + 1, fmt, ap);
+    va_end(ap);
+    return p;
+}
+
+void *arena_adopt(Arena *arena, void *ptr) {
+    if (!ptr) return NULL;
+    ArenaCleanup *c = arena_alloc(arena, sizeof(ArenaCleanup));
+    if (!c) {
+        free(ptr);
+        return NULL;
+    }
+    c->ptr = ptr;
+    c->next = arena->cleanups;
+    arena->cleanups = c;
+    return ptr;
+}
+
+void arena_reset(Arena *arena) {
+    // Cleanup nodes live in the chunks, so free them first
+    for (ArenaCleanup *c = arena->cleanups; c; c = c->next) free(c->ptr);
+    arena->cleanups = NULL;
+
+    ArenaChunk *c = arena->chunk;
+    while (c) {
+        ArenaChunk *next = c->next;
+        chunk_give(c);
+        c = next;
+    }
+    arena->chunk = NULL;
+}
+
+void arena_get_stats(ArenaStats *stats) {
+    tracked_lock(&pool_mutex);
+    *stats = pool_stats;
+    tracked_unlock(&pool_mutex);
+}
@@ -0,0 +1,228 @@
+/**
+ * @file capabilities.c
+ * @brief FFmpeg encoder/filter and render node probing
+ *
+ * A backend is considered viable for a codec when:
+ * - FFmpeg lists the matching encoder (e.g. hevc_vaapi), and
+ * - The backend's hardware is present:
+ *     VA-API  any accessible renderD* node
+ *     QSV     an Intel (vendor 0x8086) render node
+ *     NVENC   /dev/nvidia0
+ *
+ * Software is viable whenever its encoder is compiled in.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include "capabilities.h"
+#include "lockstat.h"
+#include "log.h"
+
+/** Encoder names indexed by [backend][codec] */
+static const char *encoder_names[CAPS_NUM_BACKENDS][CAPS_NUM_CODECS] = {
+    [TRANSCODE_BACKEND_SOFTWARE] = { "libx264", "libx265", "libsvtav1" },
+    [TRANSCODE_BACKEND_QSV]      = { "h264_qsv", "hevc_qsv", "av1_qsv" },
+    [TRANSCODE_BACKEND_NVENC]    = { "h264_nvenc", "hevc_nvenc", "av1_nvenc" },
+    [TRANSCODE_BACKEND_VAAPI]    = { "h264_vaapi", "hevc_vaapi", "av1_vaapi" },
+};
+
+/** Cached probe result */
+static Capabilities caps;
+
+/** Mutex for caps (probe may be re-run while sessions read it) */
+static TrackedMutex caps_mutex = TRACKED_MUTEX_INITIALIZER("caps_mutex");
+
+/**
+ * Run `ffmpeg <listing>` and hand each output line's name column to a callback
+ *
+ * Both -encoders and -filters print "<flags> <name> ..." per entry.
+ *
+ * @return 1 if FFmpeg ran, 0 otherwise
+ */
+static int probe_listing(const char *listing, void (*on_name)(const char *name)) {
+    char cmd[128];
+    snprintf(cmd, sizeof(cmd), "ffmpeg -hide_banner %s 2>/dev/null", listing);
+    FILE *p = popen(cmd, "r");
+    if (!p) return 0;
+
+    char line[512];
+    int lines = 0;
+    while (fgets(line, sizeof(line), p)) {
+        char flags[32], name[64];
+        if (sscanf(line, "%31s %63s", flags, name) == 2) on_name(name);
+        lines++;
+    }
+    int status = pclose(p);
+    return lines > 0 && status == 0;
+}
+
+static void on_encoder(const char *name) {
+    for (int b = 0; b < CAPS_NUM_BACKENDS; b++) {
+        for (int c = 0; c < CAPS_NUM_CODECS; c++) {
+            if (strcmp(name, encoder_names[b][c]) == 0) caps.encoders[b][c] = 1;
+        }
+    }
+}
+
+static void on_filter(const char *name) {
+    if (strcmp(name, "yadif") == 0) caps.filter_yadif = 1;
+    else if (strcmp(name, "hwupload") == 0) caps.filter_hwupload = 1;
+    else if (strcmp(name, "scale_vaapi") == 0) caps.filter_scale_vaapi = 1;
+    else if (strcmp(name, "vpp_qsv") == 0) caps.filter_vpp_qsv = 1;
+}
+
+/**
+ * Read a render node's PCI vendor from sysfs
+ *
+ * @return Vendor ID, or -1 if unknown (e.g. a fake device directory)
+ */
+static int render_node_vendor(const char *node_name) {
+    char path[256];
+    snprintf(path, sizeof(path), "/sys/class/drm/%s/device/vendor", node_name);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    int vendor = -1;
+    if (fscanf(f, "%x", &vendor) != 1) vendor = -1;
+    fclose(f);
+    return vendor;
+}
+
+static void probe_render_nodes(const char *dev_dir) {
+    char dri[256];
+    snprintf(dri, sizeof(dri), "%s/dri", dev_dir);
+    DIR *d = opendir(dri);
+    if (!d) return;
+
+    /* readdir order is arbitrary; keep the lowest-numbered node */
+    int best_any = -1, best_intel = -1;
+    struct dirent *ent;
+    while ((ent = readdir(d))) {
+        int num;
+        if (sscanf(ent->d_name, "renderD%d", &num) != 1) continue;
+
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", dri, ent->d_name);
+        if (access(path, R_OK | W_OK) != 0) {
+            LOG_DEBUG("CAPS", "Render node %s not accessible (check video/render groups)", path);
+            continue;
+        }
+
+        if (best_any < 0 || num < best_any) {
+            best_any = num;
+            strncpy(caps.render_node, path, sizeof(caps.render_node) - 1);
+        }
+        int vendor = render_node_vendor(ent->d_name);
+        if ((vendor == 0x8086 || vendor == -1) && (best_intel < 0 || num < best_intel)) {
+            best_intel = num;
+            strncpy(caps.intel_render_node, path, sizeof(caps.intel_render_node) - 1);
+        }
+    }
+    closedir(d);
+}
+
+void caps_probe(const char *dev_dir) {
+    tracked_lock(&caps_mutex);
+    memset(&caps, 0, sizeof(caps));
+
+    caps.ffmpeg_found = probe_listing("-encoders", on_encoder);
+    probe_listing("-filters", on_filter);
+    probe_render_nodes(dev_dir);
+
+    char nv[256];
+    snprintf(nv, sizeof(nv), "%s/nvidia0", dev_dir);
+    caps.device[TRANSCODE_BACKEND_SOFTWARE] = 1;
+    caps.device[TRANSCODE_BACKEND_VAAPI] = caps.render_node[0] && caps.filter_hwupload;
+    caps.device[TRANSCODE_BACKEND_QSV] = caps.intel_render_node[0] && caps.filter_hwupload;
+    caps.device[TRANSCODE_BACKEND_NVENC] = access(nv, F_OK) == 0;
+    caps.probed = 1;
+    tracked_unlock(&caps_mutex);
+
+    if (!caps.ffmpeg_found) {
+        LOG_ERROR("CAPS", "ffmpeg not found in PATH; transcoding will fail");
+        return;
+    }
+    for (int b = 0; b < CAPS_NUM_BACKENDS; b++) {
+        LOG_INFO("CAPS", "%-8s h264=%s hevc=%s av1=%s",
+                 transcode_backend_name((TranscodeBackend)b),
+                 caps_viable(b, TRANSCODE_CODEC_H264) ? "yes" : "no",
+                 caps_viable(b, TRANSCODE_CODEC_HEVC) ? "yes" : "no",
+                 caps_viable(b, TRANSCODE_CODEC_AV1) ? "yes" : "no");
+    }
+    if (caps.render_node[0]) LOG_INFO("CAPS", "Render node: %s", caps.render_node);
+}
+
+void caps_get(Capabilities *out) {
+    tracked_lock(&caps_mutex);
+    *out = caps;
+    tracked_unlock(&caps_mutex);
+}
+
+int caps_viable(TranscodeBackend backend, TranscodeCodec codec) {
+    if (codec == TRANSCODE_CODEC_COPY) return 1;
+    if ((int)backend < 0 || backend >= CAPS_NUM_BACKENDS || (int)codec >= CAPS_NUM_CODECS) return 0;
+
+    tracked_lock(&caps_mutex);
+    int ok = !caps.probed || (caps.encoders[backend][codec] && caps.device[backend]);
+    tracked_unlock(&caps_mutex);
+    return ok;
+}
+
+int caps_fallback_chain(TranscodeBackend preferred, TranscodeCodec codec,
+                        TranscodeBackend *chain, int max) {
+    static const TranscodeBackend order[] = {
+        TRANSCODE_BACKEND_NVENC, TRANSCODE_BACKEND_QSV,
+        TRANSCODE_BACKEND_VAAPI, TRANSCODE_BACKEND_SOFTWARE
+    };
+    int n = 0;
+
+    /* Stream copy never touches an encoder */
+    if (codec == TRANSCODE_CODEC_COPY) {
+        chain[n++] = preferred;
+        return n;
+    }
+
+    if (caps_viable(preferred, codec) && n < max) chain[n++] = preferred;
+    for (size_t i = 0; i < sizeof(order) / sizeof(order[0]) && n < max; i++) {
+        if (order[i] == preferred || !caps_viable(order[i], codec)) continue;
+        chain[n++] = order[i];
+    }
+
+    /* Nothing viable: still try what the user asked for so the error surfaces */
+    if (n == 0) chain[n++] = preferred;
+    return n;
+}
+
+char *caps_to_json(void) {
+    char buf[2048];
+    int len = 0;
+
+    tracked_lock(&caps_mutex);
+    len += snprintf(buf + len, sizeof(buf) - len,
+        "{\"probed\":%s,\"ffmpeg\":%s,\"render_node\":\"%s\",\"backends\":{",
+        caps.probed ? "true" : "false", caps.ffmpeg_found ? "true" : "false",
+        caps.render_node);
+    for (int b = 0; b < CAPS_NUM_BACKENDS; b++) {
+        len += snprintf(buf + len, sizeof(buf) - len, "%s\"%s\":{\"device\":%s",
+            b ? "," : "", transcode_backend_name((TranscodeBackend)b),
+            caps.device[b] ? "true" : "false");
+        for (int c = 0; c < CAPS_NUM_CODECS; c++) {
+            len += snprintf(buf + len, sizeof(buf) - len, ",\"%s\":%s",
+                transcode_codec_name((TranscodeCodec)c),
+                caps.encoders[b][c] && caps.device[b] ? "true" : "false");
+        }
+        len += snprintf(buf + len, sizeof(buf) - len, "}");
+    }
+    len += snprintf(buf + len, sizeof(buf) - len,
+        "},\"filters\":{\"yadif\":%s,\"hwupload\":%s,\"scale_vaapi\":%s,\"vpp_qsv\":%s}}",
+        caps.filter_yadif ? "true" : "false", caps.filter_hwupload ? "true" : "false",
+        caps.filter_scale_vaapi ? "true" : "false", caps.filter_vpp_qsv ? "true" : "false");
+    tracked_unlock(&caps_mutex);
+
+    return strdup(buf);
+}
@@ -13,9 +13,6 @@
 #include <ctype.h>
 #include "channels.h"
 
-/** Path to channels configuration file */
-#define CHANNELS_CONF "channels.conf"
-
 /**
  * Trim leading and trailing whitespace from a string in-place
  */
@@ -0,0 +1,354 @@
+/**
+ * @file compress.c
+ * @brief Content-Encoding negotiation, streaming compression and a
+ *        compressed response cache
+ *
+ * The cache is a small fixed table under one mutex; lookups are linear
+ * scans over COMPRESS_CACHE_ENTRIES keys, which is nothing next to the
+ * compression they save. Hits are copied into the request arena so an
+ * entry can be evicted while a slow client is still being written to.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+#ifdef ZAPLINK_BROTLI
+#include <setjmp.h>
+#include <brotli/encode.h>
+#endif
+
+#include "compress.h"
+#include "lockstat.h"
+#include "log.h"
+
+/** Compressed output is handed to the sink in pieces of this size */
+#define COMPRESS_OUT_CHUNK (16 * 1024)
+
+struct Compressor {
+    ContentEncoding encoding;
+    CompressSink sink;
+    void *ctx;
+    z_stream z;
+#ifdef ZAPLINK_BROTLI
+    BrotliEncoderState *br;
+    Arena *arena;              /**< Where br_alloc allocates */
+    jmp_buf br_oom;            /**< Where br_alloc goes when the arena is out of memory */
+#endif
+    int failed;                /**< The encoder gave up: output is incomplete */
+    char out[COMPRESS_OUT_CHUNK];
+};
+
+static const char *encoding_names[ENCODING_COUNT] = { NULL, "gzip", "deflate", "br" };
+
+const char *compress_encoding_name(ContentEncoding encoding) {
+    if (encoding < 0 || encoding >= ENCODING_COUNT) return NULL;
+    return encoding_names[encoding];
+}
+
+ContentEncoding compress_negotiate(const char *request, int allow_br) {
+    const char *h = strcasestr(request, "\r\nAccept-Encoding:");
+    if (!h) return ENCODING_IDENTITY;
+    h += 18;
+    const char *end = strstr(h, "\r\n");
+    if (!end) end = h + strlen(h);
+
+    // q per encoding; -1 = not mentioned
+    double q[ENCODING_COUNT] = { -1, -1, -1, -1 };
+    double wildcard = -1;
+    while (h < end) {
+        while (h < end && (*h == ' ' || *h == ',')) h++;
+        const char *tok = h;
+        while (h < end && *h != ',' && *h != ';' && *h != ' ') h++;
+        size_t tlen = h - tok;
+        double tq = 1.0;
+        while (h < end && *h != ',') {
+            if (strncmp(h, ";q=", 3) == 0 || strncmp(h, "; q=", 4) == 0) {
+                tq = strtod(strchr(h, '=') + 1, NULL);
+            }
+            h++;
+        }
+        if (tlen == 0) continue;
+        if ((tlen == 4 && strncasecmp(tok, "gzip", 4) == 0) || (tlen == 6 && strncasecmp(tok, "x-gzip", 6) == 0)) {
+            q[ENCODING_GZIP] = tq;
+        } else if (tlen == 7 && strncasecmp(tok, "deflate", 7) == 0) {
+            q[ENCODING_DEFLATE] = tq;
+        } else if (tlen == 2 && strncasecmp(tok, "br", 2) == 0) {
+            q[ENCODING_BR] = tq;
+        } else if (tlen == 1 && *tok == '*') {
+            wildcard = tq;
+        }
+    }
+    if (q[ENCODING_GZIP] < 0) q[ENCODING_GZIP] = wildcard;
+#ifndef ZAPLINK_BROTLI
+    allow_br = 0;
+#endif
+    if (!allow_br) q[ENCODING_BR] = -1;
+
+    // Preference order breaks ties
+    static const ContentEncoding order[] = { ENCODING_BR, ENCODING_GZIP, ENCODING_DEFLATE };
+    ContentEncoding best = ENCODING_IDENTITY;
+    double best_q = 0;
+    for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+        if (q[order[i]] > best_q) {
+            best_q = q[order[i]];
+            best = order[i];
+        }
+    }
+    return best;
+}
+
+/* ============================================================================
+ * Streaming compression
+ * ============================================================================ */
+
+static voidpf z_alloc(voidpf opaque, uInt items, uInt size) {
+    return arena_alloc(opaque, (size_t)items * size);
+}
+
+static void z_free(voidpf opaque, voidpf address) {
+    // Released with the request arena
+    (void)opaque;
+    (void)address;
+}
+
+#ifdef ZAPLINK_BROTLI
+/**
+ * libbrotlienc exit()s the process when an allocator returns NULL, so an
+ * arena that cannot grow unwinds to the brotli call instead. The encoder
+ * holds nothing but arena memory, so it is simply abandoned there.
+ */
+static void *br_alloc(void *opaque, size_t size) {
+    Compressor *c = opaque;
+    void *p = arena_alloc(c->arena, size);
+    if (!p) longjmp(c->br_oom, 1);
+    return p;
+}
+
+static void br_free(void *opaque, void *address) {
+    (void)opaque;
+    (void)address;
+}
+#endif
+
+Compressor *compressor_new(Arena *arena, ContentEncoding encoding, int cacheable,
+                           CompressSink sink, void *ctx) {
+    Compressor *c = arena_alloc(arena, sizeof(Compressor));
+    if (!c) return NULL;
+    memset(c, 0, sizeof(*c));
+    c->encoding = encoding;
+    c->sink = sink;
+    c->ctx = ctx;
+
+    if (encoding == ENCODING_GZIP || encoding == ENCODING_DEFLATE) {
+        c->z.zalloc = z_alloc;
+        c->z.zfree = z_free;
+        c->z.opaque = arena;
+        int level = cacheable ? COMPRESS_GZIP_LEVEL_CACHED : COMPRESS_GZIP_LEVEL_STREAM;
+        int window = encoding == ENCODING_GZIP ? 15 + 16 : 15;
+        if (deflateInit2(&c->z, level, Z_DEFLATED, window, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            LOG_ERROR("COMPRESS", "deflateInit2 failed, sending identity");
+            c->encoding = ENCODING_IDENTITY;
+        }
+    }
+#ifdef ZAPLINK_BROTLI
+    else if (encoding == ENCODING_BR) {
+        c->arena = arena;
+        if (setjmp(c->br_oom) == 0) c->br = BrotliEncoderCreateInstance(br_alloc, br_free, c);
+        else c->br = NULL;
+        if (c->br) {
+            BrotliEncoderSetParameter(c->br, BROTLI_PARAM_QUALITY, COMPRESS_BROTLI_QUALITY);
+            BrotliEncoderSetParameter(c->br, BROTLI_PARAM_LGWIN, COMPRESS_BROTLI_LGWIN);
+            BrotliEncoderSetParameter(c->br, BROTLI_PARAM_MODE, BROTLI_MODE_TEXT);
+        } else {
+            LOG_ERROR("COMPRESS", "BrotliEncoderCreateInstance failed, sending identity");
+            c->encoding = ENCODING_IDENTITY;
+        }
+    }
+#endif
+    else {
+        c->encoding = ENCODING_IDENTITY;
+    }
+    return c;
+}
+
+static void deflate_run(Compressor *c, int flush) {
+    int rc;
+    do {
+        c->z.next_out = (Bytef *)c->out;
+        c->z.avail_out = sizeof(c->out);
+        rc = deflate(&c->z, flush);
+        size_t n = sizeof(c->out) - c->z.avail_out;
+        if (n) c->sink(c->ctx, c->out, n);
+    } while (c->z.avail_out == 0 || (flush == Z_FINISH && rc == Z_OK));
+}
+
+#ifdef ZAPLINK_BROTLI
+static void brotli_run(Compressor *c, const char *data, size_t len, BrotliEncoderOperation op) {
+    const uint8_t *next_in = (const uint8_t *)data;
+    size_t avail_in = len;
+    for (;;) {
+        uint8_t *next_out = (uint8_t *)c->out;
+        size_t avail_out = sizeof(c->out);
+        if (setjmp(c->br_oom) != 0) {
+            LOG_ERROR("COMPRESS", "Out of memory in the brotli stream");
+            c->failed = 1;
+            c->br = NULL;
+            return;
+        }
+        if (!BrotliEncoderCompressStream(c->br, op, &avail_in, &next_in, &avail_out, &next_out, NULL)) {
+            LOG_ERROR("COMPRESS", "Brotli stream failed");
+            c->failed = 1;
+            return;
+        }
+        size_t n = sizeof(c->out) - avail_out;
+        if (n) c->sink(c->ctx, c->out, n);
+        if (op == BROTLI_OPERATION_FINISH) {
+            if (BrotliEncoderIsFinished(c->br)) return;
+        } else if (avail_in == 0 && !BrotliEncoderHasMoreOutput(c->br)) {
+            return;
+        }
+    }
+}
+#endif
+
+void compressor_write(Compressor *c, const char *data, size_t len) {
+    if (len == 0) return;
+    switch (c->encoding) {
+        case ENCODING_GZIP:
+        case ENCODING_DEFLATE:
+            c->z.next_in = (Bytef *)data;
+            c->z.avail_in = len;
+            deflate_run(c, Z_NO_FLUSH);
+            break;
+#ifdef ZAPLINK_BROTLI
+        case ENCODING_BR:
+            if (!c->failed) brotli_run(c, data, len, BROTLI_OPERATION_PROCESS);
+            break;
+#endif
+        default:
+            c->sink(c->ctx, data, len);
+            break;
+    }
+}
+
+int compressor_finish(Compressor *c) {
+    switch (c->encoding) {
+        case ENCODING_GZIP:
+        case ENCODING_DEFLATE:
+            c->z.next_in = NULL;
+            c->z.avail_in = 0;
+            deflate_run(c, Z_FINISH);
+            deflateEnd(&c->z);
+            break;
+#ifdef ZAPLINK_BROTLI
+        case ENCODING_BR:
+            if (!c->failed) brotli_run(c, NULL, 0, BROTLI_OPERATION_FINISH);
+            if (c->br) BrotliEncoderDestroyInstance(c->br);
+            c->br = NULL;
+            break;
+#endif
+        default:
+            break;
+    }
+    return c->failed ? -1 : 0;
+}
+
+/* ============================================================================
+ * Compressed response cache
+ * ============================================================================ */
+
+typedef struct {
+    char *key;                 /**< NULL = free slot */
+    ContentEncoding accepted;  /**< Negotiated encoding this entry serves */
+    ContentEncoding encoding;  /**< Encoding of data */
+    char *data;
+    size_t len;
+    unsigned long last_used;
+} CacheEntry;
+
+static CacheEntry cache[COMPRESS_CACHE_ENTRIES];
+static size_t cache_bytes = 0;
+static unsigned long cache_tick = 0;
+static TrackedMutex cache_mutex = TRACKED_MUTEX_INITIALIZER("compress_cache");
+
+static void cache_evict(CacheEntry *e) {
+    cache_bytes -= e->len;
+    free(e->key);
+    free(e->data);
+    memset(e, 0, sizeof(*e));
+}
+
+int compress_cache_get(const char *key, ContentEncoding accepted, Arena *arena,
+                       char **data, size_t *len, ContentEncoding *encoding) {
+    int hit = 0;
+    tracked_lock(&cache_mutex);
+    for (int i = 0; i < COMPRESS_CACHE_ENTRIES; i++) {
+        CacheEntry *e = &cache[i];
+        if (e->key && e->accepted == accepted && strcmp(e->key, key) == 0) {
+            // Without room for the copy this is a miss; producing the body will fail the same way
+            *data = arena_alloc(arena, e->len);
+            if (!*data) break;
+            e->last_used = ++cache_tick;
+            memcpy(*data, e->data, e->len);
+            *len = e->len;
+            *encoding = e->encoding;
+            hit = 1;
+            break;
+        }
+    }
+    tracked_unlock(&cache_mutex);
+    return hit;
+}
+
+void compress_cache_put(const char *key, ContentEncoding accepted, ContentEncoding encoding,
+                        const char *data, size_t len) {
+    if (len > COMPRESS_CACHE_BYTES / 4) return;
+
+    char *copy = malloc(len);
+    char *key_copy = strdup(key);
+    if (!copy || !key_copy) {
+        free(copy);
+        free(key_copy);
+        return;
+    }
+    memcpy(copy, data, len);
+
+    tracked_lock(&cache_mutex);
+    CacheEntry *slot = NULL;
+    for (int i = 0; i < COMPRESS_CACHE_ENTRIES; i++) {
+        if (cache[i].key && cache[i].accepted == accepted && strcmp(cache[i].key, key) == 0) {
+            cache_evict(&cache[i]);
+            slot = &cache[i];
+            break;
+        }
+    }
+    for (;;) {
+        CacheEntry *lru = NULL;
+        if (!slot) {
+            for (int i = 0; i < COMPRESS_CACHE_ENTRIES; i++) {
+                if (!cache[i].key) {
+                    slot = &cache[i];
+                    break;
+                }
+            }
+        }
+        if (slot && cache_bytes + len <= COMPRESS_CACHE_BYTES) break;
+        for (int i = 0; i < COMPRESS_CACHE_ENTRIES; i++) {
+            if (cache[i].key && (!lru || cache[i].last_used < lru->last_used)) lru = &cache[i];
+        }
+        if (!lru) break;
+        cache_evict(lru);
+        if (!slot) slot = lru;
+    }
+    slot->key = key_copy;
+    slot->accepted = accepted;
+    slot->encoding = encoding;
+    slot->data = copy;
+    slot->len = len;
+    slot->last_used = ++cache_tick;
+    cache_bytes += len;
+    tracked_unlock(&cache_mutex);
+}
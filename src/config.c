@@ -6,6 +6,7 @@
  * Configuration format is simple key=value pairs:
  *   TRANSCODE_BACKEND=software
  *   TRANSCODE_CODEC=h264
+ *   ENCODE_BUDGET=1
  */
 
 #include <stdio.h>
@@ -21,6 +22,7 @@ void config_load() {
     // Set defaults
     strcpy(app_config.backend, "software");
     strcpy(app_config.codec, "h264");
+    app_config.encode_budget = 1;
 
     FILE *f = fopen(CONFIG_FILE, "r");
     if (!f) return;
@@ -39,6 +41,8 @@ void config_load() {
                 strncpy(app_config.backend, val, sizeof(app_config.backend) - 1);
             } else if (strcmp(key, "TRANSCODE_CODEC") == 0) {
                 strncpy(app_config.codec, val, sizeof(app_config.codec) - 1);
+            } else if (strcmp(key, "ENCODE_BUDGET") == 0) {
+                app_config.encode_budget = atoi(val);
             }
         }
     }
@@ -51,6 +55,7 @@ void config_save() {
     
     fprintf(f, "TRANSCODE_BACKEND=%s\n", app_config.backend);
     fprintf(f, "TRANSCODE_CODEC=%s\n", app_config.codec);
+    fprintf(f, "ENCODE_BUDGET=%d\n", app_config.encode_budget);
     
     fclose(f);
 }
@@ -17,16 +17,88 @@
 #include <time.h>
 #include "db.h"
 #include "config.h"
+#include "lockstat.h"
+#include "thread_state.h"
+#include "probes.h"
 
 /** Module-level database connection handle */
 static sqlite3 *db = NULL;
 
+/**
+ * Serializes use of the shared connection. SQLite's own serialized mode
+ * would block the same way, but invisibly; this makes DB contention
+ * show up in /debug/threads and keeps insert + last_insert_rowid atomic.
+ */
+static TrackedMutex db_mutex = TRACKED_MUTEX_INITIALIZER("db");
+
+/** Bumped by every committed write to timers or recordings */
+static unsigned long generation = 0;
+
+/** Called with db_mutex held after a successful write */
+static void db_changed(void) {
+    __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+}
+
+unsigned long db_generation(void) {
+    return __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+}
+
+static ThreadStateMark db_lock(const char *site) {
+    tracked_lock_at(&db_mutex, site);
+    return thread_state_enter(THREAD_DB, site);
+}
+
+static void db_unlock(ThreadStateMark mark) {
+    thread_state_leave(mark);
+    tracked_unlock(&db_mutex);
+}
+
+/** Schema for a fresh database; existing tables are left untouched */
+static const char *schema_sql =
+    "CREATE TABLE IF NOT EXISTS timers ("
+    "  id INTEGER PRIMARY KEY AUTOINCREMENT, type TEXT, title TEXT, channel_num TEXT,"
+    "  start_time INTEGER, end_time INTEGER, created_at INTEGER);"
+    "CREATE TABLE IF NOT EXISTS recordings ("
+    "  id INTEGER PRIMARY KEY AUTOINCREMENT, title TEXT, description TEXT,"
+    "  channel_name TEXT, channel_num TEXT, start_time INTEGER, end_time INTEGER,"
+    "  file_path TEXT, status TEXT, timer_id INTEGER);"
+    "CREATE TABLE IF NOT EXISTS programs ("
+    "  frequency TEXT, channel_service_id TEXT, start_time INTEGER, end_time INTEGER,"
+    "  title TEXT, description TEXT, event_id INTEGER, source_id INTEGER);"
+    "CREATE TABLE IF NOT EXISTS session_telemetry ("
+    "  started_at INTEGER, kind INTEGER, backend INTEGER, codec INTEGER, channel TEXT,"
+    "  duration_ms INTEGER, speed_milli INTEGER, cpu_ms INTEGER, peak_rss_kb INTEGER,"
+    "  bytes INTEGER, failure TEXT);"
+    "CREATE INDEX IF NOT EXISTS session_telemetry_started ON session_telemetry (started_at);";
+
+#ifdef ZAPLINK_PROBES
+/** SQLITE_TRACE_PROFILE callback: one db__statement probe per finished statement */
+static int trace_profile(unsigned mask, void *ctx, void *p, void *x) {
+    (void)ctx;
+    if (mask == SQLITE_TRACE_PROFILE) {
+        PROBE2(db__statement, sqlite3_sql((sqlite3_stmt *)p), *(sqlite3_int64 *)x);
+    }
+    return 0;
+}
+#endif
+
 int db_init() {
     int rc = sqlite3_open(DB_PATH, &db);
     if (rc) {
         fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
         return 0;
     }
+#ifdef ZAPLINK_PROBES
+    // Profile callbacks cost a clock read per statement, so only when probes are built in
+    sqlite3_trace_v2(db, SQLITE_TRACE_PROFILE, trace_profile, NULL);
+#endif
+
+    char *err_msg = NULL;
+    if (sqlite3_exec(db, schema_sql, NULL, NULL, &err_msg) != SQLITE_OK) {
+        fprintf(stderr, "Can't create tables: %s\n", err_msg ? err_msg : "unknown");
+        if (err_msg) sqlite3_free(err_msg);
+        return 0;
+    }
     return 1;
 }
 
@@ -55,18 +127,37 @@ static void json_escape(char *dest, const char *src, size_t size) {
     dest[i] = '\0';
 }
 
-// Helper: Append string with reallocation
-static void append_str(char **buf, size_t *cap, size_t *len, const char *str) {
+/**
+ * Rows staged as JSON under the DB lock; the writer only sees them after
+ * the statement is finalized, since it may block on a slow client and the
+ * connection (and its read transaction) must not wait on that
+ */
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+    int failed;                /**< Out of memory: the document is incomplete */
+} JsonOut;
+
+static void out_str(JsonOut *out, const char *str) {
     size_t slen = strlen(str);
-    while (*len + slen + 1 > *cap) {
-        *cap *= 2;
-        *buf = realloc(*buf, *cap);
+    if (out->failed) return;
+    if (out->len + slen > out->cap) {
+        size_t cap = out->cap ? out->cap : 8192;
+        while (cap < out->len + slen) cap *= 2;
+        char *grown = realloc(out->buf, cap);
+        if (!grown) {
+            out->failed = 1;
+            return;
+        }
+        out->buf = grown;
+        out->cap = cap;
     }
-    strcpy(*buf + *len, str);
-    *len += slen;
+    memcpy(out->buf + out->len, str, slen);
+    out->len += slen;
 }
 
-char *db_get_channels_json() {
+char *db_get_channels_json(Arena *arena) {
     // For now, we unfortunately would need to read channels.conf or DB if we stored channels there.
     // The node app read channels.conf.
     // However, the DB probably has program data but maybe not the channel list itself if it relies on channels.conf.
@@ -79,30 +170,35 @@ char *db_get_channels_json() {
     // We will stub this for now with a simple empty array to check connectivity, 
     // but ideally we need to parse channels.conf in C too (ZapLinkCore does this).
     
-    return strdup("{\"channels\": []}");
+    return arena_strdup(arena, "{\"channels\": []}");
 }
 
-// Helper to execute query and return generic JSON array of objects
-static char *query_to_json(const char *sql) {
+// Helper to execute query and write a generic JSON array of objects
+// The DB lock is attributed to the caller, not to this helper
+#define query_write_json(writer, sql) query_write_json_at((writer), (sql), __func__)
+static int query_write_json_at(JsonWriter *writer, const char *sql, const char *site) {
     sqlite3_stmt *stmt;
+    JsonOut out = { 0 };
+
+    ThreadStateMark mark = db_lock(site);
     int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) return strdup("[]");
+    if (rc != SQLITE_OK) {
+        db_unlock(mark);
+        writer->write(writer->ctx, "[]", 2);
+        return 0;
+    }
 
-    size_t cap = 4096;
-    size_t len = 0;
-    char *json = malloc(cap);
-    strcpy(json, "[");
-    len = 1;
+    out_str(&out, "[");
 
     int first = 1;
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        if (!first) append_str(&json, &cap, &len, ",");
+    while (!out.failed && sqlite3_step(stmt) == SQLITE_ROW) {
+        if (!first) out_str(&out, ",");
         first = 0;
-        append_str(&json, &cap, &len, "{");
+        out_str(&out, "{");
         
         int cols = sqlite3_column_count(stmt);
         for (int i = 0; i < cols; i++) {
-            if (i > 0) append_str(&json, &cap, &len, ",");
+            if (i > 0) out_str(&out, ",");
             
             const char *name = sqlite3_column_name(stmt, i);
             const char *val = (const char *)sqlite3_column_text(stmt, i);
@@ -111,36 +207,44 @@ static char *query_to_json(const char *sql) {
             
             char buf[4096];
             snprintf(buf, sizeof(buf), "\"%s\":\"%s\"", name, escaped);
-            append_str(&json, &cap, &len, buf);
+            out_str(&out, buf);
         }
-        append_str(&json, &cap, &len, "}");
+        out_str(&out, "}");
     }
-    append_str(&json, &cap, &len, "]");
+    out_str(&out, "]");
     sqlite3_finalize(stmt);
-    return json;
+    db_unlock(mark);
+
+    if (!out.failed) writer->write(writer->ctx, out.buf, out.len);
+    free(out.buf);
+    return out.failed ? -1 : 0;
 }
 
-char *db_get_recordings_json() {
-    return query_to_json("SELECT * FROM recordings ORDER BY start_time DESC");
+int db_write_recordings_json(JsonWriter *writer) {
+    return query_write_json(writer, "SELECT * FROM recordings ORDER BY start_time DESC");
 }
 
-char *db_get_timers_json() {
-    return query_to_json("SELECT * FROM timers ORDER BY created_at DESC");
+int db_write_timers_json(JsonWriter *writer) {
+    return query_write_json(writer, "SELECT * FROM timers ORDER BY created_at DESC");
 }
 
-char *db_get_guide_json(long long start_time, long long end_time) {
+int db_write_guide_json(JsonWriter *writer, long long start_time, long long end_time) {
     char sql[512];
     snprintf(sql, sizeof(sql), 
         "SELECT * FROM programs WHERE end_time > %lld AND start_time < %lld ORDER BY start_time", 
         start_time, end_time);
-    return query_to_json(sql);
+    return query_write_json(writer, sql);
 }
 
 int db_add_timer(const char *type, const char *title, const char *channel_num, long long start, long long end) {
     sqlite3_stmt *stmt;
     const char *sql = "INSERT INTO timers (type, title, channel_num, start_time, end_time, created_at) VALUES (?, ?, ?, ?, ?, ?)";
+    ThreadStateMark mark = db_lock(__func__);
     int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) return 0;
+    if (rc != SQLITE_OK) {
+        db_unlock(mark);
+        return 0;
+    }
 
     sqlite3_bind_text(stmt, 1, type, -1, SQLITE_STATIC);
     sqlite3_bind_text(stmt, 2, title, -1, SQLITE_STATIC);
@@ -151,6 +255,8 @@ int db_add_timer(const char *type, const char *title, const char *channel_num, l
 
     rc = sqlite3_step(stmt);
     sqlite3_finalize(stmt);
+    if (rc == SQLITE_DONE) db_changed();
+    db_unlock(mark);
     return (rc == SQLITE_DONE);
 }
 
@@ -158,7 +264,10 @@ int db_delete_timer(int id) {
     char sql[128];
     snprintf(sql, sizeof(sql), "DELETE FROM timers WHERE id = %d", id);
     char *err_msg = NULL;
+    ThreadStateMark mark = db_lock(__func__);
     int rc = sqlite3_exec(db, sql, NULL, NULL, &err_msg);
+    if (rc == SQLITE_OK) db_changed();
+    db_unlock(mark);
     if (rc != SQLITE_OK) {
         if (err_msg) sqlite3_free(err_msg);
         return 0;
@@ -170,7 +279,10 @@ int db_delete_recording(int id) {
     char sql[128];
     snprintf(sql, sizeof(sql), "DELETE FROM recordings WHERE id = %d", id);
     char *err_msg = NULL;
+    ThreadStateMark mark = db_lock(__func__);
     int rc = sqlite3_exec(db, sql, NULL, NULL, &err_msg);
+    if (rc == SQLITE_OK) db_changed();
+    db_unlock(mark);
     if (rc != SQLITE_OK) {
         if (err_msg) sqlite3_free(err_msg);
         return 0;
@@ -178,20 +290,25 @@ int db_delete_recording(int id) {
     return 1;
 }
 
-char *db_get_recording_path(int id) {
+char *db_get_recording_path(Arena *arena, int id) {
     sqlite3_stmt *stmt;
     const char *sql = "SELECT file_path FROM recordings WHERE id = ?";
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) return NULL;
+    ThreadStateMark mark = db_lock(__func__);
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) {
+        db_unlock(mark);
+        return NULL;
+    }
     
     sqlite3_bind_int(stmt, 1, id);
     
     char *path = NULL;
     if (sqlite3_step(stmt) == SQLITE_ROW) {
         const char *text = (const char *)sqlite3_column_text(stmt, 0);
-        if (text) path = strdup(text);
+        if (text) path = arena_strdup(arena, text);
     }
     
     sqlite3_finalize(stmt);
+    db_unlock(mark);
     return path;
 }
 
@@ -201,7 +318,11 @@ int db_get_pending_timers(long long now, Timer **out_timers, int *out_count) {
     // We want timers where start_time <= now AND end_time > now
     const char *sql = "SELECT id, type, title, channel_num, start_time, end_time FROM timers WHERE start_time <= ? AND end_time > ?";
     
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) return 0;
+    ThreadStateMark mark = db_lock(__func__);
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) {
+        db_unlock(mark);
+        return 0;
+    }
     
     sqlite3_bind_int64(stmt, 1, now);
     sqlite3_bind_int64(stmt, 2, now);
@@ -234,6 +355,7 @@ int db_get_pending_timers(long long now, Timer **out_timers, int *out_count) {
     }
     
     sqlite3_finalize(stmt);
+    db_unlock(mark);
     *out_timers = timers;
     *out_count = count;
     return 1;
@@ -242,7 +364,11 @@ int db_get_pending_timers(long long now, Timer **out_timers, int *out_count) {
 int db_add_recording_entry(const char *title, const char *channel_name, long long start, long long end, const char *path) {
     sqlite3_stmt *stmt;
     const char *sql = "INSERT INTO recordings (title, channel_name, start_time, end_time, file_path) VALUES (?, ?, ?, ?, ?)";
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) return -1;
+    ThreadStateMark mark = db_lock(__func__);
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) {
+        db_unlock(mark);
+        return -1;
+    }
     
     sqlite3_bind_text(stmt, 1, title, -1, SQLITE_STATIC);
     sqlite3_bind_text(stmt, 2, channel_name, -1, SQLITE_STATIC);
@@ -253,7 +379,94 @@ int db_add_recording_entry(const char *title, const char *channel_name, long lon
     int id = -1;
     if (sqlite3_step(stmt) == SQLITE_DONE) {
         id = (int)sqlite3_last_insert_rowid(db);
+        db_changed();
     }
     sqlite3_finalize(stmt);
+    db_unlock(mark);
     return id;
 }
+
+int db_add_session_records(const SessionRecord *records, int count) {
+    sqlite3_stmt *stmt;
+    const char *sql = "INSERT INTO session_telemetry (started_at, kind, backend, codec, channel, duration_ms,"
+                      " speed_milli, cpu_ms, peak_rss_kb, bytes, failure) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+    ThreadStateMark mark = db_lock(__func__);
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) {
+        db_unlock(mark);
+        return 0;
+    }
+
+    // One transaction per batch: a single journal sync instead of one per row
+    int ok = sqlite3_exec(db, "BEGIN", NULL, NULL, NULL) == SQLITE_OK;
+    for (int i = 0; ok && i < count; i++) {
+        const SessionRecord *r = &records[i];
+        sqlite3_bind_int64(stmt, 1, r->started_at);
+        sqlite3_bind_int(stmt, 2, r->kind);
+        sqlite3_bind_int(stmt, 3, r->backend);
+        sqlite3_bind_int(stmt, 4, r->codec);
+        sqlite3_bind_text(stmt, 5, r->channel, -1, SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 6, r->duration_ms);
+        sqlite3_bind_int64(stmt, 7, (long long)(r->speed * 1000));
+        sqlite3_bind_int64(stmt, 8, (long long)(r->cpu_s * 1000));
+        sqlite3_bind_int64(stmt, 9, r->peak_rss_kb);
+        sqlite3_bind_int64(stmt, 10, r->bytes);
+        if (r->failure[0]) sqlite3_bind_text(stmt, 11, r->failure, -1, SQLITE_STATIC);
+        else sqlite3_bind_null(stmt, 11);
+        ok = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_reset(stmt);
+    }
+    sqlite3_exec(db, ok ? "COMMIT" : "ROLLBACK", NULL, NULL, NULL);
+    sqlite3_finalize(stmt);
+    db_unlock(mark);
+    return ok;
+}
+
+int db_get_session_records(long long since, SessionRecord **out_records, int *out_count) {
+    sqlite3_stmt *stmt;
+    const char *sql = "SELECT started_at, kind, backend, codec, channel, duration_ms, speed_milli, cpu_ms,"
+                      " peak_rss_kb, bytes, failure FROM session_telemetry WHERE started_at >= ?";
+    ThreadStateMark mark = db_lock(__func__);
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) {
+        db_unlock(mark);
+        return 0;
+    }
+    sqlite3_bind_int64(stmt, 1, since);
+
+    int capacity = 64;
+    int count = 0;
+    SessionRecord *records = malloc(sizeof(SessionRecord) * capacity);
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        if (count >= capacity) {
+            capacity *= 2;
+            records = realloc(records, sizeof(SessionRecord) * capacity);
+        }
+        SessionRecord *r = &records[count++];
+        memset(r, 0, sizeof(*r));
+        r->started_at = sqlite3_column_int64(stmt, 0);
+        r->kind = sqlite3_column_int(stmt, 1);
+        r->backend = sqlite3_column_int(stmt, 2);
+        r->codec = sqlite3_column_int(stmt, 3);
+        const char *chn = (const char *)sqlite3_column_text(stmt, 4);
+        strncpy(r->channel, chn ? chn : "", sizeof(r->channel) - 1);
+        r->duration_ms = sqlite3_column_int64(stmt, 5);
+        r->speed = sqlite3_column_int64(stmt, 6) / 1000.0;
+        r->cpu_s = sqlite3_column_int64(stmt, 7) / 1000.0;
+        r->peak_rss_kb = (long)sqlite3_column_int64(stmt, 8);
+        r->bytes = sqlite3_column_int64(stmt, 9);
+        const char *failure = (const char *)sqlite3_column_text(stmt, 10);
+        if (failure) strncpy(r->failure, failure, sizeof(r->failure) - 1);
+    }
+
+    sqlite3_finalize(stmt);
+    db_unlock(mark);
+    *out_records = records;
+    *out_count = count;
+    return 1;
+}
+
+int db_write_sessions_json(JsonWriter *writer, int limit) {
+    char sql[160];
+    snprintf(sql, sizeof(sql), "SELECT * FROM session_telemetry ORDER BY started_at DESC LIMIT %d", limit);
+    return query_write_json(writer, sql);
+}
@@ -37,6 +37,7 @@ static AvahiThreadedPoll *threaded_poll = NULL;
 static AvahiClient *client = NULL;
 static AvahiEntryGroup *group = NULL;
 static char core_url[256] = {0};  /**< Discovered ZapLinkCore URL */
+static int core_url_pinned = 0;   /**< Set by set_core_base_url(); mDNS results ignored */
 
 static void resolve_callback(
     AvahiServiceResolver *r,
@@ -80,7 +81,9 @@ static void resolve_callback(
 
         // Prioritization Logic
         int take_it = 0;
-        if (strlen(core_url) == 0) {
+        if (core_url_pinned) {
+            take_it = 0;
+        } else if (strlen(core_url) == 0) {
             take_it = 1;
         } else {
             // Check current protocol (if it has brackets, it's IPv6)
@@ -202,3 +205,9 @@ const char* get_core_base_url() {
     if (strlen(core_url) == 0) return NULL;
     return core_url;
 }
+
+void set_core_base_url(const char *url) {
+    strncpy(core_url, url, sizeof(core_url) - 1);
+    core_url_pinned = 1;
+    LOG_INFO("MDNS", "Core URL pinned: %s", core_url);
+}
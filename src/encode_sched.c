@@ -0,0 +1,331 @@
+/**
+ * @file encode_sched.c
+ * @brief CPU-aware thread budgeting and core pinning for software encodes
+ *
+ * Topology comes from sysfs:
+ *   /sys/devices/system/cpu/online                      Online logical CPUs
+ *   /sys/devices/system/cpu/cpuN/topology/core_id       Physical core
+ *   /sys/devices/system/cpu/cpuN/topology/physical_package_id
+ *   /sys/devices/system/node/nodeN/cpulist              NUMA membership
+ *
+ * Logical CPUs sharing (package, core_id) are SMT siblings and are always
+ * handed out together. Each physical core keeps a count of sessions pinned
+ * to it; new sessions take the least-used cores of the least-used node.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sched.h>
+
+#include "encode_sched.h"
+#include "lockstat.h"
+#include "log.h"
+
+/** Bits per word of EncodeBudget.cpus */
+#define MASK_BITS (8 * sizeof(unsigned long))
+
+/** Hard limits for the static topology tables */
+#define MAX_CORES 256
+#define MAX_SIBLINGS 8
+
+/**
+ * One physical core and its SMT siblings
+ */
+typedef struct {
+    int package;                /**< physical_package_id */
+    int core_id;                /**< core_id within the package */
+    int node;                   /**< NUMA node */
+    int ncpus;                  /**< Number of logical CPUs (SMT siblings) */
+    int cpus[MAX_SIBLINGS];     /**< Logical CPU numbers */
+    int sessions;               /**< Sessions currently pinned here */
+} PhysCore;
+
+static PhysCore cores[MAX_CORES];
+static int num_cores = 0;
+static int num_cpus = 0;
+static int num_nodes = 1;
+static int sched_enabled = 0;
+
+/** Threads handed out to sessions that are still running */
+static int committed_threads = 0;
+static int active_sessions = 0;
+
+/** Mutex for core accounting */
+static TrackedMutex sched_mutex = TRACKED_MUTEX_INITIALIZER("encode_sched");
+
+static int read_int_file(const char *path, int fallback) {
+    FILE *f = fopen(path, "r");
+    if (!f) return fallback;
+    int v;
+    if (fscanf(f, "%d", &v) != 1) v = fallback;
+    fclose(f);
+    return v;
+}
+
+/**
+ * Parse a sysfs CPU list ("0-3,8-11") into a cpu_set_t
+ */
+static void parse_cpulist(const char *list, cpu_set_t *set) {
+    CPU_ZERO(set);
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long lo = strtol(p, &end, 10);
+        if (end == p) break;
+        long hi = lo;
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+        }
+        for (long c = lo; c <= hi && c < CPU_SETSIZE; c++) CPU_SET(c, set);
+        p = end;
+        if (*p == ',') p++;
+        else break;
+    }
+}
+
+static int read_cpulist(const char *path, cpu_set_t *set) {
+    char line[1024];
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    if (!fgets(line, sizeof(line), f)) {
+        fclose(f);
+        return 0;
+    }
+    fclose(f);
+    parse_cpulist(line, set);
+    return 1;
+}
+
+/**
+ * Map each logical CPU to its NUMA node (all zero without NUMA sysfs)
+ */
+static void load_numa_nodes(int *cpu_node) {
+    num_nodes = 1;
+    DIR *d = opendir("/sys/devices/system/node");
+    if (!d) return;
+
+    struct dirent *ent;
+    int max_node = 0;
+    while ((ent = readdir(d))) {
+        int node;
+        if (sscanf(ent->d_name, "node%d", &node) != 1) continue;
+
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        cpu_set_t set;
+        if (!read_cpulist(path, &set)) continue;
+
+        for (int c = 0; c < CPU_SETSIZE; c++) {
+            if (CPU_ISSET(c, &set)) cpu_node[c] = node;
+        }
+        if (node > max_node) max_node = node;
+    }
+    closedir(d);
+    num_nodes = max_node + 1;
+}
+
+void encode_sched_init(int enabled) {
+    tracked_lock(&sched_mutex);
+    sched_enabled = enabled;
+    num_cores = 0;
+    num_cpus = 0;
+    committed_threads = 0;
+    active_sessions = 0;
+
+    cpu_set_t online;
+    if (!read_cpulist("/sys/devices/system/cpu/online", &online)) {
+        /* No sysfs: fall back to the current affinity mask */
+        if (sched_getaffinity(0, sizeof(online), &online) != 0) {
+            CPU_ZERO(&online);
+            CPU_SET(0, &online);
+        }
+    }
+
+    static int cpu_node[CPU_SETSIZE];
+    memset(cpu_node, 0, sizeof(cpu_node));
+    load_numa_nodes(cpu_node);
+
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (!CPU_ISSET(c, &online)) continue;
+        num_cpus++;
+
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", c);
+        int core_id = read_int_file(path, c);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", c);
+        int package = read_int_file(path, 0);
+
+        /* Group SMT siblings under one physical core */
+        PhysCore *pc = NULL;
+        for (int i = 0; i < num_cores; i++) {
+            if (cores[i].package == package && cores[i].core_id == core_id) {
+                pc = &cores[i];
+                break;
+            }
+        }
+        if (!pc) {
+            if (num_cores >= MAX_CORES) continue;
+            pc = &cores[num_cores++];
+            memset(pc, 0, sizeof(*pc));
+            pc->package = package;
+            pc->core_id = core_id;
+            pc->node = cpu_node[c];
+        }
+        if (pc->ncpus < MAX_SIBLINGS) pc->cpus[pc->ncpus++] = c;
+    }
+    tracked_unlock(&sched_mutex);
+
+    LOG_INFO("ENCODE", "Topology: %d CPUs, %d cores, %d NUMA node(s), budgeting %s",
+             num_cpus, num_cores, num_nodes, enabled ? "on" : "off");
+}
+
+static double read_loadavg(void) {
+    double load = 0;
+    FILE *f = fopen("/proc/loadavg", "r");
+    if (!f) return 0;
+    if (fscanf(f, "%lf", &load) != 1) load = 0;
+    fclose(f);
+    return load;
+}
+
+/**
+ * Pick up to `want` least-used cores of one node into `out`
+ *
+ * @return Sum of session counts on the picked cores (lower is better),
+ *         with a large penalty when the node can't supply `want` cores
+ */
+static int pick_cores(int node, int want, int *out, int *picked) {
+    int idx[MAX_CORES];
+    int n = 0;
+    for (int i = 0; i < num_cores; i++) {
+        if (cores[i].node == node) idx[n++] = i;
+    }
+
+    /* Insertion sort by sessions; stable so cores fill in sysfs order */
+    for (int i = 1; i < n; i++) {
+        int v = idx[i];
+        int j = i - 1;
+        while (j >= 0 && cores[idx[j]].sessions > cores[v].sessions) {
+            idx[j + 1] = idx[j];
+            j--;
+        }
+        idx[j + 1] = v;
+    }
+
+    int cost = 0;
+    *picked = (n < want) ? n : want;
+    for (int i = 0; i < *picked; i++) {
+        out[i] = idx[i];
+        cost += cores[idx[i]].sessions;
+    }
+    if (*picked < want) cost += 1000 * (want - *picked);
+    return cost;
+}
+
+static void mask_set(unsigned long *mask, int cpu) {
+    if (cpu >= 0 && cpu < ENCODE_MAX_CPUS) mask[cpu / MASK_BITS] |= 1UL << (cpu % MASK_BITS);
+}
+
+static int mask_isset(const unsigned long *mask, int cpu) {
+    return cpu >= 0 && cpu < ENCODE_MAX_CPUS && (mask[cpu / MASK_BITS] >> (cpu % MASK_BITS) & 1);
+}
+
+static int mask_count(const unsigned long *mask) {
+    int n = 0;
+    for (size_t i = 0; i < ENCODE_MAX_CPUS / MASK_BITS; i++) n += __builtin_popcountl(mask[i]);
+    return n;
+}
+
+int encode_sched_acquire(EncodeBudget *budget) {
+    memset(budget, 0, sizeof(*budget));
+    budget->node = -1;
+
+    tracked_lock(&sched_mutex);
+    if (!sched_enabled || num_cores == 0) {
+        tracked_unlock(&sched_mutex);
+        return 0;
+    }
+
+    /* Fair share of physical cores for everyone including the newcomer */
+    int sessions = active_sessions + 1;
+    int want = (num_cores + sessions - 1) / sessions;
+
+    /* Shrink further if something other than our encoders is loading the box */
+    double external = read_loadavg() - committed_threads;
+    if (external > 1.0 && num_cpus > 0) {
+        double spare = (num_cpus - external) / num_cpus;
+        if (spare < 0) spare = 0;
+        want = (int)(want * spare);
+    }
+    if (want < 1) want = 1;
+    if (want > ENCODE_MAX_CORES_PER_SESSION) want = ENCODE_MAX_CORES_PER_SESSION;
+
+    /* Keep the session inside the least-used NUMA node */
+    int best[MAX_CORES], best_n = 0, best_cost = -1, best_node = 0;
+    for (int node = 0; node < num_nodes; node++) {
+        int cand[MAX_CORES], n;
+        int cost = pick_cores(node, want, cand, &n);
+        if (n == 0) continue;
+        if (best_cost < 0 || cost < best_cost) {
+            best_cost = cost;
+            best_node = node;
+            best_n = n;
+            memcpy(best, cand, sizeof(int) * n);
+        }
+    }
+
+    for (int i = 0; i < best_n; i++) {
+        PhysCore *pc = &cores[best[i]];
+        pc->sessions++;
+        for (int s = 0; s < pc->ncpus; s++) mask_set(budget->cpus, pc->cpus[s]);
+    }
+
+    budget->active = 1;
+    budget->node = best_node;
+    budget->threads = mask_count(budget->cpus);
+    committed_threads += budget->threads;
+    active_sessions++;
+    tracked_unlock(&sched_mutex);
+
+    LOG_DEBUG("ENCODE", "Budget: %d threads on %d core(s), node %d (%d sessions)",
+              budget->threads, best_n, best_node, sessions);
+    return 1;
+}
+
+void encode_sched_release(EncodeBudget *budget) {
+    if (!budget->active) return;
+
+    tracked_lock(&sched_mutex);
+    for (int i = 0; i < num_cores; i++) {
+        if (mask_isset(budget->cpus, cores[i].cpus[0]) && cores[i].sessions > 0) {
+            cores[i].sessions--;
+        }
+    }
+    committed_threads -= budget->threads;
+    if (committed_threads < 0) committed_threads = 0;
+    if (active_sessions > 0) active_sessions--;
+    tracked_unlock(&sched_mutex);
+
+    budget->active = 0;
+}
+
+void encode_sched_apply(pid_t pid, const EncodeBudget *budget) {
+    if (!budget->active) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu = 0; cpu < ENCODE_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+        if (mask_isset(budget->cpus, cpu)) CPU_SET(cpu, &set);
+    }
+    sched_setaffinity(pid, sizeof(set), &set);
+}
+
+void encode_sched_topology(int *out_cores, int *out_cpus, int *out_nodes) {
+    if (out_cores) *out_cores = num_cores;
+    if (out_cpus) *out_cpus = num_cpus;
+    if (out_nodes) *out_nodes = num_nodes;
+}
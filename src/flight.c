@@ -0,0 +1,170 @@
+/**
+ * @file flight.c
+ * @brief Always-on in-memory flight recorder
+ *
+ * Writers claim a slot with one atomic increment of ring_head. The slot's
+ * seq is zeroed while the fields are filled and published last with a
+ * release store, so a dump taken mid-write sees either the old event, a
+ * zero seq (skipped by the decoder) or the complete new event.
+ *
+ * Everything reachable from the signal handlers is async-signal-safe:
+ * clock_gettime, open/write/close/rename and no allocation or stdio.
+ */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/syscall.h>
+
+#include "flight.h"
+#include "config.h"
+#include "log.h"
+
+static FlightEvent ring[FLIGHT_RING_SIZE];
+static uint64_t ring_head = 0;
+
+/** Cached kernel TID; gettid is a syscall per call otherwise */
+static __thread uint32_t cached_tid = 0;
+
+static const char *event_names[FLIGHT_NUM_EVENTS] = {
+    "NONE", "ACCEPT", "ROUTE", "SPAWN", "SPAWN_FAIL", "FIRST_BYTE", "WRITE_STALL",
+    "RELAY_END", "CHILD_EXIT", "SCHED_TICK", "REC_START", "REC_STOP", "REC_DIED", "DUMP",
+    "TIMEOUT"
+};
+
+static const char *route_names[FLIGHT_NUM_ROUTES] = {
+    "static", "api", "play", "stream", "transcode", "playlist", "debug"
+};
+
+static uint64_t clock_ns(clockid_t clk) {
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void flight_record(FlightEventType type, int64_t a, int64_t b) {
+    if (!cached_tid) cached_tid = (uint32_t)syscall(SYS_gettid);
+
+    uint64_t seq = __atomic_fetch_add(&ring_head, 1, __ATOMIC_RELAXED);
+    FlightEvent *e = &ring[seq & (FLIGHT_RING_SIZE - 1)];
+
+    __atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    e->ts_ns = clock_ns(CLOCK_MONOTONIC);
+    e->tid = cached_tid;
+    e->type = (uint16_t)type;
+    e->reserved = 0;
+    e->a = a;
+    e->b = b;
+    __atomic_store_n(&e->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+unsigned long flight_dump_size(void) {
+    return sizeof(FlightHeader) + sizeof(ring);
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int flight_write(int fd, FlightReason reason) {
+    flight_record(FLIGHT_DUMP, reason, 0);
+
+    FlightHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, FLIGHT_MAGIC, 4);
+    hdr.version = FLIGHT_VERSION;
+    hdr.event_size = sizeof(FlightEvent);
+    hdr.capacity = FLIGHT_RING_SIZE;
+    hdr.head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+    hdr.mono_ns = clock_ns(CLOCK_MONOTONIC);
+    hdr.real_ns = clock_ns(CLOCK_REALTIME);
+    hdr.reason = reason;
+    hdr.pid = (uint32_t)getpid();
+
+    if (write_all(fd, &hdr, sizeof(hdr)) < 0) return -1;
+    return write_all(fd, ring, sizeof(ring));
+}
+
+int flight_dump_file(FlightReason reason) {
+    int fd = open(FLIGHT_DUMP_FILE ".tmp", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+    int rc = flight_write(fd, reason);
+    close(fd);
+    if (rc == 0) rc = rename(FLIGHT_DUMP_FILE ".tmp", FLIGHT_DUMP_FILE);
+    return rc;
+}
+
+static void on_dump_signal(int sig) {
+    (void)sig;
+    int saved = errno;
+    flight_dump_file(FLIGHT_REASON_SIGNAL);
+    errno = saved;
+}
+
+static void on_fatal_signal(int sig) {
+    flight_dump_file(FLIGHT_REASON_CRASH);
+    /* SA_RESETHAND restored the default action; re-raise to crash as usual */
+    raise(sig);
+}
+
+void flight_init(void) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+
+    sa.sa_handler = on_dump_signal;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+
+    sa.sa_handler = on_fatal_signal;
+    sa.sa_flags = SA_RESETHAND | SA_NODEFER;
+    int fatal[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+    for (size_t i = 0; i < sizeof(fatal) / sizeof(fatal[0]); i++) sigaction(fatal[i], &sa, NULL);
+
+    LOG_INFO("FLIGHT", "Flight recorder on (%d events, %lu KB); SIGUSR1 dumps to %s",
+             FLIGHT_RING_SIZE, (unsigned long)(sizeof(ring) / 1024), FLIGHT_DUMP_FILE);
+}
+
+const char *flight_event_name(int type) {
+    if (type < 0 || type >= FLIGHT_NUM_EVENTS) return "UNKNOWN";
+    return event_names[type];
+}
+
+const char *flight_route_name(int route) {
+    if (route < 0 || route >= FLIGHT_NUM_ROUTES) return "unknown";
+    return route_names[route];
+}
+
+const char *flight_reason_name(int reason) {
+    switch (reason) {
+        case FLIGHT_REASON_SIGNAL: return "SIGUSR1";
+        case FLIGHT_REASON_CRASH: return "crash";
+        case FLIGHT_REASON_HTTP: return "/debug/flight";
+        default: return "unknown";
+    }
+}
+
+const char *flight_timeout_name(int timeout) {
+    switch (timeout) {
+        case FLIGHT_TIMEOUT_REQUEST: return "request";
+        case FLIGHT_TIMEOUT_IDLE: return "idle";
+        case FLIGHT_TIMEOUT_SEND: return "send";
+        case FLIGHT_TIMEOUT_SESSION: return "session";
+        default: return "unknown";
+    }
+}
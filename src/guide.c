@@ -0,0 +1,1173 @@
+/**
+ * @file guide.c
+ * @brief In-memory EPG store fed from ZapLinkCore
+ *
+ * The core is asked with a plain HTTP/1.0 GET, so its answer is
+ * delimited by the connection closing (a chunked one is decoded anyway).
+ * The parser only understands the document shape it is fed: decoded
+ * strings are copied into one pool as large as the document, which they
+ * can never outgrow since every string loses at least its quotes.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "guide.h"
+#include "discovery.h"
+#include "lockstat.h"
+#include "thread_state.h"
+#include "log.h"
+
+/** Nesting accepted inside skipped values */
+#define MAX_DEPTH 32
+
+static GuideSnapshot *current;
+static unsigned long generation;
+static unsigned long long current_hash;
+
+/* Change sequence, only advanced by the refresh thread */
+static long long epoch;
+static unsigned long change_seq;
+static TrackedMutex guide_mutex = TRACKED_MUTEX_INITIALIZER("guide");
+
+static long long wall_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static unsigned long long fnv1a(const char *data, size_t len) {
+    unsigned long long h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* ============================================================================
+ * Fetching
+ * ============================================================================ */
+
+/**
+ * Split "http://host:port" (host may be a bracketed IPv6 address)
+ */
+static int split_url(const char *url, char *host, size_t host_len, char *port, size_t port_len) {
+    if (strncmp(url, "http://", 7) != 0) return -1;
+    const char *h = url + 7;
+    const char *end;
+    if (*h == '[') {
+        h++;
+        end = strchr(h, ']');
+        if (!end) return -1;
+        snprintf(host, host_len, "%.*s", (int)(end - h), h);
+        end++;
+    } else {
+        end = h + strcspn(h, ":/");
+        snprintf(host, host_len, "%.*s", (int)(end - h), h);
+    }
+    if (*end == ':') snprintf(port, port_len, "%.*s", (int)strcspn(end + 1, "/"), end + 1);
+    else snprintf(port, port_len, "80");
+    return host[0] ? 0 : -1;
+}
+
+static int connect_to(const char *host, const char *port) {
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res;
+    if (getaddrinfo(host, port, &hints, &res) != 0) return -1;
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+        // Bounds connect() too
+        struct timeval tv = { GUIDE_FETCH_TIMEOUT_MS / 1000, (GUIDE_FETCH_TIMEOUT_MS % 1000) * 1000 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+/**
+ * Decode a chunked body in place
+ *
+ * @return Decoded length, or -1 if malformed
+ */
+static ssize_t dechunk(char *body, size_t len) {
+    char *in = body, *end = body + len, *out = body;
+    for (;;) {
+        char *line_end = memmem(in, end - in, "\r\n", 2);
+        if (!line_end) return -1;
+        size_t size = strtoul(in, NULL, 16);
+        in = line_end + 2;
+        if (size == 0) return out - body;
+        if ((size_t)(end - in) < size + 2) return -1;
+        memmove(out, in, size);
+        out += size;
+        in += size + 2;
+    }
+}
+
+/**
+ * GET base/xmltv.json
+ *
+ * @return Body (caller frees), or NULL
+ */
+static char *fetch_guide(const char *base, size_t *out_len) {
+    char host[256], port[16];
+    if (split_url(base, host, sizeof(host), port, sizeof(port)) < 0) {
+        LOG_WARN("GUIDE", "Cannot parse core URL %s", base);
+        return NULL;
+    }
+    int fd = connect_to(host, port);
+    if (fd < 0) {
+        LOG_WARN("GUIDE", "Cannot connect to core at %s: %s", base, strerror(errno));
+        return NULL;
+    }
+
+    char request[512];
+    int rlen = snprintf(request, sizeof(request),
+                        "GET /xmltv.json HTTP/1.0\r\nHost: %s\r\nAccept: application/json\r\n\r\n", host);
+    size_t cap = 1 << 20, len = 0;
+    char *buf = malloc(cap + 1);
+    if (!buf || send(fd, request, rlen, MSG_NOSIGNAL) != rlen) {
+        free(buf);
+        close(fd);
+        return NULL;
+    }
+
+    ThreadStateMark mark = thread_state_enter(THREAD_SOCKET_READ, "core");
+    ssize_t n;
+    while ((n = recv(fd, buf + len, cap - len, 0)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        len += n;
+        if (len == cap) {
+            if (cap >= GUIDE_MAX_BYTES) {
+                n = -1;
+                errno = EFBIG;
+                break;
+            }
+            char *grown = realloc(buf, cap * 2 + 1);
+            if (!grown) {
+                n = -1;
+                break;
+            }
+            buf = grown;
+            cap *= 2;
+        }
+    }
+    thread_state_leave(mark);
+    close(fd);
+    if (n < 0) {
+        LOG_WARN("GUIDE", "Reading the guide from %s failed: %s", base, strerror(errno));
+        free(buf);
+        return NULL;
+    }
+    buf[len] = '\0';
+
+    int status = 0;
+    sscanf(buf, "HTTP/%*s %d", &status);
+    char *body = strstr(buf, "\r\n\r\n");
+    if (status != 200 || !body) {
+        LOG_WARN("GUIDE", "Core answered /xmltv.json with status %d", status);
+        free(buf);
+        return NULL;
+    }
+    *body = '\0';
+    body += 4;
+    size_t body_len = len - (body - buf);
+    if (strcasestr(buf, "\r\nTransfer-Encoding: chunked")) {
+        ssize_t decoded = dechunk(body, body_len);
+        if (decoded < 0) {
+            LOG_WARN("GUIDE", "Malformed chunked guide from %s", base);
+            free(buf);
+            return NULL;
+        }
+        body_len = decoded;
+    }
+    memmove(buf, body, body_len);
+    buf[body_len] = '\0';
+    *out_len = body_len;
+    return buf;
+}
+
+/* ============================================================================
+ * Parsing
+ * ============================================================================ */
+
+typedef struct {
+    const char *p;
+    const char *end;
+    char *pool;                /**< Next free byte of the string pool */
+} Parser;
+
+static void skip_ws(Parser *ps) {
+    while (ps->p < ps->end && (*ps->p == ' ' || *ps->p == '\t' || *ps->p == '\n' || *ps->p == '\r')) ps->p++;
+}
+
+static int expect(Parser *ps, char c) {
+    skip_ws(ps);
+    if (ps->p >= ps->end || *ps->p != c) return -1;
+    ps->p++;
+    return 0;
+}
+
+/** Consume c if it is next */
+static int accept_char(Parser *ps, char c) {
+    skip_ws(ps);
+    if (ps->p < ps->end && *ps->p == c) {
+        ps->p++;
+        return 1;
+    }
+    return 0;
+}
+
+static int hex4(const char *p, unsigned *out) {
+    unsigned v = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        v <<= 4;
+        if (c >= '0' && c <= '9') v |= c - '0';
+        else if (c >= 'a' && c <= 'f') v |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') v |= c - 'A' + 10;
+        else return -1;
+    }
+    *out = v;
+    return 0;
+}
+
+static char *put_utf8(char *out, unsigned cp) {
+    if (cp < 0x80) {
+        *out++ = cp;
+    } else if (cp < 0x800) {
+        *out++ = 0xC0 | (cp >> 6);
+        *out++ = 0x80 | (cp & 0x3F);
+    } else if (cp < 0x10000) {
+        *out++ = 0xE0 | (cp >> 12);
+        *out++ = 0x80 | ((cp >> 6) & 0x3F);
+        *out++ = 0x80 | (cp & 0x3F);
+    } else {
+        *out++ = 0xF0 | (cp >> 18);
+        *out++ = 0x80 | ((cp >> 12) & 0x3F);
+        *out++ = 0x80 | ((cp >> 6) & 0x3F);
+        *out++ = 0x80 | (cp & 0x3F);
+    }
+    return out;
+}
+
+/**
+ * Decode a string into the pool
+ */
+static int parse_string(Parser *ps, const char **out) {
+    if (expect(ps, '"') < 0) return -1;
+    char *dst = ps->pool;
+    *out = dst;
+    while (ps->p < ps->end && *ps->p != '"') {
+        char c = *ps->p++;
+        if (c != '\\') {
+            *dst++ = c;
+            continue;
+        }
+        if (ps->p >= ps->end) return -1;
+        c = *ps->p++;
+        switch (c) {
+            case 'b': *dst++ = '\b'; break;
+            case 'f': *dst++ = '\f'; break;
+            case 'n': *dst++ = '\n'; break;
+            case 'r': *dst++ = '\r'; break;
+            case 't': *dst++ = '\t'; break;
+            case 'u': {
+                unsigned cp, lo;
+                if (ps->end - ps->p < 4 || hex4(ps->p, &cp) < 0) return -1;
+                ps->p += 4;
+                if (cp >= 0xD800 && cp < 0xDC00 && ps->end - ps->p >= 6 && ps->p[0] == '\\' &&
+                    ps->p[1] == 'u' && hex4(ps->p + 2, &lo) == 0 && lo >= 0xDC00 && lo < 0xE000) {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    ps->p += 6;
+                }
+                dst = put_utf8(dst, cp);
+                break;
+            }
+            default: *dst++ = c; break;
+        }
+    }
+    if (ps->p >= ps->end) return -1;
+    ps->p++;
+    *dst++ = '\0';
+    ps->pool = dst;
+    return 0;
+}
+
+/**
+ * A scalar as text: strings decoded, numbers and literals copied
+ * verbatim, null as ""
+ */
+static int parse_scalar(Parser *ps, const char **out) {
+    skip_ws(ps);
+    if (ps->p < ps->end && *ps->p == '"') return parse_string(ps, out);
+    const char *start = ps->p;
+    while (ps->p < ps->end && !strchr(",}] \t\r\n", *ps->p)) ps->p++;
+    if (ps->p == start) return -1;
+    char *dst = ps->pool;
+    size_t len = ps->p - start;
+    if (len == 4 && memcmp(start, "null", 4) == 0) len = 0;
+    memcpy(dst, start, len);
+    dst[len] = '\0';
+    *out = dst;
+    ps->pool = dst + len + 1;
+    return 0;
+}
+
+static int skip_value(Parser *ps, int depth) {
+    skip_ws(ps);
+    if (ps->p >= ps->end || depth > MAX_DEPTH) return -1;
+    char open = *ps->p;
+    if (open != '{' && open != '[') {
+        // Decoding into the pool costs no more than it would take to skip
+        const char *unused;
+        return parse_scalar(ps, &unused);
+    }
+    ps->p++;
+    char close = open == '{' ? '}' : ']';
+    if (accept_char(ps, close)) return 0;
+    do {
+        if (open == '{') {
+            const char *key;
+            if (parse_string(ps, &key) < 0 || expect(ps, ':') < 0) return -1;
+        }
+        if (skip_value(ps, depth + 1) < 0) return -1;
+    } while (accept_char(ps, ','));
+    return expect(ps, close);
+}
+
+typedef struct {
+    GuideChannel *channels;
+    int num_channels, cap_channels;
+    GuideProgram *programs;
+    const char **program_channels;   /**< Channel id of each program until resolved */
+    int num_programs, cap_programs;
+    const char **texts;
+    int num_texts, cap_texts;
+    int *text_slots;                 /**< Open-addressed text ids, -1 = empty */
+    int num_slots;
+} ParsedGuide;
+
+static int text_slot(const ParsedGuide *pg, const char *text) {
+    int mask = pg->num_slots - 1;
+    int i = fnv1a(text, strlen(text)) & mask;
+    while (pg->text_slots[i] >= 0 && strcmp(pg->texts[pg->text_slots[i]], text) != 0) i = (i + 1) & mask;
+    return i;
+}
+
+/**
+ * Id of a text; a repeat points at the first copy instead and, if it was
+ * just decoded to the end of the pool (ps set), gives that space back
+ *
+ * @return Text id, or -1 if out of memory
+ */
+static int intern(Parser *ps, ParsedGuide *pg, const char **text) {
+    if ((pg->num_texts + 1) * 2 > pg->num_slots) {
+        int num_slots = pg->num_slots ? pg->num_slots * 2 : 1024;
+        int *slots = malloc(num_slots * sizeof(int));
+        if (!slots) return -1;
+        free(pg->text_slots);
+        pg->text_slots = slots;
+        pg->num_slots = num_slots;
+        memset(slots, -1, num_slots * sizeof(int));
+        for (int id = 0; id < pg->num_texts; id++) slots[text_slot(pg, pg->texts[id])] = id;
+    }
+    int slot = text_slot(pg, *text);
+    int id = pg->text_slots[slot];
+    if (id >= 0) {
+        if (ps) ps->pool = (char *)*text;
+        *text = pg->texts[id];
+        return id;
+    }
+    if (pg->num_texts == pg->cap_texts) {
+        pg->cap_texts = pg->cap_texts ? pg->cap_texts * 2 : 1024;
+        const char **grown = realloc(pg->texts, pg->cap_texts * sizeof(*grown));
+        if (!grown) return -1;
+        pg->texts = grown;
+    }
+    pg->texts[pg->num_texts] = *text;
+    pg->text_slots[slot] = pg->num_texts;
+    return pg->num_texts++;
+}
+
+static int parse_channel(Parser *ps, ParsedGuide *pg) {
+    GuideChannel ch = { "", "", "", 0, 0 };
+    if (expect(ps, '{') < 0) return -1;
+    if (!accept_char(ps, '}')) {
+        do {
+            const char *key;
+            if (parse_string(ps, &key) < 0 || expect(ps, ':') < 0) return -1;
+            int rc;
+            if (strcmp(key, "id") == 0) rc = parse_scalar(ps, &ch.id);
+            else if (strcmp(key, "name") == 0) rc = parse_scalar(ps, &ch.name);
+            else if (strcmp(key, "icon") == 0) rc = parse_scalar(ps, &ch.icon);
+            else rc = skip_value(ps, 1);
+            if (rc < 0) return -1;
+        } while (accept_char(ps, ','));
+        if (expect(ps, '}') < 0) return -1;
+    }
+    if (!ch.id[0]) return 0;
+    if (pg->num_channels == pg->cap_channels) {
+        pg->cap_channels = pg->cap_channels ? pg->cap_channels * 2 : 64;
+        GuideChannel *grown = realloc(pg->channels, pg->cap_channels * sizeof(*grown));
+        if (!grown) return -1;
+        pg->channels = grown;
+    }
+    pg->channels[pg->num_channels++] = ch;
+    return 0;
+}
+
+static int parse_program(Parser *ps, ParsedGuide *pg) {
+    GuideProgram prog = { 0, 0, "", "", -1, -1, -1, 0, 0 };
+    const char *channel = "", *start = "0", *end = "0";
+    if (expect(ps, '{') < 0) return -1;
+    if (!accept_char(ps, '}')) {
+        do {
+            const char *key;
+            if (parse_string(ps, &key) < 0 || expect(ps, ':') < 0) return -1;
+            int rc;
+            if (strcmp(key, "channel") == 0) rc = parse_scalar(ps, &channel);
+            else if (strcmp(key, "start") == 0) rc = parse_scalar(ps, &start);
+            else if (strcmp(key, "end") == 0) rc = parse_scalar(ps, &end);
+            else if (strcmp(key, "title") == 0) {
+                rc = parse_scalar(ps, &prog.title);
+                if (rc == 0 && (prog.title_id = intern(ps, pg, &prog.title)) < 0) rc = -1;
+            } else if (strcmp(key, "desc") == 0 || strcmp(key, "description") == 0) {
+                rc = parse_scalar(ps, &prog.description);
+                if (rc == 0 && (prog.description_id = intern(ps, pg, &prog.description)) < 0) rc = -1;
+            } else {
+                rc = skip_value(ps, 1);
+            }
+            if (rc < 0) return -1;
+        } while (accept_char(ps, ','));
+        if (expect(ps, '}') < 0) return -1;
+    }
+    prog.start = atoll(start);
+    prog.end = atoll(end);
+    if (!channel[0] || prog.end <= prog.start) return 0;
+    // Absent title or description: the interned ""
+    if (prog.title_id < 0 && (prog.title_id = intern(NULL, pg, &prog.title)) < 0) return -1;
+    if (prog.description_id < 0 && (prog.description_id = intern(NULL, pg, &prog.description)) < 0) return -1;
+    if (pg->num_programs == pg->cap_programs) {
+        pg->cap_programs = pg->cap_programs ? pg->cap_programs * 2 : 1024;
+        GuideProgram *grown = realloc(pg->programs, pg->cap_programs * sizeof(*grown));
+        if (!grown) return -1;
+        pg->programs = grown;
+        const char **ids = realloc(pg->program_channels, pg->cap_programs * sizeof(*ids));
+        if (!ids) return -1;
+        pg->program_channels = ids;
+    }
+    pg->program_channels[pg->num_programs] = channel;
+    pg->programs[pg->num_programs++] = prog;
+    return 0;
+}
+
+static int parse_array(Parser *ps, ParsedGuide *pg, int (*item)(Parser *, ParsedGuide *)) {
+    if (expect(ps, '[') < 0) return -1;
+    if (accept_char(ps, ']')) return 0;
+    do {
+        if (item(ps, pg) < 0) return -1;
+    } while (accept_char(ps, ','));
+    return expect(ps, ']');
+}
+
+/** Orders indexes into the channel array passed as arg by id */
+static int cmp_channel_index(const void *a, const void *b, void *arg) {
+    const GuideChannel *channels = arg;
+    return strcmp(channels[*(const int *)a].id, channels[*(const int *)b].id);
+}
+
+static int cmp_program(const void *a, const void *b) {
+    const GuideProgram *x = a, *y = b;
+    if (x->channel != y->channel) return x->channel - y->channel;
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+/**
+ * Point programs at their channel (dropping unknown ones), group them by
+ * channel in start order and fill in each channel's range
+ */
+static int resolve(ParsedGuide *pg) {
+    int *by_id = malloc((pg->num_channels ? pg->num_channels : 1) * sizeof(int));
+    if (!by_id) return -1;
+    for (int i = 0; i < pg->num_channels; i++) by_id[i] = i;
+    qsort_r(by_id, pg->num_channels, sizeof(int), cmp_channel_index, pg->channels);
+
+    int kept = 0;
+    for (int i = 0; i < pg->num_programs; i++) {
+        const char *id = pg->program_channels[i];
+        int lo = 0, hi = pg->num_channels - 1, found = -1;
+        while (lo <= hi) {
+            int mid = (lo + hi) / 2;
+            int c = strcmp(pg->channels[by_id[mid]].id, id);
+            if (c == 0) {
+                found = by_id[mid];
+                break;
+            }
+            if (c < 0) lo = mid + 1;
+            else hi = mid - 1;
+        }
+        if (found < 0) continue;
+        pg->programs[kept] = pg->programs[i];
+        pg->programs[kept++].channel = found;
+    }
+    free(by_id);
+    pg->num_programs = kept;
+
+    qsort(pg->programs, pg->num_programs, sizeof(GuideProgram), cmp_program);
+    for (int i = 0; i < pg->num_programs; i++) {
+        GuideChannel *ch = &pg->channels[pg->programs[i].channel];
+        if (ch->count++ == 0) ch->first = i;
+    }
+    return 0;
+}
+
+GuideSnapshot *guide_parse(const char *json, size_t len) {
+    GuideSnapshot *g = calloc(1, sizeof(*g));
+    char *pool = malloc(len + 1);
+    ParsedGuide pg;
+    memset(&pg, 0, sizeof(pg));
+    if (!g || !pool) goto fail;
+
+    Parser ps = { json, json + len, pool };
+    if (expect(&ps, '{') < 0) goto fail;
+    if (!accept_char(&ps, '}')) {
+        do {
+            const char *key;
+            int rc;
+            if (parse_string(&ps, &key) < 0 || expect(&ps, ':') < 0) goto fail;
+            if (strcmp(key, "channels") == 0) rc = parse_array(&ps, &pg, parse_channel);
+            else if (strcmp(key, "programs") == 0) rc = parse_array(&ps, &pg, parse_program);
+            else rc = skip_value(&ps, 0);
+            if (rc < 0) goto fail;
+        } while (accept_char(&ps, ','));
+        if (expect(&ps, '}') < 0) goto fail;
+    }
+    if (resolve(&pg) < 0) goto fail;
+
+    free(pg.program_channels);
+    free(pg.text_slots);
+    g->channels = pg.channels;
+    g->num_channels = pg.num_channels;
+    g->programs = pg.programs;
+    g->num_programs = pg.num_programs;
+    g->strings = pool;
+    g->texts = pg.texts;
+    g->num_texts = pg.num_texts;
+    g->fetched_at = wall_ms();
+    atomic_init(&g->refs, 1);
+    return g;
+
+fail:
+    free(pg.channels);
+    free(pg.programs);
+    free(pg.program_channels);
+    free(pg.texts);
+    free(pg.text_slots);
+    free(pool);
+    free(g);
+    return NULL;
+}
+
+/* ============================================================================
+ * Store
+ * ============================================================================ */
+
+GuideSnapshot *guide_acquire(void) {
+    tracked_lock(&guide_mutex);
+    GuideSnapshot *g = current;
+    if (g) atomic_fetch_add(&g->refs, 1);
+    tracked_unlock(&guide_mutex);
+    return g;
+}
+
+void guide_release(GuideSnapshot *guide) {
+    if (!guide || atomic_fetch_sub(&guide->refs, 1) != 1) return;
+    free(guide->channels);
+    free(guide->programs);
+    free(guide->strings);
+    free(guide->texts);
+    free(guide->tombstones);
+    free(guide);
+}
+
+unsigned long guide_generation(void) {
+    tracked_lock(&guide_mutex);
+    unsigned long gen = generation;
+    tracked_unlock(&guide_mutex);
+    return gen;
+}
+
+static int lineup_equal(const GuideSnapshot *a, const GuideSnapshot *b) {
+    if (a->num_channels != b->num_channels) return 0;
+    for (int i = 0; i < a->num_channels; i++) {
+        const GuideChannel *x = &a->channels[i], *y = &b->channels[i];
+        if (strcmp(x->id, y->id) || strcmp(x->name, y->name) || strcmp(x->icon, y->icon)) return 0;
+    }
+    return 1;
+}
+
+static int add_tombstone(GuideSnapshot *g, int *cap, const char *channel, long long start) {
+    if (g->num_tombstones == *cap) {
+        *cap = *cap ? *cap * 2 : 1024;
+        GuideTombstone *grown = realloc(g->tombstones, *cap * sizeof(*grown));
+        if (!grown) return -1;
+        g->tombstones = grown;
+    }
+    GuideTombstone *t = &g->tombstones[g->num_tombstones++];
+    snprintf(t->channel, sizeof(t->channel), "%s", channel);
+    t->start = start;
+    t->seq = ++change_seq;
+    return 0;
+}
+
+/**
+ * Number the changes from old to g: carry over the seq of programs that
+ * are unchanged, give the rest and a tombstone per deleted program the
+ * next numbers
+ *
+ * @return 0, or -1 if out of memory (g then restarts the history)
+ */
+static int number_changes(const GuideSnapshot *old, GuideSnapshot *g) {
+    g->epoch = epoch;
+    if (!old) {
+        // Everything is new; no client can hold part of it
+        g->seq = g->channels_seq = g->horizon = ++change_seq;
+        for (int i = 0; i < g->num_programs; i++) g->programs[i].seq = g->programs[i].created = g->seq;
+        return 0;
+    }
+
+    int cap = 0;
+    g->horizon = old->horizon;
+    if (old->num_tombstones) {
+        cap = old->num_tombstones * 2;
+        g->tombstones = malloc(cap * sizeof(GuideTombstone));
+        if (!g->tombstones) return -1;
+        memcpy(g->tombstones, old->tombstones, old->num_tombstones * sizeof(GuideTombstone));
+        g->num_tombstones = old->num_tombstones;
+    }
+
+    int *by_id = malloc((old->num_channels + 1) * sizeof(int));
+    char *matched = calloc(old->num_channels + 1, 1);
+    if (!by_id || !matched) {
+        free(by_id);
+        free(matched);
+        return -1;
+    }
+    for (int i = 0; i < old->num_channels; i++) by_id[i] = i;
+    qsort_r(by_id, old->num_channels, sizeof(int), cmp_channel_index, old->channels);
+
+    int rc = 0, inserted = 0, updated = 0, deleted = g->num_tombstones;
+    for (int c = 0; c < g->num_channels && rc == 0; c++) {
+        const GuideChannel *ch = &g->channels[c];
+        int lo = 0, hi = old->num_channels - 1, oc = -1;
+        while (lo <= hi) {
+            int mid = (lo + hi) / 2;
+            int cmp = strcmp(old->channels[by_id[mid]].id, ch->id);
+            if (cmp == 0) {
+                oc = by_id[mid];
+                break;
+            }
+            if (cmp < 0) lo = mid + 1;
+            else hi = mid - 1;
+        }
+        // Both channels' programs are in start order: merge them
+        int i = ch->first, end = ch->first + ch->count;
+        int j = 0, old_end = 0;
+        if (oc >= 0) {
+            matched[oc] = 1;
+            j = old->channels[oc].first;
+            old_end = j + old->channels[oc].count;
+        }
+        while (rc == 0 && (i < end || j < old_end)) {
+            GuideProgram *p = i < end ? &g->programs[i] : NULL;
+            const GuideProgram *o = j < old_end ? &old->programs[j] : NULL;
+            if (o && (!p || o->start < p->start)) {
+                rc = add_tombstone(g, &cap, ch->id, o->start);
+                j++;
+            } else if (!o || p->start < o->start) {
+                p->seq = p->created = ++change_seq;
+                inserted++;
+                i++;
+            } else {
+                int same = p->end == o->end && strcmp(p->title, o->title) == 0 &&
+                           strcmp(p->description, o->description) == 0;
+                p->seq = same ? o->seq : ++change_seq;
+                p->created = o->created;
+                updated += !same;
+                i++;
+                j++;
+            }
+        }
+    }
+    // Channels that left the lineup take their programs with them
+    for (int oc = 0; oc < old->num_channels && rc == 0; oc++) {
+        const GuideChannel *ch = &old->channels[oc];
+        for (int j = ch->first; !matched[oc] && j < ch->first + ch->count && rc == 0; j++) {
+            rc = add_tombstone(g, &cap, ch->id, old->programs[j].start);
+        }
+    }
+    free(by_id);
+    free(matched);
+    if (rc < 0) return -1;
+    deleted = g->num_tombstones - deleted;
+
+    // Forget the oldest deletions; a client from before them must reset
+    if (g->num_tombstones > GUIDE_MAX_TOMBSTONES) {
+        int drop = g->num_tombstones - GUIDE_MAX_TOMBSTONES;
+        g->horizon = g->tombstones[drop - 1].seq;
+        memmove(g->tombstones, g->tombstones + drop, GUIDE_MAX_TOMBSTONES * sizeof(GuideTombstone));
+        g->num_tombstones = GUIDE_MAX_TOMBSTONES;
+    }
+
+    g->channels_seq = lineup_equal(old, g) ? old->channels_seq : ++change_seq;
+    g->seq = change_seq;
+    LOG_INFO("GUIDE", "Changes %lu-%lu: %d inserted, %d updated, %d deleted", old->seq + 1, g->seq,
+             inserted, updated, deleted);
+    return 0;
+}
+
+/**
+ * Fetch and publish the guide if it changed
+ *
+ * @return 0 if the store holds the core's current guide
+ */
+static int refresh(void) {
+    char base[256];
+    const char *url = get_core_base_url();
+    if (!url) return -1;
+    snprintf(base, sizeof(base), "%s", url);
+
+    size_t len = 0;
+    char *body = fetch_guide(base, &len);
+    if (!body) return -1;
+
+    unsigned long long hash = fnv1a(body, len);
+    tracked_lock(&guide_mutex);
+    int unchanged = current && hash == current_hash;
+    tracked_unlock(&guide_mutex);
+    if (unchanged) {
+        free(body);
+        return 0;
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    GuideSnapshot *g = guide_parse(body, len);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    free(body);
+    if (!g) {
+        LOG_WARN("GUIDE", "Guide from %s is malformed, keeping the previous one", base);
+        return -1;
+    }
+
+    // Only this thread replaces current, so it can be read unlocked here
+    if (number_changes(current, g) < 0) {
+        free(g->tombstones);
+        g->tombstones = NULL;
+        g->num_tombstones = 0;
+        number_changes(NULL, g);
+    }
+
+    tracked_lock(&guide_mutex);
+    GuideSnapshot *old = current;
+    g->generation = ++generation;
+    current = g;
+    current_hash = hash;
+    tracked_unlock(&guide_mutex);
+    guide_release(old);
+
+    LOG_INFO("GUIDE", "Loaded %d channels, %d programs (%zu KB, parsed in %.1f ms), generation %lu, change %lu",
+             g->num_channels, g->num_programs, len / 1024,
+             (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6, g->generation, g->seq);
+    return 0;
+}
+
+static void *guide_thread(void *arg) {
+    (void)arg;
+    thread_state_register("guide");
+    while (1) {
+        int ms = refresh() == 0 ? GUIDE_REFRESH_MS : GUIDE_RETRY_MS;
+        struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+        ThreadStateMark mark = thread_state_enter(THREAD_SLEEP, "refresh");
+        nanosleep(&ts, NULL);
+        thread_state_leave(mark);
+    }
+    return NULL;
+}
+
+void guide_start(void) {
+    epoch = wall_ms();
+    pthread_t th;
+    if (pthread_create(&th, NULL, guide_thread, NULL) != 0) {
+        LOG_ERROR("GUIDE", "Failed to create refresh thread");
+    } else {
+        pthread_detach(th);
+    }
+}
+
+/* ============================================================================
+ * JSON output
+ * ============================================================================ */
+
+/**
+ * The programs of a channel that overlap [start, end)
+ *
+ * Programs are in start order, but a listing can end before the one ahead
+ * of it (overlapping entries from the source), so the window is not a
+ * contiguous run: [*first, *last) holds every candidate and a candidate
+ * whose own end is at or before start is not in the window.
+ *
+ * @return Number of programs in the window
+ */
+static int window_range(const GuideSnapshot *guide, const GuideChannel *ch, long long start, long long end,
+                        int *first, int *last) {
+    int i = ch->first, stop = ch->first + ch->count;
+    while (i < stop && guide->programs[i].end <= start) i++;
+    int j = i, count = 0;
+    for (; j < stop && guide->programs[j].start < end; j++) {
+        if (guide->programs[j].end > start) count++;
+    }
+    *first = i;
+    *last = j;
+    return count;
+}
+
+static void write_str(JsonWriter *w, const char *s) {
+    w->write(w->ctx, s, strlen(s));
+}
+
+/** Write s as a quoted JSON string */
+static void write_quoted(JsonWriter *w, const char *s) {
+    char buf[512];
+    size_t n = 0;
+    buf[n++] = '"';
+    for (; *s; s++) {
+        if (n > sizeof(buf) - 8) {
+            w->write(w->ctx, buf, n);
+            n = 0;
+        }
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            buf[n++] = '\\';
+            buf[n++] = c;
+        } else if (c == '\n') {
+            buf[n++] = '\\';
+            buf[n++] = 'n';
+        } else if (c < 0x20) {
+            n += snprintf(buf + n, sizeof(buf) - n, "\\u%04x", c);
+        } else {
+            buf[n++] = c;
+        }
+    }
+    buf[n++] = '"';
+    w->write(w->ctx, buf, n);
+}
+
+/** Write channels [from, to) as a JSON array */
+static void write_channels(JsonWriter *writer, const GuideSnapshot *guide, int from, int to) {
+    write_str(writer, "[");
+    for (int i = from; i < to; i++) {
+        const GuideChannel *ch = &guide->channels[i];
+        write_str(writer, i > from ? ",{\"id\":" : "{\"id\":");
+        write_quoted(writer, ch->id);
+        write_str(writer, ",\"name\":");
+        write_quoted(writer, ch->name);
+        write_str(writer, ",\"icon\":");
+        write_quoted(writer, ch->icon);
+        write_str(writer, "}");
+    }
+    write_str(writer, "]");
+}
+
+void guide_write_channels_json(JsonWriter *writer, const GuideSnapshot *guide) {
+    write_channels(writer, guide, 0, guide ? guide->num_channels : 0);
+}
+
+static void write_program(JsonWriter *writer, const GuideSnapshot *guide, const GuideProgram *p, int first) {
+    char times[96];
+    snprintf(times, sizeof(times), ",\"start\":%lld,\"end\":%lld,\"title\":", p->start, p->end);
+    write_str(writer, first ? "{\"channel\":" : ",{\"channel\":");
+    write_quoted(writer, guide->channels[p->channel].id);
+    write_str(writer, times);
+    write_quoted(writer, p->title);
+    write_str(writer, ",\"description\":");
+    write_quoted(writer, p->description);
+    write_str(writer, "}");
+}
+
+/** Write the programs of channels [from, to) overlapping [start, end) */
+static void write_programs(JsonWriter *writer, const GuideSnapshot *guide, int from_channel, int to_channel,
+                           long long start, long long end) {
+    int first = 1;
+    write_str(writer, "[");
+    for (int c = from_channel; c < to_channel; c++) {
+        int from, to;
+        window_range(guide, &guide->channels[c], start, end, &from, &to);
+        for (int i = from; i < to; i++) {
+            if (guide->programs[i].end <= start) continue;
+            write_program(writer, guide, &guide->programs[i], first);
+            first = 0;
+        }
+    }
+    write_str(writer, "]");
+}
+
+void guide_write_programs_json(JsonWriter *writer, const GuideSnapshot *guide,
+                               long long start, long long end) {
+    write_programs(writer, guide, 0, guide ? guide->num_channels : 0, start, end);
+}
+
+static void write_window_json(JsonWriter *writer, const GuideSnapshot *guide, int from_channel, int to_channel,
+                              long long start, long long end) {
+    char head[64];
+    snprintf(head, sizeof(head), "{\"generation\":%lu,\"channels\":", guide ? guide->generation : 0);
+    write_str(writer, head);
+    write_channels(writer, guide, from_channel, to_channel);
+    write_str(writer, ",\"programs\":");
+    write_programs(writer, guide, from_channel, to_channel, start, end);
+    write_str(writer, "}");
+}
+
+void guide_write_json(JsonWriter *writer, const GuideSnapshot *guide, long long start, long long end) {
+    write_window_json(writer, guide, 0, guide ? guide->num_channels : 0, start, end);
+}
+
+/**
+ * Channels and time span of tile (row, col)
+ */
+static void tile_bounds(const GuideSnapshot *guide, int row, long long col, int *from_channel, int *to_channel,
+                        long long *start, long long *end) {
+    int num_channels = guide ? guide->num_channels : 0;
+    *from_channel = row >= 0 && row <= num_channels / GUIDE_TILE_CHANNELS ? row * GUIDE_TILE_CHANNELS : num_channels;
+    *to_channel = *from_channel + GUIDE_TILE_CHANNELS;
+    if (*to_channel > num_channels) *to_channel = num_channels;
+    *start = col * GUIDE_TILE_MS;
+    *end = *start + GUIDE_TILE_MS;
+}
+
+void guide_write_tile_json(JsonWriter *writer, const GuideSnapshot *guide, int row, long long col) {
+    int from, to;
+    long long start, end;
+    tile_bounds(guide, row, col, &from, &to, &start, &end);
+    write_window_json(writer, guide, from, to, start, end);
+}
+
+void guide_write_changes_json(JsonWriter *writer, const GuideSnapshot *guide, unsigned long since) {
+    unsigned long seq = guide ? guide->seq : 0;
+    int reset = !guide || since == 0 || since < guide->horizon || since > seq;
+    if (reset) since = 0;
+    char head[128];
+    snprintf(head, sizeof(head), "{\"epoch\":%lld,\"seq\":%lu,\"reset\":%s", guide ? guide->epoch : 0, seq,
+             reset ? "true" : "false");
+    write_str(writer, head);
+    if (reset || (guide && guide->channels_seq > since)) {
+        write_str(writer, ",\"channels\":");
+        guide_write_channels_json(writer, guide);
+    }
+
+    // Inserted, then updated: programs created before since but changed after
+    for (int updated = 0; updated < 2; updated++) {
+        int first = 1;
+        write_str(writer, updated ? ",\"updated\":[" : ",\"inserted\":[");
+        for (int i = 0; guide && i < guide->num_programs; i++) {
+            const GuideProgram *p = &guide->programs[i];
+            if (p->seq <= since || (p->created <= since) != updated) continue;
+            write_program(writer, guide, p, first);
+            first = 0;
+        }
+        write_str(writer, "]");
+    }
+
+    write_str(writer, ",\"deleted\":[");
+    int first = 1;
+    for (int i = guide ? guide->num_tombstones - 1 : -1; !reset && i >= 0; i--) {
+        const GuideTombstone *t = &guide->tombstones[i];
+        if (t->seq <= since) break;
+        char start[48];
+        snprintf(start, sizeof(start), ",\"start\":%lld}", t->start);
+        write_str(writer, first ? "{\"channel\":" : ",{\"channel\":");
+        write_quoted(writer, t->channel);
+        write_str(writer, start);
+        first = 0;
+    }
+    write_str(writer, "]}");
+}
+
+/* ============================================================================
+ * CBOR output
+ * ============================================================================ */
+
+enum { CBOR_UINT = 0, CBOR_NEGINT = 1, CBOR_TEXT = 3, CBOR_ARRAY = 4, CBOR_MAP = 5 };
+
+/** Items are batched so the writer (often a compressor) sees few calls */
+typedef struct {
+    JsonWriter *writer;
+    size_t len;
+    unsigned char buf[8192];
+} CborOut;
+
+static void cbor_flush(CborOut *out) {
+    if (out->len) out->writer->write(out->writer->ctx, (const char *)out->buf, out->len);
+    out->len = 0;
+}
+
+static void cbor_head(CborOut *out, int major, uint64_t value) {
+    if (out->len > sizeof(out->buf) - 9) cbor_flush(out);
+    unsigned char *p = out->buf + out->len;
+    int n;
+    if (value < 24) {
+        p[0] = major << 5 | value;
+        n = 1;
+    } else if (value <= 0xFF) {
+        p[0] = major << 5 | 24;
+        n = 2;
+    } else if (value <= 0xFFFF) {
+        p[0] = major << 5 | 25;
+        n = 3;
+    } else if (value <= 0xFFFFFFFF) {
+        p[0] = major << 5 | 26;
+        n = 5;
+    } else {
+        p[0] = major << 5 | 27;
+        n = 9;
+    }
+    // Big-endian argument after the initial byte
+    for (int i = n - 1; i > 0; i--, value >>= 8) p[i] = value & 0xFF;
+    out->len += n;
+}
+
+static void cbor_int(CborOut *out, long long value) {
+    if (value >= 0) cbor_head(out, CBOR_UINT, value);
+    else cbor_head(out, CBOR_NEGINT, -1 - value);
+}
+
+static void cbor_text(CborOut *out, const char *text) {
+    size_t len = strlen(text);
+    cbor_head(out, CBOR_TEXT, len);
+    if (out->len + len > sizeof(out->buf)) {
+        cbor_flush(out);
+        out->writer->write(out->writer->ctx, text, len);
+        return;
+    }
+    memcpy(out->buf + out->len, text, len);
+    out->len += len;
+}
+
+static int write_window_cbor(JsonWriter *writer, const GuideSnapshot *guide, int from_channel, int to_channel,
+                             long long start, long long end) {
+    int num_texts = guide ? guide->num_texts : 0;
+    CborOut *out = malloc(sizeof(*out));
+    int *remap = malloc((num_texts + 1) * sizeof(int));
+    int *order = malloc((num_texts + 1) * sizeof(int));
+    if (!out || !remap || !order) {
+        free(out);
+        free(remap);
+        free(order);
+        return -1;
+    }
+    out->writer = writer;
+    out->len = 0;
+
+    // Texts used in the window, numbered in order of first use
+    int num_used = 0, unit = 1000;
+    memset(remap, -1, (num_texts + 1) * sizeof(int));
+    for (int c = from_channel; c < to_channel; c++) {
+        int first, last;
+        window_range(guide, &guide->channels[c], start, end, &first, &last);
+        for (int i = first; i < last; i++) {
+            const GuideProgram *p = &guide->programs[i];
+            if (p->end <= start) continue;
+            if (p->start % 1000 || p->end % 1000) unit = 1;
+            if (remap[p->title_id] < 0) {
+                order[num_used] = p->title_id;
+                remap[p->title_id] = num_used++;
+            }
+            if (remap[p->description_id] < 0) {
+                order[num_used] = p->description_id;
+                remap[p->description_id] = num_used++;
+            }
+        }
+    }
+    if (start % 1000) unit = 1;
+
+    cbor_head(out, CBOR_MAP, 7);
+    cbor_text(out, "generation");
+    cbor_int(out, guide ? (long long)guide->generation : 0);
+    cbor_text(out, "start");
+    cbor_int(out, start);
+    cbor_text(out, "end");
+    cbor_int(out, end);
+    cbor_text(out, "unit");
+    cbor_int(out, unit);
+
+    cbor_text(out, "channels");
+    cbor_head(out, CBOR_ARRAY, to_channel - from_channel);
+    for (int c = from_channel; c < to_channel; c++) {
+        const GuideChannel *ch = &guide->channels[c];
+        cbor_head(out, CBOR_ARRAY, 3);
+        cbor_text(out, ch->id);
+        cbor_text(out, ch->name);
+        cbor_text(out, ch->icon);
+    }
+
+    cbor_text(out, "strings");
+    cbor_head(out, CBOR_ARRAY, num_used);
+    for (int i = 0; i < num_used; i++) cbor_text(out, guide->texts[order[i]]);
+
+    cbor_text(out, "programs");
+    cbor_head(out, CBOR_ARRAY, to_channel - from_channel);
+    for (int c = from_channel; c < to_channel; c++) {
+        int first, last;
+        int count = window_range(guide, &guide->channels[c], start, end, &first, &last);
+        cbor_head(out, CBOR_ARRAY, count * 4);
+        long long prev_end = start;
+        for (int i = first; i < last; i++) {
+            const GuideProgram *p = &guide->programs[i];
+            if (p->end <= start) continue;
+            cbor_int(out, (p->start - prev_end) / unit);
+            cbor_int(out, (p->end - p->start) / unit);
+            cbor_int(out, remap[p->title_id]);
+            cbor_int(out, remap[p->description_id]);
+            prev_end = p->end;
+        }
+    }
+    cbor_flush(out);
+    free(out);
+    free(remap);
+    free(order);
+    return 0;
+}
+
+int guide_write_cbor(JsonWriter *writer, const GuideSnapshot *guide, long long start, long long end) {
+    return write_window_cbor(writer, guide, 0, guide ? guide->num_channels : 0, start, end);
+}
+
+int guide_write_tile_cbor(JsonWriter *writer, const GuideSnapshot *guide, int row, long long col) {
+    int from, to;
+    long long start, end;
+    tile_bounds(guide, row, col, &from, &to, &start, &end);
+    return write_window_cbor(writer, guide, from, to, start, end);
+}
@@ -0,0 +1,918 @@
+/**
+ * @file h2.c
+ * @brief HTTP/2 over cleartext TCP (h2c, RFC 7540)
+ *
+ * Locks: `mutex` guards the stream slots, send windows and the dead flag
+ * and `changed` wakes writers waiting for window; `write_mutex`
+ * serializes frames on the socket and guards the HPACK encoder. The two
+ * are never held together. Both are TrackedMutex ("h2_conn" and
+ * "h2_write"), listed in /debug/threads for as long as the connection
+ * lives.
+ *
+ * A stream still receiving its request belongs to the connection thread;
+ * once dispatched its worker writes the response and frees it.
+ *
+ * The connection stays on the timer wheel (http.h): each frame must
+ * arrive in full within HTTP_REQUEST_TIMEOUT_MS of its first byte, each
+ * frame write may not stall for HTTP_SEND_TIMEOUT_MS, and a writer waits
+ * no longer than that for window. Otherwise the watchdog shuts the socket
+ * down and the blocked read or write fails. Waiting for a frame to start
+ * is only timed while no stream is open (H2_IDLE_TIMEOUT_MS): a client
+ * receiving a long response has nothing to send.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "h2.h"
+#include "hpack.h"
+#include "lockstat.h"
+#include "thread_state.h"
+#include "log.h"
+
+/* Frame types */
+#define FRAME_DATA          0x0
+#define FRAME_HEADERS       0x1
+#define FRAME_PRIORITY      0x2
+#define FRAME_RST_STREAM    0x3
+#define FRAME_SETTINGS      0x4
+#define FRAME_PUSH_PROMISE  0x5
+#define FRAME_PING          0x6
+#define FRAME_GOAWAY        0x7
+#define FRAME_WINDOW_UPDATE 0x8
+#define FRAME_CONTINUATION  0x9
+
+/* Frame flags */
+#define FLAG_END_STREAM  0x1
+#define FLAG_ACK         0x1
+#define FLAG_END_HEADERS 0x4
+#define FLAG_PADDED      0x8
+#define FLAG_PRIORITY    0x20
+
+/* Settings */
+#define SETTINGS_HEADER_TABLE_SIZE      0x1
+#define SETTINGS_ENABLE_PUSH            0x2
+#define SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define SETTINGS_INITIAL_WINDOW_SIZE    0x4
+#define SETTINGS_MAX_FRAME_SIZE         0x5
+
+/* Error codes */
+#define H2_NO_ERROR          0x0
+#define H2_PROTOCOL_ERROR    0x1
+#define H2_INTERNAL_ERROR    0x2
+#define H2_FLOW_CONTROL      0x3
+#define H2_STREAM_CLOSED     0x5
+#define H2_FRAME_SIZE_ERROR  0x6
+#define H2_REFUSED_STREAM    0x7
+#define H2_COMPRESSION_ERROR 0x9
+#define H2_ENHANCE_YOUR_CALM 0xb
+
+#define WINDOW_MAX 0x7fffffffLL
+
+/** Response header blocks are a few hundred bytes; this is ample */
+#define HEADER_BLOCK_MAX 4096
+
+static const char PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+#define PREFACE_LEN 24
+#define PREFACE_HEAD_LEN 18    /* The part http_read_request() takes for a request */
+
+typedef struct H2Conn H2Conn;
+
+struct H2Stream {
+    H2Conn *conn;
+    uint32_t id;
+    int dispatched;            /**< Request complete, worker running */
+    int reset;                 /**< Stream reset (either side) or connection gone */
+    int ended;                 /**< END_STREAM or RST_STREAM sent */
+    long long window;          /**< Send window */
+    HttpConn request;          /**< Rebuilt request head and body */
+};
+
+struct H2Conn {
+    int sock;
+    HttpConn *http;            /**< The watched connection, for its deadlines */
+    H2Handler handler;
+
+    TrackedMutex mutex;
+    pthread_cond_t changed;
+    struct H2Stream *streams[H2_MAX_STREAMS];
+    int active;                /**< Streams in the slots */
+    int dead;
+    long long window;          /**< Connection send window */
+    long long initial_window;  /**< Peer's SETTINGS_INITIAL_WINDOW_SIZE */
+
+    TrackedMutex write_mutex;
+    int write_failed;
+    HpackTable encoder;
+
+    /* Connection thread only */
+    HpackTable decoder;
+    uint32_t last_stream;      /**< Highest stream the client opened */
+    int timed_out;
+    uint32_t block_stream;     /**< Stream whose header block awaits CONTINUATION */
+    int block_end_stream;
+    size_t block_len;
+    uint8_t block[H2_MAX_FRAME];
+    size_t in_len;
+    uint8_t in[9 + H2_MAX_FRAME];
+};
+
+static uint32_t get32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/* ============================================================================
+ * Frame output
+ * ============================================================================ */
+
+/** Write one frame; caller holds write_mutex */
+static int frame_send(H2Conn *c, uint8_t type, uint8_t flags, uint32_t stream,
+                      const void *payload, size_t len) {
+    if (c->write_failed) return -1;
+    uint8_t head[9] = { len >> 16, len >> 8, len, type, flags };
+    put32(head + 5, stream & 0x7fffffff);
+    struct iovec iov[2] = { { head, 9 }, { (void *)payload, len } };
+    struct iovec *v = iov;
+    int count = len ? 2 : 1;
+
+    ThreadStateMark mark = thread_state_enter(THREAD_SOCKET_WRITE, "h2");
+    http_conn_sending(c->http, 1);
+    while (count > 0) {
+        ssize_t n = writev(c->sock, v, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            c->write_failed = 1;
+            break;
+        }
+        http_conn_sending(c->http, 1);
+        while (count > 0 && (size_t)n >= v->iov_len) {
+            n -= v->iov_len;
+            v++;
+            count--;
+        }
+        if (count > 0) {
+            v->iov_base = (char *)v->iov_base + n;
+            v->iov_len -= n;
+        }
+    }
+    http_conn_sending(c->http, 0);
+    thread_state_leave(mark);
+    return c->write_failed ? -1 : 0;
+}
+
+static int frame_write(H2Conn *c, uint8_t type, uint8_t flags, uint32_t stream,
+                       const void *payload, size_t len) {
+    tracked_lock(&c->write_mutex);
+    int rc = frame_send(c, type, flags, stream, payload, len);
+    tracked_unlock(&c->write_mutex);
+    return rc;
+}
+
+static void send_rst(H2Conn *c, uint32_t stream, uint32_t error) {
+    uint8_t payload[4];
+    put32(payload, error);
+    frame_write(c, FRAME_RST_STREAM, 0, stream, payload, 4);
+}
+
+static void send_window_update(H2Conn *c, uint32_t stream, uint32_t increment) {
+    uint8_t payload[4];
+    put32(payload, increment);
+    frame_write(c, FRAME_WINDOW_UPDATE, 0, stream, payload, 4);
+}
+
+static void send_goaway(H2Conn *c, uint32_t error) {
+    uint8_t payload[8];
+    put32(payload, c->last_stream);
+    put32(payload + 4, error);
+    frame_write(c, FRAME_GOAWAY, 0, 0, payload, 8);
+}
+
+/* ============================================================================
+ * Streams
+ * ============================================================================ */
+
+/** Caller holds mutex */
+static struct H2Stream *stream_find(H2Conn *c, uint32_t id) {
+    for (int i = 0; i < H2_MAX_STREAMS; i++) {
+        if (c->streams[i] && c->streams[i]->id == id) return c->streams[i];
+    }
+    return NULL;
+}
+
+/** Caller holds mutex */
+static void stream_remove(H2Conn *c, struct H2Stream *s) {
+    for (int i = 0; i < H2_MAX_STREAMS; i++) {
+        if (c->streams[i] == s) {
+            c->streams[i] = NULL;
+            c->active--;
+            break;
+        }
+    }
+    pthread_cond_broadcast(&c->changed);
+    free(s);
+}
+
+static struct H2Stream *stream_open(H2Conn *c, uint32_t id) {
+    struct H2Stream *s = NULL;
+    tracked_lock(&c->mutex);
+    for (int i = 0; i < H2_MAX_STREAMS && c->active < H2_MAX_STREAMS; i++) {
+        if (c->streams[i]) continue;
+        s = calloc(1, sizeof(*s));
+        if (!s) break;
+        s->conn = c;
+        s->id = id;
+        s->window = c->initial_window;
+        http_conn_init(&s->request, c->sock);
+        s->request.served = 1;
+        c->streams[i] = s;
+        c->active++;
+        break;
+    }
+    tracked_unlock(&c->mutex);
+    return s;
+}
+
+static void *stream_thread(void *arg) {
+    struct H2Stream *s = arg;
+    H2Conn *c = s->conn;
+    thread_state_register("h2");
+
+    HttpResponse res;
+    memset(&res, 0, sizeof(res));
+    res.sock = c->sock;
+    res.keep_alive = 1;
+    res.length = -1;
+    res.h2 = s;
+    c->handler(&s->request, &res);
+    // A handler that never finished its response leaves the client waiting
+    if (!s->ended) h2_end(s, 0);
+
+    tracked_lock(&c->mutex);
+    stream_remove(c, s);
+    int idle = c->active == 0;
+    tracked_unlock(&c->mutex);
+    // The connection thread may be in a read begun while streams were open
+    if (idle) http_conn_set_deadline(c->http, HTTP_DEADLINE_IDLE, H2_IDLE_TIMEOUT_MS);
+    thread_state_unregister();
+    return NULL;
+}
+
+/** The request is complete: hand it to a worker */
+static void stream_dispatch(H2Conn *c, struct H2Stream *s) {
+    HttpConn *req = &s->request;
+    req->request_len = req->len;
+    req->buf[req->len] = '\0';
+
+    tracked_lock(&c->mutex);
+    s->dispatched = 1;
+    tracked_unlock(&c->mutex);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, stream_thread, s) != 0) {
+        LOG_ERROR("H2", "Cannot start a thread for stream %u", s->id);
+        send_rst(c, s->id, H2_REFUSED_STREAM);
+        tracked_lock(&c->mutex);
+        stream_remove(c, s);
+        tracked_unlock(&c->mutex);
+        return;
+    }
+    pthread_detach(thread);
+}
+
+static void stream_body(struct H2Stream *s, const uint8_t *data, size_t len) {
+    HttpConn *req = &s->request;
+    size_t room = HTTP_REQUEST_MAX - req->len;
+    if (len > room) {
+        req->truncated = 1;
+        len = room;
+    }
+    memcpy(req->buf + req->len, data, len);
+    req->len += len;
+}
+
+/* ============================================================================
+ * Request headers
+ * ============================================================================ */
+
+/**
+ * The decoded header block, collected for rebuilding as HTTP/1.1 text
+ */
+typedef struct {
+    char method[16];
+    char path[1024];
+    char authority[256];
+    char fields[HTTP_REQUEST_MAX];
+    size_t len;
+    int malformed;
+} RequestHead;
+
+static void copy_field(char *out, size_t size, const char *value, size_t len) {
+    if (len >= size) len = size - 1;
+    memcpy(out, value, len);
+    out[len] = '\0';
+}
+
+static void on_header(void *ctx, const char *name, size_t name_len, const char *value, size_t value_len) {
+    RequestHead *h = ctx;
+    // CR or LF would let a field smuggle headers into the rebuilt text
+    if (memchr(value, '\r', value_len) || memchr(value, '\n', value_len) || memchr(value, '\0', value_len)) {
+        h->malformed = 1;
+        return;
+    }
+    if (name_len && name[0] == ':') {
+        if (name_len == 7 && memcmp(name, ":method", 7) == 0) {
+            copy_field(h->method, sizeof(h->method), value, value_len);
+        } else if (name_len == 5 && memcmp(name, ":path", 5) == 0) {
+            copy_field(h->path, sizeof(h->path), value, value_len);
+        } else if (name_len == 10 && memcmp(name, ":authority", 10) == 0) {
+            copy_field(h->authority, sizeof(h->authority), value, value_len);
+        }
+        return;
+    }
+    if (name_len == 4 && memcmp(name, "host", 4) == 0 && h->authority[0]) return;
+
+    if (h->len + name_len + value_len + 4 > sizeof(h->fields)) return;
+    // Title-Case so lookups written for HTTP/1.1 ("\r\nAccept-Encoding:") match
+    for (size_t i = 0; i < name_len; i++) {
+        int start = i == 0 || name[i - 1] == '-';
+        h->fields[h->len++] = start ? toupper((unsigned char)name[i]) : name[i];
+    }
+    memcpy(h->fields + h->len, ": ", 2);
+    memcpy(h->fields + h->len + 2, value, value_len);
+    h->len += value_len + 2;
+    memcpy(h->fields + h->len, "\r\n", 2);
+    h->len += 2;
+}
+
+/** Write the request head as HTTP/1.1 text into the stream's buffer */
+static void request_rebuild(struct H2Stream *s, const RequestHead *h) {
+    HttpConn *req = &s->request;
+    int n = snprintf(req->buf, HTTP_REQUEST_MAX + 1, "%s %s HTTP/2.0\r\n", h->method, h->path);
+    if (h->authority[0] && n < HTTP_REQUEST_MAX) {
+        n += snprintf(req->buf + n, HTTP_REQUEST_MAX + 1 - n, "Host: %s\r\n", h->authority);
+    }
+    if (n >= HTTP_REQUEST_MAX || (size_t)n + h->len + 2 > HTTP_REQUEST_MAX) {
+        req->truncated = 1;
+        n = n < HTTP_REQUEST_MAX ? n : HTTP_REQUEST_MAX;
+        req->len = n;
+        return;
+    }
+    memcpy(req->buf + n, h->fields, h->len);
+    memcpy(req->buf + n + h->len, "\r\n", 2);
+    req->len = n + h->len + 2;
+}
+
+/** A complete header block has arrived */
+static uint32_t headers_done(H2Conn *c) {
+    uint32_t id = c->block_stream;
+    c->block_stream = 0;
+
+    // Decoded even for a stream that will be refused, to keep the table in step
+    RequestHead *h = calloc(1, sizeof(*h));
+    if (!h) return H2_INTERNAL_ERROR;
+    if (hpack_decode(&c->decoder, c->block, c->block_len, on_header, h) < 0) {
+        free(h);
+        return H2_COMPRESSION_ERROR;
+    }
+
+    tracked_lock(&c->mutex);
+    struct H2Stream *s = stream_find(c, id);
+    int dispatched = s && s->dispatched;
+    tracked_unlock(&c->mutex);
+
+    uint32_t error = H2_NO_ERROR;
+    if (s) {
+        // Trailers: only allowed to end a request still being received
+        if (dispatched || !c->block_end_stream) send_rst(c, id, H2_STREAM_CLOSED);
+        else stream_dispatch(c, s);
+    } else if (id <= c->last_stream) {
+        error = H2_PROTOCOL_ERROR;
+    } else {
+        c->last_stream = id;
+        if (h->malformed || !h->method[0] || !h->path[0]) {
+            send_rst(c, id, H2_PROTOCOL_ERROR);
+        } else if (!(s = stream_open(c, id))) {
+            send_rst(c, id, H2_REFUSED_STREAM);
+        } else {
+            request_rebuild(s, h);
+            if (c->block_end_stream) stream_dispatch(c, s);
+        }
+    }
+    free(h);
+    return error;
+}
+
+/* ============================================================================
+ * Frame input
+ * ============================================================================ */
+
+static uint32_t apply_settings(H2Conn *c, const uint8_t *p, size_t len) {
+    if (len % 6) return H2_FRAME_SIZE_ERROR;
+    uint32_t error = H2_NO_ERROR;
+    long long table_size = -1;
+
+    tracked_lock(&c->mutex);
+    for (size_t i = 0; i < len && !error; i += 6) {
+        uint16_t id = (uint16_t)(p[i] << 8 | p[i + 1]);
+        uint32_t value = get32(p + i + 2);
+        switch (id) {
+            case SETTINGS_HEADER_TABLE_SIZE:
+                table_size = value;
+                break;
+            case SETTINGS_ENABLE_PUSH:
+                if (value > 1) error = H2_PROTOCOL_ERROR;
+                break;
+            case SETTINGS_INITIAL_WINDOW_SIZE: {
+                if (value > WINDOW_MAX) {
+                    error = H2_FLOW_CONTROL;
+                    break;
+                }
+                long long delta = (long long)value - c->initial_window;
+                for (int j = 0; j < H2_MAX_STREAMS; j++) {
+                    if (!c->streams[j]) continue;
+                    if ((c->streams[j]->window += delta) > WINDOW_MAX) error = H2_FLOW_CONTROL;
+                }
+                c->initial_window = value;
+                break;
+            }
+            case SETTINGS_MAX_FRAME_SIZE:
+                // DATA is sent in frames of at most H2_MAX_FRAME, which every peer accepts
+                if (value < 16384 || value > 16777215) error = H2_PROTOCOL_ERROR;
+                break;
+            default:
+                break;
+        }
+    }
+    pthread_cond_broadcast(&c->changed);
+    tracked_unlock(&c->mutex);
+
+    if (!error && table_size >= 0) {
+        tracked_lock(&c->write_mutex);
+        hpack_encoder_set_limit(&c->encoder, (size_t)table_size);
+        tracked_unlock(&c->write_mutex);
+    }
+    return error;
+}
+
+/** Strip padding (and the priority block of HEADERS) from a payload */
+static int unpad(uint8_t flags, int priority, const uint8_t **p, size_t *len) {
+    if (flags & FLAG_PADDED) {
+        if (*len < 1) return -1;
+        size_t pad = (*p)[0];
+        (*p)++;
+        (*len)--;
+        if (pad > *len) return -1;
+        *len -= pad;
+    }
+    if (priority && (flags & FLAG_PRIORITY)) {
+        if (*len < 5) return -1;
+        *p += 5;
+        *len -= 5;
+    }
+    return 0;
+}
+
+static uint32_t on_data(H2Conn *c, uint8_t flags, uint32_t id, const uint8_t *p, size_t len) {
+    if (id == 0) return H2_PROTOCOL_ERROR;
+    size_t flow = len;
+    if (unpad(flags, 0, &p, &len) < 0) return H2_PROTOCOL_ERROR;
+    // Bodies are small and read at once, so the window is credited straight back
+    if (flow) send_window_update(c, 0, flow);
+
+    tracked_lock(&c->mutex);
+    struct H2Stream *s = stream_find(c, id);
+    int receiving = s && !s->dispatched;
+    tracked_unlock(&c->mutex);
+    if (!receiving) {
+        if (id > c->last_stream) return H2_PROTOCOL_ERROR;
+        send_rst(c, id, H2_STREAM_CLOSED);
+        return H2_NO_ERROR;
+    }
+
+    stream_body(s, p, len);
+    if (flags & FLAG_END_STREAM) stream_dispatch(c, s);
+    else if (flow) send_window_update(c, id, flow);
+    return H2_NO_ERROR;
+}
+
+static uint32_t on_window_update(H2Conn *c, uint32_t id, const uint8_t *p, size_t len) {
+    if (len != 4) return H2_FRAME_SIZE_ERROR;
+    uint32_t increment = get32(p) & 0x7fffffff;
+    uint32_t error = H2_NO_ERROR, stream_error = H2_NO_ERROR;
+
+    tracked_lock(&c->mutex);
+    if (id == 0) {
+        if (increment == 0) error = H2_PROTOCOL_ERROR;
+        else if ((c->window += increment) > WINDOW_MAX) error = H2_FLOW_CONTROL;
+    } else {
+        // On a stream these are stream errors: reset it, keep the connection
+        struct H2Stream *s = stream_find(c, id);
+        if (increment == 0) stream_error = H2_PROTOCOL_ERROR;
+        else if (s && (s->window += increment) > WINDOW_MAX) stream_error = H2_FLOW_CONTROL;
+        if (s && stream_error) {
+            s->reset = 1;
+            if (!s->dispatched) stream_remove(c, s);
+        }
+    }
+    pthread_cond_broadcast(&c->changed);
+    tracked_unlock(&c->mutex);
+    if (stream_error) send_rst(c, id, stream_error);
+    return error;
+}
+
+static uint32_t on_rst_stream(H2Conn *c, uint32_t id, size_t len) {
+    if (len != 4) return H2_FRAME_SIZE_ERROR;
+    if (id == 0) return H2_PROTOCOL_ERROR;
+    tracked_lock(&c->mutex);
+    struct H2Stream *s = stream_find(c, id);
+    if (s) {
+        s->reset = 1;
+        if (!s->dispatched) stream_remove(c, s);
+        pthread_cond_broadcast(&c->changed);
+    }
+    tracked_unlock(&c->mutex);
+    return H2_NO_ERROR;
+}
+
+/** @return 0, or the error code of a connection error */
+static uint32_t frame_handle(H2Conn *c, uint8_t type, uint8_t flags, uint32_t id,
+                             const uint8_t *p, size_t len) {
+    // Nothing may come between HEADERS and its CONTINUATION frames
+    if (c->block_stream && (type != FRAME_CONTINUATION || id != c->block_stream)) return H2_PROTOCOL_ERROR;
+
+    switch (type) {
+        case FRAME_DATA:
+            return on_data(c, flags, id, p, len);
+
+        case FRAME_HEADERS:
+            if (id == 0 || !(id & 1)) return H2_PROTOCOL_ERROR;
+            if (unpad(flags, 1, &p, &len) < 0) return H2_PROTOCOL_ERROR;
+            memcpy(c->block, p, len);
+            c->block_len = len;
+            c->block_stream = id;
+            c->block_end_stream = flags & FLAG_END_STREAM;
+            return (flags & FLAG_END_HEADERS) ? headers_done(c) : H2_NO_ERROR;
+
+        case FRAME_CONTINUATION:
+            if (!c->block_stream) return H2_PROTOCOL_ERROR;
+            if (c->block_len + len > sizeof(c->block)) return H2_ENHANCE_YOUR_CALM;
+            memcpy(c->block + c->block_len, p, len);
+            c->block_len += len;
+            return (flags & FLAG_END_HEADERS) ? headers_done(c) : H2_NO_ERROR;
+
+        case FRAME_RST_STREAM:
+            return on_rst_stream(c, id, len);
+
+        case FRAME_SETTINGS: {
+            if (id != 0) return H2_PROTOCOL_ERROR;
+            if (flags & FLAG_ACK) return len ? H2_FRAME_SIZE_ERROR : H2_NO_ERROR;
+            uint32_t error = apply_settings(c, p, len);
+            if (!error) frame_write(c, FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0);
+            return error;
+        }
+
+        case FRAME_PING:
+            if (id != 0) return H2_PROTOCOL_ERROR;
+            if (len != 8) return H2_FRAME_SIZE_ERROR;
+            if (!(flags & FLAG_ACK)) frame_write(c, FRAME_PING, FLAG_ACK, 0, p, 8);
+            return H2_NO_ERROR;
+
+        case FRAME_WINDOW_UPDATE:
+            return on_window_update(c, id, p, len);
+
+        case FRAME_PUSH_PROMISE:
+            return H2_PROTOCOL_ERROR;
+
+        default:
+            // PRIORITY, GOAWAY (the client closes once its streams are done)
+            // and unknown types
+            return H2_NO_ERROR;
+    }
+}
+
+/**
+ * Read until `want` bytes are buffered
+ *
+ * @return 0 when the client closed, the read failed or the connection
+ *         sat idle for H2_IDLE_TIMEOUT_MS
+ */
+static int fill(H2Conn *c, size_t want) {
+    while (c->in_len < want) {
+        tracked_lock(&c->mutex);
+        int idle = c->active == 0 && c->in_len == 0;
+        tracked_unlock(&c->mutex);
+
+        ThreadStateMark mark = thread_state_enter(THREAD_SOCKET_READ, idle ? "h2 idle" : "h2");
+        if (idle) {
+            struct pollfd pfd = { .fd = c->sock, .events = POLLIN };
+            int ready;
+            while ((ready = poll(&pfd, 1, H2_IDLE_TIMEOUT_MS)) < 0 && errno == EINTR) {}
+            if (ready == 0) c->timed_out = 1;
+            if (ready <= 0) {
+                thread_state_leave(mark);
+                return 0;
+            }
+        }
+        ssize_t n = read(c->sock, c->in + c->in_len, sizeof(c->in) - c->in_len);
+        thread_state_leave(mark);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        // A frame's first byte starts its deadline
+        if (c->in_len == 0) http_conn_set_deadline(c->http, HTTP_DEADLINE_REQUEST, HTTP_REQUEST_TIMEOUT_MS);
+        c->in_len += n;
+    }
+    return 1;
+}
+
+/** Drop a handled frame; bytes after it start the next one's deadline */
+static void consume(H2Conn *c, size_t len) {
+    memmove(c->in, c->in + len, c->in_len - len);
+    c->in_len -= len;
+    if (c->in_len) http_conn_set_deadline(c->http, HTTP_DEADLINE_REQUEST, HTTP_REQUEST_TIMEOUT_MS);
+}
+
+/* ============================================================================
+ * Connection
+ * ============================================================================ */
+
+int h2_is_preface(HttpConn *conn) {
+    return conn->request_len == PREFACE_HEAD_LEN && memcmp(conn->buf, PREFACE, PREFACE_HEAD_LEN) == 0;
+}
+
+int h2_wants_upgrade(HttpConn *conn) {
+    char value[64];
+    if (!http_request_header(conn, "Upgrade", value, sizeof(value)) || !strcasestr(value, "h2c")) return 0;
+    if (!http_request_header(conn, "HTTP2-Settings", value, sizeof(value))) return 0;
+    // The request would have to be answered from a body read as HTTP/1.1
+    char *body = http_request_body(conn);
+    return body && *body == '\0' && !conn->truncated;
+}
+
+/** Decode the HTTP2-Settings header (base64url, padding optional) */
+static int base64url_decode(const char *in, uint8_t *out, size_t cap) {
+    size_t n = 0;
+    unsigned bits = 0;
+    int nbits = 0;
+    for (; *in && *in != '='; in++) {
+        int v;
+        if (*in >= 'A' && *in <= 'Z') v = *in - 'A';
+        else if (*in >= 'a' && *in <= 'z') v = *in - 'a' + 26;
+        else if (*in >= '0' && *in <= '9') v = *in - '0' + 52;
+        else if (*in == '-' || *in == '+') v = 62;
+        else if (*in == '_' || *in == '/') v = 63;
+        else return -1;
+        bits = bits << 6 | v;
+        nbits += 6;
+        if (nbits >= 8) {
+            nbits -= 8;
+            if (n == cap) return -1;
+            out[n++] = (bits >> nbits) & 0xff;
+        }
+    }
+    return (int)n;
+}
+
+/** Answer an upgrade request: 101, then the request becomes stream 1 */
+static int upgrade(H2Conn *c, HttpConn *conn) {
+    char encoded[256];
+    uint8_t settings[192];
+    http_request_header(conn, "HTTP2-Settings", encoded, sizeof(encoded));
+    int len = base64url_decode(encoded, settings, sizeof(settings));
+    if (len < 0 || apply_settings(c, settings, len) != H2_NO_ERROR) return -1;
+
+    static const char switching[] =
+        "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+    const char *p = switching;
+    size_t left = sizeof(switching) - 1;
+    while (left > 0) {
+        ssize_t n = write(c->sock, p, left);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        left -= n;
+    }
+    return 0;
+}
+
+void h2_serve(HttpConn *conn, H2Handler handler) {
+    H2Conn *c = calloc(1, sizeof(*c));
+    if (!c) return;
+    c->sock = conn->sock;
+    c->http = conn;
+    c->handler = handler;
+    tracked_mutex_init(&c->mutex, "h2_conn");
+    pthread_cond_init(&c->changed, NULL);
+    tracked_mutex_init(&c->write_mutex, "h2_write");
+    c->window = H2_INITIAL_WINDOW;
+    c->initial_window = H2_INITIAL_WINDOW;
+    hpack_table_init(&c->decoder, HPACK_TABLE_SIZE);
+    hpack_table_init(&c->encoder, HPACK_TABLE_SIZE);
+
+    int prior_knowledge = h2_is_preface(conn);
+    struct H2Stream *first = NULL;
+    uint32_t error = H2_NO_ERROR;
+    if (!prior_knowledge) {
+        if (upgrade(c, conn) < 0) goto done;
+        if ((first = stream_open(c, 1))) {
+            memcpy(first->request.buf, conn->buf, conn->request_len);
+            first->request.len = conn->request_len;
+        }
+        c->last_stream = 1;
+    }
+    c->in_len = http_conn_take_pending(conn, (char *)c->in, sizeof(c->in));
+
+    uint8_t settings[6] = { 0, SETTINGS_MAX_CONCURRENT_STREAMS };
+    put32(settings + 2, H2_MAX_STREAMS);
+    frame_write(c, FRAME_SETTINGS, 0, 0, settings, sizeof(settings));
+    LOG_DEBUG("H2", "Connection %d switched to h2c (%s)", c->sock, prior_knowledge ? "prior knowledge" : "upgrade");
+    if (first) stream_dispatch(c, first);
+
+    // The client preface (its request line already read for prior knowledge)
+    size_t expect = prior_knowledge ? PREFACE_LEN - PREFACE_HEAD_LEN : PREFACE_LEN;
+    if (!fill(c, expect) || memcmp(c->in, PREFACE + PREFACE_LEN - expect, expect) != 0) {
+        error = H2_PROTOCOL_ERROR;
+        goto done;
+    }
+    consume(c, expect);
+
+    for (;;) {
+        if (!fill(c, 9)) break;
+        size_t len = (size_t)c->in[0] << 16 | (size_t)c->in[1] << 8 | c->in[2];
+        if (len > H2_MAX_FRAME) {
+            error = H2_FRAME_SIZE_ERROR;
+            break;
+        }
+        if (!fill(c, 9 + len)) break;
+        // Handling may block on writes, which have their own deadline
+        http_conn_clear_deadline(c->http);
+        error = frame_handle(c, c->in[3], c->in[4], get32(c->in + 5) & 0x7fffffff, c->in + 9, len);
+        consume(c, 9 + len);
+        if (error) break;
+    }
+
+done:
+    if (error || c->timed_out) {
+        if (error) LOG_WARN("H2", "Connection %d: protocol error 0x%x", c->sock, error);
+        send_goaway(c, error);
+    }
+
+    // Stop the workers: waiting writers wake, blocked writes fail
+    tracked_lock(&c->mutex);
+    c->dead = 1;
+    for (int i = 0; i < H2_MAX_STREAMS; i++) {
+        struct H2Stream *s = c->streams[i];
+        if (!s) continue;
+        s->reset = 1;
+        if (!s->dispatched) stream_remove(c, s);
+    }
+    pthread_cond_broadcast(&c->changed);
+    tracked_unlock(&c->mutex);
+    shutdown(c->sock, SHUT_RDWR);
+
+    ThreadStateMark mark = thread_state_enter(THREAD_CHILD_WAIT, "h2 streams");
+    tracked_lock(&c->mutex);
+    while (c->active > 0) tracked_cond_wait(&c->changed, &c->mutex);
+    tracked_unlock(&c->mutex);
+    thread_state_leave(mark);
+
+    hpack_table_free(&c->decoder);
+    hpack_table_free(&c->encoder);
+    tracked_mutex_destroy(&c->mutex);
+    pthread_cond_destroy(&c->changed);
+    tracked_mutex_destroy(&c->write_mutex);
+    free(c);
+}
+
+/* ============================================================================
+ * Responses
+ * ============================================================================ */
+
+/** Hop-by-hop headers that HTTP/2 forbids */
+static int connection_specific(const char *name) {
+    return strcmp(name, "connection") == 0 || strcmp(name, "keep-alive") == 0 ||
+           strcmp(name, "transfer-encoding") == 0 || strcmp(name, "upgrade") == 0;
+}
+
+static void encode_field(H2Conn *c, uint8_t *block, size_t *len, const char *name, const char *value) {
+    int n = hpack_encode(&c->encoder, block + *len, HEADER_BLOCK_MAX - *len, name, value);
+    if (n < 0) LOG_WARN("H2", "Response header %s dropped: block full", name);
+    else *len += n;
+}
+
+int h2_begin(struct H2Stream *s, int status, const char *content_type, const char *headers,
+             long long content_length) {
+    H2Conn *c = s->conn;
+    tracked_lock(&c->mutex);
+    int gone = s->reset || c->dead;
+    tracked_unlock(&c->mutex);
+    if (gone) return -1;
+
+    uint8_t block[HEADER_BLOCK_MAX];
+    size_t len = 0;
+    char value[512], name[64];
+
+    // Encoding changes the table, so the block must be sent once started
+    tracked_lock(&c->write_mutex);
+    int n = hpack_encode_begin(&c->encoder, block, sizeof(block));
+    if (n > 0) len = n;
+    snprintf(value, sizeof(value), "%d", status);
+    encode_field(c, block, &len, ":status", value);
+    encode_field(c, block, &len, "content-type", content_type);
+
+    // "Name: value\r\n" lines, as for HTTP/1.1
+    for (const char *line = headers; line && *line;) {
+        const char *eol = strstr(line, "\r\n");
+        const char *colon = strchr(line, ':');
+        if (!eol) eol = line + strlen(line);
+        if (colon && colon < eol && (size_t)(colon - line) < sizeof(name)) {
+            size_t nlen = colon - line;
+            for (size_t i = 0; i < nlen; i++) name[i] = tolower((unsigned char)line[i]);
+            name[nlen] = '\0';
+            const char *v = colon + 1;
+            while (*v == ' ' || *v == '\t') v++;
+            copy_field(value, sizeof(value), v, eol - v);
+            if (!connection_specific(name)) encode_field(c, block, &len, name, value);
+        }
+        line = *eol ? eol + 2 : eol;
+    }
+    if (status == 204 || status == 304) content_length = 0;
+    else if (content_length >= 0) {
+        snprintf(value, sizeof(value), "%lld", content_length);
+        encode_field(c, block, &len, "content-length", value);
+    }
+
+    int end_stream = content_length == 0;
+    int rc = frame_send(c, FRAME_HEADERS, FLAG_END_HEADERS | (end_stream ? FLAG_END_STREAM : 0),
+                        s->id, block, len);
+    tracked_unlock(&c->write_mutex);
+    if (end_stream) s->ended = 1;
+    return rc;
+}
+
+int h2_write(struct H2Stream *s, const void *data, size_t len) {
+    H2Conn *c = s->conn;
+    const char *p = data;
+    while (len > 0) {
+        tracked_lock(&c->mutex);
+        int stalled = 0;
+        if (!s->reset && !c->dead && (c->window <= 0 || s->window <= 0)) {
+            // A client that stops granting window is a stalled send
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += HTTP_SEND_TIMEOUT_MS / 1000;
+            ThreadStateMark mark = thread_state_enter(THREAD_SOCKET_WRITE, "h2 window");
+            while (!s->reset && !c->dead && (c->window <= 0 || s->window <= 0)) {
+                if (tracked_cond_timedwait(&c->changed, &c->mutex, &deadline) == ETIMEDOUT &&
+                    (c->window <= 0 || s->window <= 0)) {
+                    stalled = 1;
+                    break;
+                }
+            }
+            thread_state_leave(mark);
+        }
+        if (s->reset || c->dead || stalled) {
+            tracked_unlock(&c->mutex);
+            return -1;
+        }
+        size_t n = len < H2_MAX_FRAME ? len : H2_MAX_FRAME;
+        if ((long long)n > c->window) n = c->window;
+        if ((long long)n > s->window) n = s->window;
+        c->window -= n;
+        s->window -= n;
+        tracked_unlock(&c->mutex);
+
+        if (frame_write(c, FRAME_DATA, 0, s->id, p, n) < 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+void h2_end(struct H2Stream *s, int complete) {
+    H2Conn *c = s->conn;
+    if (s->ended) return;
+    s->ended = 1;
+    tracked_lock(&c->mutex);
+    int gone = s->reset || c->dead;
+    tracked_unlock(&c->mutex);
+    if (gone) return;
+    if (complete) frame_write(c, FRAME_DATA, FLAG_END_STREAM, s->id, NULL, 0);
+    else send_rst(c, s->id, H2_INTERNAL_ERROR);
+}
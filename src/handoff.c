@@ -0,0 +1,530 @@
+/**
+ * @file handoff.c
+ * @brief Zero-downtime restart: listening socket and live session handoff
+ *
+ * Messages are fixed-size HandoffMsg records on a SOCK_SEQPACKET pair, so
+ * every sendmsg() is delivered whole and relay threads can send their own
+ * sessions without a lock. Descriptors ride along as SCM_RIGHTS; fd_mask
+ * says which of a message's slots were sent (a relay whose FFmpeg closed
+ * stderr has no stderr pipe left to pass).
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "handoff.h"
+#include "clock.h"
+#include "io_engine.h"
+#include "lockstat.h"
+#include "scheduler.h"
+#include "thread_state.h"
+#include "web.h"
+#include "log.h"
+
+/** Descriptors a single message can carry */
+#define HANDOFF_MAX_FDS 4
+
+/** First descriptor passed by systemd socket activation (SD_LISTEN_FDS_START) */
+#define SYSTEMD_LISTEN_FD 3
+
+typedef struct {
+    uint32_t type;             /**< HandoffMsgType */
+    uint32_t version;          /**< HANDOFF_VERSION of the sender */
+    uint32_t fd_mask;          /**< Bit i: slot i carried a descriptor */
+    union {
+        HandoffRelay relay;
+        HandoffRecorder recorder;
+    } u;
+} HandoffMsg;
+
+static char exe_path[PATH_MAX];
+static char **saved_argv;
+static int inherited = 0;
+static int systemd_fd = -1;
+static int listen_sock = -1;
+
+/** Handoff socket: to the new process while handing off, from the old one after a restart */
+static int chan = -1;
+/**
+ * Held around every send on chan and around closing it, so a relay thread
+ * still handing over its session never writes to a closed (or reused) fd
+ */
+static TrackedMutex chan_mutex = TRACKED_MUTEX_INITIALIZER("handoff_chan");
+static pid_t new_pid = 0;
+static atomic_int pending;
+static atomic_int relays_sent;
+static atomic_int recorders_sent;
+
+/** SIGUSR2 wakes the handoff thread through this pipe */
+static int wake_pipe[2] = { -1, -1 };
+
+/**
+ * Send a state string to systemd's notification socket, if there is one
+ */
+static void notify(const char *state) {
+    const char *path = getenv("NOTIFY_SOCKET");
+    if (!path || (path[0] != '/' && path[0] != '@')) return;
+
+    struct sockaddr_un sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    size_t len = strlen(path);
+    if (len >= sizeof(sa.sun_path)) return;
+    memcpy(sa.sun_path, path, len);
+    if (sa.sun_path[0] == '@') sa.sun_path[0] = '\0';   // Abstract namespace
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return;
+    if (sendto(fd, state, strlen(state), MSG_NOSIGNAL, (struct sockaddr *)&sa,
+               offsetof(struct sockaddr_un, sun_path) + len) < 0) {
+        LOG_DEBUG("HANDOFF", "sd_notify failed: %s", strerror(errno));
+    }
+    close(fd);
+}
+
+static int msg_send(HandoffMsgType type, const void *body, size_t len, const int *fds, int count) {
+    HandoffMsg msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.type = type;
+    msg.version = HANDOFF_VERSION;
+    if (body) memcpy(&msg.u, body, len);
+
+    int sent_fds[HANDOFF_MAX_FDS], n = 0;
+    for (int i = 0; i < count && i < HANDOFF_MAX_FDS; i++) {
+        if (fds[i] < 0) continue;
+        msg.fd_mask |= 1u << i;
+        sent_fds[n++] = fds[i];
+    }
+
+    struct iovec iov = { &msg, sizeof(msg) };
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    if (n > 0) {
+        memset(&control, 0, sizeof(control));
+        mh.msg_control = control.buf;
+        mh.msg_controllen = CMSG_SPACE(sizeof(int) * n);
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int) * n);
+        memcpy(CMSG_DATA(cm), sent_fds, sizeof(int) * n);
+    }
+    ssize_t rc = -1;
+    tracked_lock(&chan_mutex);
+    if (chan >= 0) {
+        while ((rc = sendmsg(chan, &mh, MSG_NOSIGNAL)) < 0 && errno == EINTR) {}
+    }
+    tracked_unlock(&chan_mutex);
+    return rc == (ssize_t)sizeof(msg) ? 0 : -1;
+}
+
+/** Close chan once no send is using it; later sends fail instead */
+static void chan_close(void) {
+    tracked_lock(&chan_mutex);
+    if (chan >= 0) close(chan);
+    chan = -1;
+    tracked_unlock(&chan_mutex);
+}
+
+/**
+ * Receive the next message; fds[i] is -1 for slots that carried nothing
+ *
+ * @param timeout_ms -1 to wait indefinitely
+ * @return Message type, or -1 on timeout, EOF or error
+ */
+static int msg_recv(HandoffMsg *msg, int fds[HANDOFF_MAX_FDS], int timeout_ms) {
+    for (int i = 0; i < HANDOFF_MAX_FDS; i++) fds[i] = -1;
+
+    struct pollfd pfd = { .fd = chan, .events = POLLIN };
+    int ready;
+    while ((ready = poll(&pfd, 1, timeout_ms)) < 0 && errno == EINTR) {}
+    if (ready <= 0) return -1;
+
+    struct iovec iov = { msg, sizeof(*msg) };
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control.buf;
+    mh.msg_controllen = sizeof(control.buf);
+    ssize_t n;
+    while ((n = recvmsg(chan, &mh, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {}
+    if (n <= 0) return -1;
+
+    int got[HANDOFF_MAX_FDS], count = 0;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+        count = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        if (count > HANDOFF_MAX_FDS) count = HANDOFF_MAX_FDS;
+        memcpy(got, CMSG_DATA(cm), sizeof(int) * count);
+    }
+    if (n != (ssize_t)sizeof(*msg) || msg->version != HANDOFF_VERSION) {
+        for (int i = 0; i < count; i++) close(got[i]);
+        return -1;
+    }
+    for (int i = 0, j = 0; i < HANDOFF_MAX_FDS && j < count; i++) {
+        if (msg->fd_mask & (1u << i)) fds[i] = got[j++];
+    }
+    return (int)msg->type;
+}
+
+static void close_fds(int fds[HANDOFF_MAX_FDS]) {
+    for (int i = 0; i < HANDOFF_MAX_FDS; i++) {
+        if (fds[i] >= 0) close(fds[i]);
+    }
+}
+
+/* ============================================================================
+ * New process: take over
+ * ============================================================================ */
+
+int handoff_inherited(void) {
+    return inherited;
+}
+
+int handoff_listen_fd(void) {
+    if (!inherited) return systemd_fd;
+
+    HandoffMsg msg;
+    int fds[HANDOFF_MAX_FDS];
+    if (msg_recv(&msg, fds, HANDOFF_READY_TIMEOUT_MS) != HANDOFF_MSG_HELLO) {
+        LOG_ERROR("HANDOFF", "No handoff from the old process (version mismatch?)");
+        exit(1);
+    }
+    if (msg_recv(&msg, fds, HANDOFF_READY_TIMEOUT_MS) != HANDOFF_MSG_LISTEN || fds[0] < 0) {
+        LOG_ERROR("HANDOFF", "Old process did not pass its listening socket");
+        close_fds(fds);
+        exit(1);
+    }
+    LOG_INFO("HANDOFF", "Took over the listening socket from pid %d", (int)getppid());
+    return fds[0];
+}
+
+static void *receive_sessions(void *arg) {
+    (void)arg;
+    thread_state_register("handoff");
+    int relays = 0, recorders = 0, scheduler_started = 0;
+    for (;;) {
+        HandoffMsg msg;
+        int fds[HANDOFF_MAX_FDS];
+        int type = msg_recv(&msg, fds, -1);
+        if (type == HANDOFF_MSG_RELAY && fds[0] >= 0 && fds[1] >= 0) {
+            web_adopt_relay(&msg.u.relay, fds[0], fds[1], fds[2], fds[3]);
+            relays++;
+        } else if (type == HANDOFF_MSG_RECORDER) {
+            scheduler_adopt(&msg.u.recorder, fds[0]);
+            recorders++;
+        } else if (type == HANDOFF_MSG_SCHEDULER && !scheduler_started) {
+            start_scheduler();
+            scheduler_started = 1;
+        } else {
+            close_fds(fds);
+            if (type == HANDOFF_MSG_DONE || type < 0) break;
+        }
+    }
+    // The old process may have died before passing its recorders on
+    if (!scheduler_started) start_scheduler();
+    chan_close();
+    LOG_INFO("HANDOFF", "Takeover complete: %d relays and %d recordings adopted", relays, recorders);
+    thread_state_unregister();
+    return NULL;
+}
+
+void handoff_ready(int listen_fd) {
+    listen_sock = listen_fd;
+    if (!inherited) {
+        notify("READY=1");
+        return;
+    }
+    if (msg_send(HANDOFF_MSG_READY, NULL, 0, NULL, 0) < 0) {
+        LOG_ERROR("HANDOFF", "Lost the old process before taking over");
+        exit(1);
+    }
+    pthread_t th;
+    if (pthread_create(&th, NULL, receive_sessions, NULL) == 0) pthread_detach(th);
+    char state[64];
+    snprintf(state, sizeof(state), "MAINPID=%d\nREADY=1", (int)getpid());
+    notify(state);
+}
+
+/* ============================================================================
+ * Old process: hand off
+ * ============================================================================ */
+
+int handoff_pending(void) {
+    return atomic_load_explicit(&pending, memory_order_relaxed);
+}
+
+int handoff_send_relay(const HandoffRelay *relay, int sock, int out_fd, int err_fd) {
+    int pidfd = handoff_pidfd(relay->pid);
+    int fds[HANDOFF_MAX_FDS] = { sock, out_fd, err_fd, pidfd };
+    int rc = msg_send(HANDOFF_MSG_RELAY, relay, sizeof(*relay), fds, HANDOFF_MAX_FDS);
+    if (pidfd >= 0) close(pidfd);
+    if (rc == 0) atomic_fetch_add(&relays_sent, 1);
+    return rc;
+}
+
+int handoff_send_recorder(const HandoffRecorder *recorder) {
+    int pidfd = handoff_pidfd(recorder->pid);
+    int rc = msg_send(HANDOFF_MSG_RECORDER, recorder, sizeof(*recorder), &pidfd, 1);
+    if (pidfd >= 0) close(pidfd);
+    if (rc == 0) atomic_fetch_add(&recorders_sent, 1);
+    return rc;
+}
+
+/**
+ * Start the binary on disk with the child end of a fresh handoff socket
+ *
+ * @return pid, or -1
+ */
+static pid_t spawn_successor(int child_fd) {
+    extern char **environ;
+    size_t count = 0;
+    while (environ[count]) count++;
+    char **envp = calloc(count + 2, sizeof(char *));
+    if (!envp) return -1;
+    size_t n = 0;
+    size_t key_len = strlen(HANDOFF_ENV);
+    for (size_t i = 0; i < count; i++) {
+        if (strncmp(environ[i], HANDOFF_ENV, key_len) == 0 && environ[i][key_len] == '=') continue;
+        envp[n++] = environ[i];
+    }
+    char var[64];
+    snprintf(var, sizeof(var), "%s=%d", HANDOFF_ENV, child_fd);
+    envp[n++] = var;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Only the handoff socket crosses exec
+        fcntl(child_fd, F_SETFD, 0);
+        execve(exe_path, saved_argv, envp);
+        _exit(127);
+    }
+    free(envp);
+    return pid;
+}
+
+static void handoff_run(void) {
+    if (listen_sock < 0 || chan >= 0 || handoff_pending()) {
+        LOG_WARN("HANDOFF", "SIGUSR2 ignored: %s", listen_sock < 0 ? "not listening yet" : "handoff in progress");
+        return;
+    }
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+        LOG_ERROR("HANDOFF", "socketpair: %s", strerror(errno));
+        return;
+    }
+    // systemd wants the timestamp to tell this reload from a stale one
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    char reloading[64];
+    snprintf(reloading, sizeof(reloading), "RELOADING=1\nMONOTONIC_USEC=%lld",
+             (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+    notify(reloading);
+    pid_t pid = spawn_successor(sv[1]);
+    close(sv[1]);
+    if (pid < 0) {
+        LOG_ERROR("HANDOFF", "Cannot start %s: %s", exe_path, strerror(errno));
+        close(sv[0]);
+        notify("READY=1");
+        return;
+    }
+    chan = sv[0];
+    LOG_INFO("HANDOFF", "Started %s as pid %d to take over", exe_path, (int)pid);
+
+    HandoffMsg msg;
+    int fds[HANDOFF_MAX_FDS];
+    int type = -1;
+    if (msg_send(HANDOFF_MSG_HELLO, NULL, 0, NULL, 0) == 0 &&
+        msg_send(HANDOFF_MSG_LISTEN, NULL, 0, &listen_sock, 1) == 0) {
+        type = msg_recv(&msg, fds, HANDOFF_READY_TIMEOUT_MS);
+        close_fds(fds);
+    }
+    if (type != HANDOFF_MSG_READY) {
+        LOG_ERROR("HANDOFF", "pid %d did not become ready, keeping the current process", (int)pid);
+        // It may share the listening socket by now; it has no sessions yet
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        chan_close();
+        notify("READY=1");
+        return;
+    }
+
+    new_pid = pid;
+    atomic_store(&pending, 1);
+    scheduler_handoff();
+    msg_send(HANDOFF_MSG_SCHEDULER, NULL, 0, NULL, 0);
+    // start_web_server() returns and main() calls handoff_drain()
+    io_accept_stop();
+}
+
+void handoff_drain(void) {
+    long long deadline = mono_ms() + HANDOFF_DRAIN_MS;
+    int open;
+    while ((open = web_active_connections()) > 0 && mono_ms() < deadline) {
+        usleep(50 * 1000);
+    }
+    if (open > 0) {
+        LOG_WARN("HANDOFF", "Closing %d connections still open after %d ms", open, HANDOFF_DRAIN_MS);
+    }
+    msg_send(HANDOFF_MSG_DONE, NULL, 0, NULL, 0);
+    chan_close();
+    LOG_INFO("HANDOFF", "Handed off to pid %d: %d relays, %d recordings", (int)new_pid,
+             atomic_load(&relays_sent), atomic_load(&recorders_sent));
+}
+
+static void on_handoff_signal(int sig) {
+    (void)sig;
+    int saved = errno;
+    if (write(wake_pipe[1], "", 1) < 0) {}
+    errno = saved;
+}
+
+static void *handoff_thread(void *arg) {
+    (void)arg;
+    thread_state_register("handoff");
+    for (;;) {
+        char c;
+        ThreadStateMark mark = thread_state_enter(THREAD_PIPE_READ, "sigusr2");
+        ssize_t n = read(wake_pipe[0], &c, 1);
+        thread_state_leave(mark);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        handoff_run();
+    }
+    thread_state_unregister();
+    return NULL;
+}
+
+void handoff_init(int argc, char *argv[]) {
+    (void)argc;
+    saved_argv = argv;
+    ssize_t n = readlink("/proc/self/exe", exe_path, sizeof(exe_path) - 1);
+    exe_path[n > 0 ? n : 0] = '\0';
+
+    // Both variables are consumed here, before any thread can read the environment
+    const char *fd = getenv(HANDOFF_ENV);
+    if (fd) {
+        chan = atoi(fd);
+        fcntl(chan, F_SETFD, FD_CLOEXEC);
+        inherited = 1;
+        unsetenv(HANDOFF_ENV);
+    } else {
+        const char *pid = getenv("LISTEN_PID");
+        const char *fds = getenv("LISTEN_FDS");
+        if (pid && fds && atoi(pid) == (int)getpid() && atoi(fds) >= 1) {
+            systemd_fd = SYSTEMD_LISTEN_FD;
+            fcntl(systemd_fd, F_SETFD, FD_CLOEXEC);
+            LOG_INFO("HANDOFF", "Using the listening socket from systemd");
+        }
+    }
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+
+    if (pipe2(wake_pipe, O_CLOEXEC) < 0) return;
+    pthread_t th;
+    if (pthread_create(&th, NULL, handoff_thread, NULL) != 0) return;
+    pthread_detach(th);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_handoff_signal;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR2, &sa, NULL);
+}
+
+/* ============================================================================
+ * Adopted processes
+ * ============================================================================ */
+
+int handoff_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    return -1;
+#endif
+}
+
+int handoff_kill(pid_t pid, int pidfd, int sig) {
+#ifdef SYS_pidfd_send_signal
+    // Unlike kill(), cannot hit an unrelated process that reused the pid
+    if (pidfd >= 0) return (int)syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0);
+#endif
+    return kill(pid, sig);
+}
+
+int handoff_exited(pid_t pid, int pidfd, int timeout_ms) {
+    if (pidfd >= 0) {
+        struct pollfd pfd = { .fd = pidfd, .events = POLLIN };
+        int ready;
+        while ((ready = poll(&pfd, 1, timeout_ms)) < 0 && errno == EINTR) {}
+        return ready > 0;
+    }
+    // No pidfd: poll for the process to disappear (its reaper is not us)
+    long long deadline = mono_ms() + timeout_ms;
+    while (kill(pid, 0) == 0) {
+        if (timeout_ms >= 0 && mono_ms() >= deadline) return 0;
+        usleep(20 * 1000);
+    }
+    return 1;
+}
+
+void handoff_usage(pid_t pid, struct rusage *ru) {
+    memset(ru, 0, sizeof(*ru));
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (!f) return;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+
+    // Fields 14 and 15 (utime, stime), counted after comm's closing ')'
+    char *rp = strrchr(buf, ')');
+    unsigned long utime, stime;
+    if (!rp || sscanf(rp + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+        return;
+    }
+    long hz = sysconf(_SC_CLK_TCK);
+    ru->ru_utime.tv_sec = utime / hz;
+    ru->ru_utime.tv_usec = (utime % hz) * 1000000 / hz;
+    ru->ru_stime.tv_sec = stime / hz;
+    ru->ru_stime.tv_usec = (stime % hz) * 1000000 / hz;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    f = fopen(path, "r");
+    if (!f) return;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "VmHWM:", 6) == 0) ru->ru_maxrss = atol(line + 6);
+    }
+    fclose(f);
+}
@@ -0,0 +1,419 @@
+/**
+ * @file hpack.c
+ * @brief HPACK header compression for HTTP/2 (RFC 7541)
+ *
+ * The Huffman code is canonical (codes of one length are consecutive and
+ * in symbol order), so decoding needs only the first code and symbol
+ * offset of each length rather than a tree. Header blocks are a few
+ * hundred bytes, so decoding bit by bit is cheap enough.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "hpack.h"
+
+/* ============================================================================
+ * Static table (RFC 7541 Appendix A)
+ * ============================================================================ */
+
+#define STATIC_COUNT 61
+
+static const struct {
+    const char *name;
+    const char *value;
+} static_table[STATIC_COUNT] = {
+    { ":authority", "" }, { ":method", "GET" }, { ":method", "POST" }, { ":path", "/" },
+    { ":path", "/index.html" }, { ":scheme", "http" }, { ":scheme", "https" }, { ":status", "200" },
+    { ":status", "204" }, { ":status", "206" }, { ":status", "304" }, { ":status", "400" },
+    { ":status", "404" }, { ":status", "500" }, { "accept-charset", "" }, { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" }, { "accept-ranges", "" }, { "accept", "" }, { "access-control-allow-origin", "" },
+    { "age", "" }, { "allow", "" }, { "authorization", "" }, { "cache-control", "" },
+    { "content-disposition", "" }, { "content-encoding", "" }, { "content-language", "" }, { "content-length", "" },
+    { "content-location", "" }, { "content-range", "" }, { "content-type", "" }, { "cookie", "" },
+    { "date", "" }, { "etag", "" }, { "expect", "" }, { "expires", "" },
+    { "from", "" }, { "host", "" }, { "if-match", "" }, { "if-modified-since", "" },
+    { "if-none-match", "" }, { "if-range", "" }, { "if-unmodified-since", "" }, { "last-modified", "" },
+    { "link", "" }, { "location", "" }, { "max-forwards", "" }, { "proxy-authenticate", "" },
+    { "proxy-authorization", "" }, { "range", "" }, { "referer", "" }, { "refresh", "" },
+    { "retry-after", "" }, { "server", "" }, { "set-cookie", "" }, { "strict-transport-security", "" },
+    { "transfer-encoding", "" }, { "user-agent", "" }, { "vary", "" }, { "via", "" },
+    { "www-authenticate", "" },
+};
+
+/* ============================================================================
+ * Huffman code (RFC 7541 Appendix B), symbol 256 is EOS
+ * ============================================================================ */
+
+#define HUFF_SYMBOLS 257
+#define HUFF_MAX_BITS 30
+
+static const uint32_t huff_codes[HUFF_SYMBOLS] = {
+    0x00001ff8, 0x007fffd8, 0x0fffffe2, 0x0fffffe3, 0x0fffffe4, 0x0fffffe5, 0x0fffffe6, 0x0fffffe7,
+    0x0fffffe8, 0x00ffffea, 0x3ffffffc, 0x0fffffe9, 0x0fffffea, 0x3ffffffd, 0x0fffffeb, 0x0fffffec,
+    0x0fffffed, 0x0fffffee, 0x0fffffef, 0x0ffffff0, 0x0ffffff1, 0x0ffffff2, 0x3ffffffe, 0x0ffffff3,
+    0x0ffffff4, 0x0ffffff5, 0x0ffffff6, 0x0ffffff7, 0x0ffffff8, 0x0ffffff9, 0x0ffffffa, 0x0ffffffb,
+    0x00000014, 0x000003f8, 0x000003f9, 0x00000ffa, 0x00001ff9, 0x00000015, 0x000000f8, 0x000007fa,
+    0x000003fa, 0x000003fb, 0x000000f9, 0x000007fb, 0x000000fa, 0x00000016, 0x00000017, 0x00000018,
+    0x00000000, 0x00000001, 0x00000002, 0x00000019, 0x0000001a, 0x0000001b, 0x0000001c, 0x0000001d,
+    0x0000001e, 0x0000001f, 0x0000005c, 0x000000fb, 0x00007ffc, 0x00000020, 0x00000ffb, 0x000003fc,
+    0x00001ffa, 0x00000021, 0x0000005d, 0x0000005e, 0x0000005f, 0x00000060, 0x00000061, 0x00000062,
+    0x00000063, 0x00000064, 0x00000065, 0x00000066, 0x00000067, 0x00000068, 0x00000069, 0x0000006a,
+    0x0000006b, 0x0000006c, 0x0000006d, 0x0000006e, 0x0000006f, 0x00000070, 0x00000071, 0x00000072,
+    0x000000fc, 0x00000073, 0x000000fd, 0x00001ffb, 0x0007fff0, 0x00001ffc, 0x00003ffc, 0x00000022,
+    0x00007ffd, 0x00000003, 0x00000023, 0x00000004, 0x00000024, 0x00000005, 0x00000025, 0x00000026,
+    0x00000027, 0x00000006, 0x00000074, 0x00000075, 0x00000028, 0x00000029, 0x0000002a, 0x00000007,
+    0x0000002b, 0x00000076, 0x0000002c, 0x00000008, 0x00000009, 0x0000002d, 0x00000077, 0x00000078,
+    0x00000079, 0x0000007a, 0x0000007b, 0x00007ffe, 0x000007fc, 0x00003ffd, 0x00001ffd, 0x0ffffffc,
+    0x000fffe6, 0x003fffd2, 0x000fffe7, 0x000fffe8, 0x003fffd3, 0x003fffd4, 0x003fffd5, 0x007fffd9,
+    0x003fffd6, 0x007fffda, 0x007fffdb, 0x007fffdc, 0x007fffdd, 0x007fffde, 0x00ffffeb, 0x007fffdf,
+    0x00ffffec, 0x00ffffed, 0x003fffd7, 0x007fffe0, 0x00ffffee, 0x007fffe1, 0x007fffe2, 0x007fffe3,
+    0x007fffe4, 0x001fffdc, 0x003fffd8, 0x007fffe5, 0x003fffd9, 0x007fffe6, 0x007fffe7, 0x00ffffef,
+    0x003fffda, 0x001fffdd, 0x000fffe9, 0x003fffdb, 0x003fffdc, 0x007fffe8, 0x007fffe9, 0x001fffde,
+    0x007fffea, 0x003fffdd, 0x003fffde, 0x00fffff0, 0x001fffdf, 0x003fffdf, 0x007fffeb, 0x007fffec,
+    0x001fffe0, 0x001fffe1, 0x003fffe0, 0x001fffe2, 0x007fffed, 0x003fffe1, 0x007fffee, 0x007fffef,
+    0x000fffea, 0x003fffe2, 0x003fffe3, 0x003fffe4, 0x007ffff0, 0x003fffe5, 0x003fffe6, 0x007ffff1,
+    0x03ffffe0, 0x03ffffe1, 0x000fffeb, 0x0007fff1, 0x003fffe7, 0x007ffff2, 0x003fffe8, 0x01ffffec,
+    0x03ffffe2, 0x03ffffe3, 0x03ffffe4, 0x07ffffde, 0x07ffffdf, 0x03ffffe5, 0x00fffff1, 0x01ffffed,
+    0x0007fff2, 0x001fffe3, 0x03ffffe6, 0x07ffffe0, 0x07ffffe1, 0x03ffffe7, 0x07ffffe2, 0x00fffff2,
+    0x001fffe4, 0x001fffe5, 0x03ffffe8, 0x03ffffe9, 0x0ffffffd, 0x07ffffe3, 0x07ffffe4, 0x07ffffe5,
+    0x000fffec, 0x00fffff3, 0x000fffed, 0x001fffe6, 0x003fffe9, 0x001fffe7, 0x001fffe8, 0x007ffff3,
+    0x003fffea, 0x003fffeb, 0x01ffffee, 0x01ffffef, 0x00fffff4, 0x00fffff5, 0x03ffffea, 0x007ffff4,
+    0x03ffffeb, 0x07ffffe6, 0x03ffffec, 0x03ffffed, 0x07ffffe7, 0x07ffffe8, 0x07ffffe9, 0x07ffffea,
+    0x07ffffeb, 0x0ffffffe, 0x07ffffec, 0x07ffffed, 0x07ffffee, 0x07ffffef, 0x07fffff0, 0x03ffffee,
+    0x3fffffff,
+};
+
+static const uint8_t huff_lengths[HUFF_SYMBOLS] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+     6, 10, 10, 12, 13,  6,  8, 11, 10, 10,  8, 11,  8,  6,  6,  6,
+     5,  5,  5,  6,  6,  6,  6,  6,  6,  6,  7,  8, 15,  6, 12, 10,
+    13,  6,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,
+     7,  7,  7,  7,  7,  7,  7,  7,  8,  7,  8, 13, 19, 13, 14,  6,
+    15,  5,  6,  5,  6,  5,  6,  6,  6,  5,  7,  7,  6,  6,  6,  5,
+     6,  7,  6,  5,  5,  6,  7,  7,  7,  7,  7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+static uint32_t huff_first[HUFF_MAX_BITS + 1];   /**< First code of each length */
+static uint16_t huff_count[HUFF_MAX_BITS + 1];   /**< Codes of each length */
+static uint16_t huff_offset[HUFF_MAX_BITS + 1];  /**< Index of that first code in huff_symbols */
+static uint16_t huff_symbols[HUFF_SYMBOLS];      /**< Symbols ordered by length, then code */
+static pthread_once_t huff_once = PTHREAD_ONCE_INIT;
+
+static void huff_build(void) {
+    int n = 0;
+    for (int len = 1; len <= HUFF_MAX_BITS; len++) {
+        huff_offset[len] = n;
+        for (int s = 0; s < HUFF_SYMBOLS; s++) {
+            if (huff_lengths[s] != len) continue;
+            if (huff_count[len] == 0) huff_first[len] = huff_codes[s];
+            huff_count[len]++;
+            huff_symbols[n++] = s;
+        }
+    }
+}
+
+static int huff_decode(const uint8_t *in, size_t len, char *out, size_t cap, size_t *out_len) {
+    pthread_once(&huff_once, huff_build);
+    uint32_t code = 0;
+    int bits = 0;
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        for (int b = 7; b >= 0; b--) {
+            code = (code << 1) | ((in[i] >> b) & 1);
+            if (++bits > HUFF_MAX_BITS) return -1;
+            if (huff_count[bits] && code >= huff_first[bits] && code - huff_first[bits] < huff_count[bits]) {
+                int sym = huff_symbols[huff_offset[bits] + code - huff_first[bits]];
+                // EOS inside a string is an error
+                if (sym == 256 || n >= cap) return -1;
+                out[n++] = (char)sym;
+                code = 0;
+                bits = 0;
+            }
+        }
+    }
+    // Padding must be a prefix of EOS (all ones) and shorter than a byte
+    if (bits > 7 || code != (1u << bits) - 1) return -1;
+    *out_len = n;
+    return 0;
+}
+
+static size_t huff_encoded_len(const char *s, size_t len) {
+    size_t bits = 0;
+    for (size_t i = 0; i < len; i++) bits += huff_lengths[(uint8_t)s[i]];
+    return (bits + 7) / 8;
+}
+
+static void huff_encode(const char *s, size_t len, uint8_t *out) {
+    uint64_t acc = 0;
+    int bits = 0;
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        uint8_t c = (uint8_t)s[i];
+        acc = (acc << huff_lengths[c]) | huff_codes[c];
+        bits += huff_lengths[c];
+        while (bits >= 8) {
+            bits -= 8;
+            out[n++] = (uint8_t)(acc >> bits);
+        }
+    }
+    if (bits) out[n] = (uint8_t)((acc << (8 - bits)) | (0xff >> bits));
+}
+
+/* ============================================================================
+ * Primitives (RFC 7541 5.1, 5.2)
+ * ============================================================================ */
+
+static int int_encode(uint8_t *out, size_t cap, uint8_t first, int prefix, size_t value) {
+    size_t max = (1u << prefix) - 1;
+    if (cap < 1) return -1;
+    if (value < max) {
+        out[0] = first | (uint8_t)value;
+        return 1;
+    }
+    out[0] = first | (uint8_t)max;
+    value -= max;
+    size_t n = 1;
+    while (value >= 128) {
+        if (n >= cap) return -1;
+        out[n++] = (uint8_t)((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    if (n >= cap) return -1;
+    out[n++] = (uint8_t)value;
+    return (int)n;
+}
+
+static int int_decode(const uint8_t **p, const uint8_t *end, int prefix, size_t *value) {
+    if (*p >= end) return -1;
+    size_t max = (1u << prefix) - 1;
+    size_t v = *(*p)++ & max;
+    if (v == max) {
+        int shift = 0;
+        uint8_t b;
+        do {
+            if (*p >= end || shift > 28) return -1;
+            b = *(*p)++;
+            v += (size_t)(b & 0x7f) << shift;
+            shift += 7;
+        } while (b & 0x80);
+    }
+    *value = v;
+    return 0;
+}
+
+static int str_encode(uint8_t *out, size_t cap, const char *s, size_t len) {
+    size_t hlen = huff_encoded_len(s, len);
+    int huffman = hlen < len;
+    size_t body = huffman ? hlen : len;
+    int n = int_encode(out, cap, huffman ? 0x80 : 0x00, 7, body);
+    if (n < 0 || (size_t)n + body > cap) return -1;
+    if (huffman) huff_encode(s, len, out + n);
+    else memcpy(out + n, s, len);
+    return n + (int)body;
+}
+
+static int str_decode(const uint8_t **p, const uint8_t *end, char *out, size_t *out_len) {
+    if (*p >= end) return -1;
+    int huffman = **p & 0x80;
+    size_t len;
+    if (int_decode(p, end, 7, &len) < 0 || len > (size_t)(end - *p)) return -1;
+    if (huffman) {
+        if (huff_decode(*p, len, out, HPACK_MAX_STRING, out_len) < 0) return -1;
+    } else {
+        if (len > HPACK_MAX_STRING) return -1;
+        memcpy(out, *p, len);
+        *out_len = len;
+    }
+    *p += len;
+    return 0;
+}
+
+/* ============================================================================
+ * Dynamic table
+ * ============================================================================ */
+
+void hpack_table_init(HpackTable *t, size_t limit) {
+    memset(t, 0, sizeof(*t));
+    t->limit = limit < HPACK_TABLE_SIZE ? limit : HPACK_TABLE_SIZE;
+    t->max_size = t->limit;
+}
+
+static void table_evict(HpackTable *t) {
+    HpackEntry *e = &t->entries[(t->first + t->count - 1) % HPACK_MAX_ENTRIES];
+    t->size -= e->name_len + e->value_len + 32;
+    free(e->name);
+    memset(e, 0, sizeof(*e));
+    t->count--;
+}
+
+void hpack_table_free(HpackTable *t) {
+    while (t->count) table_evict(t);
+}
+
+static void table_add(HpackTable *t, const char *name, size_t name_len, const char *value, size_t value_len) {
+    size_t size = name_len + value_len + 32;
+    while (t->count && t->size + size > t->max_size) table_evict(t);
+    // An entry larger than the table just empties it (RFC 7541 4.4)
+    if (size > t->max_size) return;
+
+    char *block = malloc(name_len + value_len + 2);
+    if (!block) return;
+    memcpy(block, name, name_len);
+    block[name_len] = '\0';
+    memcpy(block + name_len + 1, value, value_len);
+    block[name_len + 1 + value_len] = '\0';
+
+    t->first = (t->first + HPACK_MAX_ENTRIES - 1) % HPACK_MAX_ENTRIES;
+    HpackEntry *e = &t->entries[t->first];
+    e->name = block;
+    e->value = block + name_len + 1;
+    e->name_len = name_len;
+    e->value_len = value_len;
+    t->count++;
+    t->size += size;
+}
+
+/** Resolve a 1-based index over the static then dynamic table */
+static int table_lookup(HpackTable *t, size_t index, const char **name, size_t *name_len,
+                        const char **value, size_t *value_len) {
+    if (index >= 1 && index <= STATIC_COUNT) {
+        *name = static_table[index - 1].name;
+        *name_len = strlen(*name);
+        *value = static_table[index - 1].value;
+        *value_len = strlen(*value);
+        return 0;
+    }
+    if (index <= STATIC_COUNT || index - STATIC_COUNT > (size_t)t->count) return -1;
+    HpackEntry *e = &t->entries[(t->first + index - STATIC_COUNT - 1) % HPACK_MAX_ENTRIES];
+    *name = e->name;
+    *name_len = e->name_len;
+    *value = e->value;
+    *value_len = e->value_len;
+    return 0;
+}
+
+/* ============================================================================
+ * Decoder
+ * ============================================================================ */
+
+int hpack_decode(HpackTable *t, const uint8_t *block, size_t len, HpackHeaderFn fn, void *ctx) {
+    const uint8_t *p = block, *end = block + len;
+    char name_buf[HPACK_MAX_STRING], value_buf[HPACK_MAX_STRING];
+    int fields = 0;
+
+    while (p < end) {
+        uint8_t b = *p;
+        size_t index;
+        const char *name, *value;
+        size_t name_len, value_len;
+
+        if (b & 0x80) {
+            // Indexed field
+            if (int_decode(&p, end, 7, &index) < 0) return -1;
+            if (table_lookup(t, index, &name, &name_len, &value, &value_len) < 0) return -1;
+            fn(ctx, name, name_len, value, value_len);
+            fields++;
+            continue;
+        }
+
+        if ((b & 0xe0) == 0x20) {
+            // Table size update, only before the first field
+            size_t size;
+            if (fields || int_decode(&p, end, 5, &size) < 0 || size > t->limit) return -1;
+            t->max_size = size;
+            while (t->size > t->max_size) table_evict(t);
+            continue;
+        }
+
+        // Literal: with incremental indexing (01), without (0000) or never indexed (0001)
+        int indexing = (b & 0x40) != 0;
+        if (int_decode(&p, end, indexing ? 6 : 4, &index) < 0) return -1;
+        if (index) {
+            // Copied because adding this field may evict the entry it names
+            const char *n;
+            if (table_lookup(t, index, &n, &name_len, &value, &value_len) < 0) return -1;
+            memcpy(name_buf, n, name_len);
+        } else if (str_decode(&p, end, name_buf, &name_len) < 0) {
+            return -1;
+        }
+        if (str_decode(&p, end, value_buf, &value_len) < 0) return -1;
+
+        fn(ctx, name_buf, name_len, value_buf, value_len);
+        if (indexing) table_add(t, name_buf, name_len, value_buf, value_len);
+        fields++;
+    }
+    return 0;
+}
+
+/* ============================================================================
+ * Encoder
+ * ============================================================================ */
+
+void hpack_encoder_set_limit(HpackTable *t, size_t limit) {
+    if (limit > HPACK_TABLE_SIZE) limit = HPACK_TABLE_SIZE;
+    if (limit == t->max_size) return;
+    t->limit = limit;
+    t->max_size = limit;
+    while (t->size > t->max_size) table_evict(t);
+    t->size_update = 1;
+}
+
+int hpack_encode_begin(HpackTable *t, uint8_t *out, size_t cap) {
+    if (!t->size_update) return 0;
+    int n = int_encode(out, cap, 0x20, 5, t->max_size);
+    if (n > 0) t->size_update = 0;
+    return n;
+}
+
+/** Values that differ per response are not worth a table slot */
+static int worth_indexing(const char *name) {
+    return strcmp(name, "content-length") != 0 && strncmp(name, "x-", 2) != 0;
+}
+
+int hpack_encode(HpackTable *t, uint8_t *out, size_t cap, const char *name, const char *value) {
+    size_t name_len = strlen(name), value_len = strlen(value);
+    size_t name_index = 0;
+
+    for (int i = 0; i < STATIC_COUNT; i++) {
+        if (strcmp(static_table[i].name, name) != 0) continue;
+        if (strcmp(static_table[i].value, value) == 0) return int_encode(out, cap, 0x80, 7, i + 1);
+        if (!name_index) name_index = i + 1;
+    }
+    for (int i = 0; i < t->count; i++) {
+        HpackEntry *e = &t->entries[(t->first + i) % HPACK_MAX_ENTRIES];
+        if (e->name_len != name_len || memcmp(e->name, name, name_len) != 0) continue;
+        if (e->value_len == value_len && memcmp(e->value, value, value_len) == 0) {
+            return int_encode(out, cap, 0x80, 7, STATIC_COUNT + 1 + i);
+        }
+        if (!name_index) name_index = STATIC_COUNT + 1 + i;
+    }
+
+    int indexing = worth_indexing(name);
+    int n = int_encode(out, cap, indexing ? 0x40 : 0x00, indexing ? 6 : 4, name_index);
+    if (n < 0) return -1;
+    if (!name_index) {
+        int m = str_encode(out + n, cap - n, name, name_len);
+        if (m < 0) return -1;
+        n += m;
+    }
+    int m = str_encode(out + n, cap - n, value, value_len);
+    if (m < 0) return -1;
+    n += m;
+
+    if (indexing) table_add(t, name, name_len, value, value_len);
+    return n;
+}
@@ -0,0 +1,451 @@
+/**
+ * @file http.c
+ * @brief HTTP/1.1 connection reading and response framing
+ *
+ * A chunk goes out as one writev() of size line, payload and CRLF, so
+ * chunking a relayed stream costs no extra syscalls or copies.
+ *
+ * Responses on an HTTP/2 stream are handed to h2.c, which frames them.
+ *
+ * A watched connection's watchdog wakes every WATCHDOG_PERIOD_MS (or at
+ * its read deadline, if sooner) rather than being re-armed around each
+ * write: a relay writes far too often to take the wheel's lock every
+ * time, so writes only stamp writing_since. A write that stalls is thus
+ * caught between HTTP_SEND_TIMEOUT_MS and a period later.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "http.h"
+#include "clock.h"
+#include "h2.h"
+#include "io_engine.h"
+#include "flight.h"
+#include "thread_state.h"
+#include "log.h"
+
+#define WATCHDOG_PERIOD_MS (HTTP_SEND_TIMEOUT_MS / 3)
+
+void http_conn_init(HttpConn *conn, int sock) {
+    conn->sock = sock;
+    conn->served = 0;
+    conn->truncated = 0;
+    conn->len = 0;
+    conn->request_len = 0;
+    conn->saved = '\0';
+    conn->buf[0] = '\0';
+    memset(&conn->watchdog, 0, sizeof(conn->watchdog));
+    conn->watched = 0;
+    atomic_init(&conn->deadline, HTTP_DEADLINE_NONE);
+    atomic_init(&conn->deadline_at, 0);
+    atomic_init(&conn->writing_since, 0);
+    atomic_init(&conn->timed_out, 0);
+}
+
+/**
+ * Shut a watched connection down once a deadline has passed; the blocked
+ * read or write on its thread then fails
+ */
+static int conn_watchdog(WheelTimer *timer) {
+    HttpConn *conn = (HttpConn *)((char *)timer - offsetof(HttpConn, watchdog));
+    long long now = mono_ms();
+    int kind = atomic_load(&conn->deadline);
+    long long at = atomic_load(&conn->deadline_at);
+    long long since = atomic_load(&conn->writing_since);
+
+    FlightTimeout missed = 0;
+    if (kind != HTTP_DEADLINE_NONE && now >= at) {
+        missed = kind == HTTP_DEADLINE_IDLE ? FLIGHT_TIMEOUT_IDLE : FLIGHT_TIMEOUT_REQUEST;
+    } else if (since && now - since >= HTTP_SEND_TIMEOUT_MS) {
+        missed = FLIGHT_TIMEOUT_SEND;
+    }
+    if (missed) {
+        atomic_store(&conn->timed_out, 1);
+        shutdown(conn->sock, SHUT_RDWR);
+        flight_record(FLIGHT_TIMEOUT, conn->sock, missed);
+        return 0;
+    }
+
+    long long wait = WATCHDOG_PERIOD_MS;
+    if (kind != HTTP_DEADLINE_NONE && at - now < wait) wait = at - now;
+    return wait > 0 ? (int)wait : 1;
+}
+
+void http_conn_set_deadline(HttpConn *conn, HttpDeadline kind, int ms) {
+    if (!conn->watched) return;
+    atomic_store(&conn->deadline_at, mono_ms() + ms);
+    atomic_store(&conn->deadline, kind);
+    timer_arm(&conn->watchdog, conn_watchdog, ms);
+}
+
+void http_conn_clear_deadline(HttpConn *conn) {
+    if (conn->watched) atomic_store(&conn->deadline, HTTP_DEADLINE_NONE);
+}
+
+void http_conn_sending(HttpConn *conn, int active) {
+    atomic_store_explicit(&conn->writing_since, active ? mono_ms() : 0, memory_order_relaxed);
+}
+
+void http_conn_watch(HttpConn *conn) {
+    atomic_store(&conn->timed_out, 0);
+    atomic_store(&conn->writing_since, 0);
+    atomic_store(&conn->deadline, HTTP_DEADLINE_NONE);
+    conn->watched = 1;
+    timer_arm(&conn->watchdog, conn_watchdog, WATCHDOG_PERIOD_MS);
+}
+
+void http_conn_unwatch(HttpConn *conn) {
+    if (!conn->watched) return;
+    timer_cancel(&conn->watchdog);
+    conn->watched = 0;
+}
+
+/** End of the request head (after the blank line), or NULL */
+static char *head_end(char *buf) {
+    char *end = strstr(buf, "\r\n\r\n");
+    return end ? end + 4 : NULL;
+}
+
+/**
+ * Copy a request header's value into out ("" if absent); only the head
+ * before `end` is searched
+ *
+ * @return 1 if the header is present
+ */
+static int header_value(const char *buf, const char *end, const char *name, char *out, size_t size) {
+    size_t nlen = strlen(name);
+    out[0] = '\0';
+    for (const char *p = strstr(buf, "\r\n"); p && p + 2 < end; p = strstr(p + 2, "\r\n")) {
+        if (strncasecmp(p + 2, name, nlen) != 0 || p[2 + nlen] != ':') continue;
+        const char *v = p + 3 + nlen;
+        while (*v == ' ' || *v == '\t') v++;
+        size_t i = 0;
+        while (v[i] && v[i] != '\r' && i < size - 1) {
+            out[i] = v[i];
+            i++;
+        }
+        out[i] = '\0';
+        return 1;
+    }
+    return 0;
+}
+
+ssize_t http_read_request(HttpConn *conn) {
+    // Drop the previous request, keeping any pipelined bytes behind it
+    if (conn->request_len) {
+        conn->buf[conn->request_len] = conn->saved;
+        memmove(conn->buf, conn->buf + conn->request_len, conn->len - conn->request_len);
+        conn->len -= conn->request_len;
+        conn->request_len = 0;
+    }
+    conn->truncated = 0;
+
+    int idle = conn->served > 0 && conn->len == 0;
+    http_conn_set_deadline(conn, idle ? HTTP_DEADLINE_IDLE : HTTP_DEADLINE_REQUEST,
+                           idle ? HTTP_KEEPALIVE_TIMEOUT_MS : HTTP_REQUEST_TIMEOUT_MS);
+    size_t want = 0;           // Head plus Content-Length, once the head is in
+    for (;;) {
+        conn->buf[conn->len] = '\0';
+        char *end;
+        if (!want && (end = head_end(conn->buf))) {
+            char value[32];
+            want = end - conn->buf;
+            header_value(conn->buf, end, "Content-Length", value, sizeof(value));
+            long body = atol(value);
+            if (body > 0) want += body;
+            // A chunked request body is not read, so its bytes would be
+            // taken for the next request
+            header_value(conn->buf, end, "Transfer-Encoding", value, sizeof(value));
+            if (value[0]) conn->truncated = 1;
+        }
+        if (want && conn->len >= want) break;
+        if (conn->len == HTTP_REQUEST_MAX) {
+            conn->truncated = 1;
+            want = conn->len;
+            break;
+        }
+
+        ThreadStateMark mark = thread_state_enter(THREAD_SOCKET_READ, idle ? "keepalive" : "request");
+        ssize_t n = io_recv(conn->sock, conn->buf + conn->len, HTTP_REQUEST_MAX - conn->len,
+                            idle && !conn->watched ? HTTP_KEEPALIVE_TIMEOUT_MS : -1);
+        thread_state_leave(mark);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == ETIMEDOUT) return 0;
+        if (atomic_load(&conn->timed_out)) {
+            // Half a request is not worth answering once its time is up
+            if (conn->len) LOG_DEBUG("HTTP", "Request timed out after %zu bytes (fd=%d)", conn->len, conn->sock);
+            errno = ETIMEDOUT;
+            return 0;
+        }
+        if (n <= 0) {
+            if (conn->len == 0) return n < 0 ? -1 : 0;
+            // Client stopped mid-request: answer what arrived, then close
+            conn->truncated = 1;
+            want = conn->len;
+            break;
+        }
+        conn->len += n;
+        if (idle) http_conn_set_deadline(conn, HTTP_DEADLINE_REQUEST, HTTP_REQUEST_TIMEOUT_MS);
+        idle = 0;
+    }
+    http_conn_clear_deadline(conn);
+
+    conn->request_len = want;
+    conn->saved = conn->buf[want];
+    conn->buf[want] = '\0';
+    conn->served++;
+    return (ssize_t)want;
+}
+
+char *http_request_body(HttpConn *conn) {
+    return head_end(conn->buf);
+}
+
+int http_request_header(HttpConn *conn, const char *name, char *out, size_t size) {
+    char *end = head_end(conn->buf);
+    return header_value(conn->buf, end ? end : conn->buf + conn->request_len, name, out, size);
+}
+
+size_t http_conn_take_pending(HttpConn *conn, char *out, size_t size) {
+    size_t len = conn->len - conn->request_len;
+    if (len == 0) return 0;
+    if (len > size) len = size;
+    out[0] = conn->saved;
+    memcpy(out + 1, conn->buf + conn->request_len + 1, len - 1);
+    conn->len = conn->request_len;
+    return len;
+}
+
+void http_response_init(HttpResponse *res, HttpConn *conn) {
+    memset(res, 0, sizeof(*res));
+    res->sock = conn->sock;
+    res->length = -1;
+    if (conn->watched) res->conn = conn;
+
+    int major = 0, minor = 0;
+    sscanf(conn->buf, "%*s %*s HTTP/%d.%d", &major, &minor);
+    res->chunk_ok = major > 1 || (major == 1 && minor >= 1);
+
+    char *end = head_end(conn->buf);
+    char connection[64];
+    header_value(conn->buf, end ? end : conn->buf + conn->request_len, "Connection",
+                 connection, sizeof(connection));
+    // HTTP/1.1 is persistent unless asked otherwise; 1.0 only on request
+    if (res->chunk_ok) res->keep_alive = strcasestr(connection, "close") == NULL;
+    else res->keep_alive = strcasestr(connection, "keep-alive") != NULL;
+
+    if (conn->truncated || conn->served >= HTTP_KEEPALIVE_MAX) res->keep_alive = 0;
+}
+
+/**
+ * Stamp the start of a write (or of progress on one) for the send
+ * deadline of a watched connection
+ */
+static void send_progress(HttpResponse *res) {
+    if (res->conn) http_conn_sending(res->conn, 1);
+}
+
+static void send_done(HttpResponse *res) {
+    if (res->conn) http_conn_sending(res->conn, 0);
+}
+
+static int write_all(HttpResponse *res, struct iovec *iov, int count) {
+    while (count > 0) {
+        // At most HTTP_SEND_SLICE per call, so a slow client still shows progress
+        struct iovec part[4];
+        int parts = 0;
+        size_t room = HTTP_SEND_SLICE;
+        for (int i = 0; i < count && parts < 4 && room > 0; i++) {
+            part[parts] = iov[i];
+            if (part[parts].iov_len > room) part[parts].iov_len = room;
+            room -= part[parts].iov_len;
+            parts++;
+        }
+        send_progress(res);
+        ssize_t n = writev(res->sock, part, parts);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            send_done(res);
+            res->failed = 1;
+            res->keep_alive = 0;
+            return -1;
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    send_done(res);
+    return 0;
+}
+
+static int format_head(HttpResponse *res, char *buf, size_t size, int status, const char *status_text,
+                       const char *content_type, const char *headers, long long content_length) {
+    // 204 and 304 have no body, and a 304 must not claim a length of 0
+    int bodiless = status == 204 || status == 304;
+    if (bodiless) content_length = 0;
+    if (content_length < 0) {
+        if (res->keep_alive && res->chunk_ok) res->chunked = 1;
+        else res->keep_alive = 0;
+    }
+    res->length = content_length;
+    res->head_sent = 1;
+
+    char framing[64];
+    if (bodiless) framing[0] = '\0';
+    else if (content_length >= 0) snprintf(framing, sizeof(framing), "Content-Length: %lld\r\n", content_length);
+    else snprintf(framing, sizeof(framing), "%s", res->chunked ? "Transfer-Encoding: chunked\r\n" : "");
+
+    int len = snprintf(buf, size,
+        "HTTP/1.1 %d %s\r\n"
+        "Content-Type: %s\r\n"
+        "%s%s"
+        "Connection: %s\r\n"
+        "\r\n",
+        status, status_text, content_type, headers ? headers : "", framing,
+        res->keep_alive ? "keep-alive" : "close");
+    return len < (int)size ? len : (int)size - 1;
+}
+
+int http_begin(HttpResponse *res, int status, const char *status_text,
+               const char *content_type, const char *headers, long long content_length) {
+    if (res->h2) {
+        res->length = content_length;
+        res->head_sent = 1;
+        if (h2_begin(res->h2, status, content_type, headers, content_length) == 0) return 0;
+        res->failed = 1;
+        return -1;
+    }
+    char head[1024];
+    int len = format_head(res, head, sizeof(head), status, status_text, content_type, headers, content_length);
+    struct iovec iov[1] = { { head, len } };
+    return write_all(res, iov, 1);
+}
+
+int http_write(HttpResponse *res, const void *data, size_t len) {
+    if (res->failed) return -1;
+    // A zero-length chunk would end the body
+    if (len == 0) return 0;
+    res->sent += len;
+    if (res->h2) {
+        if (h2_write(res->h2, data, len) == 0) return 0;
+        res->failed = 1;
+        return -1;
+    }
+    if (!res->chunked) {
+        struct iovec iov[1] = { { (void *)data, len } };
+        return write_all(res, iov, 1);
+    }
+    char size[24];
+    int slen = snprintf(size, sizeof(size), "%zx\r\n", len);
+    struct iovec iov[3] = { { size, slen }, { (void *)data, len }, { (void *)"\r\n", 2 } };
+    return write_all(res, iov, 3);
+}
+
+int http_end(HttpResponse *res) {
+    if (res->detached) return 0;
+    if (res->h2) {
+        // A stream is reset rather than ended when its body came up short
+        h2_end(res->h2, res->head_sent && !res->failed && res->keep_alive &&
+                        (res->length < 0 || res->sent == res->length));
+        return 0;
+    }
+    if (!res->head_sent || res->failed || !res->keep_alive) return 0;
+    if (res->chunked) {
+        struct iovec iov[1] = { { (void *)"0\r\n\r\n", 5 } };
+        return write_all(res, iov, 1) == 0;
+    }
+    // A body shorter than its Content-Length leaves the client waiting
+    return res->length < 0 || res->sent == res->length;
+}
+
+int http_send_file(HttpResponse *res, int fd, size_t len) {
+    if (res->failed) return -1;
+    if (!res->h2 && !res->chunked) {
+        off_t off = lseek(fd, 0, SEEK_CUR);
+        int rc = 0;
+        while (len > 0 && rc == 0) {
+            size_t part = len < HTTP_SEND_SLICE ? len : HTTP_SEND_SLICE;
+            send_progress(res);
+            rc = io_send_file(res->sock, fd, off, part);
+            if (rc == 0) {
+                off += part;
+                len -= part;
+                res->sent += part;
+            }
+        }
+        send_done(res);
+        if (rc == 0) return 0;
+        if (rc == -1) {
+            res->failed = 1;
+            res->keep_alive = 0;
+            return -1;
+        }
+        lseek(fd, off, SEEK_SET);
+    }
+    char buf[65536];
+    while (len > 0) {
+        ssize_t n = read(fd, buf, len < sizeof(buf) ? len : sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        if (http_write(res, buf, n) < 0) return -1;
+        len -= n;
+    }
+    return 0;
+}
+
+int http_can_splice(HttpResponse *res) {
+    return !res->h2 && !res->failed && io_engine() == IO_ENGINE_URING;
+}
+
+int http_splice(HttpResponse *res, int pipe_fd, size_t len) {
+    if (res->failed) return -1;
+    if (len == 0) return 0;
+    char size[24];
+    int slen = res->chunked ? snprintf(size, sizeof(size), "%zx\r\n", len) : 0;
+    send_progress(res);
+    int rc = io_send_pipe(res->sock, pipe_fd, len, size, slen, "\r\n", res->chunked ? 2 : 0);
+    send_done(res);
+    if (rc != 0) {
+        // A pipe that cannot be spliced is as good as a failed write here:
+        // part of its data may already be gone
+        res->failed = 1;
+        res->keep_alive = 0;
+        return -1;
+    }
+    res->sent += len;
+    return 0;
+}
+
+void http_abort(HttpResponse *res) {
+    res->keep_alive = 0;
+}
+
+void http_send(HttpResponse *res, int status, const char *status_text,
+               const char *content_type, const void *body, size_t len) {
+    if (res->h2) {
+        if (http_begin(res, status, status_text, content_type, NULL, (long long)len) == 0) {
+            http_write(res, body, len);
+        }
+        return;
+    }
+    char head[1024];
+    int hlen = format_head(res, head, sizeof(head), status, status_text, content_type, NULL, (long long)len);
+    res->sent = len;
+    struct iovec iov[2] = { { head, hlen }, { (void *)body, len } };
+    write_all(res, iov, len ? 2 : 1);
+}
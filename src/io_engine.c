@@ -0,0 +1,468 @@
+/**
+ * @file io_engine.c
+ * @brief Socket and file I/O engine: blocking syscalls or io_uring
+ *
+ * Every io_uring operation here is synchronous from the caller's point of
+ * view: its SQEs are submitted together and all their completions reaped
+ * before returning, so a ring never has work in flight when it goes back
+ * to the pool and buffers on the caller's stack stay valid throughout.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "io_engine.h"
+#include "uring.h"
+#include "lockstat.h"
+#include "log.h"
+
+/**
+ * A connection thread's ring and splice pipe
+ */
+typedef struct IoRing {
+    Ring ring;
+    int pipe[2];               /**< -1 until the first splice */
+    size_t pipe_size;
+    struct IoRing *next;       /**< Pool free list */
+} IoRing;
+
+static IoEngine engine = IO_ENGINE_BLOCKING;
+
+static IoRing *pool = NULL;
+static int pool_count = 0;
+static TrackedMutex pool_mutex = TRACKED_MUTEX_INITIALIZER("io_ring_pool");
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static __thread IoRing *thread_ring = NULL;
+
+/** Everything the engine submits; all must be supported to pick io_uring */
+static const int required_ops[] = {
+    IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_SPLICE, IORING_OP_LINK_TIMEOUT,
+    IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL
+};
+
+const char *io_engine_name(IoEngine e) {
+    return e == IO_ENGINE_URING ? "io_uring" : "blocking";
+}
+
+IoEngine io_engine(void) {
+    return engine;
+}
+
+int io_engine_init(const char *name) {
+    int explicit_uring = 0;
+    if (!name || strcmp(name, "auto") == 0) {
+        explicit_uring = 0;
+    } else if (strcmp(name, "uring") == 0 || strcmp(name, "io_uring") == 0) {
+        explicit_uring = 1;
+    } else if (strcmp(name, "blocking") == 0) {
+        engine = IO_ENGINE_BLOCKING;
+        LOG_INFO("IO", "I/O engine: blocking");
+        return 0;
+    } else {
+        return -1;
+    }
+
+    char why[128] = "";
+    Ring r;
+    if (ring_init(&r, IO_RING_ENTRIES) < 0) {
+        snprintf(why, sizeof(why), "io_uring_setup: %s", strerror(errno));
+    } else {
+        for (size_t i = 0; i < sizeof(required_ops) / sizeof(required_ops[0]); i++) {
+            if (!ring_supports(&r, required_ops[i])) {
+                snprintf(why, sizeof(why), "kernel lacks opcode %d", required_ops[i]);
+                break;
+            }
+        }
+        ring_free(&r);
+    }
+
+    engine = why[0] ? IO_ENGINE_BLOCKING : IO_ENGINE_URING;
+    if (why[0] && explicit_uring) LOG_WARN("IO", "io_uring unavailable (%s), using blocking I/O", why);
+    else if (why[0]) LOG_DEBUG("IO", "io_uring unavailable (%s)", why);
+    LOG_INFO("IO", "I/O engine: %s", io_engine_name(engine));
+    return 0;
+}
+
+/* ============================================================================
+ * Per-thread rings
+ * ============================================================================ */
+
+static void pipe_drop(IoRing *ir) {
+    if (ir->pipe[0] >= 0) {
+        close(ir->pipe[0]);
+        close(ir->pipe[1]);
+    }
+    ir->pipe[0] = ir->pipe[1] = -1;
+}
+
+static void ring_put(void *arg) {
+    IoRing *ir = arg;
+    tracked_lock(&pool_mutex);
+    if (pool_count < IO_RING_POOL) {
+        ir->next = pool;
+        pool = ir;
+        pool_count++;
+        ir = NULL;
+    }
+    tracked_unlock(&pool_mutex);
+    if (ir) {
+        pipe_drop(ir);
+        ring_free(&ir->ring);
+        free(ir);
+    }
+}
+
+static void ring_key_create(void) {
+    // Hands the ring back when the connection thread exits
+    pthread_key_create(&ring_key, ring_put);
+}
+
+/** The calling thread's ring, or NULL if one cannot be set up */
+static IoRing *ring_get(void) {
+    if (thread_ring) return thread_ring;
+    pthread_once(&ring_key_once, ring_key_create);
+
+    tracked_lock(&pool_mutex);
+    IoRing *ir = pool;
+    if (ir) {
+        pool = ir->next;
+        pool_count--;
+    }
+    tracked_unlock(&pool_mutex);
+
+    if (!ir) {
+        ir = calloc(1, sizeof(*ir));
+        if (!ir) return NULL;
+        ir->pipe[0] = ir->pipe[1] = -1;
+        if (ring_init(&ir->ring, IO_RING_ENTRIES) < 0) {
+            LOG_WARN("IO", "io_uring_setup failed (%s), using blocking I/O for this connection",
+                     strerror(errno));
+            free(ir);
+            return NULL;
+        }
+    }
+    thread_ring = ir;
+    pthread_setspecific(ring_key, ir);
+    return ir;
+}
+
+static int pipe_get(IoRing *ir) {
+    if (ir->pipe[0] >= 0) return 0;
+    if (pipe2(ir->pipe, O_CLOEXEC) < 0) return -1;
+    fcntl(ir->pipe[1], F_SETPIPE_SZ, IO_PIPE_SIZE);
+    int size = fcntl(ir->pipe[1], F_GETPIPE_SZ);
+    ir->pipe_size = size > 0 ? (size_t)size : 65536;
+    return 0;
+}
+
+/**
+ * Submit what is queued and reap `count` completions, tagged 1..count,
+ * into res (-ECANCELED for a link that never ran)
+ */
+static int ring_run(Ring *r, int *res, int count) {
+    for (int i = 0; i < count; i++) res[i] = -ECANCELED;
+    if (ring_submit(r, 1) < 0) return -1;
+    int done = 0;
+    while (done < count) {
+        struct io_uring_cqe *cqe;
+        while (done < count && (cqe = ring_cqe(r))) {
+            if (cqe->user_data >= 1 && cqe->user_data <= (uint64_t)count) res[cqe->user_data - 1] = cqe->res;
+            ring_cqe_seen(r);
+            done++;
+        }
+        if (done < count && ring_submit(r, 1) < 0) return -1;
+    }
+    return 0;
+}
+
+static struct io_uring_sqe *prep_splice(Ring *r, int fd_in, int64_t off_in, int fd_out, size_t len,
+                                        uint64_t tag) {
+    struct io_uring_sqe *sqe = ring_sqe(r);
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->splice_fd_in = fd_in;
+    sqe->splice_off_in = (uint64_t)off_in;
+    sqe->fd = fd_out;
+    sqe->off = (uint64_t)-1;
+    sqe->len = (unsigned)len;
+    sqe->splice_flags = SPLICE_F_MOVE;
+    sqe->user_data = tag;
+    return sqe;
+}
+
+static struct io_uring_sqe *prep_send(Ring *r, int sock, const void *buf, size_t len, int flags,
+                                      uint64_t tag) {
+    struct io_uring_sqe *sqe = ring_sqe(r);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = sock;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = (unsigned)len;
+    sqe->msg_flags = flags;
+    sqe->user_data = tag;
+    return sqe;
+}
+
+/** Splice exactly len bytes from a pipe to the socket */
+static int splice_all(Ring *r, int pipe_fd, int sock, size_t len) {
+    while (len > 0) {
+        int res;
+        prep_splice(r, pipe_fd, -1, sock, len, 1);
+        if (ring_run(r, &res, 1) < 0 || res <= 0) return -1;
+        len -= res;
+    }
+    return 0;
+}
+
+/** Send all of buf (a short send breaks a link chain; this finishes it) */
+static int send_all(Ring *r, int sock, const char *buf, size_t len) {
+    while (len > 0) {
+        int res;
+        prep_send(r, sock, buf, len, MSG_NOSIGNAL, 1);
+        if (ring_run(r, &res, 1) < 0 || res <= 0) return -1;
+        buf += res;
+        len -= res;
+    }
+    return 0;
+}
+
+/* ============================================================================
+ * Operations
+ * ============================================================================ */
+
+/* Accept ring user_data */
+#define ACCEPT_TAG 1
+#define STOP_TAG 2
+#define CANCEL_TAG 3
+
+static Ring accept_ring;
+static int accept_state = 0;       /* 0 = not set up, 1 = ready, -1 = use accept4 */
+static int accept_armed = 0;
+static int accept_multishot = 1;
+static int accept_stopping = 0;
+static int stop_armed = 0;
+
+/** Written by io_accept_stop(); set up before the acceptor first waits */
+static int stop_fd = -1;
+static pthread_once_t stop_once = PTHREAD_ONCE_INIT;
+
+static void stop_fd_init(void) {
+    stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+}
+
+void io_accept_stop(void) {
+    pthread_once(&stop_once, stop_fd_init);
+    uint64_t one = 1;
+    if (stop_fd >= 0 && write(stop_fd, &one, sizeof(one)) < 0) {
+        LOG_WARN("IO", "Cannot stop the acceptor: %s", strerror(errno));
+    }
+}
+
+/**
+ * accept4() that also wakes for io_accept_stop()
+ *
+ * The listening socket is shared with a successor during a handoff, so it
+ * is non-blocking and a connection it took first just means waiting again.
+ */
+static int accept_blocking(int listen_fd) {
+    int flags = fcntl(listen_fd, F_GETFL);
+    if (flags >= 0 && !(flags & O_NONBLOCK)) fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK);
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) return fd;
+
+        struct pollfd pfd[2] = { { .fd = listen_fd, .events = POLLIN }, { .fd = stop_fd, .events = POLLIN } };
+        if (poll(pfd, stop_fd >= 0 ? 2 : 1, -1) < 0 && errno != EINTR) return -1;
+        if (pfd[1].revents & POLLIN) {
+            errno = ECANCELED;
+            return -1;
+        }
+    }
+}
+
+int io_accept(int listen_fd) {
+    pthread_once(&stop_once, stop_fd_init);
+    if (engine == IO_ENGINE_URING && accept_state == 0) {
+        accept_state = ring_init(&accept_ring, 64) == 0 ? 1 : -1;
+    }
+    if (engine != IO_ENGINE_URING || accept_state < 0) {
+        return accept_blocking(listen_fd);
+    }
+
+    for (;;) {
+        struct io_uring_cqe *cqe = ring_cqe(&accept_ring);
+        if (cqe) {
+            uint64_t tag = cqe->user_data;
+            int res = cqe->res;
+            int more = cqe->flags & IORING_CQE_F_MORE;
+            ring_cqe_seen(&accept_ring);
+            if (tag == STOP_TAG) {
+                // Connections already accepted still come back; the cancelled accept ends the loop
+                accept_stopping = 1;
+                if (accept_armed) {
+                    struct io_uring_sqe *sqe = ring_sqe(&accept_ring);
+                    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                    sqe->addr = ACCEPT_TAG;
+                    sqe->user_data = CANCEL_TAG;
+                }
+                continue;
+            }
+            if (tag != ACCEPT_TAG) continue;
+            // Without F_MORE the multishot accept has ended and must be re-armed
+            if (!more) accept_armed = 0;
+            if (res == -EINVAL && accept_multishot && !accept_stopping) {
+                LOG_DEBUG("IO", "Multishot accept unsupported, arming one accept at a time");
+                accept_multishot = 0;
+                continue;
+            }
+            if (res >= 0) return res;
+            errno = accept_stopping ? ECANCELED : -res;
+            return -1;
+        }
+        if (accept_stopping && !accept_armed) {
+            errno = ECANCELED;
+            return -1;
+        }
+        if (!stop_armed && stop_fd >= 0) {
+            struct io_uring_sqe *sqe = ring_sqe(&accept_ring);
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = stop_fd;
+            sqe->poll32_events = POLLIN;
+            sqe->user_data = STOP_TAG;
+            stop_armed = 1;
+        }
+        if (!accept_armed && !accept_stopping) {
+            struct io_uring_sqe *sqe = ring_sqe(&accept_ring);
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = listen_fd;
+            sqe->accept_flags = SOCK_CLOEXEC;
+            sqe->user_data = ACCEPT_TAG;
+            if (accept_multishot) sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            accept_armed = 1;
+        }
+        if (ring_submit(&accept_ring, 1) < 0) return -1;
+    }
+}
+
+ssize_t io_recv(int sock, void *buf, size_t len, int timeout_ms) {
+    // Only waits with a timeout gain anything: a plain read is one syscall either way
+    IoRing *ir = engine == IO_ENGINE_URING && timeout_ms >= 0 ? ring_get() : NULL;
+    if (!ir) {
+        if (timeout_ms >= 0) {
+            struct pollfd pfd = { .fd = sock, .events = POLLIN };
+            int ready = poll(&pfd, 1, timeout_ms);
+            if (ready < 0) return -1;
+            if (ready == 0) {
+                errno = ETIMEDOUT;
+                return -1;
+            }
+        }
+        return read(sock, buf, len);
+    }
+
+    // A client that sends its next request right away is served with one
+    // recv; only an actual wait pays for arming the linked timeout
+    ssize_t n = recv(sock, buf, len, MSG_DONTWAIT);
+    if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) return n;
+
+    Ring *r = &ir->ring;
+    struct __kernel_timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000LL };
+    struct io_uring_sqe *sqe = ring_sqe(r);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sock;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = (unsigned)len;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = 1;
+    sqe = ring_sqe(r);
+    sqe->opcode = IORING_OP_LINK_TIMEOUT;
+    sqe->addr = (uintptr_t)&ts;
+    sqe->len = 1;
+    sqe->user_data = 2;
+
+    int res[2];
+    if (ring_run(r, res, 2) < 0) return -1;
+    if (res[0] == -ECANCELED) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    if (res[0] < 0) {
+        errno = -res[0];
+        return -1;
+    }
+    return res[0];
+}
+
+int io_send_file(int sock, int fd, off_t offset, size_t len) {
+    IoRing *ir = engine == IO_ENGINE_URING ? ring_get() : NULL;
+    if (!ir || pipe_get(ir) < 0) return -2;
+    Ring *r = &ir->ring;
+
+    while (len > 0) {
+        size_t chunk = len < ir->pipe_size ? len : ir->pipe_size;
+        prep_splice(r, fd, offset, ir->pipe[1], chunk, 1)->flags = IOSQE_IO_LINK;
+        prep_splice(r, ir->pipe[0], -1, sock, chunk, 2);
+        int res[2];
+        if (ring_run(r, res, 2) < 0 || res[0] <= 0 || (res[1] < 0 && res[1] != -ECANCELED)) {
+            // Whatever is left in the pipe must not leak into the next response
+            pipe_drop(ir);
+            return -1;
+        }
+        size_t out = res[1] > 0 ? (size_t)res[1] : 0;
+        if (out < (size_t)res[0] && splice_all(r, ir->pipe[0], sock, res[0] - out) < 0) {
+            pipe_drop(ir);
+            return -1;
+        }
+        offset += res[0];
+        len -= res[0];
+    }
+    return 0;
+}
+
+int io_send_pipe(int sock, int pipe_fd, size_t len, const char *head, size_t head_len,
+                 const char *tail, size_t tail_len) {
+    IoRing *ir = engine == IO_ENGINE_URING ? ring_get() : NULL;
+    if (!ir) return -2;
+    Ring *r = &ir->ring;
+
+    int n = 0, head_tag = 0, splice_tag, tail_tag = 0;
+    if (head_len) {
+        head_tag = ++n;
+        prep_send(r, sock, head, head_len, MSG_MORE | MSG_NOSIGNAL, head_tag)->flags = IOSQE_IO_LINK;
+    }
+    splice_tag = ++n;
+    struct io_uring_sqe *sqe = prep_splice(r, pipe_fd, -1, sock, len, splice_tag);
+    if (tail_len) {
+        sqe->flags = IOSQE_IO_LINK;
+        tail_tag = ++n;
+        prep_send(r, sock, tail, tail_len, MSG_NOSIGNAL, tail_tag);
+    }
+
+    int res[3];
+    if (ring_run(r, res, n) < 0) return -1;
+    if (head_tag && res[head_tag - 1] != (int)head_len) {
+        if (res[head_tag - 1] <= 0 || send_all(r, sock, head + res[head_tag - 1], head_len - res[head_tag - 1]) < 0) {
+            return -1;
+        }
+    }
+    int spliced = res[splice_tag - 1];
+    if (spliced < 0 && spliced != -ECANCELED) return -1;
+    if (spliced < 0) spliced = 0;
+    if ((size_t)spliced < len && splice_all(r, pipe_fd, sock, len - spliced) < 0) return -1;
+    if (tail_tag) {
+        int sent = res[tail_tag - 1];
+        if (sent < 0 && sent != -ECANCELED) return -1;
+        if (sent < 0) sent = 0;
+        if ((size_t)sent < tail_len && send_all(r, sock, tail + sent, tail_len - sent) < 0) return -1;
+    }
+    return 0;
+}
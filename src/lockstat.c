@@ -0,0 +1,188 @@
+/**
+ * @file lockstat.c
+ * @brief Instrumented mutex with wait/hold times and contended sites
+ *
+ * The uncontended path is a trylock plus one clock read on each side of
+ * the critical section. Only a failed trylock reads the clock around the
+ * blocking lock and marks the thread THREAD_LOCK for /debug/threads.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "lockstat.h"
+#include "thread_state.h"
+#include "strbuf.h"
+
+/** Registered mutexes, newest first */
+static TrackedMutex *registry = NULL;
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread int cached_tid = 0;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void register_mutex(TrackedMutex *m) {
+    pthread_mutex_lock(&registry_mutex);
+    if (!m->registered) {
+        m->next = registry;
+        registry = m;
+        __atomic_store_n(&m->registered, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&registry_mutex);
+}
+
+void tracked_mutex_init(TrackedMutex *m, const char *name) {
+    memset(m, 0, sizeof(*m));
+    pthread_mutex_init(&m->mutex, NULL);
+    m->name = name;
+}
+
+void tracked_mutex_destroy(TrackedMutex *m) {
+    // lockstat_json walks the registry under registry_mutex, so it never sees m freed
+    pthread_mutex_lock(&registry_mutex);
+    if (m->registered) {
+        TrackedMutex **p = &registry;
+        while (*p && *p != m) p = &(*p)->next;
+        if (*p) *p = m->next;
+        m->registered = 0;
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    pthread_mutex_destroy(&m->mutex);
+}
+
+/** Called with m held */
+static LockSite *find_site(TrackedMutex *m, const char *site) {
+    for (int i = 0; i < m->num_sites; i++) {
+        if (m->sites[i].site == site) return &m->sites[i];
+    }
+    if (m->num_sites < LOCKSTAT_MAX_SITES) {
+        LockSite *s = &m->sites[m->num_sites++];
+        s->site = site;
+        return s;
+    }
+    LockSite *s = &m->sites[LOCKSTAT_MAX_SITES - 1];
+    s->site = "(other)";
+    return s;
+}
+
+/** Called with m held */
+static void acquired(TrackedMutex *m, const char *site, int contended, uint64_t wait) {
+    if (!cached_tid) cached_tid = (int)syscall(SYS_gettid);
+
+    LockSite *s = find_site(m, site);
+    s->acquisitions++;
+    m->acquisitions++;
+    if (contended) {
+        s->contended++;
+        s->wait_ns += wait;
+        if (wait > s->wait_max_ns) s->wait_max_ns = wait;
+        m->contended++;
+        m->wait_ns += wait;
+        if (wait > m->wait_max_ns) m->wait_max_ns = wait;
+    }
+    m->owner_site = s;
+    m->owner_tid = cached_tid;
+    m->locked_at_ns = now_ns();
+}
+
+void tracked_lock_at(TrackedMutex *m, const char *site) {
+    if (!__atomic_load_n(&m->registered, __ATOMIC_ACQUIRE)) register_mutex(m);
+
+    if (pthread_mutex_trylock(&m->mutex) == 0) {
+        acquired(m, site, 0, 0);
+        return;
+    }
+
+    ThreadStateMark mark = thread_state_enter(THREAD_LOCK, m->name);
+    uint64_t t0 = now_ns();
+    pthread_mutex_lock(&m->mutex);
+    uint64_t wait = now_ns() - t0;
+    thread_state_leave(mark);
+    acquired(m, site, 1, wait);
+}
+
+int tracked_trylock_at(TrackedMutex *m, const char *site) {
+    if (!__atomic_load_n(&m->registered, __ATOMIC_ACQUIRE)) register_mutex(m);
+
+    int rc = pthread_mutex_trylock(&m->mutex);
+    if (rc == 0) acquired(m, site, 0, 0);
+    return rc;
+}
+
+/** Called with m held, just before it is released */
+static void released(TrackedMutex *m) {
+    uint64_t held = now_ns() - m->locked_at_ns;
+    m->hold_ns += held;
+    if (held > m->hold_max_ns) m->hold_max_ns = held;
+    if (m->owner_site && held > m->owner_site->hold_max_ns) m->owner_site->hold_max_ns = held;
+    m->owner_tid = 0;
+    m->owner_site = NULL;
+}
+
+void tracked_unlock(TrackedMutex *m) {
+    released(m);
+    pthread_mutex_unlock(&m->mutex);
+}
+
+int tracked_cond_timedwait_at(pthread_cond_t *cond, TrackedMutex *m,
+                              const struct timespec *abstime, const char *site) {
+    // The wait releases the mutex, so the hold ends here and restarts on wakeup.
+    // Time spent relocking after the signal is not told apart from the wait.
+    released(m);
+    int rc = abstime ? pthread_cond_timedwait(cond, &m->mutex, abstime)
+                     : pthread_cond_wait(cond, &m->mutex);
+    acquired(m, site, 0, 0);
+    return rc;
+}
+
+static int cmp_site_wait(const void *a, const void *b) {
+    const LockSite *x = a, *y = b;
+    return (x->wait_ns < y->wait_ns) - (x->wait_ns > y->wait_ns);
+}
+
+char *lockstat_json(void) {
+    size_t len = 0, cap = 4096;
+    char *json = malloc(cap);
+    json[0] = '\0';
+    strbuf_append(&json, &len, &cap, "[");
+
+    pthread_mutex_lock(&registry_mutex);
+    for (TrackedMutex *m = registry; m; m = m->next) {
+        LockSite sites[LOCKSTAT_MAX_SITES];
+        int num_sites = m->num_sites;
+        memcpy(sites, m->sites, sizeof(LockSite) * num_sites);
+        qsort(sites, num_sites, sizeof(LockSite), cmp_site_wait);
+
+        int owner = m->owner_tid;
+        uint64_t locked_at = m->locked_at_ns;
+        strbuf_append(&json, &len, &cap,
+               "%s{\"name\":\"%s\",\"acquisitions\":%lu,\"contended\":%lu,"
+               "\"wait_ms\":%.3f,\"wait_max_ms\":%.3f,\"hold_ms\":%.3f,\"hold_max_ms\":%.3f,"
+               "\"holder_tid\":%d,\"held_for_ms\":%.3f,\"sites\":[",
+               m == registry ? "" : ",", m->name, m->acquisitions, m->contended,
+               m->wait_ns / 1e6, m->wait_max_ns / 1e6, m->hold_ns / 1e6, m->hold_max_ns / 1e6,
+               owner, owner ? (now_ns() - locked_at) / 1e6 : 0.0);
+        for (int i = 0; i < num_sites; i++) {
+            strbuf_append(&json, &len, &cap,
+                   "%s{\"site\":\"%s\",\"acquisitions\":%lu,\"contended\":%lu,"
+                   "\"wait_ms\":%.3f,\"wait_max_ms\":%.3f,\"hold_max_ms\":%.3f}",
+                   i ? "," : "", sites[i].site, sites[i].acquisitions, sites[i].contended,
+                   sites[i].wait_ns / 1e6, sites[i].wait_max_ns / 1e6, sites[i].hold_max_ns / 1e6);
+        }
+        strbuf_append(&json, &len, &cap, "]}");
+    }
+    pthread_mutex_unlock(&registry_mutex);
+
+    strbuf_append(&json, &len, &cap, "]");
+    return json;
+}
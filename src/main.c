@@ -5,26 +5,45 @@
  * Initializes all subsystems and starts the HTTP server:
  * 1. Database connection
  * 2. Runtime configuration loading
- * 3. mDNS service discovery
- * 4. DVR scheduler
- * 5. HTTP server (blocking)
+ * 3. Encode CPU budgeting (core topology)
+ * 4. FFmpeg capability probe
+ * 5. mDNS service discovery
+ * 6. DVR scheduler (after a handoff: once the recorders have moved over)
+ * 7. HTTP server (blocking until a handoff replaces this process)
+ *
+ * SIGUSR2 restarts the server without dropping streams or recordings
+ * (see handoff.h).
  *
  * Command line options:
- *   -v    Enable verbose/debug logging
- *   -h    Show help
+ *   -v        Enable verbose/debug logging
+ *   -c URL    Use this ZapLinkCore base URL instead of mDNS discovery
+ *   -E ENGINE I/O engine: auto (default), uring or blocking (io_engine.h)
+ *   -h        Show help
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include "config.h"
 #include "web.h"
 #include "db.h"
 #include "app_config.h"
 #include "discovery.h"
+#include "guide.h"
 #include "scheduler.h"
+#include "encode_sched.h"
+#include "capabilities.h"
+#include "flight.h"
+#include "telemetry.h"
+#include "io_engine.h"
+#include "handoff.h"
+#include "thread_state.h"
 #include "log.h"
 
 /** Global verbose flag - controls LOG_DEBUG visibility */
@@ -42,25 +61,76 @@ static void print_banner(int port) {
 }
 
 static void print_usage(const char *progname) {
-    printf("Usage: %s [-v]\n", progname);
-    printf("  -v    Enable verbose/debug logging\n");
+    printf("Usage: %s [-v] [-c core_url] [-E engine]\n", progname);
+    printf("  -v        Enable verbose/debug logging\n");
+    printf("  -c URL    Use this ZapLinkCore base URL (skip mDNS discovery)\n");
+    printf("  -E ENGINE I/O engine: auto (default), uring or blocking\n");
 }
 
-void handle_signal(int sig) {
+/** SIGINT/SIGTERM wake the shutdown thread through this pipe */
+static int shutdown_pipe[2] = { -1, -1 };
+
+static void handle_signal(int sig) {
     (void)sig;
+    int saved = errno;
+    if (write(shutdown_pipe[1], "", 1) < 0) {}
+    errno = saved;
+}
+
+/**
+ * Shut down outside the signal handler: stopping recorders takes locks
+ * and waits for children, none of which is async-signal-safe
+ */
+static void *shutdown_thread(void *arg) {
+    (void)arg;
+    thread_state_register("shutdown");
+    char c;
+    ThreadStateMark mark = thread_state_enter(THREAD_PIPE_READ, "signal");
+    while (read(shutdown_pipe[0], &c, 1) < 0 && errno == EINTR) {}
+    thread_state_leave(mark);
+
     LOG_INFO("MAIN", "Shutting down...");
+    // Recorders are separate processes; stop them so their files are finalized
+    scheduler_terminate_recorders();
+    telemetry_flush();
     db_close();
     exit(0);
 }
 
+static void install_shutdown_handler(void) {
+    pthread_t th;
+    if (pipe2(shutdown_pipe, O_CLOEXEC) < 0 || pthread_create(&th, NULL, shutdown_thread, NULL) != 0) {
+        // Keep the default action: exit at once, recorders left running
+        LOG_ERROR("MAIN", "Cannot start the shutdown thread");
+        return;
+    }
+    pthread_detach(th);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_signal;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+}
+
 int main(int argc, char *argv[]) {
+    handoff_init(argc, argv);
+
     /* Parse command line arguments */
     int opt;
-    while ((opt = getopt(argc, argv, "vh")) != -1) {
+    const char *core_url = NULL;
+    const char *engine = "auto";
+    while ((opt = getopt(argc, argv, "vc:E:h")) != -1) {
         switch (opt) {
             case 'v':
                 g_verbose = 1;
                 break;
+            case 'c':
+                core_url = optarg;
+                break;
+            case 'E':
+                engine = optarg;
+                break;
             case 'h':
             default:
                 print_usage(argv[0]);
@@ -68,31 +138,48 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    signal(SIGINT, handle_signal);
-    signal(SIGTERM, handle_signal);
+    install_shutdown_handler();
     signal(SIGPIPE, SIG_IGN);
+    flight_init();
 
     print_banner(WEB_PORT);
     fflush(stdout);
 
+    if (io_engine_init(engine) < 0) {
+        LOG_ERROR("IO", "Unknown I/O engine '%s' (auto, uring or blocking)", engine);
+        return 1;
+    }
+
     if (!db_init()) {
         LOG_ERROR("DB", "Failed to initialize database");
         return 1;
     }
     LOG_INFO("DB", "Database initialized");
+    telemetry_start();
 
     config_load();
     LOG_INFO("CONFIG", "Backend=%s, Codec=%s", app_config.backend, app_config.codec);
+
+    encode_sched_init(app_config.encode_budget);
+    caps_probe("/dev");
     
     /* Start mDNS advertising and discovery */
+    if (core_url) set_core_base_url(core_url);
     start_mdns_service(WEB_PORT);
 
+    /* Keep the core's EPG in memory for /api/guide and /api/bootstrap */
+    guide_start();
+
     /* Start DVR Scheduler */
-    start_scheduler();
+    if (!handoff_inherited()) start_scheduler();
 
     LOG_INFO("HTTP", "Starting web server on port %d", WEB_PORT);
     start_web_server(WEB_PORT);
 
+    // Only a handoff gets here: let remaining requests finish, then exit
+    handoff_drain();
+    telemetry_flush();
+    db_close();
     return 0;
 }
 
@@ -0,0 +1,204 @@
+/**
+ * @file profiler.c
+ * @brief In-process sampling CPU profiler
+ *
+ * The SIGPROF handler only claims a slot with an atomic increment and
+ * calls backtrace() into it. backtrace() loads libgcc's unwinder on first
+ * use, so profiler_run() calls it once before arming the timer to keep
+ * dlopen out of the handler.
+ *
+ * Teardown disarms the timer, ignores SIGPROF (discarding any still
+ * pending), detaches the buffer and waits for handlers already running
+ * before it is sorted and freed, then puts the previous action back.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include "profiler.h"
+#include "lockstat.h"
+#include "thread_state.h"
+#include "strbuf.h"
+#include "log.h"
+
+/** backtrace() frames belonging to the handler and the signal trampoline */
+#define HANDLER_FRAMES 2
+
+typedef struct {
+    int depth;
+    void *pc[PROFILE_MAX_DEPTH];
+} Sample;
+
+static TrackedMutex profile_mutex = TRACKED_MUTEX_INITIALIZER("profile");
+/** Buffer the handler writes into; NULL whenever no profile is collecting */
+static Sample *samples = NULL;
+static unsigned long sample_head = 0;
+/** Handlers still running; samples is freed only once this drops to zero */
+static int in_handler = 0;
+
+static void on_sigprof(int sig) {
+    (void)sig;
+    int saved = errno;
+    // Announce before looking at the buffer, so teardown either sees us or we see NULL
+    __atomic_add_fetch(&in_handler, 1, __ATOMIC_SEQ_CST);
+    Sample *buf = __atomic_load_n(&samples, __ATOMIC_SEQ_CST);
+    unsigned long i = buf ? __atomic_fetch_add(&sample_head, 1, __ATOMIC_RELAXED) : PROFILE_MAX_SAMPLES;
+    if (i < PROFILE_MAX_SAMPLES) {
+        void *frames[PROFILE_MAX_DEPTH + HANDLER_FRAMES];
+        int n = backtrace(frames, PROFILE_MAX_DEPTH + HANDLER_FRAMES) - HANDLER_FRAMES;
+        if (n < 0) n = 0;
+        memcpy(buf[i].pc, frames + HANDLER_FRAMES, n * sizeof(void *));
+        buf[i].depth = n;
+    }
+    __atomic_sub_fetch(&in_handler, 1, __ATOMIC_RELEASE);
+    errno = saved;
+}
+
+static int cmp_sample(const void *a, const void *b) {
+    const Sample *x = a, *y = b;
+    if (x->depth != y->depth) return x->depth - y->depth;
+    return memcmp(x->pc, y->pc, x->depth * sizeof(void *));
+}
+
+/**
+ * Name one frame: the exported symbol containing it, or module+offset
+ * for static functions and stripped code (resolve with addr2line)
+ */
+static void symbolize(void *pc, int leaf, char *out, size_t len) {
+    // Return addresses point past the call; step back into the caller's line
+    void *addr = leaf ? pc : (char *)pc - 1;
+    Dl_info info;
+    const ElfW(Sym) *sym = NULL;
+    if (!dladdr1(addr, &info, (void **)&sym, RTLD_DL_SYMENT)) {
+        snprintf(out, len, "[%p]", pc);
+        return;
+    }
+    if (info.dli_sname && info.dli_saddr && sym &&
+        (char *)addr < (char *)info.dli_saddr + (sym->st_size ? sym->st_size : 1)) {
+        snprintf(out, len, "%s", info.dli_sname);
+        return;
+    }
+    const char *module = info.dli_fname ? strrchr(info.dli_fname, '/') : NULL;
+    module = module ? module + 1 : (info.dli_fname ? info.dli_fname : "?");
+    snprintf(out, len, "%s+0x%lx", module, (unsigned long)((char *)addr - (char *)info.dli_fbase));
+}
+
+static char *fold(Sample *buf, unsigned long count, ProfileStats *stats) {
+    qsort(buf, count, sizeof(Sample), cmp_sample);
+
+    size_t len = 0, cap = 16384;
+    char *out = malloc(cap);
+    if (!out) return NULL;
+    out[0] = '\0';
+
+    for (unsigned long i = 0; i < count;) {
+        unsigned long run = 1;
+        while (i + run < count && cmp_sample(&buf[i], &buf[i + run]) == 0) run++;
+
+        // Folded stacks list the outermost frame first
+        Sample *s = &buf[i];
+        for (int f = s->depth - 1; f >= 0; f--) {
+            char name[256];
+            symbolize(s->pc[f], f == 0, name, sizeof(name));
+            if (strbuf_append(&out, &len, &cap, "%s%s", name, f > 0 ? ";" : "") < 0) goto fail;
+        }
+        if (s->depth == 0 && strbuf_append(&out, &len, &cap, "[unknown]") < 0) goto fail;
+        if (strbuf_append(&out, &len, &cap, " %lu\n", run) < 0) goto fail;
+
+        stats->stacks++;
+        i += run;
+    }
+    return out;
+
+fail:
+    free(out);
+    return NULL;
+}
+
+char *profiler_run(int seconds, int hz, ProfileStats *stats) {
+    ProfileStats local;
+    if (!stats) stats = &local;
+    memset(stats, 0, sizeof(*stats));
+
+    if (seconds <= 0) seconds = PROFILE_DEFAULT_SECONDS;
+    if (seconds > PROFILE_MAX_SECONDS) seconds = PROFILE_MAX_SECONDS;
+    if (hz <= 0) hz = PROFILE_DEFAULT_HZ;
+    if (hz > PROFILE_MAX_HZ) hz = PROFILE_MAX_HZ;
+    stats->seconds = seconds;
+    stats->hz = hz;
+
+    if (tracked_trylock(&profile_mutex) != 0) {
+        errno = EBUSY;
+        return NULL;
+    }
+
+    Sample *buf = calloc(PROFILE_MAX_SAMPLES, sizeof(Sample));
+    if (!buf) {
+        tracked_unlock(&profile_mutex);
+        errno = ENOMEM;
+        return NULL;
+    }
+    __atomic_store_n(&sample_head, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&samples, buf, __ATOMIC_SEQ_CST);
+
+    void *warm[4];
+    backtrace(warm, 4);
+
+    struct sigaction sa, previous;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigprof;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, &previous);
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = 1000000 / hz;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, NULL);
+
+    LOG_INFO("PROFILE", "Sampling for %ds at %d Hz", seconds, hz);
+    struct timespec ts = { seconds, 0 };
+    ThreadStateMark mark = thread_state_enter(THREAD_SLEEP, "profile");
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {}
+    thread_state_leave(mark);
+
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    // SIG_IGN discards SIGPROFs still pending on any thread
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPROF, &sa, NULL);
+    __atomic_store_n(&samples, NULL, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&in_handler, __ATOMIC_SEQ_CST) > 0) sched_yield();
+    // Nothing can be pending now, so even SIG_DFL is safe to put back
+    sigaction(SIGPROF, &previous, NULL);
+
+    unsigned long taken = __atomic_load_n(&sample_head, __ATOMIC_ACQUIRE);
+    unsigned long count = taken < PROFILE_MAX_SAMPLES ? taken : PROFILE_MAX_SAMPLES;
+    stats->samples = count;
+    stats->dropped = taken - count;
+
+    char *out = fold(buf, count, stats);
+    if (out) {
+        LOG_INFO("PROFILE", "Captured %lu samples (%lu dropped), %lu distinct stacks",
+                 stats->samples, stats->dropped, stats->stacks);
+    } else {
+        LOG_ERROR("PROFILE", "Out of memory folding %lu samples", stats->samples);
+    }
+
+    free(buf);
+    tracked_unlock(&profile_mutex);
+    if (!out) errno = ENOMEM;
+    return out;
+}
@@ -0,0 +1,472 @@
+/**
+ * @file qoe.c
+ * @brief Viewer quality-of-experience telemetry
+ *
+ * Sessions and groups live in fixed tables under one mutex. Beacons are
+ * small (one per player every few seconds), so lookups are linear scans.
+ * Counters that accumulate (stalls, watch time, errors) are added to the
+ * group as beacons arrive; the per-session rebuffer ratio is added once,
+ * when the session is finalized.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "qoe.h"
+#include "lockstat.h"
+#include "strbuf.h"
+#include "log.h"
+
+typedef struct {
+    int in_use;
+    char sid[QOE_SID_LEN];
+    char channel[32];
+    char profile[32];
+    long long opened_ms;
+    long long updated_ms;
+
+    /* Server half */
+    int server_open;
+    int pid;
+    long long first_byte_us;
+    long long bytes;
+
+    /* Client half */
+    int client_seen;
+    long long startup_ms;       /**< -1 until reported */
+    int stalls;
+    long long stall_ms;
+    long long play_ms;
+    int level_switches;
+    int errors;
+    long long bitrate;          /**< Last hls.js level bitrate */
+    int ended;
+} QoeSession;
+
+typedef struct {
+    char channel[32];
+    char profile[32];
+    unsigned long sessions;     /**< Finalized sessions with client data */
+    unsigned long startup[QOE_STARTUP_BUCKETS];
+    unsigned long first_byte[QOE_STARTUP_BUCKETS];
+    unsigned long rebuffer[QOE_REBUFFER_BUCKETS];
+    unsigned long stalls;
+    unsigned long errors;
+    unsigned long level_switches;
+    long long stall_ms;
+    long long play_ms;
+} QoeGroup;
+
+/** Startup and first-byte bucket upper bounds (ms) */
+static const long long startup_bounds[QOE_STARTUP_BUCKETS - 1] = { 250, 500, 1000, 2000, 4000, 8000, 16000 };
+
+/** Rebuffer ratio bucket upper bounds (stall time / (stall + play time)) */
+static const double rebuffer_bounds[QOE_REBUFFER_BUCKETS - 1] = { 0.0, 0.001, 0.005, 0.01, 0.02, 0.05, 0.1 };
+
+static QoeSession sessions[QOE_MAX_SESSIONS];
+static QoeGroup groups[QOE_MAX_GROUPS];
+static int num_groups = 0;
+static unsigned long next_generated = 1;
+static unsigned long generation = 1;    /* Bumped when a server session opens, starts or closes */
+static TrackedMutex qoe_mutex = TRACKED_MUTEX_INITIALIZER("qoe");
+
+/** Session served by the calling thread (index + sid to detect reuse) */
+static __thread int current = -1;
+static __thread char current_sid[QOE_SID_LEN];
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/** Copy keeping [A-Za-z0-9._/-] so ids and labels are safe to echo in JSON */
+static void sanitize(char *dest, const char *src, size_t size) {
+    size_t i = 0;
+    for (; *src && i < size - 1; src++) {
+        if (isalnum((unsigned char)*src) || strchr("-_./", *src)) dest[i++] = *src;
+    }
+    dest[i] = '\0';
+}
+
+static int startup_bucket(long long ms) {
+    int b = 0;
+    while (b < QOE_STARTUP_BUCKETS - 1 && ms > startup_bounds[b]) b++;
+    return b;
+}
+
+static int rebuffer_bucket(double ratio) {
+    int b = 0;
+    while (b < QOE_REBUFFER_BUCKETS - 1 && ratio > rebuffer_bounds[b]) b++;
+    return b;
+}
+
+/** Called with qoe_mutex held */
+static QoeGroup *find_group(const char *channel, const char *profile) {
+    for (int i = 0; i < num_groups; i++) {
+        if (strcmp(groups[i].channel, channel) == 0 && strcmp(groups[i].profile, profile) == 0) return &groups[i];
+    }
+    if (num_groups == QOE_MAX_GROUPS) return NULL;
+    QoeGroup *g = &groups[num_groups++];
+    memset(g, 0, sizeof(*g));
+    snprintf(g->channel, sizeof(g->channel), "%s", channel);
+    snprintf(g->profile, sizeof(g->profile), "%s", profile);
+    return g;
+}
+
+/** Called with qoe_mutex held; adds the rebuffer ratio and frees the slot */
+static void finalize(QoeSession *s) {
+    if (s->client_seen && s->startup_ms >= 0) {
+        QoeGroup *g = find_group(s->channel, s->profile);
+        if (g) {
+            long long watched = s->play_ms + s->stall_ms;
+            double ratio = watched > 0 ? (double)s->stall_ms / watched : 0.0;
+            g->rebuffer[rebuffer_bucket(ratio)]++;
+            g->sessions++;
+        }
+    }
+    s->in_use = 0;
+}
+
+/** Called with qoe_mutex held */
+static void sweep_idle(long long now) {
+    for (int i = 0; i < QOE_MAX_SESSIONS; i++) {
+        QoeSession *s = &sessions[i];
+        if (!s->in_use || s->server_open) continue;
+        if (s->ended || now - s->updated_ms > QOE_IDLE_MS) finalize(s);
+    }
+}
+
+/**
+ * Called with qoe_mutex held; finds or creates the session for sid
+ *
+ * A full table gives up its least recently updated client-only session.
+ * Beacons are unauthenticated, so only the server (`server` set) may take
+ * the slot of a session it is streaming, and only when every slot is one.
+ *
+ * @return The session, or NULL for a beacon when no slot can be taken
+ */
+static QoeSession *get_session(const char *sid, long long now, int server) {
+    QoeSession *free_slot = NULL, *oldest = NULL, *oldest_open = NULL;
+    for (int i = 0; i < QOE_MAX_SESSIONS; i++) {
+        QoeSession *s = &sessions[i];
+        if (!s->in_use) {
+            if (!free_slot) free_slot = s;
+            continue;
+        }
+        if (strcmp(s->sid, sid) == 0) return s;
+        if (s->server_open) {
+            if (!oldest_open || s->updated_ms < oldest_open->updated_ms) oldest_open = s;
+        } else if (!oldest || s->updated_ms < oldest->updated_ms) {
+            oldest = s;
+        }
+    }
+    QoeSession *s = free_slot;
+    if (!s) {
+        if (!oldest && server) oldest = oldest_open;
+        if (!oldest) return NULL;
+        finalize(oldest);
+        s = oldest;
+    }
+    memset(s, 0, sizeof(*s));
+    s->in_use = 1;
+    snprintf(s->sid, sizeof(s->sid), "%s", sid);
+    strcpy(s->channel, "unknown");
+    strcpy(s->profile, "unknown");
+    s->startup_ms = -1;
+    s->opened_ms = s->updated_ms = now;
+    return s;
+}
+
+/** Called with qoe_mutex held; the calling thread's session if still its own */
+static QoeSession *current_session(void) {
+    if (current < 0) return NULL;
+    QoeSession *s = &sessions[current];
+    if (!s->in_use || strcmp(s->sid, current_sid) != 0) return NULL;
+    return s;
+}
+
+void qoe_take_sid(char *path, char *sid, size_t sid_len) {
+    sid[0] = '\0';
+    char *query = strchr(path, '?');
+    if (!query) return;
+    *query++ = '\0';
+    char *save = NULL;
+    for (char *param = strtok_r(query, "&", &save); param; param = strtok_r(NULL, "&", &save)) {
+        if (strncmp(param, "sid=", 4) == 0) sanitize(sid, param + 4, sid_len);
+    }
+}
+
+void qoe_session_begin(const char *sid, const char *channel) {
+    char id[QOE_SID_LEN];
+    long long now = now_ms();
+
+    tracked_lock(&qoe_mutex);
+    if (sid && sid[0]) snprintf(id, sizeof(id), "%s", sid);
+    else snprintf(id, sizeof(id), "srv-%lx", next_generated++);
+
+    QoeSession *s = get_session(id, now, 1);
+    sanitize(s->channel, channel, sizeof(s->channel));
+    s->server_open = 1;
+    s->updated_ms = now;
+    generation++;
+    current = (int)(s - sessions);
+    snprintf(current_sid, sizeof(current_sid), "%s", id);
+    tracked_unlock(&qoe_mutex);
+}
+
+void qoe_session_started(int pid, TranscodeBackend backend, TranscodeCodec codec, long long first_byte_us) {
+    if (current < 0) return;
+    tracked_lock(&qoe_mutex);
+    QoeSession *s = current_session();
+    if (s) {
+        snprintf(s->profile, sizeof(s->profile), "%s/%s",
+                 transcode_backend_name(backend), transcode_codec_name(codec));
+        s->pid = pid;
+        s->first_byte_us = first_byte_us;
+        s->updated_ms = now_ms();
+        generation++;
+        QoeGroup *g = find_group(s->channel, s->profile);
+        if (g) g->first_byte[startup_bucket(first_byte_us / 1000)]++;
+    }
+    tracked_unlock(&qoe_mutex);
+}
+
+void qoe_session_relayed(long long bytes) {
+    if (current < 0) return;
+    tracked_lock(&qoe_mutex);
+    QoeSession *s = current_session();
+    if (s) s->bytes = bytes;
+    tracked_unlock(&qoe_mutex);
+}
+
+void qoe_session_finish(void) {
+    if (current < 0) return;
+    tracked_lock(&qoe_mutex);
+    QoeSession *s = current_session();
+    if (s) {
+        s->server_open = 0;
+        s->updated_ms = now_ms();
+        generation++;
+        if (s->ended) finalize(s);
+    }
+    tracked_unlock(&qoe_mutex);
+    current = -1;
+}
+
+/** Copy the string value of "key" within [obj, end) */
+static int json_str(const char *obj, const char *end, const char *key, char *out, size_t len) {
+    char pattern[32];
+    snprintf(pattern, sizeof(pattern), "\"%s\":\"", key);
+    const char *p = strstr(obj, pattern);
+    if (!p || p >= end) return 0;
+    p += strlen(pattern);
+    const char *q = memchr(p, '"', end - p);
+    if (!q) return 0;
+    char raw[128];
+    size_t n = (size_t)(q - p) < sizeof(raw) - 1 ? (size_t)(q - p) : sizeof(raw) - 1;
+    memcpy(raw, p, n);
+    raw[n] = '\0';
+    sanitize(out, raw, len);
+    return 1;
+}
+
+/** Read the numeric value of "key" within [obj, end); negative values are refused */
+static int json_ll(const char *obj, const char *end, const char *key, long long *out) {
+    char pattern[32];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char *p = strstr(obj, pattern);
+    if (!p || p >= end) return 0;
+    long long v = atoll(p + strlen(pattern));
+    if (v < 0) return 0;
+    *out = v;
+    return 1;
+}
+
+int qoe_ingest(const char *body) {
+    const char *body_end = body + strlen(body);
+    char sid[QOE_SID_LEN];
+    if (!json_str(body, body_end, "sid", sid, sizeof(sid)) || !sid[0]) return -1;
+
+    const char *ev = strstr(body, "\"events\"");
+    if (!ev || !(ev = strchr(ev, '['))) return -1;
+
+    long long now = now_ms();
+    tracked_lock(&qoe_mutex);
+    sweep_idle(now);
+    QoeSession *s = get_session(sid, now, 0);
+    if (!s) {
+        // Every slot is a session being streamed; drop the beacon rather than one of those
+        tracked_unlock(&qoe_mutex);
+        return 0;
+    }
+    // Only the server half names a channel and profile: a player's own labels
+    // would let any client mint groups, so sessions it never opened count as
+    // "unknown"
+    s->client_seen = 1;
+    s->updated_ms = now;
+    QoeGroup *g = find_group(s->channel, s->profile);
+
+    // Events are flat objects; walk them brace to brace
+    const char *p = ev;
+    while ((p = strchr(p, '{')) != NULL) {
+        const char *end = strchr(p, '}');
+        if (!end) break;
+        char type[16] = "";
+        long long v = 0;
+        json_str(p, end, "type", type, sizeof(type));
+
+        if (strcmp(type, "startup") == 0 && json_ll(p, end, "ms", &v)) {
+            if (s->startup_ms < 0 && g) g->startup[startup_bucket(v)]++;
+            s->startup_ms = v;
+        } else if (strcmp(type, "stall") == 0 && json_ll(p, end, "ms", &v)) {
+            s->stalls++;
+            s->stall_ms += v;
+            if (g) {
+                g->stalls++;
+                g->stall_ms += v;
+            }
+        } else if (strcmp(type, "play") == 0 && json_ll(p, end, "ms", &v)) {
+            s->play_ms += v;
+            if (g) g->play_ms += v;
+        } else if (strcmp(type, "level") == 0) {
+            if (json_ll(p, end, "bitrate", &v)) s->bitrate = v;
+            s->level_switches++;
+            if (g) g->level_switches++;
+        } else if (strcmp(type, "error") == 0) {
+            char code[32] = "";
+            json_str(p, end, "code", code, sizeof(code));
+            LOG_DEBUG("QOE", "Player error in session %s (%s %s): %s", s->sid, s->channel, s->profile, code);
+            s->errors++;
+            if (g) g->errors++;
+        } else if (strcmp(type, "end") == 0) {
+            s->ended = 1;
+        }
+        p = end + 1;
+    }
+    if (s->ended && !s->server_open) finalize(s);
+    tracked_unlock(&qoe_mutex);
+    return 0;
+}
+
+static void append_counts(char **buf, size_t *len, size_t *cap, const unsigned long *counts, int n) {
+    strbuf_append(buf, len, cap, "[");
+    for (int i = 0; i < n; i++) strbuf_append(buf, len, cap, "%s%lu", i ? "," : "", counts[i]);
+    strbuf_append(buf, len, cap, "]");
+}
+
+/** Bucket index holding quantile q, or -1 when empty */
+static int quantile_bucket(const unsigned long *counts, int n, double q) {
+    unsigned long total = 0;
+    for (int i = 0; i < n; i++) total += counts[i];
+    if (total == 0) return -1;
+    unsigned long target = (unsigned long)(q * total + 0.5);
+    if (target == 0) target = 1;
+    unsigned long seen = 0;
+    for (int i = 0; i < n; i++) {
+        seen += counts[i];
+        if (seen >= target) return i;
+    }
+    return n - 1;
+}
+
+/** Upper bound of the startup bucket holding q; null when empty or open-ended */
+static void append_startup_quantile(char **buf, size_t *len, size_t *cap, const unsigned long *counts, double q) {
+    int b = quantile_bucket(counts, QOE_STARTUP_BUCKETS, q);
+    if (b < 0 || b == QOE_STARTUP_BUCKETS - 1) strbuf_append(buf, len, cap, "null");
+    else strbuf_append(buf, len, cap, "%lld", startup_bounds[b]);
+}
+
+char *qoe_json(void) {
+    size_t len = 0, cap = 8192;
+    char *json = malloc(cap);
+    json[0] = '\0';
+
+    strbuf_append(&json, &len, &cap, "{\"startup_buckets_ms\":[");
+    for (int i = 0; i < QOE_STARTUP_BUCKETS - 1; i++) strbuf_append(&json, &len, &cap, "%lld,", startup_bounds[i]);
+    strbuf_append(&json, &len, &cap, "null],\"rebuffer_buckets\":[");
+    for (int i = 0; i < QOE_REBUFFER_BUCKETS - 1; i++) strbuf_append(&json, &len, &cap, "%g,", rebuffer_bounds[i]);
+    strbuf_append(&json, &len, &cap, "null],\"groups\":[");
+
+    long long now = now_ms();
+    tracked_lock(&qoe_mutex);
+    sweep_idle(now);
+
+    for (int i = 0; i < num_groups; i++) {
+        QoeGroup *g = &groups[i];
+        long long watched = g->play_ms + g->stall_ms;
+        strbuf_append(&json, &len, &cap,
+               "%s{\"channel\":\"%s\",\"profile\":\"%s\",\"sessions\":%lu,\"startup\":",
+               i ? "," : "", g->channel, g->profile, g->sessions);
+        append_counts(&json, &len, &cap, g->startup, QOE_STARTUP_BUCKETS);
+        strbuf_append(&json, &len, &cap, ",\"startup_p50_ms\":");
+        append_startup_quantile(&json, &len, &cap, g->startup, 0.5);
+        strbuf_append(&json, &len, &cap, ",\"startup_p95_ms\":");
+        append_startup_quantile(&json, &len, &cap, g->startup, 0.95);
+        strbuf_append(&json, &len, &cap, ",\"first_byte\":");
+        append_counts(&json, &len, &cap, g->first_byte, QOE_STARTUP_BUCKETS);
+        strbuf_append(&json, &len, &cap, ",\"first_byte_p50_ms\":");
+        append_startup_quantile(&json, &len, &cap, g->first_byte, 0.5);
+        strbuf_append(&json, &len, &cap, ",\"rebuffer\":");
+        append_counts(&json, &len, &cap, g->rebuffer, QOE_REBUFFER_BUCKETS);
+        strbuf_append(&json, &len, &cap,
+               ",\"rebuffer_ratio\":%.5f,\"stalls\":%lu,\"stall_ms\":%lld,\"play_ms\":%lld,"
+               "\"errors\":%lu,\"level_switches\":%lu}",
+               watched > 0 ? (double)g->stall_ms / watched : 0.0, g->stalls, g->stall_ms, g->play_ms,
+               g->errors, g->level_switches);
+    }
+
+    strbuf_append(&json, &len, &cap, "],\"sessions\":[");
+    int first = 1;
+    for (int i = 0; i < QOE_MAX_SESSIONS; i++) {
+        QoeSession *s = &sessions[i];
+        if (!s->in_use) continue;
+        strbuf_append(&json, &len, &cap,
+               "%s{\"sid\":\"%s\",\"channel\":\"%s\",\"profile\":\"%s\",\"server_open\":%d,\"pid\":%d,"
+               "\"first_byte_ms\":%.1f,\"bytes\":%lld,\"client\":%d,\"startup_ms\":%lld,\"stalls\":%d,"
+               "\"stall_ms\":%lld,\"play_ms\":%lld,\"bitrate\":%lld,\"level_switches\":%d,\"errors\":%d,"
+               "\"age_s\":%lld}",
+               first ? "" : ",", s->sid, s->channel, s->profile, s->server_open, s->pid,
+               s->first_byte_us / 1000.0, s->bytes, s->client_seen, s->startup_ms, s->stalls,
+               s->stall_ms, s->play_ms, s->bitrate, s->level_switches, s->errors,
+               (now - s->opened_ms) / 1000);
+        first = 0;
+    }
+    tracked_unlock(&qoe_mutex);
+
+    strbuf_append(&json, &len, &cap, "]}");
+    return json;
+}
+
+char *qoe_active_json(void) {
+    size_t len = 0, cap = 1024;
+    char *json = malloc(cap);
+    json[0] = '\0';
+
+    strbuf_append(&json, &len, &cap, "[");
+    int first = 1;
+    tracked_lock(&qoe_mutex);
+    for (int i = 0; i < QOE_MAX_SESSIONS; i++) {
+        QoeSession *s = &sessions[i];
+        if (!s->in_use || !s->server_open) continue;
+        strbuf_append(&json, &len, &cap,
+               "%s{\"sid\":\"%s\",\"channel\":\"%s\",\"profile\":\"%s\",\"pid\":%d,\"opened_ms\":%lld}",
+               first ? "" : ",", s->sid, s->channel, s->profile, s->pid, s->opened_ms);
+        first = 0;
+    }
+    tracked_unlock(&qoe_mutex);
+
+    strbuf_append(&json, &len, &cap, "]");
+    return json;
+}
+
+unsigned long qoe_generation(void) {
+    tracked_lock(&qoe_mutex);
+    unsigned long gen = generation;
+    tracked_unlock(&qoe_mutex);
+    return gen;
+}
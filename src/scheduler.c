@@ -3,13 +3,18 @@
  * @brief DVR recording scheduler
  *
  * Manages automatic recording based on scheduled timers:
- * - Background thread polls database every POLL_INTERVAL seconds
+ * - Background thread polls database every poll_interval_ms (POLL_INTERVAL
+ *   seconds by default)
  * - Starts FFmpeg processes when timer start times are reached
  * - Stops recordings when end times are reached or manually requested
  *
  * Recordings are saved to the "recordings/" directory as MP4 files.
  * The scheduler uses the local /stream/ endpoint to fetch content,
  * ensuring proper discovery resolution.
+ *
+ * On a handoff (see handoff.h) the scheduler thread passes its running
+ * recorders to the new process and exits; the new process tracks them
+ * through pidfds since they are not its children.
  */
 
 #define _GNU_SOURCE
@@ -25,11 +30,19 @@
 #include <sys/stat.h>
 #include <limits.h>
 #include <fcntl.h>
+#include <sys/resource.h>
 
 #include "scheduler.h"
 #include "db.h"
 #include "config.h"
 #include "web.h"
+#include "flight.h"
+#include "lockstat.h"
+#include "thread_state.h"
+#include "telemetry.h"
+#include "transcode.h"
+#include "handoff.h"
+#include "probes.h"
 #include "log.h"
 
 /** Seconds between database polls for pending timers */
@@ -43,9 +56,16 @@ typedef struct {
     int recording_id;       /**< Database recording ID */
     pid_t pid;              /**< FFmpeg process ID (0 = slot empty) */
     long long end_time;     /**< Scheduled end time (ms since epoch) */
+    long long started_at;   /**< Actual start time (ms since epoch) */
     char path[256];         /**< Output file path */
+    char channel[32];       /**< Channel number */
+    int adopted;            /**< Taken over from the previous process: not our child */
+    int pidfd;              /**< pidfd of an adopted recorder (-1 = none) */
 } ActiveRecording;
 
+/** How long shutdown waits for each recorder to finalize its file */
+#define RECORDER_STOP_MS 5000
+
 /** Maximum concurrent recordings */
 #define MAX_ACTIVE_RECORDINGS 16
 
@@ -53,31 +73,225 @@ typedef struct {
 static ActiveRecording active_recordings[MAX_ACTIVE_RECORDINGS];
 
 /** Mutex for thread-safe access to active_recordings */
-static pthread_mutex_t active_mutex = PTHREAD_MUTEX_INITIALIZER;
+static TrackedMutex active_mutex = TRACKED_MUTEX_INITIALIZER("active_mutex");
+
+/** Current poll interval */
+static volatile int poll_interval_ms = POLL_INTERVAL * 1000;
+
+/** Wakes the scheduler thread early; guards the two flags below */
+static TrackedMutex wake_mutex = TRACKED_MUTEX_INITIALIZER("wake_mutex");
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+static int running = 0;
+static int handoff_requested = 0;
+
+/** Timing counters, guarded by stats_mutex */
+static SchedulerStats stats;
+static TrackedMutex stats_mutex = TRACKED_MUTEX_INITIALIZER("stats_mutex");
+
+static double mono_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static long long wall_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void stat_max(double *max, double v) {
+    if (v > *max) *max = v;
+}
+
+/**
+ * Lock active_mutex from the scheduler thread, recording wait time
+ *
+ * @return Monotonic time the lock was acquired, for unlock_active()
+ */
+static double lock_active(void) {
+    double t0 = mono_ms();
+    tracked_lock(&active_mutex);
+    double t1 = mono_ms();
+    tracked_lock(&stats_mutex);
+    stats.lock_wait_sum_ms += t1 - t0;
+    stat_max(&stats.lock_wait_max_ms, t1 - t0);
+    tracked_unlock(&stats_mutex);
+    return t1;
+}
+
+static void unlock_active(double locked_at) {
+    double held = mono_ms() - locked_at;
+    tracked_unlock(&active_mutex);
+    tracked_lock(&stats_mutex);
+    stats.lock_hold_sum_ms += held;
+    stat_max(&stats.lock_hold_max_ms, held);
+    tracked_unlock(&stats_mutex);
+}
+
+/**
+ * Queue the telemetry record for a reaped recorder (called with active_mutex held)
+ */
+static void record_session(const ActiveRecording *rec, const struct rusage *ru, const char *failure) {
+    SessionRecord r;
+    memset(&r, 0, sizeof(r));
+    r.started_at = rec->started_at;
+    r.kind = SESSION_RECORDING;
+    r.backend = TRANSCODE_BACKEND_SOFTWARE;
+    r.codec = TRANSCODE_CODEC_COPY;
+    snprintf(r.channel, sizeof(r.channel), "%s", rec->channel);
+    r.duration_ms = wall_ms() - rec->started_at;
+    r.cpu_s = ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6 + ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+    r.peak_rss_kb = ru->ru_maxrss;
+    struct stat st;
+    if (stat(rec->path, &st) == 0) r.bytes = st.st_size;
+    if (failure) snprintf(r.failure, sizeof(r.failure), "%s", failure);
+    telemetry_record(&r);
+}
+
+/**
+ * Stop a recorder with SIGTERM, so FFmpeg finalizes the MP4, and wait for it
+ */
+static void recorder_stop(ActiveRecording *rec, struct rusage *ru) {
+    ThreadStateMark mark = thread_state_enter(THREAD_CHILD_WAIT, "recorder");
+    if (rec->adopted) {
+        handoff_usage(rec->pid, ru);
+        handoff_kill(rec->pid, rec->pidfd, SIGTERM);
+        handoff_exited(rec->pid, rec->pidfd, -1);
+        if (rec->pidfd >= 0) close(rec->pidfd);
+        rec->pidfd = -1;
+    } else {
+        kill(rec->pid, SIGTERM);
+        wait4(rec->pid, NULL, 0, ru);
+    }
+    thread_state_leave(mark);
+}
+
+/**
+ * Check whether a recorder has exited on its own
+ *
+ * @param failure Output: why, when it has
+ * @return 1 if it has exited (and been reaped if it was our child)
+ */
+static int recorder_exited(ActiveRecording *rec, struct rusage *ru, char *failure, size_t len) {
+    if (rec->adopted) {
+        // Exit status and usage went to the process that started it
+        if (!handoff_exited(rec->pid, rec->pidfd, 0)) return 0;
+        memset(ru, 0, sizeof(*ru));
+        snprintf(failure, len, "recorder_died");
+        if (rec->pidfd >= 0) close(rec->pidfd);
+        rec->pidfd = -1;
+        return 1;
+    }
+    int status;
+    // 0 is still running; -1 leaves status unset, so only a reaped pid counts
+    if (wait4(rec->pid, &status, WNOHANG, ru) <= 0) return 0;
+    if (WIFSIGNALED(status)) snprintf(failure, len, "recorder_died signal %d", WTERMSIG(status));
+    else snprintf(failure, len, "recorder_died exit %d", WEXITSTATUS(status));
+    return 1;
+}
+
+/**
+ * Pass every running recorder to the new process (see handoff.h)
+ *
+ * A recorder that cannot be sent is stopped here, so its file is finalized
+ * rather than left growing with nobody to stop it.
+ */
+static void hand_off_recorders(void) {
+    int sent = 0;
+    double locked = lock_active();
+    for (int j = 0; j < MAX_ACTIVE_RECORDINGS; j++) {
+        ActiveRecording *rec = &active_recordings[j];
+        if (rec->pid == 0) continue;
+        HandoffRecorder h;
+        memset(&h, 0, sizeof(h));
+        h.pid = rec->pid;
+        h.timer_id = rec->timer_id;
+        h.recording_id = rec->recording_id;
+        h.end_time = rec->end_time;
+        h.started_at = rec->started_at;
+        snprintf(h.path, sizeof(h.path), "%s", rec->path);
+        snprintf(h.channel, sizeof(h.channel), "%s", rec->channel);
+        if (handoff_send_recorder(&h) == 0) {
+            sent++;
+            if (rec->adopted && rec->pidfd >= 0) close(rec->pidfd);
+        } else {
+            LOG_WARN("DVR", "Cannot hand off recording ID %d, stopping it", rec->recording_id);
+            struct rusage ru;
+            recorder_stop(rec, &ru);
+            record_session(rec, &ru, NULL);
+        }
+        rec->pid = 0;
+        rec->timer_id = 0;
+        rec->adopted = 0;
+        rec->pidfd = -1;
+    }
+    unlock_active(locked);
+    LOG_INFO("DVR", "Handed off %d recordings", sent);
+}
+
+/**
+ * Sleep until the next poll, or until a handoff is requested
+ *
+ * @return 1 if the scheduler should hand off and exit
+ */
+static int scheduler_sleep(int interval) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += interval / 1000;
+    deadline.tv_nsec += (interval % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    ThreadStateMark mark = thread_state_enter(THREAD_SLEEP, "poll");
+    tracked_lock(&wake_mutex);
+    while (!handoff_requested && tracked_cond_timedwait(&wake_cond, &wake_mutex, &deadline) == 0) {}
+    int stop = handoff_requested;
+    tracked_unlock(&wake_mutex);
+    thread_state_leave(mark);
+    return stop;
+}
+
+/**
+ * Add a skew sample (wall-clock ms late versus the timer) to the counters
+ */
+static void record_skew(double *sum, double *max, unsigned long *count, long long late_ms) {
+    tracked_lock(&stats_mutex);
+    *sum += late_ms;
+    stat_max(max, late_ms);
+    (*count)++;
+    tracked_unlock(&stats_mutex);
+}
 
 void *scheduler_thread(void *arg) {
     (void)arg;
     LOG_INFO("DVR", "Scheduler thread started");
+    thread_state_register("scheduler");
 
     while (1) {
-        time_t now_sec = time(NULL);
-        long long now_ms = (long long)now_sec * 1000;
+        double tick_start = mono_ms();
+        double db_ms = 0, t;
+        long long now_ms = wall_ms();
         
         // 1. Check pending timers
         Timer *timers = NULL;
         int count = 0;
-        if (db_get_pending_timers(now_ms, &timers, &count)) {
+        t = mono_ms();
+        int have_timers = db_get_pending_timers(now_ms, &timers, &count);
+        db_ms += mono_ms() - t;
+        if (have_timers) {
             for (int i = 0; i < count; i++) {
                 // Check if already active
                 int is_active = 0;
-                pthread_mutex_lock(&active_mutex);
+                double locked = lock_active();
                 for (int j = 0; j < MAX_ACTIVE_RECORDINGS; j++) {
                     if (active_recordings[j].timer_id == timers[i].id) {
                         is_active = 1;
                         break;
                     }
                 }
-                pthread_mutex_unlock(&active_mutex);
+                unlock_active(locked);
 
                 if (!is_active) {
                     // START RECORDING
@@ -99,9 +313,14 @@ void *scheduler_thread(void *arg) {
                     mkdir("recordings", 0777);
 
                     // Insert into DB first to get ID
+                    t = mono_ms();
                     int rec_id = db_add_recording_entry(timers[i].title,  timers[i].channel_num, now_ms, 0, filename);
+                    db_ms += mono_ms() - t;
                     if (rec_id == -1) {
                         LOG_ERROR("DVR", "Failed to create recording DB entry");
+                        tracked_lock(&stats_mutex);
+                        stats.start_failures++;
+                        tracked_unlock(&stats_mutex);
                         continue;
                     }
 
@@ -135,18 +354,39 @@ void *scheduler_thread(void *arg) {
                         _exit(1);
                     } else if (pid > 0) {
                         // Parent
-                        pthread_mutex_lock(&active_mutex);
+                        flight_record(FLIGHT_REC_START, pid, timers[i].id);
+                        long long skew = wall_ms() - timers[i].start_time;
+                        PROBE3(sched__start, timers[i].id, pid, skew);
+                        record_skew(&stats.start_skew_sum_ms, &stats.start_skew_max_ms, &stats.started, skew);
+                        int slotted = 0;
+                        double locked = lock_active();
                         for (int j = 0; j < MAX_ACTIVE_RECORDINGS; j++) {
                             if (active_recordings[j].pid == 0) {
                                 active_recordings[j].timer_id = timers[i].id;
                                 active_recordings[j].recording_id = rec_id;
                                 active_recordings[j].pid = pid;
                                 active_recordings[j].end_time = timers[i].end_time;
+                                active_recordings[j].started_at = wall_ms();
+                                active_recordings[j].adopted = 0;
+                                active_recordings[j].pidfd = -1;
+                                snprintf(active_recordings[j].channel, sizeof(active_recordings[j].channel),
+                                         "%s", timers[i].channel_num);
                                 strncpy(active_recordings[j].path, filename, 255);
+                                slotted = 1;
                                 break;
                             }
                         }
-                        pthread_mutex_unlock(&active_mutex);
+                        unlock_active(locked);
+                        if (!slotted) {
+                            LOG_WARN("DVR", "No free recording slot for %s", timers[i].title);
+                            tracked_lock(&stats_mutex);
+                            stats.slot_overflows++;
+                            tracked_unlock(&stats_mutex);
+                        }
+                    } else {
+                        tracked_lock(&stats_mutex);
+                        stats.start_failures++;
+                        tracked_unlock(&stats_mutex);
                     }
                 }
             }
@@ -154,14 +394,19 @@ void *scheduler_thread(void *arg) {
         }
 
         // 2. Check for finished recordings
-        pthread_mutex_lock(&active_mutex);
+        double locked = lock_active();
         for (int j = 0; j < MAX_ACTIVE_RECORDINGS; j++) {
             if (active_recordings[j].pid != 0) {
                 // Check if time is up
                 if (now_ms >= active_recordings[j].end_time) {
                     LOG_INFO("DVR", "Stopping recording ID %d (time reached)", active_recordings[j].recording_id);
-                    kill(active_recordings[j].pid, SIGTERM);
-                    waitpid(active_recordings[j].pid, NULL, 0);
+                    struct rusage ru;
+                    recorder_stop(&active_recordings[j], &ru);
+                    record_session(&active_recordings[j], &ru, NULL);
+                    flight_record(FLIGHT_REC_STOP, active_recordings[j].pid, active_recordings[j].recording_id);
+                    long long skew = wall_ms() - active_recordings[j].end_time;
+                    PROBE3(sched__stop, active_recordings[j].recording_id, active_recordings[j].pid, skew);
+                    record_skew(&stats.stop_skew_sum_ms, &stats.stop_skew_max_ms, &stats.stopped, skew);
                     
                     // Update End Time in DB (Implement helper if verifying duration matters, or just leave as is)
                     // Reset slot
@@ -171,84 +416,201 @@ void *scheduler_thread(void *arg) {
                     // TODO: We should probably delete the "Once" timer or update its status so it doesn't trigger again immediately if loops logic was different.
                     // But db_get_pending_timers checks for valid range. If end_time is passed, it won't be returned by DB.
                     // However, we should clean up "active" "once" timers. 
+                    t = mono_ms();
                     db_delete_timer(active_recordings[j].timer_id); // Simple approach: delete "once" timers when done.
+                    db_ms += mono_ms() - t;
                 } else {
                     // Check if process is still alive
-                    int status;
-                    if (waitpid(active_recordings[j].pid, &status, WNOHANG) != 0) {
+                    struct rusage ru;
+                    char failure[64];
+                    if (recorder_exited(&active_recordings[j], &ru, failure, sizeof(failure))) {
                         LOG_WARN("DVR", "FFmpeg process %d died unexpectedly", active_recordings[j].pid);
+                        record_session(&active_recordings[j], &ru, failure);
+                        flight_record(FLIGHT_REC_DIED, active_recordings[j].pid, active_recordings[j].recording_id);
                         active_recordings[j].pid = 0;
                         active_recordings[j].timer_id = 0;
+                        tracked_lock(&stats_mutex);
+                        stats.died++;
+                        tracked_unlock(&stats_mutex);
                     }
                 }
             }
         }
-        pthread_mutex_unlock(&active_mutex);
+        unlock_active(locked);
 
-        sleep(POLL_INTERVAL);
+        double busy = mono_ms() - tick_start;
+        flight_record(FLIGHT_SCHED_TICK, count, (int64_t)(busy * 1000));
+        PROBE2(sched__tick, count, (int64_t)(busy * 1000));
+        tracked_lock(&stats_mutex);
+        stats.ticks++;
+        stats.db_sum_ms += db_ms;
+        stat_max(&stats.db_tick_max_ms, db_ms);
+        stats.tick_sum_ms += busy;
+        stat_max(&stats.tick_max_ms, busy);
+        tracked_unlock(&stats_mutex);
+
+        if (scheduler_sleep(poll_interval_ms)) break;
     }
+
+    // Handoff: the new process starts its own scheduler once it has the recorders
+    hand_off_recorders();
+    tracked_lock(&wake_mutex);
+    running = 0;
+    pthread_cond_broadcast(&wake_cond);
+    tracked_unlock(&wake_mutex);
+    thread_state_unregister();
+    LOG_INFO("DVR", "Scheduler thread stopped");
     return NULL;
 }
 
 void start_scheduler() {
-    // Clear active list
-    memset(active_recordings, 0, sizeof(active_recordings));
-    
+    // Slots may already hold recorders adopted through a handoff
     pthread_t th;
+    tracked_lock(&wake_mutex);
+    running = 1;
+    tracked_unlock(&wake_mutex);
     if (pthread_create(&th, NULL, scheduler_thread, NULL) != 0) {
         fprintf(stderr, "Failed to create scheduler thread\n");
+        tracked_lock(&wake_mutex);
+        running = 0;
+        tracked_unlock(&wake_mutex);
     } else {
         pthread_detach(th);
     }
 }
 
+void scheduler_handoff(void) {
+    tracked_lock(&wake_mutex);
+    if (!running) {
+        tracked_unlock(&wake_mutex);
+        hand_off_recorders();
+        return;
+    }
+    handoff_requested = 1;
+    pthread_cond_broadcast(&wake_cond);
+    ThreadStateMark mark = thread_state_enter(THREAD_SLEEP, "scheduler");
+    while (running) tracked_cond_wait(&wake_cond, &wake_mutex);
+    thread_state_leave(mark);
+    tracked_unlock(&wake_mutex);
+}
+
+void scheduler_adopt(const HandoffRecorder *recorder, int pidfd) {
+    int slotted = 0;
+    tracked_lock(&active_mutex);
+    for (int j = 0; j < MAX_ACTIVE_RECORDINGS; j++) {
+        ActiveRecording *rec = &active_recordings[j];
+        if (rec->pid != 0) continue;
+        rec->timer_id = recorder->timer_id;
+        rec->recording_id = recorder->recording_id;
+        rec->end_time = recorder->end_time;
+        rec->started_at = recorder->started_at;
+        snprintf(rec->path, sizeof(rec->path), "%s", recorder->path);
+        snprintf(rec->channel, sizeof(rec->channel), "%s", recorder->channel);
+        rec->adopted = 1;
+        rec->pidfd = pidfd;
+        rec->pid = recorder->pid;
+        slotted = 1;
+        break;
+    }
+    tracked_unlock(&active_mutex);
+    if (slotted) {
+        LOG_INFO("DVR", "Adopted recording ID %d (ffmpeg pid %d)", recorder->recording_id, (int)recorder->pid);
+        return;
+    }
+    LOG_WARN("DVR", "No free slot for adopted recording ID %d, stopping it", recorder->recording_id);
+    handoff_kill(recorder->pid, pidfd, SIGTERM);
+    if (pidfd >= 0) close(pidfd);
+}
+
+void scheduler_terminate_recorders(void) {
+    tracked_lock(&active_mutex);
+    for (int j = 0; j < MAX_ACTIVE_RECORDINGS; j++) {
+        ActiveRecording *rec = &active_recordings[j];
+        if (rec->pid != 0) handoff_kill(rec->pid, rec->adopted ? rec->pidfd : -1, SIGTERM);
+    }
+    for (int j = 0; j < MAX_ACTIVE_RECORDINGS; j++) {
+        ActiveRecording *rec = &active_recordings[j];
+        if (rec->pid == 0) continue;
+        if (rec->adopted) {
+            handoff_exited(rec->pid, rec->pidfd, RECORDER_STOP_MS);
+        } else {
+            for (int waited = 0; waited < RECORDER_STOP_MS && waitpid(rec->pid, NULL, WNOHANG) == 0; waited += 20) {
+                usleep(20 * 1000);
+            }
+        }
+        rec->pid = 0;
+    }
+    tracked_unlock(&active_mutex);
+}
+
+void scheduler_set_poll_interval(int ms) {
+    poll_interval_ms = ms < 10 ? 10 : ms;
+}
+
+void scheduler_get_stats(SchedulerStats *out) {
+    tracked_lock(&stats_mutex);
+    *out = stats;
+    tracked_unlock(&stats_mutex);
+}
+
+void scheduler_reset_stats(void) {
+    tracked_lock(&stats_mutex);
+    memset(&stats, 0, sizeof(stats));
+    tracked_unlock(&stats_mutex);
+}
+
 int stop_recording(int recording_id) {
     int found = 0;
-    pthread_mutex_lock(&active_mutex);
+    tracked_lock(&active_mutex);
     for (int j = 0; j < MAX_ACTIVE_RECORDINGS; j++) {
         if (active_recordings[j].recording_id == recording_id && active_recordings[j].pid != 0) {
-            kill(active_recordings[j].pid, SIGTERM);
-            waitpid(active_recordings[j].pid, NULL, 0);
+            struct rusage ru;
+            recorder_stop(&active_recordings[j], &ru);
+            record_session(&active_recordings[j], &ru, NULL);
             active_recordings[j].pid = 0;
             // Don't delete timer here necessarily, depends on logic, but for now we just stop the recording.
             found = 1;
             break;
         }
     }
-    pthread_mutex_unlock(&active_mutex);
+    tracked_unlock(&active_mutex);
     return found;
 }
 
 int get_active_recording_count() {
     int count = 0;
-    pthread_mutex_lock(&active_mutex);
+    tracked_lock(&active_mutex);
     for (int j = 0; j < MAX_ACTIVE_RECORDINGS; j++) {
         if (active_recordings[j].pid != 0) count++;
     }
-    pthread_mutex_unlock(&active_mutex);
+    tracked_unlock(&active_mutex);
     return count;
 }
 
-int *get_active_recording_ids(int *count) {
+int *get_active_recording_ids(Arena *arena, int *count) {
     *count = 0;
-    pthread_mutex_lock(&active_mutex);
+    tracked_lock(&active_mutex);
     // First count
     for (int j = 0; j < MAX_ACTIVE_RECORDINGS; j++) {
         if (active_recordings[j].pid != 0) (*count)++;
     }
     
     if (*count == 0) {
-        pthread_mutex_unlock(&active_mutex);
+        tracked_unlock(&active_mutex);
         return NULL;
     }
 
-    int *ids = malloc(sizeof(int) * (*count));
+    int *ids = arena_alloc(arena, sizeof(int) * (*count));
+    if (!ids) {
+        tracked_unlock(&active_mutex);
+        return NULL;
+    }
     int idx = 0;
     for (int j = 0; j < MAX_ACTIVE_RECORDINGS; j++) {
         if (active_recordings[j].pid != 0) {
             ids[idx++] = active_recordings[j].recording_id;
         }
     }
-    pthread_mutex_unlock(&active_mutex);
+    tracked_unlock(&active_mutex);
     return ids;
 }
@@ -0,0 +1,29 @@
+/**
+ * @file strbuf.c
+ * @brief printf-append into a growing heap buffer
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include "strbuf.h"
+
+int strbuf_append(char **buf, size_t *len, size_t *cap, const char *fmt, ...) {
+    va_list ap;
+    for (;;) {
+        va_start(ap, fmt);
+        int n = vsnprintf(*buf + *len, *cap - *len, fmt, ap);
+        va_end(ap);
+        if (n < 0) return -1;
+        if (*len + n < *cap) {
+            *len += n;
+            return 0;
+        }
+        size_t new_cap = (*cap + n) * 2;
+        char *grown = realloc(*buf, new_cap);
+        if (!grown) return -1;
+        *buf = grown;
+        *cap = new_cap;
+    }
+}
@@ -0,0 +1,219 @@
+/**
+ * @file telemetry.c
+ * @brief Historical session telemetry for capacity planning
+ *
+ * Producers copy records into a fixed queue under one mutex; the writer
+ * swaps the queue out and inserts the batch with the lock released, so a
+ * slow disk never stalls a relay. Percentiles are nearest-rank over the
+ * sorted per-profile samples.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "telemetry.h"
+#include "transcode.h"
+#include "capabilities.h"
+#include "lockstat.h"
+#include "thread_state.h"
+#include "strbuf.h"
+#include "log.h"
+
+static SessionRecord queue[TELEMETRY_QUEUE];
+static int queued = 0;
+static unsigned long written = 0;
+static unsigned long dropped = 0;
+static TrackedMutex queue_mutex = TRACKED_MUTEX_INITIALIZER("telemetry");
+
+static const char *kind_names[SESSION_NUM_KINDS] = { "live", "playback", "recording" };
+
+const char *session_kind_name(int kind) {
+    if (kind < 0 || kind >= SESSION_NUM_KINDS) return "unknown";
+    return kind_names[kind];
+}
+
+int session_kind_parse(const char *name) {
+    for (int i = 0; i < SESSION_NUM_KINDS; i++) {
+        if (strcmp(name, kind_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+static long long wall_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int telemetry_record(const SessionRecord *record) {
+    int rc = 0;
+    tracked_lock(&queue_mutex);
+    if (queued < TELEMETRY_QUEUE) {
+        queue[queued++] = *record;
+    } else {
+        dropped++;
+        rc = -1;
+    }
+    tracked_unlock(&queue_mutex);
+    return rc;
+}
+
+void telemetry_flush(void) {
+    tracked_lock(&queue_mutex);
+    int n = queued;
+    SessionRecord *batch = n ? malloc(sizeof(SessionRecord) * n) : NULL;
+    if (batch) memcpy(batch, queue, sizeof(SessionRecord) * n);
+    queued = 0;
+    tracked_unlock(&queue_mutex);
+    if (!batch) return;
+
+    if (db_add_session_records(batch, n)) {
+        tracked_lock(&queue_mutex);
+        written += n;
+        tracked_unlock(&queue_mutex);
+    } else {
+        LOG_ERROR("TELEMETRY", "Failed to write %d session records", n);
+        tracked_lock(&queue_mutex);
+        dropped += n;
+        tracked_unlock(&queue_mutex);
+    }
+    free(batch);
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/** Nearest-rank percentile; sorts v in place */
+static double percentile(double *v, int n, double p) {
+    if (n == 0) return 0;
+    qsort(v, n, sizeof(double), cmp_double);
+    int rank = (int)(p / 100.0 * n + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > n) rank = n;
+    return v[rank - 1];
+}
+
+static int profile_index(const SessionRecord *r) {
+    if (r->kind < 0 || r->kind >= SESSION_NUM_KINDS) return -1;
+    if (r->backend < 0 || r->backend >= CAPS_NUM_BACKENDS) return -1;
+    if (r->codec < 0 || r->codec >= TELEMETRY_NUM_CODECS) return -1;
+    return (r->kind * CAPS_NUM_BACKENDS + r->backend) * TELEMETRY_NUM_CODECS + r->codec;
+}
+
+/**
+ * Aggregate records into costs[SESSION_NUM_KINDS * CAPS_NUM_BACKENDS * TELEMETRY_NUM_CODECS]
+ */
+static void compute_costs(const SessionRecord *records, int count, int kind, ProfileCost *costs) {
+    const int groups = SESSION_NUM_KINDS * CAPS_NUM_BACKENDS * TELEMETRY_NUM_CODECS;
+    memset(costs, 0, sizeof(ProfileCost) * groups);
+    if (count == 0) return;
+
+    double *cpu = malloc(sizeof(double) * count);
+    double *rss = malloc(sizeof(double) * count);
+    double *speed = malloc(sizeof(double) * count);
+    double *dur = malloc(sizeof(double) * count);
+
+    for (int g = 0; g < groups; g++) {
+        int n = 0, n_cpu = 0, n_speed = 0;
+        for (int i = 0; i < count; i++) {
+            const SessionRecord *r = &records[i];
+            if (profile_index(r) != g || (kind >= 0 && r->kind != kind)) continue;
+            costs[g].sessions++;
+            if (r->failure[0]) costs[g].failures++;
+            if (r->duration_ms > 0) cpu[n_cpu++] = r->cpu_s * 60000.0 / r->duration_ms;
+            if (r->speed > 0) speed[n_speed++] = r->speed;
+            rss[n] = r->peak_rss_kb;
+            dur[n] = r->duration_ms / 1000.0;
+            n++;
+        }
+        if (n == 0) continue;
+        costs[g].cpu_per_min_p95 = percentile(cpu, n_cpu, 95);
+        costs[g].cpu_per_min_p50 = percentile(cpu, n_cpu, 50);
+        costs[g].rss_kb_p95 = percentile(rss, n, 95);
+        costs[g].rss_kb_p50 = percentile(rss, n, 50);
+        costs[g].speed_p95 = percentile(speed, n_speed, 95);
+        costs[g].speed_p50 = percentile(speed, n_speed, 50);
+        costs[g].duration_s_p95 = percentile(dur, n, 95);
+        costs[g].duration_s_p50 = percentile(dur, n, 50);
+    }
+
+    free(cpu);
+    free(rss);
+    free(speed);
+    free(dur);
+}
+
+char *telemetry_costs_json(int days, int kind) {
+    SessionRecord *records = NULL;
+    int count = 0;
+    long long since = wall_ms() - (long long)days * 86400000LL;
+    if (!db_get_session_records(since, &records, &count)) return NULL;
+
+    ProfileCost costs[SESSION_NUM_KINDS][CAPS_NUM_BACKENDS][TELEMETRY_NUM_CODECS];
+    compute_costs(records, count, kind, &costs[0][0][0]);
+    free(records);
+
+    tracked_lock(&queue_mutex);
+    int pending = queued;
+    unsigned long w = written, d = dropped;
+    tracked_unlock(&queue_mutex);
+
+    size_t len = 0, cap = 4096;
+    char *json = malloc(cap);
+    json[0] = '\0';
+    strbuf_append(&json, &len, &cap,
+           "{\"days\":%d,\"sessions\":%d,\"queued\":%d,\"written\":%lu,\"dropped\":%lu,\"profiles\":[",
+           days, count, pending, w, d);
+
+    int first = 1;
+    for (int k = 0; k < SESSION_NUM_KINDS; k++) {
+        for (int b = 0; b < CAPS_NUM_BACKENDS; b++) {
+            for (int c = 0; c < TELEMETRY_NUM_CODECS; c++) {
+                const ProfileCost *p = &costs[k][b][c];
+                if (p->sessions == 0) continue;
+                strbuf_append(&json, &len, &cap,
+                       "%s{\"kind\":\"%s\",\"backend\":\"%s\",\"codec\":\"%s\",\"sessions\":%d,\"failures\":%d,"
+                       "\"cpu_per_min\":{\"p50\":%.3f,\"p95\":%.3f},\"peak_rss_kb\":{\"p50\":%.0f,\"p95\":%.0f},"
+                       "\"speed\":{\"p50\":%.3f,\"p95\":%.3f},\"duration_s\":{\"p50\":%.1f,\"p95\":%.1f}}",
+                       first ? "" : ",", kind_names[k], transcode_backend_name((TranscodeBackend)b),
+                       transcode_codec_name((TranscodeCodec)c), p->sessions, p->failures,
+                       p->cpu_per_min_p50, p->cpu_per_min_p95, p->rss_kb_p50, p->rss_kb_p95,
+                       p->speed_p50, p->speed_p95, p->duration_s_p50, p->duration_s_p95);
+                first = 0;
+            }
+        }
+    }
+
+    strbuf_append(&json, &len, &cap, "]}");
+    return json;
+}
+
+static void *telemetry_thread(void *arg) {
+    (void)arg;
+    thread_state_register("telemetry");
+
+    while (1) {
+        struct timespec ts = { TELEMETRY_FLUSH_MS / 1000, (TELEMETRY_FLUSH_MS % 1000) * 1000000L };
+        ThreadStateMark mark = thread_state_enter(THREAD_SLEEP, "flush");
+        nanosleep(&ts, NULL);
+        thread_state_leave(mark);
+
+        telemetry_flush();
+    }
+    return NULL;
+}
+
+void telemetry_start(void) {
+    pthread_t th;
+    if (pthread_create(&th, NULL, telemetry_thread, NULL) != 0) {
+        LOG_ERROR("TELEMETRY", "Failed to create writer thread");
+    } else {
+        pthread_detach(th);
+    }
+}
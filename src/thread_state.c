@@ -0,0 +1,138 @@
+/**
+ * @file thread_state.c
+ * @brief Per-thread state registry for /debug/threads
+ *
+ * Each slot is written only by its owning thread. /debug/threads reads
+ * them without locking, so a label may occasionally show torn mid-update.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "thread_state.h"
+#include "strbuf.h"
+
+typedef struct {
+    int tid;                /**< 0 = free */
+    const char *role;
+    volatile int state;
+    const char *volatile detail;
+    volatile uint64_t since_ns;
+    uint64_t started_ns;
+    char label[128];
+} ThreadSlot;
+
+static ThreadSlot slots[THREAD_STATE_MAX];
+static __thread ThreadSlot *self = NULL;
+
+static const char *state_names[THREAD_NUM_STATES] = {
+    "running", "accept", "socket_read", "socket_write", "pipe_read", "db", "lock", "child_wait", "sleep"
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void thread_state_register(const char *role) {
+    int tid = (int)syscall(SYS_gettid);
+    for (int i = 0; i < THREAD_STATE_MAX; i++) {
+        int expected = 0;
+        if (__atomic_load_n(&slots[i].tid, __ATOMIC_RELAXED) == 0 &&
+            __atomic_compare_exchange_n(&slots[i].tid, &expected, -1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            ThreadSlot *s = &slots[i];
+            s->role = role;
+            s->state = THREAD_RUNNING;
+            s->detail = NULL;
+            s->started_ns = s->since_ns = now_ns();
+            s->label[0] = '\0';
+            // Publish only once the slot is filled in
+            __atomic_store_n(&s->tid, tid, __ATOMIC_RELEASE);
+            self = s;
+            return;
+        }
+    }
+}
+
+void thread_state_unregister(void) {
+    if (!self) return;
+    __atomic_store_n(&self->tid, 0, __ATOMIC_RELEASE);
+    self = NULL;
+}
+
+void thread_state_label(const char *label) {
+    if (!self) return;
+    snprintf(self->label, sizeof(self->label), "%s", label);
+}
+
+ThreadStateMark thread_state_enter(ThreadState state, const char *detail) {
+    ThreadStateMark prev = { THREAD_RUNNING, NULL };
+    if (!self) return prev;
+    prev.state = (ThreadState)self->state;
+    prev.detail = self->detail;
+    self->detail = detail;
+    self->state = state;
+    self->since_ns = now_ns();
+    return prev;
+}
+
+void thread_state_leave(ThreadStateMark prev) {
+    if (!self) return;
+    self->detail = prev.detail;
+    self->state = prev.state;
+    self->since_ns = now_ns();
+}
+
+const char *thread_state_name(ThreadState state) {
+    if (state < 0 || state >= THREAD_NUM_STATES) return "unknown";
+    return state_names[state];
+}
+
+/** Labels are request paths; keep them printable and quote-safe */
+static void sanitize(char *dest, const char *src, size_t size) {
+    size_t i = 0;
+    for (; src[i] && i < size - 1; i++) {
+        unsigned char c = (unsigned char)src[i];
+        dest[i] = (c < 0x20 || c == '"' || c == '\\' || c >= 0x7f) ? '?' : (char)c;
+    }
+    dest[i] = '\0';
+}
+
+char *thread_state_json(void) {
+    size_t len = 0, cap = 8192;
+    char *json = malloc(cap);
+    json[0] = '\0';
+    strbuf_append(&json, &len, &cap, "[");
+
+    uint64_t now = now_ns();
+    int first = 1;
+    for (int i = 0; i < THREAD_STATE_MAX; i++) {
+        ThreadSlot *s = &slots[i];
+        int tid = __atomic_load_n(&s->tid, __ATOMIC_ACQUIRE);
+        if (tid <= 0) continue;
+
+        int state = s->state;
+        const char *detail = s->detail;
+        uint64_t since = s->since_ns;
+        char label[sizeof(s->label)];
+        sanitize(label, s->label, sizeof(label));
+
+        strbuf_append(&json, &len, &cap,
+               "%s{\"tid\":%d,\"role\":\"%s\",\"state\":\"%s\",\"detail\":\"%s\","
+               "\"state_ms\":%.1f,\"age_s\":%.1f,\"label\":\"%s\"}",
+               first ? "" : ",", tid, s->role, thread_state_name((ThreadState)state),
+               detail ? detail : "", now > since ? (now - since) / 1e6 : 0.0,
+               (now - s->started_ns) / 1e9, label);
+        first = 0;
+    }
+
+    strbuf_append(&json, &len, &cap, "]");
+    return json;
+}
@@ -0,0 +1,233 @@
+/**
+ * @file timer_wheel.c
+ * @brief Shared hierarchical timer wheel for deadlines and watchdogs
+ *
+ * A timer lives in the lowest level whose slot is certain to come round
+ * before it expires: level l if its expiry tick and the current tick only
+ * differ in level l's slot index and below. When level 0 wraps, the next
+ * level 1 slot is emptied back into the wheel (and so on upwards), which
+ * places its timers one level lower.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "timer_wheel.h"
+#include "lockstat.h"
+#include "thread_state.h"
+#include "log.h"
+
+#define SLOT_MASK (TIMER_SLOTS - 1)
+
+static WheelTimer *slots[TIMER_LEVELS][TIMER_SLOTS];
+static uint64_t occupied[TIMER_LEVELS];    /* Bit i: slots[level][i] is non-empty */
+
+/** Last tick processed; timers are always armed for a later one */
+static uint64_t now_tick;
+
+/** Tick the thread sleeps until (UINT64_MAX = until signalled) */
+static uint64_t wake_tick = UINT64_MAX;
+
+static TrackedMutex wheel_mutex = TRACKED_MUTEX_INITIALIZER("timer_wheel");
+static pthread_cond_t wheel_cond;
+static pthread_once_t wheel_once = PTHREAD_ONCE_INIT;
+
+/* Counters, guarded by wheel_mutex */
+static long pending;
+static long peak_pending;
+static unsigned long armed_total;
+static unsigned long fired_total;
+static unsigned long ticks_total;
+static unsigned long cascaded_total;
+
+static uint64_t mono_tick(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000) / TIMER_TICK_MS;
+}
+
+static void link_timer(WheelTimer *t) {
+    uint64_t expires = t->expires;
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 &&
+           (expires >> (TIMER_SLOT_BITS * (level + 1))) != (now_tick >> (TIMER_SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+    int idx = (expires >> (TIMER_SLOT_BITS * level)) & SLOT_MASK;
+    WheelTimer **head = &slots[level][idx];
+    t->next = *head;
+    if (*head) (*head)->pprev = &t->next;
+    *head = t;
+    t->pprev = head;
+    occupied[level] |= 1ULL << idx;
+}
+
+static void unlink_timer(WheelTimer *t) {
+    *t->pprev = t->next;
+    if (t->next) t->next->pprev = t->pprev;
+    // Head of its slot: the slot may have just emptied
+    WheelTimer **first = &slots[0][0];
+    if (t->pprev >= first && t->pprev < first + TIMER_LEVELS * TIMER_SLOTS && !*t->pprev) {
+        long n = t->pprev - first;
+        occupied[n / TIMER_SLOTS] &= ~(1ULL << (n % TIMER_SLOTS));
+    }
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+static uint64_t ticks_for(int ms) {
+    if (ms > TIMER_MAX_MS) ms = TIMER_MAX_MS;
+    uint64_t ticks = (ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    return ticks ? ticks : 1;
+}
+
+/**
+ * Re-place every timer of a higher-level slot, one level down or more
+ */
+static void cascade(int level, int idx) {
+    WheelTimer *t = slots[level][idx];
+    slots[level][idx] = NULL;
+    occupied[level] &= ~(1ULL << idx);
+    while (t) {
+        WheelTimer *next = t->next;
+        t->next = NULL;
+        t->pprev = NULL;
+        link_timer(t);
+        cascaded_total++;
+        t = next;
+    }
+}
+
+/**
+ * Advance to tick and fire what is due there (wheel locked)
+ */
+static void run_tick(uint64_t tick) {
+    now_tick = tick;
+    ticks_total++;
+    int idx = tick & SLOT_MASK;
+    for (int level = 1; level < TIMER_LEVELS && idx == 0; level++) {
+        idx = (tick >> (TIMER_SLOT_BITS * level)) & SLOT_MASK;
+        cascade(level, idx);
+    }
+
+    idx = tick & SLOT_MASK;
+    WheelTimer *t;
+    while ((t = slots[0][idx]) != NULL) {
+        unlink_timer(t);
+        pending--;
+        fired_total++;
+        int again = t->fn(t);
+        if (again > 0) {
+            t->expires = tick + ticks_for(again);
+            link_timer(t);
+            pending++;
+        }
+    }
+}
+
+/**
+ * First tick after now_tick where something happens: an occupied level 0
+ * slot, or the next wrap if higher levels hold timers
+ */
+static uint64_t next_event(void) {
+    if (pending == 0) return UINT64_MAX;
+    int idx = now_tick & SLOT_MASK;
+    // Occupied slots later in this level 0 rotation
+    uint64_t ahead = idx == SLOT_MASK ? 0 : occupied[0] & (~0ULL << (idx + 1));
+    if (ahead) return (now_tick & ~(uint64_t)SLOT_MASK) + __builtin_ctzll(ahead);
+    return (now_tick | SLOT_MASK) + 1;
+}
+
+static void *wheel_thread(void *arg) {
+    (void)arg;
+    thread_state_register("timers");
+    tracked_lock(&wheel_mutex);
+    for (;;) {
+        uint64_t current = mono_tick();
+        while (now_tick < current) {
+            uint64_t next = next_event();
+            // Skip straight over ticks where nothing is due
+            if (next > current) {
+                now_tick = current;
+                break;
+            }
+            run_tick(next);
+        }
+
+        wake_tick = next_event();
+        ThreadStateMark mark = thread_state_enter(THREAD_SLEEP, "timers");
+        if (wake_tick == UINT64_MAX) {
+            tracked_cond_wait(&wheel_cond, &wheel_mutex);
+        } else {
+            uint64_t ms = wake_tick * TIMER_TICK_MS;
+            struct timespec deadline = { ms / 1000, (ms % 1000) * 1000000L };
+            tracked_cond_timedwait(&wheel_cond, &wheel_mutex, &deadline);
+        }
+        thread_state_leave(mark);
+    }
+    return NULL;
+}
+
+static void wheel_start(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wheel_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    now_tick = mono_tick();
+
+    pthread_t th;
+    if (pthread_create(&th, NULL, wheel_thread, NULL) != 0) {
+        LOG_ERROR("TIMER", "Cannot start the timer thread: %s", strerror(errno));
+        return;
+    }
+    pthread_detach(th);
+}
+
+void timer_arm(WheelTimer *timer, WheelTimerFn fn, int ms) {
+    pthread_once(&wheel_once, wheel_start);
+    tracked_lock(&wheel_mutex);
+    if (timer->pprev) {
+        unlink_timer(timer);
+        pending--;
+    }
+    timer->fn = fn;
+    // Relative to the clock, not to now_tick, which lags while the thread sleeps
+    uint64_t current = mono_tick();
+    timer->expires = (current > now_tick ? current : now_tick) + ticks_for(ms);
+    link_timer(timer);
+    pending++;
+    armed_total++;
+    if (pending > peak_pending) peak_pending = pending;
+    if (timer->expires < wake_tick) pthread_cond_signal(&wheel_cond);
+    tracked_unlock(&wheel_mutex);
+}
+
+int timer_cancel(WheelTimer *timer) {
+    // A never-armed timer has nothing to wait for
+    if (!timer->fn) return 0;
+    tracked_lock(&wheel_mutex);
+    int was_armed = timer->pprev != NULL;
+    if (was_armed) {
+        unlink_timer(timer);
+        pending--;
+    }
+    tracked_unlock(&wheel_mutex);
+    return was_armed;
+}
+
+char *timer_wheel_json(void) {
+    char *json = malloc(256);
+    if (!json) return NULL;
+    tracked_lock(&wheel_mutex);
+    snprintf(json, 256,
+             "{\"pending\":%ld,\"peak_pending\":%ld,\"armed\":%lu,\"fired\":%lu,\"ticks\":%lu,\"cascaded\":%lu}",
+             pending, peak_pending, armed_total, fired_total, ticks_total, cascaded_total);
+    tracked_unlock(&wheel_mutex);
+    return json;
+}
@@ -5,8 +5,11 @@
  * Provides real-time transcoding of video streams for browser playback.
  * The pipeline:
  * 1. Spawns FFmpeg as a child process
- * 2. Pipes FFmpeg stdout to the client socket
- * 3. Manages process lifecycle (cleanup on disconnect)
+ * 2. Pipes FFmpeg stdout to the client, chunked when the connection is
+ *    kept alive so a finished playback can be followed by more requests
+ *    (spliced straight from the pipe with the io_uring engine)
+ * 3. Manages process lifecycle (cleanup on disconnect, and a watchdog on
+ *    the timer wheel that kills an FFmpeg whose output stalls)
  *
  * Supports multiple hardware acceleration backends:
  * - Software (libx264, libx265, libsvtav1)
@@ -26,8 +29,23 @@
 #include <sys/wait.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <errno.h>
+#include <stddef.h>
+#include <time.h>
 
 #include "transcode.h"
+#include "clock.h"
+#include "encode_sched.h"
+#include "handoff.h"
+#include "capabilities.h"
+#include "flight.h"
+#include "thread_state.h"
+#include "qoe.h"
+#include "telemetry.h"
+#include "probes.h"
 #include "log.h"
 
 /* Default audio bitrates */
@@ -35,12 +53,57 @@ static const char *default_audio_bitrate = "128k";         /**< Stereo AAC/Opus
 static const char *default_aac_surround_bitrate = "384k";  /**< 5.1 AAC */
 static const char *default_surround_bitrate = "384k";      /**< 5.1 Opus */
 
-static char **build_ffmpeg_args(const char *input_url, TranscodeConfig config, int *argc_out) {
+const char *transcode_backend_name(TranscodeBackend backend) {
+    switch (backend) {
+        case TRANSCODE_BACKEND_QSV: return "qsv";
+        case TRANSCODE_BACKEND_NVENC: return "nvenc";
+        case TRANSCODE_BACKEND_VAAPI: return "vaapi";
+        default: return "software";
+    }
+}
+
+const char *transcode_codec_name(TranscodeCodec codec) {
+    switch (codec) {
+        case TRANSCODE_CODEC_HEVC: return "hevc";
+        case TRANSCODE_CODEC_AV1: return "av1";
+        case TRANSCODE_CODEC_COPY: return "copy";
+        default: return "h264";
+    }
+}
+
+/**
+ * Build the FFmpeg command line; runs in the forked child, so it must take
+ * no locks (render nodes come from a Capabilities snapshot the parent took)
+ */
+static char **build_ffmpeg_args(const char *input_url, TranscodeConfig config,
+                                const EncodeBudget *budget, const char *render_node,
+                                const char *intel_render_node, int *argc_out) {
     int capacity = 64;
     char **argv = malloc(sizeof(char*) * capacity);
     int argc = 0;
 
+    /* Budgeted thread counts (only ever built in the forked child) */
+    static char threads_str[16], x265_params[32], svtav1_params[32];
+    snprintf(threads_str, sizeof(threads_str), "%d", budget->threads);
+    snprintf(x265_params, sizeof(x265_params), "pools=%d", budget->threads);
+    snprintf(svtav1_params, sizeof(svtav1_params), "lp=%d", budget->threads);
+
+    /* Optional downscale, appended to each backend's filter chain */
+    static char vf_software[64], vf_qsv[128], vf_vaapi[96];
+    if (config.height > 0) {
+        snprintf(vf_software, sizeof(vf_software), "scale=-2:%d", config.height);
+        snprintf(vf_qsv, sizeof(vf_qsv), "yadif=0:-1:0,format=nv12,hwupload=extra_hw_frames=64,format=qsv,scale_qsv=w=-1:h=%d", config.height);
+        snprintf(vf_vaapi, sizeof(vf_vaapi), "format=nv12,hwupload,scale_vaapi=w=-2:h=%d", config.height);
+    } else {
+        snprintf(vf_qsv, sizeof(vf_qsv), "yadif=0:-1:0,format=nv12,hwupload=extra_hw_frames=64,format=qsv");
+        snprintf(vf_vaapi, sizeof(vf_vaapi), "format=nv12,hwupload");
+    }
+
     argv[argc++] = "ffmpeg";
+    argv[argc++] = "-hide_banner";
+    argv[argc++] = "-stats";   // Progress lines feed session telemetry (speed)
+    argv[argc++] = "-loglevel";
+    argv[argc++] = "error";  // Errors only: stderr is parsed for failure reasons
     
     // HW Accel Enums: 
     // VAAPI: -init_hw_device vaapi=gpu:/dev/dri/renderD128 -filter_hw_device gpu
@@ -50,21 +113,39 @@ static char **build_ffmpeg_args(const char *input_url, TranscodeConfig config, i
     // if (engine === 'qsv') ffmpegArgs.push('-init_hw_device', 'qsv=hw', '-filter_hw_device', 'hw');
     // else if (engine === 'vaapi') ffmpegArgs.push('-init_hw_device', 'vaapi=gpu:/dev/dri/renderD128', '-filter_hw_device', 'gpu');
 
+    // Render nodes come from the capability probe instead of assuming renderD128
+    static char vaapi_device[96], qsv_device[112];
+    snprintf(vaapi_device, sizeof(vaapi_device), "vaapi=gpu:%s",
+             render_node[0] ? render_node : "/dev/dri/renderD128");
+    if (intel_render_node[0]) {
+        snprintf(qsv_device, sizeof(qsv_device), "qsv=hw:hw,child_device=%s", intel_render_node);
+    } else {
+        snprintf(qsv_device, sizeof(qsv_device), "qsv=hw");
+    }
+
     if (config.backend == TRANSCODE_BACKEND_VAAPI) {
         argv[argc++] = "-init_hw_device";
-        argv[argc++] = "vaapi=gpu:/dev/dri/renderD128";
+        argv[argc++] = vaapi_device;
         argv[argc++] = "-filter_hw_device";
         argv[argc++] = "gpu";
     } else if (config.backend == TRANSCODE_BACKEND_QSV) {
         argv[argc++] = "-init_hw_device";
-        argv[argc++] = "qsv=hw";
+        argv[argc++] = qsv_device;
         argv[argc++] = "-filter_hw_device";
         argv[argc++] = "hw";
     }
 
-    argv[argc++] = "-re"; // Read input at native frame rate (important for live streams?) 
-    // Actually, for transcoding, usually -re is for pushing to RTMP, but if we are pulling live, we don't strictly need it 
-    // effectively, but lets stick to reference or safe defaults. Input is http live stream, so it flows at live rate anyway.
+    if (!config.unpaced) {
+        argv[argc++] = "-re"; // Read input at native frame rate (important for live streams?) 
+        // Actually, for transcoding, usually -re is for pushing to RTMP, but if we are pulling live, we don't strictly need it 
+        // effectively, but lets stick to reference or safe defaults. Input is http live stream, so it flows at live rate anyway.
+    }
+
+    // Cap decoder threads to the session's budget too
+    if (budget->active) {
+        argv[argc++] = "-threads";
+        argv[argc++] = threads_str;
+    }
     
     argv[argc++] = "-i";
     argv[argc++] = (char*)input_url;
@@ -81,19 +162,43 @@ static char **build_ffmpeg_args(const char *input_url, TranscodeConfig config, i
             else if (config.codec == TRANSCODE_CODEC_AV1) argv[argc++] = "libsvtav1";
             else argv[argc++] = "libx264";
 
+            if (config.height > 0) {
+                argv[argc++] = "-vf";
+                argv[argc++] = vf_software;
+            }
+
             argv[argc++] = "-preset";
-            argv[argc++] = "fast"; // ultrafast?
+            if (config.preset) argv[argc++] = (char*)config.preset;
+            else if (config.codec == TRANSCODE_CODEC_AV1) argv[argc++] = "10"; // SVT-AV1 takes 0-13
+            else argv[argc++] = "fast"; // ultrafast?
             argv[argc++] = "-crf";
             argv[argc++] = "23";
 
+            if (budget->active) {
+                argv[argc++] = "-threads";
+                argv[argc++] = threads_str;
+                if (config.codec == TRANSCODE_CODEC_HEVC) {
+                    argv[argc++] = "-x265-params";
+                    argv[argc++] = x265_params;
+                } else if (config.codec == TRANSCODE_CODEC_AV1) {
+                    argv[argc++] = "-svtav1-params";
+                    argv[argc++] = svtav1_params;
+                }
+            }
+
         } else if (config.backend == TRANSCODE_BACKEND_NVENC) {
             argv[argc++] = "-c:v";
             if (config.codec == TRANSCODE_CODEC_HEVC) argv[argc++] = "hevc_nvenc";
             else if (config.codec == TRANSCODE_CODEC_AV1) argv[argc++] = "av1_nvenc";
             else argv[argc++] = "h264_nvenc";
 
+            if (config.height > 0) {
+                argv[argc++] = "-vf";
+                argv[argc++] = vf_software;
+            }
+
             argv[argc++] = "-preset";
-            argv[argc++] = "p4"; // medium
+            argv[argc++] = config.preset ? (char*)config.preset : "p4"; // medium
             argv[argc++] = "-rc";
             argv[argc++] = "constqp"; // or vbr
             argv[argc++] = "-qp"; // cq
@@ -103,7 +208,7 @@ static char **build_ffmpeg_args(const char *input_url, TranscodeConfig config, i
             // Filter
             // -vf yadif=0:-1:0,format=nv12,hwupload=extra_hw_frames=64,format=qsv
             argv[argc++] = "-vf";
-            argv[argc++] = "yadif=0:-1:0,format=nv12,hwupload=extra_hw_frames=64,format=qsv";
+            argv[argc++] = vf_qsv;
 
             argv[argc++] = "-c:v";
             if (config.codec == TRANSCODE_CODEC_HEVC) argv[argc++] = "hevc_qsv";
@@ -113,10 +218,15 @@ static char **build_ffmpeg_args(const char *input_url, TranscodeConfig config, i
             argv[argc++] = "-global_quality";
             argv[argc++] = "23";
 
+            if (config.preset) {
+                argv[argc++] = "-preset";
+                argv[argc++] = (char*)config.preset;
+            }
+
         } else if (config.backend == TRANSCODE_BACKEND_VAAPI) {
             // Filter: format=nv12,hwupload
             argv[argc++] = "-vf";
-            argv[argc++] = "format=nv12,hwupload";
+            argv[argc++] = vf_vaapi;
 
             argv[argc++] = "-c:v";
             if (config.codec == TRANSCODE_CODEC_HEVC) argv[argc++] = "hevc_vaapi";
@@ -186,51 +296,84 @@ static char **build_ffmpeg_args(const char *input_url, TranscodeConfig config, i
     return argv;
 }
 
-static void send_headers(int client_socket, const char *content_type) {
-    char buffer[1024];
-    int len = snprintf(buffer, sizeof(buffer),
-        "HTTP/1.1 200 OK\r\n"
-        "Content-Type: %s\r\n"
-        "Connection: close\r\n"
-        "\r\n",
-        content_type);
-    write(client_socket, buffer, len);
+static void send_error(HttpResponse *res, const char *reason) {
+    char body[512], escaped[300];
+    size_t j = 0;
+    for (size_t i = 0; reason[i] && j < sizeof(escaped) - 2; i++) {
+        if (reason[i] == '"' || reason[i] == '\\') escaped[j++] = '\\';
+        escaped[j++] = ((unsigned char)reason[i] < 0x20) ? ' ' : reason[i];
+    }
+    escaped[j] = '\0';
+
+    int body_len = snprintf(body, sizeof(body), "{\"error\":\"Transcode failed: %s\"}", escaped);
+    if (body_len >= (int)sizeof(body)) body_len = sizeof(body) - 1;
+    http_send(res, 502, "Bad Gateway", "application/json", body, body_len);
 }
 
-int transcode_source(int client_socket, const char *input_source, TranscodeConfig config) {
-    // Pipe for ffmpeg stdout -> parent
-    int pipe_fd[2];
-    if (pipe(pipe_fd) < 0) {
+int transcode_spawn(const char *input_source, TranscodeConfig config, TranscodeProcess *proc) {
+    memset(proc, 0, sizeof(*proc));
+    proc->pid = -1;
+    proc->out_fd = -1;
+    proc->err_fd = -1;
+    proc->pidfd = -1;
+    proc->backend = config.backend;
+
+    // Only CPU encodes compete for cores; hardware sessions keep FFmpeg defaults
+    if (config.backend == TRANSCODE_BACKEND_SOFTWARE && config.codec != TRANSCODE_CODEC_COPY) {
+        encode_sched_acquire(&proc->budget);
+    }
+
+    // Pipes for ffmpeg stdout/stderr -> parent
+    int pipe_fd[2], err_fd[2];
+    if (pipe2(pipe_fd, O_CLOEXEC) < 0) {
+        perror("pipe failed");
+        encode_sched_release(&proc->budget);
+        return -1;
+    }
+    if (pipe2(err_fd, O_CLOEXEC) < 0) {
         perror("pipe failed");
+        close(pipe_fd[0]);
+        close(pipe_fd[1]);
+        encode_sched_release(&proc->budget);
         return -1;
     }
 
+    // caps_mutex may be held by another thread at fork(); the child must not
+    // take it, so the render nodes are read here
+    Capabilities caps;
+    caps_get(&caps);
+
     pid_t pid = fork();
     if (pid < 0) {
         perror("fork failed");
+        flight_record(FLIGHT_SPAWN_FAIL, errno, config.backend << 8 | config.codec);
+        close(pipe_fd[0]);
+        close(pipe_fd[1]);
+        close(err_fd[0]);
+        close(err_fd[1]);
+        encode_sched_release(&proc->budget);
         return -1;
     }
 
     if (pid == 0) {
         // Child: FFmpeg
         close(pipe_fd[0]);
+        close(err_fd[0]);
         
-        // Redirect stdout to pipe write end
+        // Redirect stdout/stderr to pipe write ends
         dup2(pipe_fd[1], STDOUT_FILENO);
         close(pipe_fd[1]);
+        dup2(err_fd[1], STDERR_FILENO);
+        close(err_fd[1]);
 
         // Close all other FDs to be safe
         // (Assuming standard setup, not strictly iterating all)
+
+        encode_sched_apply(0, &proc->budget);
         
         int argc;
-        char **argv = build_ffmpeg_args(input_source, config, &argc);
-
-        // Redirect stderr to /dev/null to hide ffmpeg debug output
-        int devnull = open("/dev/null", O_WRONLY);
-        if (devnull >= 0) {
-            dup2(devnull, STDERR_FILENO);
-            close(devnull);
-        }
+        char **argv = build_ffmpeg_args(input_source, config, &proc->budget, caps.render_node,
+                                         caps.intel_render_node, &argc);
 
         execvp("ffmpeg", argv);
         perror("execvp ffmpeg failed");
@@ -238,36 +381,439 @@ int transcode_source(int client_socket, const char *input_source, TranscodeConfi
     }
 
     // Parent
-    close(pipe_fd[1]); // Close write end
+    flight_record(FLIGHT_SPAWN, pid, config.backend << 8 | config.codec);
+    PROBE3(session__spawn, pid, transcode_backend_name(config.backend), transcode_codec_name(config.codec));
+    close(pipe_fd[1]); // Close write ends
+    close(err_fd[1]);
+    proc->pid = pid;
+    proc->out_fd = pipe_fd[0];
+    proc->err_fd = err_fd[0];
+    return 0;
+}
 
-    // Send HTTP Headers to Client first
-    // Determine content type
-    const char *ctype = (config.codec == TRANSCODE_CODEC_AV1) ? "video/webm" : "video/mp4";
-    send_headers(client_socket, ctype);
+/**
+ * Take time= and speed= from a -stats progress line
+ *
+ * @return 1 if the line was a progress line
+ */
+static int parse_progress(TranscodeProcess *proc, const char *line) {
+    if (strncmp(line, "frame=", 6) != 0 && strncmp(line, "size=", 5) != 0) return 0;
+
+    const char *p = strstr(line, "time=");
+    int h, m;
+    double s;
+    if (p && sscanf(p + 5, "%d:%d:%lf", &h, &m, &s) == 3) {
+        proc->media_s = h * 3600.0 + m * 60.0 + s;
+    }
+    p = strstr(line, "speed=");
+    if (p) {
+        double v = strtod(p + 6, NULL);
+        if (v > 0) proc->speed = v;
+    }
+    return 1;
+}
 
-    // Relay loop
-    char buffer[8192];
-    ssize_t n;
-    while ((n = read(pipe_fd[0], buffer, sizeof(buffer))) > 0) {
-        if (write(client_socket, buffer, n) < 0) {
-            // Client likely disconnected
+/**
+ * Drain whatever FFmpeg wrote to stderr, keeping the last complete line
+ *
+ * Progress lines end in '\r' and are parsed rather than kept.
+ */
+static void drain_stderr(TranscodeProcess *proc) {
+    char chunk[1024];
+    ssize_t n = read(proc->err_fd, chunk, sizeof(chunk));
+    if (n <= 0) {
+        close(proc->err_fd);
+        proc->err_fd = -1;
+        return;
+    }
+    for (ssize_t i = 0; i < n; i++) {
+        int eol = chunk[i] == '\n' || chunk[i] == '\r';
+        if (eol || proc->err_len == sizeof(proc->err_line) - 1) {
+            proc->err_line[proc->err_len] = '\0';
+            if (proc->err_len > 0 && !parse_progress(proc, proc->err_line)) {
+                memcpy(proc->last_error, proc->err_line, proc->err_len + 1);
+                LOG_DEBUG("FFMPEG", "[%d] %s", proc->pid, proc->last_error);
+            }
+            proc->err_len = 0;
+            if (eol) continue;
+        }
+        proc->err_line[proc->err_len++] = chunk[i];
+    }
+}
+
+/**
+ * Wait until FFmpeg's stdout is readable, draining stderr meanwhile
+ *
+ * @return 0 when stdout is readable (or at EOF), -1 on error
+ */
+static int wait_output(TranscodeProcess *proc) {
+    atomic_store_explicit(&proc->waiting_since, mono_ms(), memory_order_relaxed);
+    int rc = 0;
+    while (1) {
+        struct pollfd pfds[2] = {
+            { .fd = proc->out_fd, .events = POLLIN },
+            { .fd = proc->err_fd, .events = POLLIN },
+        };
+        ThreadStateMark mark = thread_state_enter(THREAD_PIPE_READ, "ffmpeg");
+        int ready = poll(pfds, proc->err_fd >= 0 ? 2 : 1, -1);
+        thread_state_leave(mark);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            rc = -1;
             break;
         }
+        if (proc->err_fd >= 0 && (pfds[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+            drain_stderr(proc);
+        }
+        if (pfds[0].revents & (POLLIN | POLLHUP | POLLERR)) break;
     }
+    atomic_store_explicit(&proc->waiting_since, 0, memory_order_relaxed);
+    return rc;
+}
+
+/**
+ * Kill an FFmpeg that has kept its relay waiting for TRANSCODE_STALL_MS;
+ * its pipe then reaches EOF and the relay ends
+ */
+static int output_watchdog(WheelTimer *timer) {
+    TranscodeProcess *proc = (TranscodeProcess *)((char *)timer - offsetof(TranscodeProcess, watchdog));
+    long long since = atomic_load(&proc->waiting_since);
+    if (!since) return TRANSCODE_STALL_MS / 2;
+    long long waited = mono_ms() - since;
+    if (waited < TRANSCODE_STALL_MS) return (int)(TRANSCODE_STALL_MS - waited);
+
+    LOG_WARN("TRANSCODE", "ffmpeg pid=%d produced nothing for %llds, killing it", proc->pid, waited / 1000);
+    atomic_store(&proc->stalled, 1);
+    flight_record(FLIGHT_TIMEOUT, proc->pid, FLIGHT_TIMEOUT_SESSION);
+    if (proc->adopted) handoff_kill(proc->pid, proc->pidfd, SIGKILL);
+    else kill(proc->pid, SIGKILL);
+    return 0;
+}
+
+/** Start the stall watchdog of a relayed FFmpeg; transcode_finish() stops it */
+static void watch_output(TranscodeProcess *proc) {
+    timer_arm(&proc->watchdog, output_watchdog, TRANSCODE_STALL_MS / 2);
+}
+
+ssize_t transcode_read(TranscodeProcess *proc, char *buf, size_t len) {
+    if (wait_output(proc) < 0) return -1;
+    return read(proc->out_fd, buf, len);
+}
+
+ssize_t transcode_ready(TranscodeProcess *proc) {
+    int avail = 0;
+    if (wait_output(proc) < 0 || ioctl(proc->out_fd, FIONREAD, &avail) < 0) return -1;
+    return avail;
+}
+
+int transcode_finish(TranscodeProcess *proc, struct rusage *usage) {
+    int status = 0;
+    // Before the pid can be reaped and reused
+    timer_cancel(&proc->watchdog);
+    if (proc->out_fd >= 0) {
+        close(proc->out_fd);
+        proc->out_fd = -1;
+    }
+    if (proc->err_fd >= 0) {
+        close(proc->err_fd);
+        proc->err_fd = -1;
+    }
+    if (proc->pid > 0 && proc->adopted) {
+        // Not our child: no wait status, and usage only while it is running
+        if (usage) handoff_usage(proc->pid, usage);
+        if (!handoff_exited(proc->pid, proc->pidfd, 0)) {
+            handoff_kill(proc->pid, proc->pidfd, SIGTERM);
+            handoff_exited(proc->pid, proc->pidfd, -1);
+        }
+        flight_record(FLIGHT_CHILD_EXIT, proc->pid, -1);
+        if (proc->pidfd >= 0) close(proc->pidfd);
+        proc->pidfd = -1;
+        proc->pid = -1;
+    } else if (proc->pid > 0) {
+        // Only signal FFmpeg if it hasn't already exited on its own
+        struct rusage ru;
+        pid_t r = wait4(proc->pid, &status, WNOHANG, &ru);
+        if (r == 0) {
+            kill(proc->pid, SIGTERM);
+            r = wait4(proc->pid, &status, 0, &ru);
+        }
+        flight_record(FLIGHT_CHILD_EXIT, proc->pid, r > 0 ? status : -1);
+        if (usage) {
+            if (r > 0) *usage = ru;
+            else memset(usage, 0, sizeof(*usage));
+        }
+        proc->pid = -1;
+    }
+    encode_sched_release(&proc->budget);
+    return status;
+}
+
+static int64_t elapsed_us(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)(now.tv_sec - since->tv_sec) * 1000000 + (now.tv_nsec - since->tv_nsec) / 1000;
+}
+
+static long long wall_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void add_usage(SessionRecord *rec, const struct rusage *ru) {
+    rec->cpu_s += ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6 +
+                  ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+    if (ru->ru_maxrss > rec->peak_rss_kb) rec->peak_rss_kb = ru->ru_maxrss;
+}
+
+/**
+ * Hand a relay paused between chunks to the new process (see handoff.h)
+ *
+ * @return 1 if it went: the socket and FFmpeg now belong to the new
+ *         process and only our descriptors and budget are left to drop
+ */
+static int hand_off(HttpResponse *res, TranscodeProcess *proc, const SessionRecord *rec) {
+    // An HTTP/2 stream shares its connection with others; it ends with the drain
+    if (res->h2) return 0;
+    // Deadlines move with the relay
+    timer_cancel(&proc->watchdog);
+    if (res->conn) http_conn_unwatch(res->conn);
+
+    HandoffRelay paused;
+    memset(&paused, 0, sizeof(paused));
+    paused.pid = proc->pid;
+    paused.budgeted = proc->budget.active;
+    paused.chunked = res->chunked;
+    paused.chunk_ok = res->chunk_ok;
+    paused.keep_alive = res->keep_alive;
+    paused.sent = res->sent;
+    paused.started_at = rec->started_at;
+    paused.kind = rec->kind;
+    paused.backend = rec->backend;
+    paused.codec = rec->codec;
+    snprintf(paused.channel, sizeof(paused.channel), "%s", rec->channel);
+    paused.cpu_s = rec->cpu_s;
+    paused.peak_rss_kb = rec->peak_rss_kb;
+    paused.media_s = proc->media_s;
+    paused.speed = proc->speed;
+    if (handoff_send_relay(&paused, res->sock, proc->out_fd, proc->err_fd) < 0) {
+        LOG_WARN("TRANSCODE", "Handoff of ffmpeg pid=%d failed, relaying it here", proc->pid);
+        watch_output(proc);
+        if (res->conn) http_conn_watch(res->conn);
+        return 0;
+    }
+
+    LOG_DEBUG("TRANSCODE", "Handed off ffmpeg pid=%d after %lld bytes", proc->pid, res->sent);
+    res->detached = 1;
+    close(proc->out_fd);
+    if (proc->err_fd >= 0) close(proc->err_fd);
+    if (proc->pidfd >= 0) close(proc->pidfd);
+    proc->out_fd = proc->err_fd = proc->pidfd = -1;
+    proc->pid = -1;
+    encode_sched_release(&proc->budget);
+    return 1;
+}
+
+/**
+ * Relay FFmpeg output to the client until either side ends, then reap
+ * FFmpeg and queue the session's telemetry record
+ *
+ * @param n Bytes of the first chunk, already read into buffer
+ */
+static void relay(HttpResponse *res, TranscodeProcess *proc, SessionRecord *rec,
+                  char *buffer, size_t size, ssize_t n) {
+    // After the first chunk, media can go pipe -> socket without passing
+    // through buffer when the I/O engine splices
+    int splice = http_can_splice(res);
+    int in_buffer = 1;
+    int handoff_tried = 0;
+    long long relayed = 0;
+    int client_gone = 0;
+    do {
+        struct timespec before;
+        clock_gettime(CLOCK_MONOTONIC, &before);
+        ThreadStateMark mark = thread_state_enter(THREAD_SOCKET_WRITE, "client");
+        int written = in_buffer ? http_write(res, buffer, n) : http_splice(res, proc->out_fd, n);
+        thread_state_leave(mark);
+        if (written < 0) {
+            // Client likely disconnected
+            client_gone = 1;
+            break;
+        }
+        int64_t blocked = elapsed_us(&before);
+        PROBE3(relay__write, res->sock, n, blocked);
+        if (blocked >= FLIGHT_STALL_MS * 1000) {
+            flight_record(FLIGHT_WRITE_STALL, res->sock, blocked);
+            PROBE2(relay__stall, res->sock, blocked);
+        }
+        relayed += n;
+        // Between chunks nothing is held in buffer, so the relay can move
+        if (handoff_pending() && !handoff_tried) {
+            handoff_tried = 1;
+            if (hand_off(res, proc, rec)) {
+                flight_record(FLIGHT_RELAY_END, -1, relayed);
+                return;
+            }
+        }
+        in_buffer = !splice;
+    } while ((n = splice ? transcode_ready(proc) : transcode_read(proc, buffer, size)) > 0);
+    flight_record(FLIGHT_RELAY_END, proc->pid, relayed);
+    qoe_session_relayed(relayed);
+
+    LOG_DEBUG("TRANSCODE", "Client disconnected, stopping ffmpeg pid=%d", proc->pid);
 
-    LOG_DEBUG("TRANSCODE", "Client disconnected, stopping ffmpeg pid=%d", pid);
-    
     // Cleanup
-    kill(pid, SIGTERM);
-    close(pipe_fd[0]);
-    int status;
-    waitpid(pid, &status, 0);
+    struct rusage ru;
+    pid_t pid = proc->pid;
+    int status = transcode_finish(proc, &ru);
+    PROBE3(session__exit, pid, relayed, status);
+
+    // Only an FFmpeg that ended on its own can have failed; SIGTERM is ours
+    add_usage(rec, &ru);
+    rec->duration_ms = wall_ms() - rec->started_at;
+    rec->bytes += relayed;
+    rec->speed = proc->speed;
+    if (rec->speed == 0 && proc->media_s > 0 && rec->duration_ms > 0) {
+        rec->speed = proc->media_s * 1000.0 / rec->duration_ms;
+    }
+    if (!client_gone && atomic_load(&proc->stalled)) {
+        snprintf(rec->failure, sizeof(rec->failure), "stalled");
+    } else if (!client_gone && n < 0) {
+        snprintf(rec->failure, sizeof(rec->failure), "read_error");
+    } else if (!client_gone && WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+        snprintf(rec->failure, sizeof(rec->failure), "ffmpeg_exit %d: %.100s", WEXITSTATUS(status), proc->last_error);
+    } else if (!client_gone && WIFSIGNALED(status) && WTERMSIG(status) != SIGTERM) {
+        snprintf(rec->failure, sizeof(rec->failure), "ffmpeg_signal %d", WTERMSIG(status));
+    }
+    telemetry_record(rec);
+
+    // A stream that broke off must not look complete to the client
+    if (rec->failure[0]) http_abort(res);
+}
+
+/**
+ * Run the backend fallback chain and relay FFmpeg output to the client,
+ * then queue the session's telemetry record
+ */
+static int relay_source(HttpResponse *res, const char *input_source, TranscodeConfig config,
+                        SessionKind kind, const char *channel) {
+    SessionRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.started_at = wall_ms();
+    rec.kind = kind;
+    rec.codec = config.codec;
+    snprintf(rec.channel, sizeof(rec.channel), "%s", channel);
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    TranscodeBackend chain[CAPS_NUM_BACKENDS];
+    int chain_len = caps_fallback_chain(config.backend, config.codec, chain, CAPS_NUM_BACKENDS);
+    if (chain[0] != config.backend) {
+        LOG_WARN("TRANSCODE", "Backend %s cannot encode %s on this host, using %s",
+                 transcode_backend_name(config.backend), transcode_codec_name(config.codec),
+                 transcode_backend_name(chain[0]));
+    }
+
+    // Start FFmpeg, moving down the chain until one produces output
+    TranscodeProcess proc;
+    char buffer[8192];
+    ssize_t n = 0;
+    for (int i = 0; i < chain_len; i++) {
+        config.backend = chain[i];
+        rec.backend = chain[i];
+        struct timespec spawned;
+        clock_gettime(CLOCK_MONOTONIC, &spawned);
+        if (transcode_spawn(input_source, config, &proc) < 0) {
+            // Nothing has been sent yet, whichever backend this was
+            send_error(res, "cannot start FFmpeg");
+            snprintf(rec.failure, sizeof(rec.failure), "spawn_failed");
+            rec.duration_ms = elapsed_us(&started) / 1000;
+            telemetry_record(&rec);
+            return -1;
+        }
+        watch_output(&proc);
+        n = transcode_read(&proc, buffer, sizeof(buffer));
+        if (n > 0) {
+            int64_t first_us = elapsed_us(&spawned);
+            flight_record(FLIGHT_FIRST_BYTE, proc.pid, first_us);
+            PROBE2(session__first_byte, proc.pid, first_us);
+            qoe_session_started(proc.pid, config.backend, config.codec, first_us);
+            break;
+        }
 
+        struct rusage ru;
+        transcode_finish(&proc, &ru);
+        add_usage(&rec, &ru);
+        LOG_WARN("TRANSCODE", "%s backend failed before first byte: %s",
+                 transcode_backend_name(chain[i]),
+                 proc.last_error[0] ? proc.last_error : "no output");
+    }
+
+    if (n <= 0) {
+        send_error(res, proc.last_error[0] ? proc.last_error : "FFmpeg produced no output");
+        snprintf(rec.failure, sizeof(rec.failure), "no_output: %.100s",
+                 proc.last_error[0] ? proc.last_error : "no output");
+        rec.duration_ms = elapsed_us(&started) / 1000;
+        telemetry_record(&rec);
+        return -1;
+    }
+
+    // Send HTTP Headers once FFmpeg is known to be producing media
+    // Determine content type
+    const char *ctype = (config.codec == TRANSCODE_CODEC_AV1) ? "video/webm" : "video/mp4";
+    http_begin(res, 200, "OK", ctype, NULL, -1);
+
+    relay(res, &proc, &rec, buffer, sizeof(buffer), n);
     return 0;
 }
 
-int transcode_stream(int client_socket, const char *core_url, const char *channel_id, TranscodeConfig config) {
+void transcode_resume(HttpResponse *res, const HandoffRelay *paused, int out_fd, int err_fd, int pidfd) {
+    TranscodeProcess proc;
+    memset(&proc, 0, sizeof(proc));
+    proc.pid = paused->pid;
+    proc.out_fd = out_fd;
+    proc.err_fd = err_fd;
+    proc.pidfd = pidfd;
+    proc.adopted = 1;
+    proc.backend = paused->backend;
+    proc.media_s = paused->media_s;
+    proc.speed = paused->speed;
+    // Take the cores back into this process's accounting and move FFmpeg onto them
+    if (paused->budgeted && encode_sched_acquire(&proc.budget)) {
+        encode_sched_apply(proc.pid, &proc.budget);
+    }
+
+    SessionRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.started_at = paused->started_at;
+    rec.kind = paused->kind;
+    rec.backend = paused->backend;
+    rec.codec = paused->codec;
+    snprintf(rec.channel, sizeof(rec.channel), "%s", paused->channel);
+    rec.cpu_s = paused->cpu_s;
+    rec.peak_rss_kb = paused->peak_rss_kb;
+    rec.bytes = paused->sent;
+    LOG_DEBUG("TRANSCODE", "Resuming ffmpeg pid=%d after %lld bytes", proc.pid, paused->sent);
+    watch_output(&proc);
+
+    char buffer[8192];
+    ssize_t n = transcode_read(&proc, buffer, sizeof(buffer));
+    if (n > 0) {
+        relay(res, &proc, &rec, buffer, sizeof(buffer), n);
+        return;
+    }
+    // FFmpeg ended right at the handoff
+    transcode_finish(&proc, NULL);
+    rec.duration_ms = wall_ms() - rec.started_at;
+    telemetry_record(&rec);
+}
+
+int transcode_source(HttpResponse *res, const char *input_source, TranscodeConfig config) {
+    return relay_source(res, input_source, config, SESSION_PLAYBACK, "recording");
+}
+
+int transcode_stream(HttpResponse *res, const char *core_url, const char *channel_id, TranscodeConfig config) {
     char input_url[512];
     snprintf(input_url, sizeof(input_url), "%s/stream/%s", core_url, channel_id);
-    return transcode_source(client_socket, input_url, config);
+    return relay_source(res, input_url, config, SESSION_LIVE, channel_id);
 }
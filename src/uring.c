@@ -0,0 +1,133 @@
+/**
+ * @file uring.c
+ * @brief Minimal io_uring ring over the raw syscalls
+ *
+ * Ring indices are shared with the kernel: our tails are published with
+ * release stores and its tails read with acquire loads, as liburing does.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+static int sys_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned submit, unsigned wait, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+static int sys_register(int fd, unsigned opcode, void *arg, unsigned nr) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr);
+}
+
+int ring_init(Ring *r, unsigned entries) {
+    memset(r, 0, sizeof(*r));
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    r->fd = sys_setup(entries, &p);
+    if (r->fd < 0) return -1;
+
+    r->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+        if (r->cq_map_size > r->sq_map_size) r->sq_map_size = r->cq_map_size;
+        r->cq_map_size = r->sq_map_size;
+    }
+    r->sq_map = mmap(NULL, r->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_map == MAP_FAILED) goto fail;
+    r->cq_map = single ? r->sq_map
+                       : mmap(NULL, r->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                              r->fd, IORING_OFF_CQ_RING);
+    if (r->cq_map == MAP_FAILED) goto fail;
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) goto fail;
+
+    char *sq = r->sq_map, *cq = r->cq_map;
+    r->sq_entries = p.sq_entries;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->sqe_tail = *r->sq_tail;
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+
+fail: {
+        int err = errno;
+        if (r->sq_map == MAP_FAILED) r->sq_map = NULL;
+        if (r->cq_map == MAP_FAILED) r->cq_map = NULL;
+        if (r->sqes == MAP_FAILED) r->sqes = NULL;
+        ring_free(r);
+        errno = err;
+        return -1;
+    }
+}
+
+void ring_free(Ring *r) {
+    if (r->sqes) munmap(r->sqes, r->sqes_size);
+    if (r->cq_map && r->cq_map != r->sq_map) munmap(r->cq_map, r->cq_map_size);
+    if (r->sq_map) munmap(r->sq_map, r->sq_map_size);
+    if (r->fd >= 0) close(r->fd);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+struct io_uring_sqe *ring_sqe(Ring *r) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->sqe_tail - head >= r->sq_entries) return NULL;
+    struct io_uring_sqe *sqe = &r->sqes[r->sqe_tail & *r->sq_mask];
+    r->sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int ring_submit(Ring *r, int wait) {
+    unsigned tail = *r->sq_tail;
+    for (; tail != r->sqe_tail; tail++) r->sq_array[tail & *r->sq_mask] = tail & *r->sq_mask;
+    __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+
+    for (;;) {
+        // Whatever the kernel has not consumed yet, after an interrupted enter too
+        unsigned submit = tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        if (wait && ring_cqe(r)) wait = 0;
+        if (!submit && !wait) return 0;
+        int rc = sys_enter(r->fd, submit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0);
+        if (rc >= 0 && (!wait || ring_cqe(r))) return 0;
+        if (rc < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) return -1;
+    }
+}
+
+struct io_uring_cqe *ring_cqe(Ring *r) {
+    unsigned head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) return NULL;
+    return &r->cqes[head & *r->cq_mask];
+}
+
+void ring_cqe_seen(Ring *r) {
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int ring_supports(Ring *r, int opcode) {
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    if (!probe) return 0;
+    int ok = sys_register(r->fd, IORING_REGISTER_PROBE, probe, 256) == 0 && opcode <= probe->last_op &&
+             (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    return ok;
+}
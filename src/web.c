@@ -9,8 +9,16 @@
  * - Transcoded streaming (/transcode/)
  * - Recording playback (/api/play/)
  *
- * Each incoming connection spawns a new pthread for handling.
- * The server supports basic HTTP/1.1 with Connection: close.
+ * Each incoming connection spawns a new pthread for handling. The thread
+ * serves requests on the connection until the client closes it or it
+ * goes idle (HTTP/1.1 keep-alive, see http.h); bodies of unknown length
+ * are sent chunked. A connection that opens with the HTTP/2 preface or
+ * upgrades to h2c is handed to h2.c, which runs each stream's request
+ * through the same handler on a thread of its own.
+ *
+ * During a handoff (see handoff.h) the acceptor stops and the listening
+ * socket, relays and their connections move to the new process, which
+ * carries each adopted relay on a thread of its own here.
  */
 
 #define _GNU_SOURCE
@@ -23,7 +31,12 @@
 #include <pthread.h>
 #include <ctype.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <time.h>
 
 #include "web.h"
 #include "config.h"
@@ -33,6 +46,22 @@
 #include "transcode.h"
 #include "scheduler.h"
 #include "channels.h"
+#include "capabilities.h"
+#include "flight.h"
+#include "profiler.h"
+#include "lockstat.h"
+#include "thread_state.h"
+#include "timer_wheel.h"
+#include "arena.h"
+#include "compress.h"
+#include "http.h"
+#include "h2.h"
+#include "handoff.h"
+#include "io_engine.h"
+#include "qoe.h"
+#include "guide.h"
+#include "telemetry.h"
+#include "probes.h"
 #include "log.h"
 
 // MIME type helper
@@ -50,25 +79,491 @@ static const char *get_mime_type(const char *path) {
     return "application/octet-stream";
 }
 
-// Send HTTP response headers
-static void send_headers(int client_socket, int status_code, const char *status_text, const char *content_type, long content_length) {
-    char buffer[1024];
-    int len = snprintf(buffer, sizeof(buffer),
-        "HTTP/1.1 %d %s\r\n"
-        "Content-Type: %s\r\n"
-        "Content-Length: %ld\r\n"
-        "Connection: close\r\n"
-        "\r\n",
-        status_code, status_text, content_type, content_length);
-    write(client_socket, buffer, len);
+/** Guide window /api/guide serves by default */
+#define GUIDE_WINDOW_MS (13 * 3600 * 1000LL)
+
+/** Guide windows are aligned to the dashboard's half-hour slots */
+#define GUIDE_SLOT_MS (30 * 60 * 1000LL)
+
+/** Last tile column /api/guide/tile serves (the year 2200) */
+#define GUIDE_MAX_TILE_COL (7258118400000LL / GUIDE_TILE_MS)
+
+/** Longest window /api/guide serves */
+#define GUIDE_MAX_WINDOW_MS (7 * 24 * 3600 * 1000LL)
+
+// Send headers for a body whose encoding was negotiated
+static void send_encoded_headers(HttpResponse *res, const char *content_type, ContentEncoding encoding,
+                                 const char *extra, long long content_length) {
+    char headers[256];
+    const char *name = compress_encoding_name(encoding);
+    snprintf(headers, sizeof(headers), "%s%s%sVary: Accept-Encoding\r\n%s",
+             name ? "Content-Encoding: " : "", name ? name : "", name ? "\r\n" : "", extra ? extra : "");
+    http_begin(res, 200, "OK", content_type, headers, content_length);
+}
+
+/**
+ * A response body compressed as it is written.
+ *
+ * Collected into the request arena (for the cache, res == NULL), or
+ * streamed: output is held until COMPRESS_MIN_BYTES of input have been
+ * written, then the headers go out and the rest is sent chunked as the
+ * compressor produces it. Either way the first COMPRESS_MIN_BYTES of
+ * input are kept so a small body can go out as identity instead.
+ */
+typedef struct {
+    Arena *arena;
+    HttpResponse *res;
+    const char *content_type;
+    Compressor *compressor;
+    ContentEncoding encoding;
+    int streaming;             /**< Headers sent, output goes straight to res */
+    int failed;                /**< Out of memory collecting: data is incomplete */
+    char *data;
+    size_t len;
+    size_t cap;
+    size_t raw_len;
+    char head[COMPRESS_MIN_BYTES];
+} EncodedBody;
+
+/**
+ * Writes a response body (JsonWriter-compatible)
+ *
+ * @return 0, or -1 if the body could not be produced (what was written is
+ *         not the body and must not be sent or cached)
+ */
+typedef int (*BodyProducer)(JsonWriter *writer, void *arg);
+
+static void body_collect(void *ctx, const char *data, size_t len) {
+    EncodedBody *b = ctx;
+    if (b->streaming) {
+        http_write(b->res, data, len);
+        return;
+    }
+    if (b->failed) return;
+    if (b->len + len > b->cap) {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (b->len + len > cap) cap *= 2;
+        char *data = arena_realloc(b->arena, b->data, b->cap, cap);
+        if (!data) {
+            b->failed = 1;
+            return;
+        }
+        b->data = data;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+static void body_write(void *ctx, const char *data, size_t len) {
+    EncodedBody *b = ctx;
+    if (b->raw_len < sizeof(b->head)) {
+        size_t n = len < sizeof(b->head) - b->raw_len ? len : sizeof(b->head) - b->raw_len;
+        memcpy(b->head + b->raw_len, data, n);
+    }
+    b->raw_len += len;
+    compressor_write(b->compressor, data, len);
+    if (b->res && !b->streaming && !b->failed && b->raw_len >= sizeof(b->head)) {
+        // Big enough to compress: send what is ready and stream the rest
+        send_encoded_headers(b->res, b->content_type, b->encoding, NULL, -1);
+        b->streaming = 1;
+        http_write(b->res, b->data, b->len);
+        b->len = 0;
+    }
+}
+
+/**
+ * Run a producer through the compressor. With res set the body is sent
+ * as it is produced; otherwise it is left in b->data.
+ *
+ * @return 0, or -1 if the producer, the compressor or the arena failed:
+ *         nothing more is sent, and nothing at all unless b->streaming
+ */
+static int encode_body(EncodedBody *b, Arena *arena, HttpResponse *res, const char *content_type,
+                        ContentEncoding encoding, int cacheable, BodyProducer produce, void *arg) {
+    b->arena = arena;
+    b->res = res;
+    b->content_type = content_type;
+    b->encoding = encoding;
+    b->streaming = 0;
+    b->failed = 0;
+    b->data = NULL;
+    b->len = b->cap = b->raw_len = 0;
+    b->compressor = compressor_new(arena, encoding, cacheable, body_collect, b);
+    if (!b->compressor) return -1;
+    JsonWriter writer = { body_write, b };
+    int rc = produce(&writer, arg);
+    if (compressor_finish(b->compressor) < 0 || b->failed) rc = -1;
+    if (b->streaming || rc < 0) return rc;
+    if (encoding != ENCODING_IDENTITY && b->raw_len < sizeof(b->head)) {
+        // Too small to be worth a Content-Encoding; send what was written
+        b->encoding = ENCODING_IDENTITY;
+        b->data = b->head;
+        b->len = b->raw_len;
+    }
+    if (res) {
+        send_encoded_headers(res, content_type, b->encoding, NULL, b->len);
+        http_write(res, b->data, b->len);
+    }
+    return 0;
+}
+
+/**
+ * Per-process value in every send_cached() ETag
+ *
+ * Cache keys are built from generation counters that start over in each
+ * process (after a restart or handoff), so the same key can name a
+ * different body than it did before; the nonce keeps those ETags apart.
+ */
+static unsigned int boot_nonce;
+
+/**
+ * Whether If-None-Match lists etag (or is "*")
+ */
+static int etag_matches(const char *request, const char *etag) {
+    const char *h = strcasestr(request, "\r\nIf-None-Match:");
+    if (!h) return 0;
+    h += 16;
+    const char *end = strstr(h, "\r\n");
+    if (!end) end = h + strlen(h);
+    size_t elen = strlen(etag);
+    for (const char *p = h; p < end; p++) {
+        if (*p == '*') return 1;
+        // Weak validators match too: If-None-Match uses weak comparison
+        if (*p == '"' && (size_t)(end - p) >= elen && memcmp(p, etag, elen) == 0) return 1;
+    }
+    return 0;
+}
+
+/**
+ * Serve a body that only changes with `key`: from the compressed cache,
+ * or produce and encode it once (brotli allowed) and store it
+ *
+ * The body for a key and negotiated encoding never changes, so that pair
+ * is its ETag and a client that revalidates gets a 304 without the body
+ * being produced, or even looked up. If the producer fails the client
+ * gets a 500 and nothing is cached.
+ *
+ * @param headers Extra header lines (NULL if none), e.g. "Vary: Accept"
+ *                when the key depends on another request header
+ * @param cache_control Cache-Control value, NULL for "no-cache" (always
+ *                revalidate)
+ */
+static void send_cached(HttpResponse *res, Arena *arena, const char *request, const char *key,
+                        const char *content_type, const char *headers, const char *cache_control,
+                        BodyProducer produce, void *arg) {
+    ContentEncoding accepted = compress_negotiate(request, 1);
+    ContentEncoding encoding;
+    char *data = NULL;
+    size_t len = 0;
+    EncodedBody body;
+
+    unsigned long long hash = 1469598103934665603ULL;
+    for (const char *k = key; *k; k++) hash = (hash ^ (unsigned char)*k) * 1099511628211ULL;
+    const char *accepted_name = compress_encoding_name(accepted);
+    char etag[56], validators[168];
+    snprintf(etag, sizeof(etag), "\"%08x-%016llx-%s\"", boot_nonce, hash,
+             accepted_name ? accepted_name : "identity");
+    snprintf(validators, sizeof(validators), "ETag: %s\r\nCache-Control: %s\r\n%s", etag,
+             cache_control ? cache_control : "no-cache", headers ? headers : "");
+    if (etag_matches(request, etag)) {
+        char not_modified[200];
+        snprintf(not_modified, sizeof(not_modified), "%sVary: Accept-Encoding\r\n", validators);
+        http_begin(res, 304, "Not Modified", content_type, not_modified, 0);
+        return;
+    }
+    if (!compress_cache_get(key, accepted, arena, &data, &len, &encoding)) {
+        if (encode_body(&body, arena, NULL, content_type, accepted, 1, produce, arg) < 0) {
+            const char *err = "{\"error\":\"Internal Server Error\"}";
+            http_send(res, 500, "Internal Server Error", "application/json", err, strlen(err));
+            return;
+        }
+        encoding = body.encoding;
+        data = body.data;
+        len = body.len;
+        compress_cache_put(key, accepted, encoding, data, len);
+    }
+    send_encoded_headers(res, content_type, encoding, validators, len);
+    http_write(res, data, len);
+}
+
+/**
+ * Serve an uncacheable body, gzip/deflate-compressed and sent chunked as
+ * it is produced, so memory stays constant however large it gets
+ */
+static void send_streamed(HttpResponse *res, Arena *arena, const char *request,
+                          const char *content_type, BodyProducer produce, void *arg) {
+    EncodedBody body;
+    if (encode_body(&body, arena, res, content_type, compress_negotiate(request, 0), 0, produce, arg) < 0 &&
+        !body.streaming) {
+        const char *err = "{\"error\":\"Internal Server Error\"}";
+        http_send(res, 500, "Internal Server Error", "application/json", err, strlen(err));
+    }
+}
+
+static int produce_string(JsonWriter *writer, void *arg) {
+    writer->write(writer->ctx, arg, strlen(arg));
+    return 0;
+}
+
+static int produce_fd(JsonWriter *writer, void *arg) {
+    char buffer[16384];
+    ssize_t n;
+    while ((n = read(*(int *)arg, buffer, sizeof(buffer))) > 0) {
+        writer->write(writer->ctx, buffer, n);
+    }
+    return 0;
+}
+
+static int produce_recordings(JsonWriter *writer, void *arg) {
+    (void)arg;
+    return db_write_recordings_json(writer);
+}
+
+static int produce_timers(JsonWriter *writer, void *arg) {
+    (void)arg;
+    return db_write_timers_json(writer);
+}
+
+static int produce_sessions(JsonWriter *writer, void *arg) {
+    return db_write_sessions_json(writer, *(int *)arg);
+}
+
+/**
+ * Active recording ids as a JSON array
+ */
+static char *active_ids_json(Arena *arena) {
+    int count = 0;
+    int *ids = get_active_recording_ids(arena, &count);
+    if (!ids && count > 0) return NULL;
+
+    // Build ID list string "[1,2]"
+    char ids_str[256] = "[";
+    for (int i=0; i<count; i++) {
+        char num[16];
+        snprintf(num, sizeof(num), "%d%s", ids[i], (i<count-1) ? "," : "");
+        strncat(ids_str, num, sizeof(ids_str)-strlen(ids_str)-1);
+    }
+    strncat(ids_str, "]", sizeof(ids_str)-strlen(ids_str)-1);
+    return arena_strdup(arena, ids_str);
+}
+
+/**
+ * The /api/status object
+ *
+ * @return NULL when out of memory (active_ids may be such a NULL)
+ */
+static char *status_json(Arena *arena, const char *active_ids) {
+    char *caps_json = arena_adopt(arena, caps_to_json());
+    if (!active_ids || !caps_json) return NULL;
+    return arena_sprintf(arena,
+        "{\"status\":\"ok\",\"version\":\"2.1-c\",\"backend\":\"%s\",\"codec\":\"%s\",\"active_recordings\":%d,\"active_ids\":%s,\"capabilities\":%s}",
+        app_config.backend, app_config.codec, get_active_recording_count(), active_ids, caps_json);
+}
+
+typedef struct {
+    GuideSnapshot *guide;
+    long long start;
+    long long end;
+} GuideArgs;
+
+static int produce_guide(JsonWriter *writer, void *arg) {
+    const GuideArgs *args = arg;
+    guide_write_json(writer, args->guide, args->start, args->end);
+    return 0;
+}
+
+static int produce_guide_cbor(JsonWriter *writer, void *arg) {
+    const GuideArgs *args = arg;
+    return guide_write_cbor(writer, args->guide, args->start, args->end);
+}
+
+/**
+ * Tile geometry and lineup: what a client needs to ask for tiles, and the
+ * change its tiles are current to, for following /api/guide/changes
+ */
+static int produce_guide_tiles(JsonWriter *writer, void *arg) {
+    const GuideSnapshot *guide = arg;
+    char head[192];
+    snprintf(head, sizeof(head),
+             "{\"epoch\":%lld,\"generation\":%lu,\"seq\":%lu,\"tile_channels\":%d,\"tile_ms\":%lld,\"channels\":",
+             guide ? guide->epoch : 0, guide ? guide->generation : 0, guide ? guide->seq : 0, GUIDE_TILE_CHANNELS,
+             GUIDE_TILE_MS);
+    produce_string(writer, head);
+    guide_write_channels_json(writer, guide);
+    produce_string(writer, "}");
+    return 0;
+}
+
+typedef struct {
+    GuideSnapshot *guide;
+    int row;
+    long long col;
+} GuideTileArgs;
+
+static int produce_guide_tile(JsonWriter *writer, void *arg) {
+    const GuideTileArgs *args = arg;
+    guide_write_tile_json(writer, args->guide, args->row, args->col);
+    return 0;
+}
+
+static int produce_guide_tile_cbor(JsonWriter *writer, void *arg) {
+    const GuideTileArgs *args = arg;
+    return guide_write_tile_cbor(writer, args->guide, args->row, args->col);
+}
+
+typedef struct {
+    GuideSnapshot *guide;
+    unsigned long since;
+} GuideChangesArgs;
+
+static int produce_guide_changes(JsonWriter *writer, void *arg) {
+    const GuideChangesArgs *args = arg;
+    guide_write_changes_json(writer, args->guide, args->since);
+    return 0;
+}
+
+/**
+ * Whether Accept lists application/cbor (with a nonzero q)
+ */
+static int accepts_cbor(const char *request) {
+    const char *h = strcasestr(request, "\r\nAccept:");
+    if (!h) return 0;
+    const char *end = strstr(h + 2, "\r\n");
+    const char *type = strcasestr(h, "application/cbor");
+    if (!type || (end && type > end)) return 0;
+    type += 16;
+    while (*type == ' ') type++;
+    if (strncmp(type, ";q=", 3) == 0 || strncmp(type, "; q=", 4) == 0) {
+        return strtod(strchr(type, '=') + 1, NULL) > 0;
+    }
+    return 1;
+}
+
+typedef struct {
+    Arena *arena;
+    const char *active_ids;
+    GuideSnapshot *guide;
+} BootstrapArgs;
+
+/**
+ * Channel lineup from channels.conf, in the guide's shape, for when the
+ * core has not provided a guide yet
+ */
+static int write_conf_channels(JsonWriter *writer, Arena *arena) {
+    int count = 0;
+    Channel *channels = channels_load(&count);
+    GuideSnapshot lineup;
+    memset(&lineup, 0, sizeof(lineup));
+    lineup.channels = arena_alloc(arena, (count ? count : 1) * sizeof(GuideChannel));
+    if (!lineup.channels) {
+        if (channels) channels_free(channels, count);
+        return -1;
+    }
+    for (int i = 0; channels && i < count; i++) {
+        GuideChannel ch = { channels[i].number, channels[i].name, "", 0, 0 };
+        lineup.channels[lineup.num_channels++] = ch;
+    }
+    guide_write_channels_json(writer, &lineup);
+    if (channels) channels_free(channels, count);
+    return 0;
+}
+
+/**
+ * Everything the dashboard shows on load, so it starts with one request;
+ * for the guide that is the tile geometry, the grid then asks for the
+ * tiles in view
+ */
+static int produce_bootstrap(JsonWriter *writer, void *arg) {
+    const BootstrapArgs *args = arg;
+    Arena *arena = args->arena;
+
+    char *status = status_json(arena, args->active_ids);
+    char *config = arena_sprintf(arena, ",\"config\":{\"backend\":\"%s\",\"codec\":\"%s\"},\"channels\":",
+                                 app_config.backend, app_config.codec);
+    char *sessions = arena_adopt(arena, qoe_active_json());
+    char *guide = arena_sprintf(arena,
+                                ",\"guide\":{\"epoch\":%lld,\"generation\":%lu,\"seq\":%lu,"
+                                "\"tile_channels\":%d,\"tile_ms\":%lld}}",
+                                args->guide ? args->guide->epoch : 0,
+                                args->guide ? args->guide->generation : 0,
+                                args->guide ? args->guide->seq : 0,
+                                GUIDE_TILE_CHANNELS, GUIDE_TILE_MS);
+    if (!status || !config || !sessions || !guide) return -1;
+
+    produce_string(writer, "{\"status\":");
+    produce_string(writer, status);
+    produce_string(writer, config);
+    if (args->guide && args->guide->num_channels > 0) guide_write_channels_json(writer, args->guide);
+    else if (write_conf_channels(writer, arena) < 0) return -1;
+    produce_string(writer, ",\"sessions\":");
+    produce_string(writer, sessions);
+    produce_string(writer, ",\"timers\":");
+    if (db_write_timers_json(writer) < 0) return -1;
+    produce_string(writer, guide);
+    return 0;
+}
+
+/**
+ * Align a guide window to half-hour slots; the default starts one slot
+ * before the current one, as the dashboard's grid does
+ */
+static void guide_window(GuideArgs *window, const char *query) {
+    long long now = (long long)time(NULL) * 1000;
+    window->start = now / GUIDE_SLOT_MS * GUIDE_SLOT_MS - GUIDE_SLOT_MS;
+    window->end = -1;
+    if (query) {
+        const char *p;
+        if ((p = strstr(query, "start=")) && isdigit((unsigned char)p[6])) window->start = atoll(p + 6);
+        if ((p = strstr(query, "end=")) && isdigit((unsigned char)p[4])) window->end = atoll(p + 4);
+    }
+    window->start = window->start / GUIDE_SLOT_MS * GUIDE_SLOT_MS;
+    if (window->end <= window->start) window->end = window->start + GUIDE_WINDOW_MS;
+    if (window->end - window->start > GUIDE_MAX_WINDOW_MS) window->end = window->start + GUIDE_MAX_WINDOW_MS;
+    window->end = (window->end + GUIDE_SLOT_MS - 1) / GUIDE_SLOT_MS * GUIDE_SLOT_MS;
+}
+
+typedef struct {
+    const char *host;
+    const char *transcode_path;
+} PlaylistArgs;
+
+static int produce_playlist(JsonWriter *writer, void *arg) {
+    const PlaylistArgs *args = arg;
+    int chan_count = 0;
+    Channel *channels = channels_load(&chan_count);
+
+    if (!channels || chan_count == 0) {
+        produce_string(writer, "# No channels found in channels.conf\n");
+        if (channels) channels_free(channels, chan_count);
+        return 0;
+    }
+
+    produce_string(writer, "#EXTM3U\n");
+    for (int i = 0; i < chan_count; i++) {
+        char line[1024];
+        int len = snprintf(line, sizeof(line),
+            "#EXTINF:-1 tvg-id=\"%s\" tvg-name=\"%s\",%s\n"
+            "http://%s/transcode%s/%s\n",
+            channels[i].number, channels[i].name, channels[i].name,
+            args->host, args->transcode_path, channels[i].number);
+        if (len >= (int)sizeof(line)) len = sizeof(line) - 1;
+        writer->write(writer->ctx, line, len);
+    }
+    channels_free(channels, chan_count);
+    return 0;
+}
+
+static int is_compressible(const char *mime) {
+    return strncmp(mime, "text/", 5) == 0 || strcmp(mime, "application/javascript") == 0 ||
+           strcmp(mime, "application/json") == 0 || strcmp(mime, "image/svg+xml") == 0;
 }
 
 // Serve static file
-static void serve_file(int client_socket, const char *path) {
+static void serve_file(HttpResponse *res, const char *path, const char *request, Arena *arena) {
     // Basic security: prevent directory traversal
     if (strstr(path, "..")) {
-        send_headers(client_socket, 403, "Forbidden", "text/plain", 9);
-        write(client_socket, "Forbidden", 9);
+        http_send(res, 403, "Forbidden", "text/plain", "Forbidden", 9);
         return;
     }
 
@@ -96,33 +591,29 @@ static void serve_file(int client_socket, const char *path) {
 
     if (fd < 0) {
         const char *msg = "404 Not Found";
-        send_headers(client_socket, 404, "Not Found", "text/plain", strlen(msg));
-        write(client_socket, msg, strlen(msg));
+        http_send(res, 404, "Not Found", "text/plain", msg, strlen(msg));
         return;
     }
 
     fstat(fd, &st);
-    send_headers(client_socket, 200, "OK", get_mime_type(full_path), st.st_size);
-
-    char buffer[4096];
-    ssize_t bytes_read;
-    while ((bytes_read = read(fd, buffer, sizeof(buffer))) > 0) {
-        write(client_socket, buffer, bytes_read);
+    const char *mime = get_mime_type(full_path);
+    if (is_compressible(mime) && st.st_size >= COMPRESS_MIN_BYTES) {
+        // Keyed by mtime and size so an edited file is re-encoded
+        char key[640];
+        snprintf(key, sizeof(key), "file:%s:%ld.%09ld:%ld", full_path, (long)st.st_mtim.tv_sec,
+                 st.st_mtim.tv_nsec, (long)st.st_size);
+        send_cached(res, arena, request, key, mime, NULL, NULL, produce_fd, &fd);
+        close(fd);
+        return;
     }
+    if (http_begin(res, 200, "OK", mime, NULL, st.st_size) == 0) http_send_file(res, fd, st.st_size);
     close(fd);
 }
 
-static void *client_handler(void *arg) {
-    int client_socket = *(int *)arg;
-    free(arg);
-
-    char buffer[4096];
-    ssize_t bytes_read = read(client_socket, buffer, sizeof(buffer) - 1);
-    if (bytes_read <= 0) {
-        close(client_socket);
-        return NULL;
-    }
-    buffer[bytes_read] = '\0';
+// Handle one request read into conn->buf; the caller owns the connection
+static void handle_client(HttpConn *conn, HttpResponse *res, FlightRoute *route, Arena *arena) {
+    int client_socket = conn->sock;
+    char *buffer = conn->buf;
 
     // Simple parser
     char method[16], path[1024];
@@ -131,30 +622,107 @@ static void *client_handler(void *arg) {
     sscanf(buffer, "%15s %1023s", method, path);
 
     LOG_DEBUG("HTTP", "%s %s", method, path);
+    thread_state_label(path);
+
+    if (strncmp(path, "/api/play/", 10) == 0) *route = FLIGHT_ROUTE_PLAY;
+    else if (strncmp(path, "/api/", 5) == 0) *route = FLIGHT_ROUTE_API;
+    else if (strncmp(path, "/stream/", 8) == 0) *route = FLIGHT_ROUTE_STREAM;
+    else if (strncmp(path, "/transcode/", 11) == 0) *route = FLIGHT_ROUTE_TRANSCODE;
+    else if (strncmp(path, "/playlist.m3u", 13) == 0) *route = FLIGHT_ROUTE_PLAYLIST;
+    else if (strncmp(path, "/debug/", 7) == 0) *route = FLIGHT_ROUTE_DEBUG;
+    flight_record(FLIGHT_ROUTE, *route, client_socket);
+    PROBE4(request__start, client_socket, (int)*route, method, path);
+
+    // Players tag media URLs with ?sid= to join their QoE beacons to the server session
+    char sid[QOE_SID_LEN] = "";
+    if (*route == FLIGHT_ROUTE_STREAM || *route == FLIGHT_ROUTE_TRANSCODE || *route == FLIGHT_ROUTE_PLAY) {
+        qoe_take_sid(path, sid, sizeof(sid));
+    }
 
     if (strncmp(path, "/api/", 5) == 0) {
-        char *json = NULL;
+        const char *json = NULL;
         int status = 200;
 
         if (strcmp(path, "/api/status") == 0) {
-            char status_json[1024];
-            int count = 0;
-            int *ids = get_active_recording_ids(&count);
-            
-            // Build ID list string "[1,2]"
-            char ids_str[256] = "[";
-            for (int i=0; i<count; i++) {
-                char num[16];
-                snprintf(num, sizeof(num), "%d%s", ids[i], (i<count-1) ? "," : "");
-                strncat(ids_str, num, sizeof(ids_str)-strlen(ids_str)-1);
+            json = status_json(arena, active_ids_json(arena));
+        } else if (strcmp(path, "/api/bootstrap") == 0) {
+            // Status, config, lineup, open sessions, timers and the guide's tile geometry in one body
+            BootstrapArgs args = { arena, active_ids_json(arena), guide_acquire() };
+            struct stat st;
+            long long conf_mtime = stat(CHANNELS_CONF, &st) == 0 ? (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec : 0;
+            char *key = arena_sprintf(arena, "bootstrap:%lu:%lu:%lu:%lld:%s:%s:%s", db_generation(),
+                                      args.guide ? args.guide->generation : 0, qoe_generation(),
+                                      conf_mtime, app_config.backend, app_config.codec, args.active_ids);
+            if (!key || !args.active_ids) {
+                // Out of memory: the 500 below
+                guide_release(args.guide);
+            } else {
+                send_cached(res, arena, buffer, key, "application/json", NULL, NULL, produce_bootstrap, &args);
+                guide_release(args.guide);
+                return;
             }
-            strncat(ids_str, "]", sizeof(ids_str)-strlen(ids_str)-1);
-            if (ids) free(ids);
-
-            snprintf(status_json, sizeof(status_json), 
-                "{\"status\":\"ok\",\"version\":\"2.1-c\",\"backend\":\"%s\",\"codec\":\"%s\",\"active_recordings\":%d,\"active_ids\":%s}",
-                app_config.backend, app_config.codec, get_active_recording_count(), ids_str);
-            json = strdup(status_json);
+        } else if (strncmp(path, "/api/guide", 10) == 0 && (path[10] == '\0' || path[10] == '?')) {
+            // Same-origin guide for a window: /api/guide?start=ms&end=ms, CBOR if the client accepts it
+            GuideArgs args = { guide_acquire(), 0, 0 };
+            guide_window(&args, strchr(path, '?'));
+            int cbor = accepts_cbor(buffer);
+            char key[96];
+            snprintf(key, sizeof(key), "guide:%s:%lu:%lld:%lld", cbor ? "cbor" : "json",
+                     args.guide ? args.guide->generation : 0, args.start, args.end);
+            send_cached(res, arena, buffer, key, cbor ? "application/cbor" : "application/json", "Vary: Accept\r\n",
+                        NULL, cbor ? produce_guide_cbor : produce_guide, &args);
+            guide_release(args.guide);
+            return;
+        } else if (strcmp(path, "/api/guide/tiles") == 0) {
+            GuideSnapshot *guide = guide_acquire();
+            char key[48];
+            snprintf(key, sizeof(key), "guide-tiles:%lu", guide ? guide->generation : 0);
+            send_cached(res, arena, buffer, key, "application/json", NULL, NULL, produce_guide_tiles, guide);
+            guide_release(guide);
+            return;
+        } else if (strncmp(path, "/api/guide/tile?", 16) == 0) {
+            // One tile, fixed for its generation: /api/guide/tile?epoch=E&gen=G&row=R&col=C, CBOR if accepted.
+            // Generations restart with the process, so the epoch keeps an immutable URL from naming two tiles
+            GuideTileArgs args = { guide_acquire(), -1, -1 };
+            const char *p;
+            long long epoch = (p = strstr(path, "epoch=")) ? atoll(p + 6) : 0;
+            unsigned long gen = (p = strstr(path, "gen=")) ? strtoul(p + 4, NULL, 10) : 0;
+            if ((p = strstr(path, "row=")) && isdigit((unsigned char)p[4])) args.row = atoi(p + 4);
+            if ((p = strstr(path, "col=")) && isdigit((unsigned char)p[4])) args.col = atoll(p + 4);
+            if (!args.guide || epoch != args.guide->epoch || gen != args.guide->generation) {
+                // Only the current guide is kept: the client must start over from /api/guide/tiles
+                json = "{\"error\":\"Guide generation changed\"}";
+                status = 409;
+            } else if (args.row < 0 || args.col < 0 || args.col > GUIDE_MAX_TILE_COL) {
+                json = "{\"error\":\"Invalid tile\"}";
+                status = 400;
+            } else {
+                int cbor = accepts_cbor(buffer);
+                char key[128];
+                snprintf(key, sizeof(key), "guide-tile:%s:%lld:%lu:%d:%lld", cbor ? "cbor" : "json", epoch, gen,
+                         args.row, args.col);
+                send_cached(res, arena, buffer, key, cbor ? "application/cbor" : "application/json", "Vary: Accept\r\n",
+                            "public, max-age=31536000, immutable", cbor ? produce_guide_tile_cbor : produce_guide_tile,
+                            &args);
+                guide_release(args.guide);
+                return;
+            }
+            guide_release(args.guide);
+        } else if (strncmp(path, "/api/guide/changes", 18) == 0 && (path[18] == '\0' || path[18] == '?')) {
+            // Changes after the client's copy: /api/guide/changes?since=seq&epoch=ms
+            GuideChangesArgs args = { guide_acquire(), 0 };
+            const char *query = strchr(path, '?'), *p;
+            long long epoch = 0;
+            if (query && (p = strstr(query, "since=")) && isdigit((unsigned char)p[6])) args.since = strtoul(p + 6, NULL, 10);
+            if (query && (p = strstr(query, "epoch=")) && isdigit((unsigned char)p[6])) epoch = atoll(p + 6);
+            // A sequence from another process means nothing here
+            if (!args.guide || epoch != args.guide->epoch) args.since = 0;
+            char key[96];
+            snprintf(key, sizeof(key), "guide-changes:%lld:%lu:%lu", args.guide ? args.guide->epoch : 0,
+                     args.guide ? args.guide->seq : 0, args.since);
+            send_cached(res, arena, buffer, key, "application/json", NULL, NULL, produce_guide_changes, &args);
+            guide_release(args.guide);
+            return;
         } else if (strcmp(path, "/api/config") == 0) {
             if (strcmp(method, "POST") == 0) {
                 char *body = strstr(buffer, "\r\n\r\n");
@@ -181,17 +749,17 @@ static void *client_handler(void *arg) {
                         }
                     }
                     config_save();
-                    json = strdup("{\"success\":true}");
+                    json = "{\"success\":true}";
                 }
             } else {
-                char conf_json[512];
-                snprintf(conf_json, sizeof(conf_json), 
-                    "{\"backend\":\"%s\",\"codec\":\"%s\"}",
-                    app_config.backend, app_config.codec);
-                json = strdup(conf_json);
+                json = arena_sprintf(arena, "{\"backend\":\"%s\",\"codec\":\"%s\"}",
+                                     app_config.backend, app_config.codec);
             }
         } else if (strcmp(path, "/api/recordings") == 0) {
-            json = db_get_recordings_json();
+            char key[64];
+            snprintf(key, sizeof(key), "recordings:%lu", db_generation());
+            send_cached(res, arena, buffer, key, "application/json", NULL, NULL, produce_recordings, NULL);
+            return;
         } else if (strncmp(path, "/api/recordings/", 16) == 0) {
             // Check for /stop suffix
             char *stop_suffix = strstr(path + 16, "/stop");
@@ -201,20 +769,17 @@ static void *client_handler(void *arg) {
                  int id = atoi(path + 16);
                  *stop_suffix = '/'; // Restore if needed (not really)
                  
-                 if (stop_recording(id)) json = strdup("{\"success\":true}");
+                 if (stop_recording(id)) json = "{\"success\":true}";
                  else {
                      status = 404;
-                     json = strdup("{\"error\":\"Recording not found or not active\"}");
+                     json = "{\"error\":\"Recording not found or not active\"}";
                  }
             }
             else if (strcmp(method, "DELETE") == 0) {
                 int id = atoi(path + 16);
-                char *fpath = db_get_recording_path(id);
-                if (fpath) {
-                    unlink(fpath);
-                    free(fpath);
-                }
-                if (db_delete_recording(id)) json = strdup("{\"success\":true}");
+                char *fpath = db_get_recording_path(arena, id);
+                if (fpath) unlink(fpath);
+                if (db_delete_recording(id)) json = "{\"success\":true}";
                 else status = 500;
             }
             // Removed stub
@@ -233,16 +798,19 @@ static void *client_handler(void *arg) {
                     if ((p = strstr(body, "\"start_time\":"))) start = atoll(p + 13);
                     if ((p = strstr(body, "\"end_time\":"))) end = atoll(p + 11);
                     
-                    if (db_add_timer(type, title, channel, start, end)) json = strdup("{\"success\":true}");
+                    if (db_add_timer(type, title, channel, start, end)) json = "{\"success\":true}";
                     else status = 500;
                 }
             } else {
-                json = db_get_timers_json();
+                char key[64];
+                snprintf(key, sizeof(key), "timers:%lu", db_generation());
+                send_cached(res, arena, buffer, key, "application/json", NULL, NULL, produce_timers, NULL);
+                return;
             }
         } else if (strncmp(path, "/api/timers/", 12) == 0) {
             if (strcmp(method, "DELETE") == 0) {
                 int id = atoi(path + 12);
-                if (db_delete_timer(id)) json = strdup("{\"success\":true}");
+                if (db_delete_timer(id)) json = "{\"success\":true}";
                 else status = 500;
             }
         } else if (strncmp(path, "/api/play/", 10) == 0) {
@@ -255,9 +823,12 @@ static void *client_handler(void *arg) {
             tc.codec = TRANSCODE_CODEC_H264;         // Default
             tc.bitrate_kbps = 0;
             tc.surround51 = 0;
+            tc.unpaced = 0;
+            tc.preset = NULL;
+            tc.height = 0;
 
-            char *p = strdup(path + 10);
-            char *token = strtok(p, "/");
+            char *p = arena_strdup(arena, path + 10);
+            char *token = p ? strtok(p, "/") : NULL;
             
             // First token is ID
             if (token && isdigit(token[0])) {
@@ -288,45 +859,79 @@ static void *client_handler(void *arg) {
 
                 token = strtok(NULL, "/");
             }
-            free(p);
             
-            if (id > 0) {
-                char *fpath = db_get_recording_path(id);
+            if (!p) {
+                // Out of memory: the 500 below
+            } else if (id > 0) {
+                char *fpath = db_get_recording_path(arena, id);
                 if (fpath) {
                     printf("[PLAY] Playing Rec %d: %s (Backend=%d Codec=%d)\n", id, fpath, tc.backend, tc.codec);
                     
-                    if (transcode_source(client_socket, fpath, tc) < 0) {
+                    qoe_session_begin(sid, "recording");
+                    if (transcode_source(res, fpath, tc) < 0) {
                         printf("[PLAY] Transcode startup failed\n");
                     }
-                    free(fpath);
-                    
-                    // Route handled, socket closed by transcode logic or below
-                    close(client_socket);
-                    return NULL;
+                    qoe_session_finish();
+                    return;
                 } else {
-                    json = strdup("{\"error\":\"Recording not found\"}");
+                    json = "{\"error\":\"Recording not found\"}";
                     status = 404;
                 }
             } else {
-                json = strdup("{\"error\":\"Invalid ID\"}");
+                json = "{\"error\":\"Invalid ID\"}";
                 status = 400;
             }
 
+        } else if (strcmp(path, "/api/qoe") == 0) {
+            // Player QoE beacons (navigator.sendBeacon) in, aggregates out
+            if (strcmp(method, "POST") == 0) {
+                char *body = http_request_body(conn);
+                if (body && qoe_ingest(body) == 0) {
+                    http_send(res, 204, "No Content", "application/json", "", 0);
+                    return;
+                }
+                json = "{\"error\":\"Malformed beacon\"}";
+                status = 400;
+            } else {
+                json = arena_adopt(arena, qoe_json());
+            }
+        } else if (strncmp(path, "/api/telemetry/costs", 20) == 0 && (path[20] == '\0' || path[20] == '?')) {
+            // p50/p95 cost per profile: /api/telemetry/costs?days=N&kind=live|playback|recording
+            int days = TELEMETRY_COST_DAYS, kind = -1;
+            char *query = strchr(path, '?');
+            if (query) {
+                char *save = NULL;
+                for (char *param = strtok_r(query + 1, "&", &save); param; param = strtok_r(NULL, "&", &save)) {
+                    if (strncmp(param, "days=", 5) == 0) days = atoi(param + 5);
+                    else if (strncmp(param, "kind=", 5) == 0) kind = session_kind_parse(param + 5);
+                }
+            }
+            if (days < 1) days = 1;
+            if (days > 365) days = 365;
+            json = arena_adopt(arena, telemetry_costs_json(days, kind));
+        } else if (strncmp(path, "/api/telemetry/sessions", 23) == 0 && (path[23] == '\0' || path[23] == '?')) {
+            // Most recent completed sessions: /api/telemetry/sessions?limit=N
+            int limit = 100;
+            char *q = strstr(path, "limit=");
+            if (q) limit = atoi(q + 6);
+            if (limit < 1) limit = 1;
+            if (limit > 1000) limit = 1000;
+            send_streamed(res, arena, buffer, "application/json", produce_sessions, &limit);
+            return;
         } else if (strcmp(path, "/api/version") == 0) {
-            json = strdup("{\"version\":\"2.1.0-c\"}");
+            json = "{\"version\":\"2.1.0-c\"}";
         } else {
-            json = strdup("{\"error\":\"Not Implemented\"}");
+            json = "{\"error\":\"Not Implemented\"}";
             status = 501;
         }
         
-        if (json) {
-            send_headers(client_socket, status, "OK", "application/json", strlen(json));
-            write(client_socket, json, strlen(json));
-            free(json);
+        if (json && status == 200 && strlen(json) >= COMPRESS_MIN_BYTES) {
+            send_streamed(res, arena, buffer, "application/json", produce_string, (void *)json);
+        } else if (json) {
+            http_send(res, status, "OK", "application/json", json, strlen(json));
         } else {
             const char *err = "{\"error\":\"Internal Server Error\"}";
-            send_headers(client_socket, 500, "Internal Server Error", "application/json", strlen(err));
-            write(client_socket, err, strlen(err));
+            http_send(res, 500, "Internal Server Error", "application/json", err, strlen(err));
         }
     } else if (strncmp(path, "/stream/", 8) == 0) {
         // Streaming Proxy / Transcode
@@ -335,13 +940,15 @@ static void *client_handler(void *arg) {
         
         if (!core) {
             const char *err = "{\"error\":\"ZapLinkCore not discovered yet\"}";
-            send_headers(client_socket, 503, "Service Unavailable", "application/json", strlen(err));
-            write(client_socket, err, strlen(err));
+            http_send(res, 503, "Service Unavailable", "application/json", err, strlen(err));
         } else {
             // Map configuration
             TranscodeConfig tc;
             tc.bitrate_kbps = 0; // Default
             tc.surround51 = 0;   // Default
+            tc.unpaced = 0;      // Default
+            tc.preset = NULL;    // Default
+            tc.height = 0;       // Default
 
             if (strcmp(app_config.backend, "qsv") == 0) tc.backend = TRANSCODE_BACKEND_QSV;
             else if (strcmp(app_config.backend, "nvenc") == 0) tc.backend = TRANSCODE_BACKEND_NVENC;
@@ -355,13 +962,14 @@ static void *client_handler(void *arg) {
 
             printf("[WEB] Starting Transcode from %s (Backend=%s, Codec=%s)\n", core, app_config.backend, app_config.codec);
             
-            if (transcode_stream(client_socket, core, chan, tc) < 0) {
+            qoe_session_begin(sid, chan);
+            if (transcode_stream(res, core, chan, tc) < 0) {
                 // If transcode failed immediately
                 printf("[WEB] Transcode startup failed\n");
             }
+            qoe_session_finish();
         }
-        close(client_socket);
-        return NULL;
+        return;
     } else if (strncmp(path, "/transcode/", 11) == 0) {
         // Flexible Transcoding Endpoint
         // /transcode/[backend]/[codec]/[options]/[channel]
@@ -371,11 +979,14 @@ static void *client_handler(void *arg) {
         tc.codec = TRANSCODE_CODEC_H264;         // Default
         tc.bitrate_kbps = 0;                     // Default
         tc.surround51 = 0;                       // Default
+        tc.unpaced = 0;                          // Default
+        tc.preset = NULL;                        // Default
+        tc.height = 0;                           // Default
         char channel_id[64] = {0};
 
         // Make a copy of path segments after /transcode/
-        char *p = strdup(path + 11);
-        char *token = strtok(p, "/");
+        char *p = arena_strdup(arena, path + 11);
+        char *token = p ? strtok(p, "/") : NULL;
         while (token) {
             // Backend
             if (strcmp(token, "software") == 0) tc.backend = TRANSCODE_BACKEND_SOFTWARE;
@@ -404,27 +1015,28 @@ static void *client_handler(void *arg) {
 
             token = strtok(NULL, "/");
         }
-        free(p);
 
         const char *core = get_core_base_url();
-        if (!core) {
+        if (!p) {
+            const char *err = "{\"error\":\"Internal Server Error\"}";
+            http_send(res, 500, "Internal Server Error", "application/json", err, strlen(err));
+        } else if (!core) {
             const char *err = "{\"error\":\"ZapLinkCore not discovered yet\"}";
-            send_headers(client_socket, 503, "Service Unavailable", "application/json", strlen(err));
-            write(client_socket, err, strlen(err));
+            http_send(res, 503, "Service Unavailable", "application/json", err, strlen(err));
         } else if (strlen(channel_id) == 0) {
             const char *err = "{\"error\":\"No channel specified\"}";
-            send_headers(client_socket, 400, "Bad Request", "application/json", strlen(err));
-            write(client_socket, err, strlen(err));
+            http_send(res, 400, "Bad Request", "application/json", err, strlen(err));
         } else {
             printf("[TRANSCODE] Req: Chan=%s Backend=%d Codec=%d Bitrate=%d 5.1=%d\n", 
                    channel_id, tc.backend, tc.codec, tc.bitrate_kbps, tc.surround51);
                    
-            if (transcode_stream(client_socket, core, channel_id, tc) < 0) {
+            qoe_session_begin(sid, channel_id);
+            if (transcode_stream(res, core, channel_id, tc) < 0) {
                 printf("[TRANSCODE] Startup failed\n");
             }
+            qoe_session_finish();
         }
-        close(client_socket);
-        return NULL;
+        return;
 
     } else if (strncmp(path, "/playlist.m3u", 13) == 0) {
         /* ================================================================
@@ -475,19 +1087,6 @@ static void *client_handler(void *arg) {
             strcat(transcode_path, "/ac6");
         }
         
-        /* Load channels */
-        int chan_count = 0;
-        Channel *channels = channels_load(&chan_count);
-        
-        if (!channels || chan_count == 0) {
-            const char *err = "# No channels found in channels.conf\n";
-            send_headers(client_socket, 200, "OK", "audio/x-mpegurl", strlen(err));
-            write(client_socket, err, strlen(err));
-            if (channels) channels_free(channels, chan_count);
-            close(client_socket);
-            return NULL;
-        }
-        
         /* Get Host header for absolute URLs */
         char *host_header = strstr(buffer, "Host:");
         char host[256] = "localhost:3000";  /* Default */
@@ -504,83 +1103,274 @@ static void *client_handler(void *arg) {
             }
         }
         
-        /* Build M3U playlist */
-        size_t buf_cap = 4096;
-        size_t buf_len = 0;
-        char *m3u = malloc(buf_cap);
-        
-        /* Header */
-        buf_len += snprintf(m3u + buf_len, buf_cap - buf_len, "#EXTM3U\n");
-        
-        /* Each channel */
-        for (int i = 0; i < chan_count; i++) {
-            /* Ensure buffer capacity */
-            while (buf_len + 512 > buf_cap) {
-                buf_cap *= 2;
-                m3u = realloc(m3u, buf_cap);
+        /* The playlist only changes with channels.conf, the host and the options */
+        struct stat st;
+        long long conf_mtime = stat(CHANNELS_CONF, &st) == 0 ? (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec : 0;
+        char key[512];
+        snprintf(key, sizeof(key), "playlist:%s:%s:%lld", host, transcode_path, conf_mtime);
+        PlaylistArgs args = { host, transcode_path };
+        send_cached(res, arena, buffer, key, "audio/x-mpegurl", NULL, NULL, produce_playlist, &args);
+        return;
+
+    } else if (strcmp(path, "/debug/flight") == 0) {
+        // Raw flight recorder dump, decode with tools/flight_decode
+        char disposition[128];
+        snprintf(disposition, sizeof(disposition), "Content-Disposition: attachment; filename=\"%s\"\r\n",
+                 FLIGHT_DUMP_FILE);
+        // Dumped to memory first so it can be framed like any other body
+        int fd = memfd_create("flight", MFD_CLOEXEC);
+        off_t size = -1;
+        if (fd >= 0 && flight_write(fd, FLIGHT_REASON_HTTP) == 0) size = lseek(fd, 0, SEEK_CUR);
+        if (size >= 0 && lseek(fd, 0, SEEK_SET) == 0) {
+            if (http_begin(res, 200, "OK", "application/octet-stream", disposition, size) == 0) {
+                http_send_file(res, fd, size);
+            }
+        } else {
+            const char *err = "{\"error\": \"Cannot write flight dump\"}";
+            http_send(res, 500, "Internal Server Error", "application/json", err, strlen(err));
+        }
+        if (fd >= 0) close(fd);
+    } else if (strcmp(path, "/debug/threads") == 0) {
+        // Per-thread blocking state, lock wait/hold stats and the timer wheel
+        char *threads = arena_adopt(arena, thread_state_json());
+        char *locks = arena_adopt(arena, lockstat_json());
+        char *timers = arena_adopt(arena, timer_wheel_json());
+        char *json = threads && locks && timers
+                         ? arena_sprintf(arena, "{\"threads\":%s,\"locks\":%s,\"timers\":%s}", threads, locks, timers)
+                         : NULL;
+        if (json) {
+            http_send(res, 200, "OK", "application/json", json, strlen(json));
+        } else {
+            const char *err = "{\"error\":\"Internal Server Error\"}";
+            http_send(res, 500, "Internal Server Error", "application/json", err, strlen(err));
+        }
+    } else if (strncmp(path, "/debug/profile", 14) == 0 && (path[14] == '\0' || path[14] == '?')) {
+        // Folded CPU stacks for flamegraph.pl: /debug/profile?seconds=N&hz=N
+        int seconds = PROFILE_DEFAULT_SECONDS, hz = PROFILE_DEFAULT_HZ;
+        char *query = strchr(path, '?');
+        if (query) {
+            char *param = strtok(query + 1, "&");
+            while (param) {
+                if (strncmp(param, "seconds=", 8) == 0) seconds = atoi(param + 8);
+                else if (strncmp(param, "hz=", 3) == 0) hz = atoi(param + 3);
+                param = strtok(NULL, "&");
             }
-            
-            buf_len += snprintf(m3u + buf_len, buf_cap - buf_len,
-                "#EXTINF:-1 tvg-id=\"%s\" tvg-name=\"%s\",%s\n"
-                "http://%s/transcode%s/%s\n",
-                channels[i].number, channels[i].name, channels[i].name,
-                host, transcode_path, channels[i].number);
         }
-        
-        channels_free(channels, chan_count);
-        
-        /* Send response */
-        send_headers(client_socket, 200, "OK", "audio/x-mpegurl", buf_len);
-        write(client_socket, m3u, buf_len);
-        free(m3u);
-        
-        close(client_socket);
-        return NULL;
 
+        ProfileStats stats;
+        char *folded = profiler_run(seconds, hz, &stats);
+        int profile_errno = errno;
+        folded = arena_adopt(arena, folded);
+        if (!folded && profile_errno == EBUSY) {
+            const char *err = "{\"error\": \"A profile is already running\"}";
+            http_send(res, 409, "Conflict", "application/json", err, strlen(err));
+        } else if (!folded) {
+            const char *err = "{\"error\": \"Out of memory folding the profile\"}";
+            http_send(res, 500, "Internal Server Error", "application/json", err, strlen(err));
+        } else {
+            char headers[256];
+            snprintf(headers, sizeof(headers),
+                "X-Profile-Seconds: %d\r\nX-Profile-Hz: %d\r\n"
+                "X-Profile-Samples: %lu\r\nX-Profile-Dropped: %lu\r\n",
+                stats.seconds, stats.hz, stats.samples, stats.dropped);
+            http_begin(res, 200, "OK", "text/plain", headers, strlen(folded));
+            http_write(res, folded, strlen(folded));
+        }
     } else {
-        serve_file(client_socket, path);
+        serve_file(res, path, buffer, arena);
     }
+}
+
+/**
+ * Answer one request, on an HTTP/1.1 connection or an HTTP/2 stream
+ *
+ * Split from handle_client so request__end fires and the arena is
+ * released after every request, whichever path answered it.
+ *
+ * @return 1 if an HTTP/1.1 connection can serve another request
+ */
+static int serve_request(HttpConn *conn, HttpResponse *res, Arena *arena) {
+    FlightRoute route = FLIGHT_ROUTE_STATIC;
+    handle_client(conn, res, &route, arena);
+    int reuse = http_end(res);
+    arena_reset(arena);
+    PROBE2(request__end, conn->sock, (int)route);
+    return reuse;
+}
+
+static void serve_h2_stream(HttpConn *request, HttpResponse *res) {
+    Arena arena = ARENA_INIT;
+    serve_request(request, res, &arena);
+}
+
+/**
+ * Media responses stay on HTTP/1.1: a relayed stream gains nothing from
+ * multiplexing and would pay for flow control on every frame
+ */
+static int is_media_request(const char *request) {
+    char path[32] = "";
+    sscanf(request, "%*s %31s", path);
+    return strncmp(path, "/stream/", 8) == 0 || strncmp(path, "/transcode/", 11) == 0 ||
+           strncmp(path, "/api/play/", 10) == 0;
+}
+
+/** Connection threads running, waited for by handoff_drain() */
+static atomic_int active_connections;
+
+int web_active_connections(void) {
+    return atomic_load(&active_connections);
+}
 
+/**
+ * Serve requests on a connection until it closes or goes idle
+ */
+static void serve_connection(HttpConn *conn) {
+    Arena arena = ARENA_INIT;
+    while (http_read_request(conn) > 0) {
+        if (h2_is_preface(conn) || (h2_wants_upgrade(conn) && !is_media_request(conn->buf))) {
+            // Still watched: h2.c keeps the connection's deadlines per frame
+            h2_serve(conn, serve_h2_stream);
+            break;
+        }
+        HttpResponse res;
+        http_response_init(&res, conn);
+        // Requests still arriving here during a handoff are the last on their connection
+        if (handoff_pending()) res.keep_alive = 0;
+        if (!serve_request(conn, &res, &arena)) break;
+    }
+}
+
+static void *client_handler(void *arg) {
+    int client_socket = (int)(intptr_t)arg;
+
+    thread_state_register("http");
+    atomic_fetch_add(&active_connections, 1);
+    HttpConn conn;
+    http_conn_init(&conn, client_socket);
+    http_conn_watch(&conn);
+    serve_connection(&conn);
+    http_conn_unwatch(&conn);
     close(client_socket);
+    atomic_fetch_sub(&active_connections, 1);
+    thread_state_unregister();
     return NULL;
 }
 
+/**
+ * A relay taken over from the previous process, with its descriptors
+ */
+typedef struct {
+    HandoffRelay relay;
+    int sock;
+    int out_fd;
+    int err_fd;
+    int pidfd;
+} AdoptedRelay;
+
+static void *adopted_relay_handler(void *arg) {
+    AdoptedRelay *a = arg;
+
+    thread_state_register("http");
+    atomic_fetch_add(&active_connections, 1);
+    HttpConn conn;
+    http_conn_init(&conn, a->sock);
+    conn.served = 1;
+    http_conn_watch(&conn);
+    HttpResponse res;
+    memset(&res, 0, sizeof(res));
+    res.sock = a->sock;
+    res.conn = &conn;
+    res.head_sent = 1;
+    res.length = -1;
+    res.chunked = a->relay.chunked;
+    res.chunk_ok = a->relay.chunk_ok;
+    res.keep_alive = a->relay.keep_alive;
+    res.sent = a->relay.sent;
+    transcode_resume(&res, &a->relay, a->out_fd, a->err_fd, a->pidfd);
+    // The connection is ours from here on, like any other
+    if (http_end(&res)) serve_connection(&conn);
+    http_conn_unwatch(&conn);
+    close(a->sock);
+    free(a);
+    atomic_fetch_sub(&active_connections, 1);
+    thread_state_unregister();
+    return NULL;
+}
+
+void web_adopt_relay(const HandoffRelay *relay, int sock, int out_fd, int err_fd, int pidfd) {
+    AdoptedRelay *a = malloc(sizeof(*a));
+    pthread_t thread;
+    if (a) {
+        a->relay = *relay;
+        a->sock = sock;
+        a->out_fd = out_fd;
+        a->err_fd = err_fd;
+        a->pidfd = pidfd;
+        if (pthread_create(&thread, NULL, adopted_relay_handler, a) == 0) {
+            pthread_detach(thread);
+            return;
+        }
+        free(a);
+    }
+    // Dropping the relay ends FFmpeg on its next write (SIGPIPE)
+    LOG_ERROR("WEB", "Cannot resume relay for ffmpeg pid=%d", (int)relay->pid);
+    close(sock);
+    close(out_fd);
+    if (err_fd >= 0) close(err_fd);
+    if (pidfd >= 0) close(pidfd);
+}
+
 void start_web_server(int port) {
     int server_socket, client_socket;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t client_len = sizeof(client_addr);
+    struct sockaddr_in server_addr;
+
+    struct timespec boot;
+    clock_gettime(CLOCK_REALTIME, &boot);
+    boot_nonce = (unsigned int)(boot.tv_sec ^ boot.tv_nsec ^ ((unsigned int)getpid() << 16));
 
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    server_socket = handoff_listen_fd();
     if (server_socket < 0) {
-        perror("Socket creation failed");
-        exit(1);
-    }
+        server_socket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (server_socket < 0) {
+            perror("Socket creation failed");
+            exit(1);
+        }
 
-    int opt = 1;
-    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        int opt = 1;
+        setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
 
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(port);
+        memset(&server_addr, 0, sizeof(server_addr));
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_addr.s_addr = INADDR_ANY;
+        server_addr.sin_port = htons(port);
 
-    if (bind(server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        perror("Bind failed");
-        exit(1);
-    }
+        if (bind(server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+            perror("Bind failed");
+            exit(1);
+        }
 
-    listen(server_socket, 10);
+        listen(server_socket, 10);
+    }
     printf("ZapLinkWeb (C) listening on port %d\n", port);
+    thread_state_register("acceptor");
+    handoff_ready(server_socket);
 
     while (1) {
-        client_socket = accept(server_socket, (struct sockaddr *)&client_addr, &client_len);
-        if (client_socket < 0) continue;
+        // CLOEXEC so FFmpeg children don't hold other clients' connections open
+        ThreadStateMark mark = thread_state_enter(THREAD_ACCEPT, NULL);
+        client_socket = io_accept(server_socket);
+        thread_state_leave(mark);
+        if (client_socket < 0) {
+            // The listening socket belongs to the new process now
+            if (errno == ECANCELED) break;
+            continue;
+        }
+        flight_record(FLIGHT_ACCEPT, client_socket, 0);
 
         pthread_t thread;
-        int *arg = malloc(sizeof(int));
-        *arg = client_socket;
-        pthread_create(&thread, NULL, client_handler, arg);
+        pthread_create(&thread, NULL, client_handler, (void *)(intptr_t)client_socket);
         pthread_detach(thread);
     }
+    close(server_socket);
+    thread_state_unregister();
 }
-
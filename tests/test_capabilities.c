@@ -0,0 +1,250 @@
+/**
+ * @file test_capabilities.c
+ * @brief Capability probe against a fake ffmpeg and device directory
+ *
+ * caps_probe() resolves ffmpeg through PATH and takes the device root as a
+ * parameter, so each case writes a shell script named ffmpeg that prints
+ * canned -encoders / -filters listings, builds a directory with
+ * dri/renderD* and nvidia0 as needed, and checks the resulting matrix,
+ * fallback chains and /api/status JSON. No GPU or real FFmpeg is needed.
+ *
+ * Fake render nodes use a minor number no real host has, so sysfs has no
+ * vendor for them and they count as possibly Intel (see capabilities.c).
+ *
+ * Usage:
+ *   test_capabilities
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "capabilities.h"
+
+int g_verbose = 0;
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+static char root[] = "/tmp/zaplink-caps-XXXXXX";
+
+/**
+ * Write a fake ffmpeg into <root>/<name>/bin and a device root <root>/<name>/dev
+ *
+ * @param name Case directory
+ * @param encoders Encoder names printed for -encoders ("" for none)
+ * @param filters Filter names printed for -filters
+ * @param status Exit status of the fake binary
+ * @param render_node 1 to create dev/dri/renderD250
+ * @param nvidia 1 to create dev/nvidia0
+ * @param dev Output: device root for caps_probe()
+ * @param dev_size Capacity of dev
+ */
+static void make_case(const char *name, const char *encoders, const char *filters,
+                      int status, int render_node, int nvidia, char *dev, size_t dev_size) {
+    char path[512];
+
+    snprintf(path, sizeof(path), "%s/%s", root, name);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/%s/bin", root, name);
+    mkdir(path, 0755);
+    snprintf(dev, dev_size, "%s/%s/dev", root, name);
+    mkdir(dev, 0755);
+
+    /* Same layout as the real listings: "<flags> <name> <description>" */
+    snprintf(path, sizeof(path), "%s/%s/bin/ffmpeg", root, name);
+    FILE *f = fopen(path, "w");
+    if (!f) { perror(path); exit(1); }
+    fprintf(f, "#!/bin/sh\n"
+               "case \"$*\" in\n"
+               "*-encoders*) for e in %s; do echo \" V....D $e  Fake encoder\"; done ;;\n"
+               "*-filters*) for e in %s; do echo \" TSC $e  V->V  Fake filter\"; done ;;\n"
+               "esac\n"
+               "exit %d\n", encoders, filters, status);
+    fclose(f);
+    chmod(path, 0755);
+
+    if (render_node) {
+        snprintf(path, sizeof(path), "%s/dri", dev);
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), "%s/dri/renderD250", dev);
+        f = fopen(path, "w");
+        if (f) fclose(f);
+    }
+    if (nvidia) {
+        snprintf(path, sizeof(path), "%s/nvidia0", dev);
+        f = fopen(path, "w");
+        if (f) fclose(f);
+    }
+
+    snprintf(path, sizeof(path), "%s/%s/bin", root, name);
+    setenv("PATH", path, 1);
+}
+
+/** Run the fallback chain and compare it with the expected backends */
+static int chain_is(TranscodeBackend preferred, TranscodeCodec codec,
+                    int n, const TranscodeBackend *expect) {
+    TranscodeBackend chain[CAPS_NUM_BACKENDS];
+    int got = caps_fallback_chain(preferred, codec, chain, CAPS_NUM_BACKENDS);
+    if (got != n) return 0;
+    for (int i = 0; i < n; i++) {
+        if (chain[i] != expect[i]) return 0;
+    }
+    return 1;
+}
+
+/** VA-API host: software and VA-API encoders, NVENC compiled in but no GPU */
+static void test_vaapi_host(void) {
+    char dev[512], node[600];
+    Capabilities c;
+
+    make_case("vaapi", "libx264 libx265 h264_vaapi hevc_vaapi h264_nvenc",
+              "yadif hwupload scale_vaapi", 0, 1, 0, dev, sizeof(dev));
+    caps_probe(dev);
+    caps_get(&c);
+
+    snprintf(node, sizeof(node), "%s/dri/renderD250", dev);
+    CHECK(c.probed);
+    CHECK(c.ffmpeg_found);
+    CHECK(strcmp(c.render_node, node) == 0);
+    CHECK(c.filter_yadif && c.filter_hwupload && c.filter_scale_vaapi && !c.filter_vpp_qsv);
+    CHECK(c.encoders[TRANSCODE_BACKEND_NVENC][TRANSCODE_CODEC_H264]);
+    CHECK(!c.device[TRANSCODE_BACKEND_NVENC]);
+
+    CHECK(caps_viable(TRANSCODE_BACKEND_SOFTWARE, TRANSCODE_CODEC_H264));
+    CHECK(caps_viable(TRANSCODE_BACKEND_VAAPI, TRANSCODE_CODEC_HEVC));
+    CHECK(!caps_viable(TRANSCODE_BACKEND_VAAPI, TRANSCODE_CODEC_AV1));
+    CHECK(!caps_viable(TRANSCODE_BACKEND_NVENC, TRANSCODE_CODEC_H264));
+    CHECK(!caps_viable(TRANSCODE_BACKEND_QSV, TRANSCODE_CODEC_H264));
+    CHECK(!caps_viable(TRANSCODE_BACKEND_SOFTWARE, TRANSCODE_CODEC_AV1));
+    CHECK(caps_viable(TRANSCODE_BACKEND_NVENC, TRANSCODE_CODEC_COPY));
+
+    /* Unavailable preference falls through to the other hardware, then software */
+    const TranscodeBackend nvenc_h264[] = { TRANSCODE_BACKEND_VAAPI, TRANSCODE_BACKEND_SOFTWARE };
+    CHECK(chain_is(TRANSCODE_BACKEND_NVENC, TRANSCODE_CODEC_H264, 2, nvenc_h264));
+    const TranscodeBackend sw_hevc[] = { TRANSCODE_BACKEND_SOFTWARE, TRANSCODE_BACKEND_VAAPI };
+    CHECK(chain_is(TRANSCODE_BACKEND_SOFTWARE, TRANSCODE_CODEC_HEVC, 2, sw_hevc));
+    /* Nothing encodes AV1: the requested backend is still tried */
+    const TranscodeBackend qsv_av1[] = { TRANSCODE_BACKEND_QSV };
+    CHECK(chain_is(TRANSCODE_BACKEND_QSV, TRANSCODE_CODEC_AV1, 1, qsv_av1));
+
+    char *json = caps_to_json();
+    char expect[700];
+    snprintf(expect, sizeof(expect), "\"render_node\":\"%s\"", node);
+    CHECK(strstr(json, "\"ffmpeg\":true") != NULL);
+    CHECK(strstr(json, expect) != NULL);
+    CHECK(strstr(json, "\"vaapi\":{\"device\":true,\"h264\":true,\"hevc\":true,\"av1\":false}") != NULL);
+    CHECK(strstr(json, "\"nvenc\":{\"device\":false,\"h264\":false") != NULL);
+    free(json);
+}
+
+/** A render node without hwupload is not usable for VA-API or QSV */
+static void test_no_hwupload(void) {
+    char dev[512];
+    Capabilities c;
+
+    make_case("nohwupload", "libx264 h264_vaapi h264_qsv h264_nvenc", "yadif",
+              0, 1, 1, dev, sizeof(dev));
+    caps_probe(dev);
+    caps_get(&c);
+
+    CHECK(c.render_node[0]);
+    CHECK(c.intel_render_node[0]);
+    CHECK(!c.device[TRANSCODE_BACKEND_VAAPI]);
+    CHECK(!c.device[TRANSCODE_BACKEND_QSV]);
+    CHECK(c.device[TRANSCODE_BACKEND_NVENC]);
+
+    const TranscodeBackend vaapi_h264[] = { TRANSCODE_BACKEND_NVENC, TRANSCODE_BACKEND_SOFTWARE };
+    CHECK(chain_is(TRANSCODE_BACKEND_VAAPI, TRANSCODE_CODEC_H264, 2, vaapi_h264));
+}
+
+/** Intel-looking node with hwupload: QSV viable and ordered before VA-API */
+static void test_qsv_host(void) {
+    char dev[512];
+    Capabilities c;
+
+    make_case("qsv", "libx264 h264_qsv h264_vaapi", "hwupload vpp_qsv",
+              0, 1, 0, dev, sizeof(dev));
+    caps_probe(dev);
+    caps_get(&c);
+
+    CHECK(strcmp(c.intel_render_node, c.render_node) == 0);
+    CHECK(c.filter_vpp_qsv);
+    CHECK(caps_viable(TRANSCODE_BACKEND_QSV, TRANSCODE_CODEC_H264));
+
+    const TranscodeBackend sw_h264[] = {
+        TRANSCODE_BACKEND_SOFTWARE, TRANSCODE_BACKEND_QSV, TRANSCODE_BACKEND_VAAPI
+    };
+    CHECK(chain_is(TRANSCODE_BACKEND_SOFTWARE, TRANSCODE_CODEC_H264, 3, sw_h264));
+}
+
+/** FFmpeg that fails, and no FFmpeg at all: nothing is viable */
+static void test_no_ffmpeg(void) {
+    char dev[512];
+    Capabilities c;
+
+    make_case("broken", "libx264", "yadif", 1, 0, 0, dev, sizeof(dev));
+    caps_probe(dev);
+    caps_get(&c);
+    CHECK(c.probed);
+    CHECK(!c.ffmpeg_found);
+
+    char empty[512];
+    snprintf(empty, sizeof(empty), "%s/empty", root);
+    mkdir(empty, 0755);
+    setenv("PATH", empty, 1);
+    caps_probe(empty);
+    caps_get(&c);
+
+    CHECK(c.probed);
+    CHECK(!c.ffmpeg_found);
+    CHECK(!c.render_node[0]);
+    CHECK(!caps_viable(TRANSCODE_BACKEND_SOFTWARE, TRANSCODE_CODEC_H264));
+
+    const TranscodeBackend sw_h264[] = { TRANSCODE_BACKEND_SOFTWARE };
+    CHECK(chain_is(TRANSCODE_BACKEND_SOFTWARE, TRANSCODE_CODEC_H264, 1, sw_h264));
+
+    char *json = caps_to_json();
+    CHECK(strstr(json, "\"probed\":true,\"ffmpeg\":false") != NULL);
+    free(json);
+}
+
+int main(void) {
+    const char *path = getenv("PATH");
+    char *saved_path = strdup(path ? path : "/usr/bin:/bin");
+
+    if (!mkdtemp(root)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    /* Before any probe every combination is assumed viable */
+    CHECK(caps_viable(TRANSCODE_BACKEND_NVENC, TRANSCODE_CODEC_AV1));
+
+    test_vaapi_host();
+    test_no_hwupload();
+    test_qsv_host();
+    test_no_ffmpeg();
+
+    setenv("PATH", saved_path, 1);
+    free(saved_path);
+    char cmd[600];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", root);
+    if (system(cmd) != 0) fprintf(stderr, "could not remove %s\n", root);
+
+    if (failures) {
+        fprintf(stderr, "test_capabilities: %d failure(s)\n", failures);
+        return 1;
+    }
+    printf("test_capabilities: OK\n");
+    return 0;
+}
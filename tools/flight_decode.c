@@ -0,0 +1,176 @@
+/**
+ * @file flight_decode.c
+ * @brief Offline decoder for flight recorder dumps
+ *
+ * Reads a dump written on SIGUSR1, on a crash (zaplinkweb.flight) or
+ * downloaded from /debug/flight, and prints the events oldest first with
+ * wall-clock time, offset before the dump, thread and decoded arguments.
+ *
+ * Usage:
+ *   flight_decode [-n last_events] [-T tid] [-e EVENT] [-s] dump.flight
+ *
+ *   -s  Summary only: per-event counts
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "flight.h"
+#include "transcode.h"
+
+int g_verbose = 0;
+
+static int cmp_seq(const void *a, const void *b) {
+    const FlightEvent *x = a, *y = b;
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+static void format_args(const FlightEvent *e, char *out, size_t len) {
+    switch (e->type) {
+        case FLIGHT_ACCEPT:
+            snprintf(out, len, "fd=%lld", (long long)e->a);
+            break;
+        case FLIGHT_ROUTE:
+            snprintf(out, len, "route=%s fd=%lld", flight_route_name((int)e->a), (long long)e->b);
+            break;
+        case FLIGHT_SPAWN:
+            snprintf(out, len, "pid=%lld backend=%s codec=%s", (long long)e->a,
+                     transcode_backend_name((TranscodeBackend)(e->b >> 8)),
+                     transcode_codec_name((TranscodeCodec)(e->b & 0xFF)));
+            break;
+        case FLIGHT_SPAWN_FAIL:
+            snprintf(out, len, "errno=%lld (%s) backend=%s codec=%s", (long long)e->a, strerror((int)e->a),
+                     transcode_backend_name((TranscodeBackend)(e->b >> 8)),
+                     transcode_codec_name((TranscodeCodec)(e->b & 0xFF)));
+            break;
+        case FLIGHT_FIRST_BYTE:
+            snprintf(out, len, "pid=%lld after=%.1fms", (long long)e->a, e->b / 1000.0);
+            break;
+        case FLIGHT_WRITE_STALL:
+            snprintf(out, len, "fd=%lld blocked=%.1fms", (long long)e->a, e->b / 1000.0);
+            break;
+        case FLIGHT_RELAY_END:
+            snprintf(out, len, "pid=%lld relayed=%lld bytes", (long long)e->a, (long long)e->b);
+            break;
+        case FLIGHT_CHILD_EXIT: {
+            int st = (int)e->b;
+            if (e->b < 0) snprintf(out, len, "pid=%lld not reaped", (long long)e->a);
+            else if (WIFSIGNALED(st)) snprintf(out, len, "pid=%lld signal=%d", (long long)e->a, WTERMSIG(st));
+            else snprintf(out, len, "pid=%lld exit=%d", (long long)e->a, WEXITSTATUS(st));
+            break;
+        }
+        case FLIGHT_SCHED_TICK:
+            snprintf(out, len, "pending=%lld busy=%.2fms", (long long)e->a, e->b / 1000.0);
+            break;
+        case FLIGHT_REC_START:
+            snprintf(out, len, "pid=%lld timer=%lld", (long long)e->a, (long long)e->b);
+            break;
+        case FLIGHT_REC_STOP:
+        case FLIGHT_REC_DIED:
+            snprintf(out, len, "pid=%lld recording=%lld", (long long)e->a, (long long)e->b);
+            break;
+        case FLIGHT_DUMP:
+            snprintf(out, len, "reason=%s", flight_reason_name((int)e->a));
+            break;
+        case FLIGHT_TIMEOUT:
+            snprintf(out, len, "%s=%lld deadline=%s", e->b == FLIGHT_TIMEOUT_SESSION ? "pid" : "fd",
+                     (long long)e->a, flight_timeout_name((int)e->b));
+            break;
+        default:
+            snprintf(out, len, "a=%lld b=%lld", (long long)e->a, (long long)e->b);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    long last = 0;
+    unsigned tid_filter = 0;
+    const char *event_filter = NULL;
+    int summary = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:T:e:s")) != -1) {
+        switch (opt) {
+            case 'n': last = atol(optarg); break;
+            case 'T': tid_filter = (unsigned)atoi(optarg); break;
+            case 'e': event_filter = optarg; break;
+            case 's': summary = 1; break;
+            default:
+                fprintf(stderr, "Usage: %s [-n last_events] [-T tid] [-e EVENT] [-s] dump.flight\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-n last_events] [-T tid] [-e EVENT] [-s] dump.flight\n", argv[0]);
+        return 1;
+    }
+
+    FILE *f = fopen(argv[optind], "rb");
+    if (!f) {
+        perror(argv[optind]);
+        return 1;
+    }
+    FlightHeader hdr;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, FLIGHT_MAGIC, 4) != 0) {
+        fprintf(stderr, "%s: not a flight recorder dump\n", argv[optind]);
+        return 1;
+    }
+    if (hdr.version != FLIGHT_VERSION || hdr.event_size != sizeof(FlightEvent)) {
+        fprintf(stderr, "%s: unsupported dump version %u (event size %u)\n",
+                argv[optind], hdr.version, hdr.event_size);
+        return 1;
+    }
+
+    FlightEvent *ev = calloc(hdr.capacity, sizeof(FlightEvent));
+    size_t got = fread(ev, sizeof(FlightEvent), hdr.capacity, f);
+    fclose(f);
+
+    /* Keep published slots only, oldest first */
+    size_t n = 0;
+    for (size_t i = 0; i < got; i++) {
+        if (ev[i].seq != 0 && ((ev[i].seq - 1) % hdr.capacity) == i) ev[n++] = ev[i];
+    }
+    qsort(ev, n, sizeof(FlightEvent), cmp_seq);
+
+    time_t dump_sec = (time_t)(hdr.real_ns / 1000000000ULL);
+    char when[64];
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&dump_sec));
+    printf("pid %u, dumped %s (%s), %llu events recorded, %zu in ring, %llu overwritten\n",
+           hdr.pid, when, flight_reason_name(hdr.reason), (unsigned long long)hdr.head, n,
+           (unsigned long long)(hdr.head > n ? hdr.head - n : 0));
+
+    long counts[FLIGHT_NUM_EVENTS + 1] = {0};
+    size_t start = (last > 0 && (size_t)last < n) ? n - last : 0;
+    for (size_t i = start; i < n; i++) {
+        FlightEvent *e = &ev[i];
+        const char *name = flight_event_name(e->type);
+        if (tid_filter && e->tid != tid_filter) continue;
+        if (event_filter && strcasecmp(event_filter, name) != 0) continue;
+        counts[e->type < FLIGHT_NUM_EVENTS ? e->type : FLIGHT_NUM_EVENTS]++;
+        if (summary) continue;
+
+        /* Place the monotonic timestamp on the wall clock via the dump header */
+        double before_s = ((double)hdr.mono_ns - (double)e->ts_ns) / 1e9;
+        double wall = hdr.real_ns / 1e9 - before_s;
+        time_t sec = (time_t)wall;
+        char ts[32];
+        strftime(ts, sizeof(ts), "%H:%M:%S", localtime(&sec));
+
+        char args[160];
+        format_args(e, args, sizeof(args));
+        printf("%s.%06ld  -%10.6fs  [%6u] %-12s %s\n", ts, (long)((wall - sec) * 1e6),
+               before_s, e->tid, name, args);
+    }
+
+    if (summary) {
+        for (int t = 1; t <= FLIGHT_NUM_EVENTS; t++) {
+            if (counts[t]) printf("  %-12s %ld\n", flight_event_name(t), counts[t]);
+        }
+    }
+    free(ev);
+    return 0;
+}